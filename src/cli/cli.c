@@ -1,17 +1,27 @@
 /* sfssh.c: SimpleFS shell */
 
+// copy_file_range and splice
+#define _GNU_SOURCE
+
 #include "../include/disk.h"
 #include "../include/sfs.h"
+#include "../include/utils.h"
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 /* Macros */
 
 #define streq(a, b)	(strcmp((a), (b)) == 0)
 
+// extents looked up per fs_extents call by copyout
+#define COPY_EXTENTS	(64)
+
 /* Command Prototyes */
 
 void do_debug(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
@@ -23,11 +33,15 @@ void do_stat(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
 void do_copyout(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
 void do_cat(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
 void do_copyin(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
+void do_stats(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
 void do_help(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
 
 // Utility prototypes
 bool copyout(FileSystem *fs, size_t inode_number, const char *path);
 bool copyin(FileSystem *fs, const char *path, size_t inode_number);
+size_t copy_blocks(int image, off_t position, int fd, size_t length);
+bool write_all(int fd, const char *data, size_t length);
+void print_op_stats(const char *name, const DiskOpStats *stats);
 
 // Main entry point for the CLI tool, adjust to make into tool rather than a shell session
 int main(int argc, char *argv[]) {
@@ -88,6 +102,8 @@ int main(int argc, char *argv[]) {
             do_cat(disk, &fs, args, arg1, arg2);
         } else if (streq(cmd, "copyin")) {
             do_copyin(disk, &fs, args, arg1, arg2);
+        } else if (streq(cmd, "stats")) {
+            do_stats(disk, &fs, args, arg1, arg2);
         } else if (streq(cmd, "help")) {
             do_help(disk, &fs, args, arg1, arg2);
         } else if (streq(cmd, "exit") || streq(cmd, "quit")) {
@@ -113,16 +129,36 @@ void do_debug(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
 	printf("Usage: debug\n");
 	return;
     }
+    // cached inodes and blocks have to reach the disk to show up
+    if (disk->mounted) fs_sync(fs);
     fs_debug(disk);
 }
 
 void do_format(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
-    if (args != 1) {
-	printf("Usage: format\n");
+    uint32_t features = 0;
+    bool valid = args <= 3;
+    // each argument is one feature or several separated by commas
+    for (int i = 1; valid && i < args; i++) {
+        for (char *name = strtok(i == 1 ? arg1 : arg2, ","); valid && name; name = strtok(NULL, ",")) {
+            if (streq(name, "extents")) {
+                features |= FS_FEATURE_EXTENTS;
+            } else if (streq(name, "groups")) {
+                features |= FS_FEATURE_GROUPS;
+            } else if (streq(name, "triple")) {
+                features |= FS_FEATURE_TRIPLE_INDIRECT;
+            } else if (streq(name, "inline")) {
+                features |= FS_FEATURE_INLINE_DATA;
+            } else {
+                valid = false;
+            }
+        }
+    }
+    if (!valid) {
+	printf("Usage: format [extents|groups|triple|inline[,...]]...\n");
 	return;
     }
 
-    if (fs_format(disk)) {
+    if (fs_format_features(disk, features, 0)) {
         printf("disk formatted.\n");
     } else {
         printf("format failed!\n");
@@ -218,9 +254,43 @@ void do_copyin(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
     }
 }
 
+void do_stats(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
+    if (args > 2 || (args == 2 && !streq(arg1, "reset"))) {
+        printf("Usage: stats [reset]\n");
+        return;
+    }
+
+    if (args == 2) {
+        disk_stats_reset(disk);
+        printf("disk statistics reset.\n");
+        return;
+    }
+
+    DiskStats stats;
+    disk_stats(disk, &stats);
+    print_op_stats("reads", &stats.read);
+    print_op_stats("writes", &stats.write);
+
+    printf("%-9s %10s %10s %12s %12s %12s %12s\n", "caller", "reads", "writes", "read bytes", "write bytes", "read ms", "write ms");
+    for (int tag = 0; tag < DISK_TAGS; tag++) {
+        const DiskTagStats *t = &stats.tags[tag];
+        printf("%-9s %10zu %10zu %12zu %12zu %12.3f %12.3f\n", disk_tag_name(tag),
+            t->reads, t->writes, t->read_bytes, t->write_bytes, t->read_ns / 1e6, t->write_ns / 1e6);
+    }
+
+    if (fs->cache) {
+        printf("cache: %zu hits, %zu misses, %zu evictions, %zu writebacks in %zu runs, %zu prefetches\n",
+            fs->cache->hits, fs->cache->misses, fs->cache->evictions, fs->cache->writebacks, fs->cache->runs, fs->cache->prefetches);
+    }
+    if (fs->icache) {
+        printf("inode cache: %zu hits, %zu misses, %zu evictions, %zu writebacks\n",
+            fs->icache->hits, fs->icache->misses, fs->icache->evictions, fs->icache->writebacks);
+    }
+}
+
 void do_help(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
     printf("Commands are:\n");
-    printf("    format\n");
+    printf("    format  [extents|groups|triple|inline[,...]]...\n");
     printf("    mount\n");
     printf("    debug\n");
     printf("    create\n");
@@ -229,6 +299,7 @@ void do_help(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
     printf("    stat    <inode>\n");
     printf("    copyin  <file> <inode>\n");
     printf("    copyout <inode> <file>\n");
+    printf("    stats   [reset]\n");
     printf("    help\n");
     printf("    quit\n");
     printf("    exit\n");
@@ -236,21 +307,48 @@ void do_help(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
 
 /* Utility Functions */
 
+void print_op_stats(const char *name, const DiskOpStats *stats) {
+    if (stats->ops == 0) {
+        printf("%s: none\n", name);
+        return;
+    }
+    printf("%s: %zu ops, %zu bytes, %zu sequential, %zu random\n",
+        name, stats->ops, stats->bytes, stats->sequential, stats->random);
+    printf("    latency us: mean %.1f, p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n",
+        stats->total_ns / 1e3 / stats->ops,
+        disk_latency_percentile(stats, 50) / 1e3,
+        disk_latency_percentile(stats, 90) / 1e3,
+        disk_latency_percentile(stats, 99) / 1e3,
+        stats->max_ns / 1e3);
+}
+
 bool copyin(FileSystem *fs, const char *path, size_t inode_number) {
     FILE *stream = fopen(path, "r");
     if (!stream) {
         fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
         return false;
     }
+    File *file = fs_open(fs, inode_number);
+    if (!file) {
+        fclose(stream);
+        return false;
+    }
 
-    char buffer[4*BUFSIZ] = {0};
+    // a window of whole blocks per write, allocated in one run and written straight from the buffer
+    size_t chunk = FS_IO_WINDOW * BLOCK_SIZE;
+    char *buffer = malloc(chunk);
+    if (!buffer) {
+        fs_close(file);
+        fclose(stream);
+        return false;
+    }
     size_t offset = 0;
     while (true) {
-        ssize_t result = fread(buffer, 1, sizeof(buffer), stream);
+        ssize_t result = fread(buffer, 1, chunk, stream);
         if (result <= 0) {
             break;
         }
-        ssize_t actual = fs_write(fs, inode_number, buffer, result, offset);
+        ssize_t actual = fs_file_write(file, buffer, result);
         if (actual < 0) {
             fprintf(stderr, "fs_write returned invalid result %ld\n", actual);
             break;
@@ -261,29 +359,104 @@ bool copyin(FileSystem *fs, const char *path, size_t inode_number) {
             break;
         }
     }
+    // the file is complete, closing gives back the blocks reserved for more appends
+    fs_close(file);
     printf("%lu bytes copied\n", offset);
+    free(buffer);
     fclose(stream);
     return true;
 }
 
 bool copyout(FileSystem *fs, size_t inode_number, const char *path) {
-    FILE *stream = fopen(path, "w");
-    if (!stream) {
+    // what printf buffered goes out before the file when path is the terminal
+    fflush(stdout);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
         fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
         return false;
     }
+    // the handle resolves the blocks of the file once for all the chunks
+    File *file = fs_open(fs, inode_number);
+    if (!file) {
+        close(fd);
+        return false;
+    }
 
+    // runs of whole blocks are moved from the image by the kernel, which reads the image file,
+    // so what the block cache holds has to be written back first
+    int image = disk_fd(fs->disk);
+    bool direct = image >= 0 && fs_sync(fs);
+    FsExtent extents[COPY_EXTENTS];
     char buffer[4*BUFSIZ] = {0};
     size_t offset = 0;
-    while (true) {
-        ssize_t result = fs_read(fs, inode_number, buffer, sizeof(buffer), offset);
+    bool success = true;
+    ssize_t count;
+    while (success && (count = fs_extents(fs, inode_number, offset, extents, COPY_EXTENTS)) > 0) {
+        for (ssize_t i = 0; success && i < count; i++) {
+            size_t end = extents[i].offset + extents[i].length;
+            if (direct && extents[i].block != 0) {
+                size_t whole = (end - offset) / BLOCK_SIZE * BLOCK_SIZE;
+                size_t moved = copy_blocks(image, (off_t)extents[i].block * BLOCK_SIZE, fd, whole);
+                // the destination takes neither call, the rest goes through the buffer
+                if (moved < whole) {
+                    direct = false;
+                }
+                offset += moved;
+            }
+            // holes, small files, the partial last block and whatever the kernel did not move
+            success = fs_file_seek(file, offset);
+            while (success && offset < end) {
+                ssize_t result = fs_file_read(file, buffer, min(sizeof(buffer), end - offset));
+                success = result > 0 && write_all(fd, buffer, result);
+                if (success) {
+                    offset += result;
+                }
+            }
+        }
+    }
+    if (count < 0) {
+        success = false;
+    }
+    fs_close(file);
+    printf("%lu bytes copied\n", offset);
+    close(fd);
+    return success;
+}
+
+// Move length bytes at position of the image to fd without them passing through user space,
+// with copy_file_range or, when fd is a pipe, with splice. Returns the number of bytes moved,
+// fewer than length when fd takes neither.
+size_t copy_blocks(int image, off_t position, int fd, size_t length) {
+    size_t moved = 0;
+#ifdef __linux__
+    while (moved < length) {
+        loff_t from = position + moved;
+        ssize_t result = copy_file_range(image, &from, fd, NULL, length - moved, 0);
+        if (result < 0) {
+            from = position + moved;
+            result = splice(image, &from, fd, NULL, length - moved, SPLICE_F_MOVE);
+        }
         if (result <= 0) {
             break;
         }
-        fwrite(buffer, 1, result, stream);
-        offset += result;
+        moved += result;
+    }
+#endif
+    return moved;
+}
+
+bool write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t result = write(fd, data, length);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            fprintf(stderr, "Unable to write: %s\n", strerror(errno));
+            return false;
+        }
+        data += result;
+        length -= result;
     }
-    printf("%lu bytes copied\n", offset);
-    fclose(stream);
     return true;
 }
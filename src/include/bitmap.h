@@ -0,0 +1,33 @@
+// Packed bitmaps searched a 64 bit word at a time
+
+#ifndef BITMAP_H
+#define BITMAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Bitmap Constants
+#define BITMAP_WORD_BITS    (64)    // bits per word, bit i lives in bit i % 64 of word i / 64
+#define BITMAP_WORDS(bits)  (((bits) + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS)
+
+// Bitmap Functions
+
+bool    bitmap_test(const uint64_t *words, size_t bit);
+void    bitmap_set(uint64_t *words, size_t bit);
+void    bitmap_clear(uint64_t *words, size_t bit);
+
+// Set or clear count bits starting at first
+void    bitmap_set_range(uint64_t *words, size_t first, size_t count);
+void    bitmap_clear_range(uint64_t *words, size_t first, size_t count);
+
+// Number of set bits among the first bits
+size_t  bitmap_count(const uint64_t *words, size_t bits);
+
+// First set bit at or after from (bits if there is none)
+size_t  bitmap_find(const uint64_t *words, size_t bits, size_t from);
+
+// Number of consecutive set bits starting at from, at most limit
+size_t  bitmap_run(const uint64_t *words, size_t bits, size_t from, size_t limit);
+
+#endif
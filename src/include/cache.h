@@ -0,0 +1,66 @@
+// Block buffer cache between the file system and the disk emulator
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "disk.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Cache Constants
+#define CACHE_DEFAULT_BLOCKS    (1024)  // default capacity, 4MB of blocks
+#define CACHE_FLUSH_BATCH       (256)   // default number of dirty blocks sorted and written back per pass
+#define CACHE_MAX_RUN           (64)    // default maximum number of blocks merged into one vectored write
+
+// Slot flags
+#define CACHE_VALID         (1<<0)  // slot holds a block
+#define CACHE_DIRTY         (1<<1)  // block was written and not flushed yet
+#define CACHE_REFERENCED    (1<<2)  // block was used since the clock hand last passed it
+
+// Write-back cache of whole blocks with CLOCK replacement.
+// Blocks are looked up through a chained hash table, slot i owns data[i * BLOCK_SIZE].
+typedef struct Cache Cache;
+struct Cache {
+    Disk *disk; // disk the cached blocks belong to
+    size_t capacity; // number of slots
+    size_t hits; // lookups served from the cache
+    size_t misses; // lookups that went to disk
+    size_t evictions; // valid blocks pushed out to make room
+    size_t writebacks; // dirty blocks written to disk
+    size_t prefetches; // blocks read ahead of use by cache_prefetch
+    size_t runs; // vectored writes issued to write dirty blocks back
+    size_t flush_batch; // dirty blocks written back per pass, may be changed at any time
+    size_t max_run; // longest run of blocks per vectored write, may be changed at any time
+
+    char *data; // capacity blocks, BLOCK_SIZE aligned
+    size_t *blocks; // block number held by each slot
+    uint8_t *flags; // CACHE_* flags of each slot
+    uint8_t *tags; // DISK_TAG_* of the caller that last wrote each slot, used when writing it back
+    ssize_t *next; // next slot in the same hash bucket (-1 terminates)
+    ssize_t *buckets; // first slot of each hash bucket (-1 if empty)
+    size_t nbuckets;
+    size_t hand; // clock hand
+    size_t dirty; // number of dirty slots
+};
+
+// Cache Functions
+
+Cache*  cache_create(Disk *disk, size_t capacity);
+void    cache_destroy(Cache *cache);
+
+ssize_t cache_read(Cache *cache, size_t block, char *data);
+ssize_t cache_write(Cache *cache, size_t block, const char *data);
+
+// Like cache_read/cache_write for count blocks, misses are read from disk in one batch
+ssize_t cache_read_list(Cache *cache, const size_t *blocks, char **data, size_t count);
+ssize_t cache_write_list(Cache *cache, const size_t *blocks, char **data, size_t count);
+
+// Load blocks that are not cached yet without copying them anywhere
+ssize_t cache_prefetch(Cache *cache, const size_t *blocks, size_t count);
+
+// Write every dirty block back to disk, sorted by block number and merged into contiguous runs
+bool    cache_flush(Cache *cache);
+
+#endif
@@ -4,13 +4,36 @@
 #define DISK_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 // Disk Constants
 #define BLOCK_SIZE      (1<<12)   // 4KB, compilation will replace BLOCK_SIZE with 1 bitshifted left by 12
 #define DISK_FAILURE    (-1)
 
+// Disk open flags
+#define DISK_MMAP       (1<<0)    // map the whole image with mmap instead of going through read/write
+#define DISK_THREADPOOL (1<<1)    // serve asynchronous requests from a thread pool even when io_uring is available
+#define DISK_DIRECT     (1<<2)    // open the image with O_DIRECT, bypassing the host page cache (not with DISK_MMAP)
+
+#define DISK_QUEUE_DEPTH    (64)  // maximum number of asynchronous requests in flight per disk
+#define DISK_BUFFER_POOL    (64)  // number of released buffers kept for reuse by disk_buffer_alloc
+
+// Latency histograms are log scaled like HDR histograms: latencies below 4ns get a bucket each,
+// every power of two above that is split into 4 linear buckets (at most 25% error per bucket)
+#define DISK_LATENCY_BUCKETS    (4 * 63)  // enough for any 64 bit latency
+
+// Callers tag the requests they issue with disk_tag so statistics can be broken down by caller
+#define DISK_TAG_OTHER      (0)
+#define DISK_TAG_SCAN       (1)   // free block scan during mount
+#define DISK_TAG_INODE      (2)   // inode table
+#define DISK_TAG_DATA       (3)   // file contents
+#define DISK_TAG_INDIRECT   (4)   // indirect pointer blocks
+#define DISK_TAG_BITMAP     (5)   // free block bitmap
+#define DISK_TAGS           (6)
+
 
 // Define typedef so we would not have to keep typing typedef struct Disk
 // size_t is an unsigned integer type defined by several C/C++ standards
@@ -20,20 +43,133 @@
 // Most frequently compiler-based operator sizeof should evaluate to a constant value that is compatitble with size_t
 // Used frequently for array indexing -> cannot be negative!
 typedef struct Disk Disk;
+typedef struct DiskOps DiskOps;
+typedef struct DiskQueue DiskQueue; // asynchronous request queue, private to disk_async.c
+
+// Statistics of one direction (reads or writes). An operation is one call into the backend,
+// so a vectored run counts once, and it is sequential when it starts right after the previous one.
+typedef struct DiskOpStats DiskOpStats;
+struct DiskOpStats {
+    size_t ops;
+    size_t bytes;
+    size_t sequential;
+    size_t random;
+    uint64_t total_ns; // sum of the latencies
+    uint64_t max_ns;
+    size_t histogram[DISK_LATENCY_BUCKETS]; // operations per latency bucket
+};
+
+// Per caller breakdown
+typedef struct DiskTagStats DiskTagStats;
+struct DiskTagStats {
+    size_t reads;
+    size_t writes;
+    size_t read_bytes;
+    size_t write_bytes;
+    uint64_t read_ns;
+    uint64_t write_ns;
+};
+
+typedef struct DiskStats DiskStats;
+struct DiskStats {
+    DiskOpStats read;
+    DiskOpStats write;
+    DiskTagStats tags[DISK_TAGS];
+};
+
 struct Disk {
-    int fd; // file descriptor for disk emulator
+    const DiskOps *ops; // backend that stores the blocks
+    void *backend; // private state of the backend
     size_t blocks; // number of blocks in disk
     size_t reads; // number of reads to disk
     size_t writes; // number of writes to disk
     bool mounted; // whether disk is mounted
+    int flags; // DISK_* flags the disk was opened with
+    DiskQueue *queue; // created by the first disk_submit
+    int tag; // DISK_TAG_* of the caller issuing requests
+    size_t next_block; // block after the last operation, for sequential detection
+    DiskStats stats; // latency and size statistics, read them with disk_stats
+};
+
+// Operations of a disk backend. read and write move the count contiguous blocks starting at block,
+// data[i] being the BLOCK_SIZE buffer of block + i, and return 0 on success (-1 with errno set on error).
+// Range checks and the read/write counters are handled by disk.c, read and write must be safe to call
+// from several threads at once (the asynchronous thread pool does).
+struct DiskOps {
+    const char *name;
+    bool (*open)(Disk *disk, const char *path); // set up disk->backend for disk->blocks blocks
+    int  (*read)(Disk *disk, size_t block, char **data, size_t count);
+    int  (*write)(Disk *disk, size_t block, char **data, size_t count);
+    bool (*flush)(Disk *disk);
+    void (*close)(Disk *disk); // release disk->backend
+    char* (*map_block)(Disk *disk, size_t block); // optional, address of a block held in memory
+    int  (*fd)(Disk *disk); // optional, file descriptor holding the blocks at offset block * BLOCK_SIZE
+};
+
+// Backends shipped with the library
+extern const DiskOps disk_file_ops; // image file moved with pread/pwrite (O_DIRECT with DISK_DIRECT)
+extern const DiskOps disk_mmap_ops; // image file mapped into memory
+extern const DiskOps disk_ram_ops;  // anonymous memory, contents are lost on disk_close
+
+// An asynchronous request for a single block, result is set when the request is reaped
+typedef struct DiskRequest DiskRequest;
+struct DiskRequest {
+    size_t block; // block to move
+    char *data; // BLOCK_SIZE buffer to read into or write from
+    bool write; // write data to block instead of reading block into data
+    ssize_t result; // BLOCK_SIZE on success, DISK_FAILURE on error
+    int tag; // set by disk_submit, caller the request is accounted to
+    uint64_t started; // set by disk_submit, for the latency statistics
 };
 
 // Disk Functions
 
 Disk*	disk_open(const char *path, size_t blocks);
+Disk*	disk_open_flags(const char *path, size_t blocks, int flags);
+Disk*	disk_open_ops(const DiskOps *ops, const char *path, size_t blocks, int flags);
+Disk*	disk_open_ram(size_t blocks);
 void	disk_close(Disk *disk);
+bool	disk_flush(Disk *disk);
 
 ssize_t	disk_read(Disk *disk, size_t block, char *data);
 ssize_t	disk_write(Disk *disk, size_t block, char *data);
 
+// Vectored block I/O, data[i] is the BLOCK_SIZE buffer for the i-th block of the transfer.
+// readv/writev move the contiguous run [block, block + count) with as few syscalls as possible,
+// read_list/write_list take an arbitrary list of block numbers and merge neighbouring entries into runs.
+ssize_t	disk_readv(Disk *disk, size_t block, char **data, size_t count);
+ssize_t	disk_writev(Disk *disk, size_t block, char **data, size_t count);
+ssize_t	disk_read_list(Disk *disk, const size_t *blocks, char **data, size_t count);
+ssize_t	disk_write_list(Disk *disk, const size_t *blocks, char **data, size_t count);
+
+// Zero-copy access for mapped disks, returns a pointer to the block inside the mapping (NULL if not mapped).
+// The pointer stays valid until disk_close, modifications must still go through disk_write.
+const char*	disk_map_block(Disk *disk, size_t block);
+// Whether the backend keeps the blocks in memory, so disk_map_block succeeds
+bool	disk_mapped(const Disk *disk);
+// File descriptor of the backend (-1 if the blocks do not live in a file)
+int	disk_fd(Disk *disk);
+
+// Asynchronous block I/O, io_uring when available and a thread pool otherwise.
+// submit queues requests in one go and returns how many were accepted, reap waits for completions.
+ssize_t	disk_submit(Disk *disk, DiskRequest *requests, size_t count);
+ssize_t	disk_reap(Disk *disk, size_t min_complete);
+ssize_t	disk_batch(Disk *disk, DiskRequest *requests, size_t count);
+void	disk_queue_destroy(DiskQueue *queue);
+
+// Statistics, collected for every backend operation (disk_map_block is not timed).
+// disk_tag sets the caller that following requests are accounted to and returns the previous one.
+int	disk_tag(Disk *disk, int tag);
+void	disk_stats(Disk *disk, DiskStats *stats);
+void	disk_stats_reset(Disk *disk);
+// Latency in ns below which percentile percent of the operations completed (bucket upper bound)
+uint64_t	disk_latency_percentile(const DiskOpStats *stats, double percentile);
+const char*	disk_tag_name(int tag);
+
+// BLOCK_SIZE aligned buffers of count blocks, as required by DISK_DIRECT disks.
+// Released buffers are pooled, a buffer must be freed with the count it was allocated with.
+char*	disk_buffer_alloc(size_t count);
+void	disk_buffer_free(char *buffer, size_t count);
+bool	disk_buffer_aligned(const char *buffer);
+
 #endif
@@ -0,0 +1,65 @@
+// In-core inode cache between the file system and its inode table
+
+#ifndef ICACHE_H
+#define ICACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+// Inode Cache Constants
+#define ICACHE_DEFAULT_INODES   (1024)  // default capacity
+#define ICACHE_FLUSH_BATCH      (128)   // dirty inodes sorted and stored together when a dirty one is evicted
+
+// Slot flags
+#define ICACHE_VALID        (1<<0)  // slot holds an inode
+#define ICACHE_DIRTY        (1<<1)  // inode was changed and not stored yet
+#define ICACHE_REFERENCED   (1<<2)  // inode was used since the clock hand last passed it
+
+// Copy inode number out of the inode table into record
+typedef bool (*InodeLoad)(void *context, size_t number, void *record);
+// Store count inodes into the inode table, numbers are sorted so inodes sharing a table block are adjacent
+typedef bool (*InodeStore)(void *context, const size_t *numbers, const void *const *records, size_t count);
+
+// Write-back cache of inodes with reference counts and CLOCK replacement.
+// Inodes are looked up through a chained hash table, slot i owns records[i * record_size].
+// Slots with references are never evicted, the cache does not know the layout of an inode,
+// the file system loads and stores them through its callbacks.
+typedef struct InodeCache InodeCache;
+struct InodeCache {
+    size_t capacity; // number of slots
+    size_t record_size; // size of an inode
+    size_t hits; // lookups served from the cache
+    size_t misses; // lookups that had to load the inode (or, for new contents, claim a slot)
+    size_t evictions; // valid inodes pushed out to make room
+    size_t writebacks; // dirty inodes stored
+    InodeLoad load;
+    InodeStore store;
+    void *context; // passed to load and store
+
+    char *records; // capacity inodes
+    size_t *numbers; // inode number held by each slot
+    uint8_t *flags; // ICACHE_* flags of each slot
+    size_t *refs; // references handed out by icache_get and not put back yet
+    ssize_t *next; // next slot in the same hash bucket (-1 terminates)
+    ssize_t *buckets; // first slot of each hash bucket (-1 if empty)
+    size_t nbuckets;
+    size_t hand; // clock hand
+    size_t dirty; // number of dirty slots
+};
+
+// Inode Cache Functions
+
+InodeCache* icache_create(size_t capacity, size_t record_size, InodeLoad load, InodeStore store, void *context);
+void        icache_destroy(InodeCache *cache);
+
+// Take a reference to a cached inode, loading it on a miss unless the caller overwrites all of it
+void*       icache_get(InodeCache *cache, size_t number, bool load);
+// Give a reference back, dirty if the caller changed the inode
+void        icache_put(InodeCache *cache, const void *record, bool dirty);
+
+// Store every dirty inode, sorted by inode number, the inodes stay cached
+bool        icache_flush(InodeCache *cache);
+
+#endif
@@ -2,7 +2,11 @@
 #define FS_H
 
 #include "disk.h"
+#include "cache.h"
+#include "icache.h"
+#include "bitmap.h"
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -16,22 +20,67 @@
 // When the filesystem is mounted, the OS looks for this magic number. 
 // If it is correct, then the disk is assumed to contain a valid filesystem. If some other number is present, then the mount fails, perhaps because the disk is not formatted or contains some other kind of data.
 #define MAGIC_NUMBER        (0xf0f03410)
+// Marks the superblock fields after the original six as valid, older images have arbitrary bytes there
+#define FEATURES_MAGIC      (0x5346b17d)
+#define FS_FEATURE_BITMAP   (1<<0)  // free block bitmap stored on disk after the inode table
+#define FS_FEATURE_INODE_BITMAP (1<<1)  // free inode bitmap stored on disk after the free block bitmap
+#define FS_FEATURE_EXTENTS  (1<<2)  // inodes map their data with extents instead of direct and indirect pointers
+#define FS_FEATURE_GROUPS   (1<<3)  // blocks are split into groups, each with its own bitmaps and slice of the inode table
+#define FS_FEATURE_TRIPLE_INDIRECT (1<<4)  // inodes have 3 direct pointers and single, double and triple indirect blocks
+#define FS_FEATURE_INLINE_DATA (1<<5)  // files of up to FS_TAIL_MAX bytes live in their inode or in slots of shared blocks
+#define FS_STATE_CLEAN      (1)     // unmounted cleanly, the bitmaps and counters on disk can be trusted
+#define FS_STATE_MOUNTED    (2)     // mounted (or crashed while mounted), the next mount rebuilds the bitmaps
+#define BITS_PER_BLOCK      (BLOCK_SIZE * 8)    // Number of blocks tracked per bitmap block
+#define FS_GROUP_BLOCKS     (BITS_PER_BLOCK)    // Default number of blocks per group, the most one bitmap block can track
+#define GROUPS_PER_BLOCK    (128)   // Number of group descriptors per block
 #define INODES_PER_BLOCK    (128)   // Number of inodes per block
 #define POINTERS_PER_INODE  (5)    // Number of direct pointers per inode
 #define POINTERS_PER_BLOCK  (1024)  // Number of pointers per block
+#define DIRECT_POINTERS_DEEP (3)    // Number of direct pointers per inode with FS_FEATURE_TRIPLE_INDIRECT
+#define FS_INDIRECT_LEVELS  (3)     // Most levels of indirect blocks above the data blocks of a file
+#define INLINE_DATA_SIZE    (24)    // Bytes of file data an inode holds in place of its block map
+#define FS_TAIL_SLOT_SIZE   (128)   // Size of a slot in a shared small file block
+#define FS_TAIL_SLOTS       (32)    // Slots per shared small file block, the first one holds the mask of the slots in use
+#define FS_TAIL_MAX         (1024)  // Largest small file with FS_FEATURE_INLINE_DATA
+#define EXTENTS_PER_INODE   (2)     // Number of extents kept in an inode
+#define EXTENTS_PER_BLOCK   (512)   // Number of extents per extent block
+#define EXTENTS_MAX         (EXTENTS_PER_INODE + EXTENTS_PER_BLOCK) // Most extents an inode can have
+#define FS_IO_WINDOW        (DISK_QUEUE_DEPTH)  // Number of blocks submitted to the disk at once by reads, writes and the mount scan
+#define FS_READAHEAD_SLOTS  (16)    // Number of inodes whose read pattern is tracked at once
+#define FS_READAHEAD_MIN    (4)     // Readahead window in blocks once a read stream turns sequential
+#define FS_READAHEAD_MAX    (FS_IO_WINDOW)  // Largest readahead window in blocks
+#define FS_SCAN_THREADS_MAX (64)    // Most threads the mount scan is split across
+#define FS_RESERVE_MIN      (8)     // Blocks reserved past the end of a file once it keeps growing
+#define FS_RESERVE_MAX      (256)   // Largest reservation window in blocks
 
 // File system structure
 
 // Data structure that contains information like number of blocks, number of blocks for inode table etc.
 typedef struct SuperBlock SuperBlock;
 typedef struct Inode      Inode;
+// A run of contiguous data blocks of an inode
+typedef struct Extent     Extent;
 typedef struct GroupsDescriptor GroupsDescriptor;
+// In memory state of a block group
+typedef struct BlockGroup BlockGroup;
 // we use union for block as it is a union data type, a type that could take up multiple types
 typedef union  Block      Block;
+// Read pattern of one inode, used to prefetch ahead of sequential reads
+typedef struct Readahead  Readahead;
+// Indirect blocks on the path to the last block of a file that was looked up
+typedef struct BlockMap   BlockMap;
+// Blocks set aside for the next appends to a file
+typedef struct Reservation Reservation;
 // FileSystem contains information on disk FS is mounted on, as well as the superblock
 typedef struct FileSystem FileSystem;
+// Handle of an open inode with its position and resolved blocks
+typedef struct File       File;
+// One piece of a vectored read or write
+typedef struct FsVector   FsVector;
+// Run of a file that is contiguous on disk
+typedef struct FsExtent   FsExtent;
 
-// The super block is completely empty besides 24 bytes of data, we can add in a bitmap in here in the future
+// The super block is completely empty besides 72 bytes of data, the free block bitmap lives in its own blocks
 struct SuperBlock {
     uint32_t magic_number;
     uint32_t total_blocks; // total number of blocks in FS
@@ -40,38 +89,191 @@ struct SuperBlock {
     uint32_t    blocks; // total number of blocks per block group
     uint32_t    inode_blocks; // number of blocks reserved for inodes per blockgroup, total number of data blocks, would be total number of blocks - 1 (superblocl) -  
     uint32_t    inodes; // number of inodes per block group
+
+    uint32_t features_magic; // FEATURES_MAGIC if the fields below are set
+    uint32_t features; // FS_FEATURE_* flags chosen at format time
+    uint32_t bitmap_blocks; // number of free block bitmap blocks, they follow the inode table
+    uint32_t inode_bitmap_blocks; // number of free inode bitmap blocks, they follow the free block bitmap
+    uint32_t state; // FS_STATE_* (anything else is treated like FS_STATE_MOUNTED)
+    uint32_t free_block_count; // number of free blocks at the last clean unmount
+    uint32_t free_inode_count; // number of free inodes at the last clean unmount
+    uint32_t inode_hint; // where fs_create continued at the last clean unmount
+
+    uint32_t group_blocks; // blocks per group with FS_FEATURE_GROUPS (a multiple of 64), 0 otherwise
+    uint32_t group_inode_blocks; // inode table blocks per group
+    uint32_t group_count; // number of groups
+    uint32_t group_table_blocks; // number of group descriptor blocks, they follow the super block
+};
+
+// With FS_FEATURE_GROUPS group g covers blocks [g * group_blocks, (g + 1) * group_blocks) and starts with
+// its free block bitmap, its free inode bitmap and its slice of the inode table, followed by its data blocks.
+// Group 0 has the super block and the group descriptors in front. Group g holds the inodes
+// [g * group_inode_blocks * INODES_PER_BLOCK, (g + 1) * group_inode_blocks * INODES_PER_BLOCK).
+struct GroupsDescriptor {
+    uint32_t    block_bitmap; // block of the free block bitmap of the group
+    uint32_t    inode_bitmap; // block of the free inode bitmap of the group
+    uint32_t    inode_table; // first block of the slice of the inode table
+    uint32_t    data_start; // first data block of the group
+    uint32_t    free_blocks; // number of free blocks in the group at the last clean unmount
+    uint32_t    free_inodes; // number of free inodes in the group at the last clean unmount
+    uint32_t    reserved[2];
+};
+
+// A file system without FS_FEATURE_GROUPS is one group covering the whole disk
+struct BlockGroup {
+    size_t first; // first block of the group
+    size_t end; // block after the last one of the group
+    size_t data_start; // first data block of the group
+    size_t block_bitmap; // block of its free block bitmap (0 if the bitmaps are stored whole)
+    size_t inode_bitmap; // block of its free inode bitmap (0 if the bitmaps are stored whole)
+    size_t inode_table; // first block of its slice of the inode table
+    size_t inode_blocks; // number of blocks in its slice of the inode table
+    size_t first_inode; // first inode of the group
+    size_t inodes; // number of inodes in the group
+    size_t free_blocks; // number of free data blocks
+    size_t free_inodes; // number of free inodes
+    bool blocks_dirty; // its part of the free block bitmap changed since it was stored
+    bool inodes_dirty; // its part of the free inode bitmap changed since it was stored
+    pthread_mutex_t lock; // held while its part of the bitmaps and its counters change
 };
 
-// this shall be extended in the future
-// struct GroupsDescriptor {
-//     uint32_t magic_number;
-//     uint32_t    blocks; // Number of blocks per block group
-//     uint32_t    inode_blocks; // Number of blocks reserved for inodes per blockgroup
-//     uint32_t    inodes; // number of inodes per block group
-// };
+struct Extent {
+    uint32_t start; // first block of the run
+    uint32_t length; // number of blocks in the run
+};
 
 // 5 * 4 bytes( uin32_t ) ( the direct pointers) +  3 *  4bytes = 32 bytes size of one Inode structure
-// extend to have 2 and 3 indirect pointers as well
+// On a file system formatted with FS_FEATURE_TRIPLE_INDIRECT the last two direct pointers become the
+// double and triple indirect block, a double indirect block points to indirect blocks and so on.
+// With FS_FEATURE_INLINE_DATA the size decides where the bytes are: files of up to INLINE_DATA_SIZE bytes
+// keep them in the inode, files of up to FS_TAIL_MAX bytes in consecutive slots of a shared block.
+// On a file system formatted with FS_FEATURE_EXTENTS the pointers are replaced by extents, same 32 bytes:
+// the first EXTENTS_PER_INODE extents of the file, the number of extents and the block holding the rest of them.
+// The extents are in file order, extent i starts where extent i - 1 ends in the file.
 struct Inode {
     uint32_t valid;
     uint32_t size;
-    uint32_t    direct[POINTERS_PER_INODE]; // an array of uint32, where each number represents a pointer or "block number", not pointer is not an actual pointer.
-    uint32_t    indirect;  // block number or "pointer" to indirect block of pointer
+    union {
+        struct {
+            uint32_t    direct[POINTERS_PER_INODE]; // an array of uint32, where each number represents a pointer or "block number", not pointer is not an actual pointer.
+            uint32_t    indirect;  // block number or "pointer" to indirect block of pointer
+        };
+        struct {
+            uint32_t    shared_direct[DIRECT_POINTERS_DEEP]; // direct[0] to direct[2]
+            uint32_t    double_indirect; // block of pointers to indirect blocks
+            uint32_t    triple_indirect; // block of pointers to double indirect blocks
+        };
+        uint32_t        pointers[POINTERS_PER_INODE + 1]; // the direct pointers and the indirect block as one array
+        char            inline_data[INLINE_DATA_SIZE]; // bytes of a file of up to INLINE_DATA_SIZE bytes
+        struct {
+            uint32_t    tail_block; // shared block holding a small file
+            uint32_t    tail_slot; // first of its slots
+        };
+        struct {
+            Extent      extents[EXTENTS_PER_INODE]; // first extents of the file
+            uint32_t    extent_count; // number of extents in use, in the inode and then in the extent block
+            uint32_t    extent_block; // block holding extents EXTENTS_PER_INODE and on
+        };
+    };
 };
 
 // A block of data is 4KB, and is a union of the different types it can take on
 union Block {
-    SuperBlock super_block; // 24 bytes only
-    // GroupsDescriptor groups_descriptor; 
+    SuperBlock super_block; // 72 bytes only
+    GroupsDescriptor groups[GROUPS_PER_BLOCK]; // 32 * 128
     Inode inodes[INODES_PER_BLOCK]; // 32 * 128 (Inodes per block -> 4096 / 32 = 128)
     uint32_t block_pointers[POINTERS_PER_BLOCK]; // a pointer is 4 bytes, POINTERS per block = 4096/4 = 1028
+    Extent extents[EXTENTS_PER_BLOCK]; // an extent is 8 bytes, 4096/8 = 512
+    uint32_t tail_used; // mask of the slots in use of a shared small file block
     char data[BLOCK_SIZE]; // 4096 bytes
 };
 
+struct Readahead {
+    bool valid;
+    size_t inode_number;
+    size_t offset; // byte offset a sequential read continues at
+    size_t ahead; // logical blocks before this one have been prefetched
+    size_t window; // number of blocks prefetched past each read, 0 while access is random
+};
+
+// Entry l holds the indirect block of level l + 1 (the one pointing to data blocks is level 1) that was
+// walked through last. Lookups of nearby blocks start from the lowest entry covering them instead of the inode.
+// Each open handle has its own, the file system keeps one per read stream slot for fs_read and fs_write.
+struct BlockMap {
+    bool valid;
+    size_t inode_number;
+    size_t blocks[FS_INDIRECT_LEVELS]; // indirect block held (0 if none)
+    size_t first[FS_INDIRECT_LEVELS]; // first logical block of the file it maps
+    bool dirty[FS_INDIRECT_LEVELS]; // it changed and has to be written back
+    Block *buffers; // its contents, FS_INDIRECT_LEVELS blocks allocated on first use
+};
+
+// The reserved blocks are taken from the free block bitmap but belong to no file until it grows into them
+struct Reservation {
+    bool valid;
+    size_t inode_number;
+    size_t next; // block after the last one allocated to the file, its next block is taken from the reservation
+    size_t start; // first reserved block
+    size_t count; // number of reserved blocks
+    size_t window; // size of the last reservation, 0 until the file is appended to twice in a row
+};
+
 struct FileSystem {
     Disk *disk;
-    bool *free_blocks; // free block bit map, currently an in memory array of free blocks, to be extended to be on disk in the future
+    uint64_t *free_blocks; // packed free block bitmap, a set bit marks a free block (whole blocks of words so it can be stored as is)
+    size_t free_count; // number of free blocks
+    bool free_blocks_dirty; // bitmap changed since it was last stored on disk
+    uint64_t *free_inodes; // packed free inode bitmap, a set bit marks a free inode
+    size_t free_inode_count; // number of free inodes
+    size_t inode_hint; // fs_create looks for a free inode from here on
+    bool free_inodes_dirty; // inode bitmap changed since it was last stored on disk
+    size_t data_start; // first data block, after the superblock, the inode table and the bitmaps (of the first group)
+    BlockGroup *groups; // block groups, allocation works on one group at a time under its lock
+    size_t group_count; // number of block groups (1 without FS_FEATURE_GROUPS)
     SuperBlock meta; // FS metadata
+    Cache *cache; // block cache in front of the disk, NULL on disks that keep their blocks in memory
+    size_t cache_blocks; // capacity of the block cache, set before fs_mount (0 selects CACHE_DEFAULT_BLOCKS)
+    InodeCache *icache; // inode cache in front of the inode table, NULL when there is no block cache
+    size_t icache_inodes; // capacity of the inode cache, set before fs_mount (0 selects ICACHE_DEFAULT_INODES)
+    size_t scan_threads; // threads scanning the inode table when fs_mount has to, set before fs_mount (0 or 1 scans serially)
+    Readahead readahead[FS_READAHEAD_SLOTS]; // read streams, indexed by inode number modulo FS_READAHEAD_SLOTS
+    BlockMap maps[FS_READAHEAD_SLOTS]; // block map walks outside a handle, indexed like the read streams
+    Reservation reservations[FS_READAHEAD_SLOTS]; // reservation windows, looked for from the slot of the inode number on
+    size_t tail_block; // shared block new small files are packed into (0 until one is needed)
+    File *files; // open handles, their block maps and resolved blocks are dropped when a write elsewhere changes them
+};
+
+// length bytes of the file at offset, read into or written from data
+struct FsVector {
+    char *data;
+    size_t length;
+    size_t offset;
+};
+
+// length bytes of the file at offset kept in the blocks from block on. Extents start at block boundaries
+// and cover whole blocks, except the last one of the file, which ends at its size. block is 0 for holes
+// and for small files, whose bytes are in the inode or in a shared block.
+struct FsExtent {
+    size_t offset;
+    size_t length;
+    size_t block;
+};
+
+// An open Inode, see fs_open. The inode stays pinned in the inode cache and the physical blocks of the
+// file are resolved once, as reads get to them, so streaming through a handle touches little metadata.
+struct File {
+    FileSystem *fs;
+    size_t inode_number;
+    Inode *inode; // pinned in the inode cache (NULL without one, the inode is then copied into copy, from memory)
+    Inode copy;
+    size_t position; // byte offset the next read or write through the handle starts at
+    size_t *blocks; // physical block of each logical block of the file up to mapped, 0 for holes
+    size_t mapped; // number of blocks resolved, from the start of the file
+    size_t capacity; // number of blocks there is room for
+    BlockMap map; // indirect blocks on the path of the last block looked up or written through the handle
+    bool written; // the file was written through the handle
+    Block *edges; // buffers for a partly read first and last block
+    File *next; // next open handle of the file system
 };
 
 // sfs functions
@@ -79,20 +281,51 @@ struct FileSystem {
 // a directory structure as well as mapping to name
 void fs_debug(Disk *disk);
 bool fs_format(Disk *disk);
+// format like fs_format, a disk without a file system also gets the optional FS_FEATURE_* flags in features,
+// group_blocks is the size of a block group with FS_FEATURE_GROUPS (0 selects FS_GROUP_BLOCKS)
+bool fs_format_features(Disk *disk, uint32_t features, size_t group_blocks);
 // mount the file system
 bool    fs_mount(FileSystem *fs, Disk *disk);
 // unmount the file system from a mountpoint
 void    fs_unmount(FileSystem *fs);
+// write every cached change back to disk and flush the disk
+bool    fs_sync(FileSystem *fs);
 ssize_t fs_create(FileSystem *fs);
 // remove an inode from a file system, same as rm
 bool    fs_remove(FileSystem *fs, size_t inode_number);
 ssize_t fs_stat(FileSystem *fs, size_t inode_number);
+// whether a block is free according to the free block bitmap
+bool    fs_block_is_free(const FileSystem *fs, size_t block_number);
+// group a block belongs to (fs->group_count if none)
+size_t  fs_block_group(const FileSystem *fs, size_t block_number);
+// allocate up to count contiguous blocks near goal, and give blocks back, both can be called from several threads
+size_t  fs_allocate_run(FileSystem *fs, size_t goal, size_t count, size_t *first);
+void    fs_release_run(FileSystem *fs, size_t first, size_t count);
 
 // Read and write to an inode, inputs being data to be written or read to, the size as well as the offset.
 ssize_t fs_read(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset);
 ssize_t fs_write(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset);
+// Read and write several pieces of an inode at once, each block is mapped once and the disk I/O is batched
+ssize_t fs_readv(FileSystem *fs, size_t inode_number, const FsVector *vectors, size_t count);
+ssize_t fs_writev(FileSystem *fs, size_t inode_number, const FsVector *vectors, size_t count);
+// where the bytes of an inode from offset on are on disk, to move them without going through fs_read
+ssize_t fs_extents(FileSystem *fs, size_t inode_number, size_t offset, FsExtent *extents, size_t count);
+// allocate the blocks of an inode from offset to offset + length ahead of the writes, keeping its size:
+// holes get blocks of null bytes, blocks past the end are reserved for its appends until it is released
+bool    fs_fallocate(FileSystem *fs, size_t inode_number, size_t offset, size_t length);
+// give back the blocks reserved for the next appends to an inode, once the writer is done with it
+void    fs_release_reservation(FileSystem *fs, size_t inode_number);
+
+// Open an inode for reading and writing at a position that moves with each call, close before fs_unmount
+File*   fs_open(FileSystem *fs, size_t inode_number);
+// close a handle, blocks reserved for appends through it are given back
+void    fs_close(File *file);
+ssize_t fs_file_read(File *file, char *data, size_t length);
+ssize_t fs_file_write(File *file, char *data, size_t length);
+// move the position of a handle, writing past the end of the file leaves a gap like fs_write
+bool    fs_file_seek(File *file, size_t position);
 
-// intializes the free block bitmap of fs meta
+// intializes the free block bitmap and free inode bitmap of fs meta
 bool fs_initialize_free_block_bitmap(FileSystem *fs);
 // intializes the meta of fs
 bool fs_initialize_meta(FileSystem *fs, Block* super_block, Disk* disk);
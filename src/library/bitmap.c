@@ -0,0 +1,105 @@
+// packed bitmaps for simple FS
+#include "../include/bitmap.h"
+#include "../include/utils.h"
+
+void    bitmap_update_range(uint64_t *words, size_t first, size_t count, bool value);
+
+bool bitmap_test(const uint64_t *words, size_t bit) {
+    return (words[bit / BITMAP_WORD_BITS] >> (bit % BITMAP_WORD_BITS)) & 1;
+}
+
+void bitmap_set(uint64_t *words, size_t bit) {
+    words[bit / BITMAP_WORD_BITS] |= 1ull << (bit % BITMAP_WORD_BITS);
+}
+
+void bitmap_clear(uint64_t *words, size_t bit) {
+    words[bit / BITMAP_WORD_BITS] &= ~(1ull << (bit % BITMAP_WORD_BITS));
+}
+
+void bitmap_set_range(uint64_t *words, size_t first, size_t count) {
+    bitmap_update_range(words, first, count, true);
+}
+
+void bitmap_clear_range(uint64_t *words, size_t first, size_t count) {
+    bitmap_update_range(words, first, count, false);
+}
+
+/**
+ * Set or clear count bits starting at first, whole words at a time in the middle of the range.
+ **/
+void bitmap_update_range(uint64_t *words, size_t first, size_t count, bool value) {
+    size_t bit = first;
+    size_t end = first + count;
+    while(bit < end) {
+        size_t shift = bit % BITMAP_WORD_BITS;
+        size_t n = min(BITMAP_WORD_BITS - shift, end - bit);
+        uint64_t mask = (n == BITMAP_WORD_BITS ? ~0ull : ((1ull << n) - 1)) << shift;
+        if(value) words[bit / BITMAP_WORD_BITS] |= mask;
+        else words[bit / BITMAP_WORD_BITS] &= ~mask;
+        bit += n;
+    }
+}
+
+/**
+ * Count the set bits among the first bits of a bitmap.
+ *
+ * @param       words       Bitmap.
+ * @param       bits        Number of bits to look at.
+ * @return      Number of set bits.
+ **/
+size_t bitmap_count(const uint64_t *words, size_t bits) {
+    size_t count = 0;
+    size_t full = bits / BITMAP_WORD_BITS;
+    for(size_t w = 0; w < full; w++) count += __builtin_popcountll(words[w]);
+    if(bits % BITMAP_WORD_BITS) {
+        count += __builtin_popcountll(words[full] & ((1ull << (bits % BITMAP_WORD_BITS)) - 1));
+    }
+    return count;
+}
+
+/**
+ * Find the first set bit at or after from. Empty words are skipped whole and the bit
+ * within the first non-empty word is found with a count of trailing zeros.
+ *
+ * @param       words       Bitmap.
+ * @param       bits        Number of bits in the bitmap.
+ * @param       from        First bit to look at.
+ * @return      Index of the set bit (bits if there is none).
+ **/
+size_t bitmap_find(const uint64_t *words, size_t bits, size_t from) {
+    if(from >= bits) return bits;
+    size_t w = from / BITMAP_WORD_BITS;
+    size_t nwords = BITMAP_WORDS(bits);
+    uint64_t word = words[w] & (~0ull << (from % BITMAP_WORD_BITS));
+    while(word == 0) {
+        if(++w >= nwords) return bits;
+        word = words[w];
+    }
+    size_t bit = w * BITMAP_WORD_BITS + __builtin_ctzll(word);
+    return min(bit, bits);
+}
+
+/**
+ * Measure the run of set bits starting at from. Full words extend the run by 64 bits at
+ * a time, the first clear bit is found with a count of trailing zeros of the inverted word.
+ *
+ * @param       words       Bitmap.
+ * @param       bits        Number of bits in the bitmap.
+ * @param       from        First bit of the run.
+ * @param       limit       Longest run of interest.
+ * @return      Length of the run (0 if from is clear).
+ **/
+size_t bitmap_run(const uint64_t *words, size_t bits, size_t from, size_t limit) {
+    if(from >= bits) return 0;
+    size_t end = from + min(limit, bits - from);
+    size_t bit = from;
+    while(bit < end) {
+        uint64_t clear = ~words[bit / BITMAP_WORD_BITS] >> (bit % BITMAP_WORD_BITS);
+        if(clear != 0) {
+            bit += __builtin_ctzll(clear);
+            break;
+        }
+        bit += BITMAP_WORD_BITS - bit % BITMAP_WORD_BITS;
+    }
+    return min(bit, end) - from;
+}
@@ -0,0 +1,394 @@
+// write-back block buffer cache for simple FS
+#include "../include/cache.h"
+#include "../include/log.h"
+
+#include <string.h>
+
+ssize_t cache_lookup(Cache *cache, size_t block);
+void    cache_insert(Cache *cache, size_t slot, size_t block);
+void    cache_remove(Cache *cache, size_t slot);
+ssize_t cache_victim(Cache *cache);
+ssize_t cache_fill(Cache *cache, size_t block, const char *data);
+ssize_t cache_load(Cache *cache, DiskRequest *requests, size_t count);
+bool    cache_writeback(Cache *cache, size_t first, size_t limit);
+int     cache_dirty_compare(const void *a, const void *b);
+
+// A dirty slot waiting to be written back
+typedef struct CacheDirty CacheDirty;
+struct CacheDirty {
+    size_t block;
+    size_t slot;
+};
+
+/**
+ * Create a cache of capacity blocks in front of the specified disk.
+ *
+ * @param       disk        Disk whose blocks are cached.
+ * @param       capacity    Number of blocks to cache (0 selects CACHE_DEFAULT_BLOCKS).
+ * @return      Pointer to newly allocated Cache structure (NULL on failure).
+ **/
+Cache* cache_create(Disk *disk, size_t capacity) {
+    if(disk == NULL) return NULL;
+    if(capacity == 0) capacity = CACHE_DEFAULT_BLOCKS;
+    Cache *cache = calloc(1, sizeof(Cache));
+    if(cache == NULL) return NULL;
+    cache->disk = disk;
+    cache->capacity = capacity;
+    cache->nbuckets = capacity * 2;
+    cache->flush_batch = CACHE_FLUSH_BATCH;
+    cache->max_run = CACHE_MAX_RUN;
+    cache->data = disk_buffer_alloc(capacity);
+    cache->blocks = calloc(capacity, sizeof(size_t));
+    cache->flags = calloc(capacity, sizeof(uint8_t));
+    cache->tags = calloc(capacity, sizeof(uint8_t));
+    cache->next = malloc(capacity * sizeof(ssize_t));
+    cache->buckets = malloc(cache->nbuckets * sizeof(ssize_t));
+    if(!cache->data || !cache->blocks || !cache->flags || !cache->tags || !cache->next || !cache->buckets) {
+        error("unable to allocate a cache of %zu blocks", capacity);
+        cache_destroy(cache);
+        return NULL;
+    }
+    for(size_t i = 0; i < cache->nbuckets; i++) cache->buckets[i] = -1;
+    return cache;
+}
+
+/**
+ * Flush dirty blocks and release the cache.
+ *
+ * @param       cache       Pointer to Cache structure (NULL is ignored).
+ **/
+void cache_destroy(Cache *cache) {
+    if(cache == NULL) return;
+    if(cache->flags && cache->dirty > 0) cache_flush(cache);
+    disk_buffer_free(cache->data, cache->capacity);
+    free(cache->blocks);
+    free(cache->flags);
+    free(cache->tags);
+    free(cache->next);
+    free(cache->buckets);
+    free(cache);
+}
+
+/**
+ * Read a block through the cache, going to disk only on a miss.
+ *
+ * @param cache
+ * @param block
+ * @param data      BLOCK_SIZE buffer to copy the block into
+ *
+ * @return BLOCK_SIZE on success (DISK_FAILURE on error)
+**/
+ssize_t cache_read(Cache *cache, size_t block, char *data) {
+    if(cache == NULL || data == NULL || block >= cache->disk->blocks) return DISK_FAILURE;
+    ssize_t slot = cache_lookup(cache, block);
+    if(slot >= 0) {
+        cache->hits += 1;
+        cache->flags[slot] |= CACHE_REFERENCED;
+        memcpy(data, cache->data + slot * BLOCK_SIZE, BLOCK_SIZE);
+        return BLOCK_SIZE;
+    }
+    cache->misses += 1;
+    if(disk_read(cache->disk, block, data) != BLOCK_SIZE) return DISK_FAILURE;
+    return cache_fill(cache, block, data) < 0 ? DISK_FAILURE : BLOCK_SIZE;
+}
+
+/**
+ * Write a block into the cache. Whole blocks are written so nothing is read from disk,
+ * the block reaches the disk when it is evicted or flushed.
+ *
+ * @param cache
+ * @param block
+ * @param data      BLOCK_SIZE buffer holding the new contents
+ *
+ * @return BLOCK_SIZE on success (DISK_FAILURE on error)
+**/
+ssize_t cache_write(Cache *cache, size_t block, const char *data) {
+    if(cache == NULL || data == NULL || block >= cache->disk->blocks) return DISK_FAILURE;
+    ssize_t slot = cache_lookup(cache, block);
+    if(slot < 0 && (slot = cache_fill(cache, block, data)) < 0) return DISK_FAILURE;
+    memcpy(cache->data + slot * BLOCK_SIZE, data, BLOCK_SIZE);
+    cache->tags[slot] = cache->disk->tag;
+    if(!(cache->flags[slot] & CACHE_DIRTY)) cache->dirty += 1;
+    cache->flags[slot] |= CACHE_DIRTY | CACHE_REFERENCED;
+    return BLOCK_SIZE;
+}
+
+/**
+ * Read count blocks through the cache. Hits are copied out, the misses are submitted
+ * to the disk together (see cache_load) and then added to the cache.
+ *
+ * @param cache
+ * @param blocks    block numbers to read
+ * @param data      one BLOCK_SIZE buffer per block
+ * @param count
+ *
+ * @return number of bytes read (DISK_FAILURE on error)
+**/
+ssize_t cache_read_list(Cache *cache, const size_t *blocks, char **data, size_t count) {
+    if(cache == NULL || blocks == NULL || data == NULL) return DISK_FAILURE;
+    DiskRequest requests[DISK_QUEUE_DEPTH];
+    size_t done = 0;
+    while(done < count) {
+        size_t misses = 0;
+        size_t end = done;
+        for(; end < count && misses < DISK_QUEUE_DEPTH; end++) {
+            if(blocks[end] >= cache->disk->blocks || data[end] == NULL) return DISK_FAILURE;
+            ssize_t slot = cache_lookup(cache, blocks[end]);
+            if(slot >= 0) {
+                cache->hits += 1;
+                cache->flags[slot] |= CACHE_REFERENCED;
+                memcpy(data[end], cache->data + slot * BLOCK_SIZE, BLOCK_SIZE);
+            } else {
+                requests[misses++] = (DiskRequest){ .block = blocks[end], .data = data[end] };
+            }
+        }
+        cache->misses += misses;
+        if(misses > 0 && cache_load(cache, requests, misses) == DISK_FAILURE) return DISK_FAILURE;
+        for(size_t i = 0; i < misses; i++) {
+            // the same block may be listed twice, only the first copy is cached
+            if(cache_lookup(cache, requests[i].block) < 0 && cache_fill(cache, requests[i].block, requests[i].data) < 0) return DISK_FAILURE;
+        }
+        done = end;
+    }
+    return count * BLOCK_SIZE;
+}
+
+/**
+ * Read the blocks of a batch of misses from disk. Runs of consecutive blocks, like the
+ * blocks of an extent, are read with one vectored read each, the remaining blocks are
+ * submitted to the disk queue together.
+ *
+ * @param cache
+ * @param requests  read requests, at most DISK_QUEUE_DEPTH
+ * @param count
+ *
+ * @return number of bytes read (DISK_FAILURE on error)
+**/
+ssize_t cache_load(Cache *cache, DiskRequest *requests, size_t count) {
+    DiskRequest singles[DISK_QUEUE_DEPTH];
+    char *data[DISK_QUEUE_DEPTH];
+    size_t nsingles = 0;
+    for(size_t start = 0; start < count; ) {
+        size_t end = start + 1;
+        while(end < count && requests[end].block == requests[end - 1].block + 1) end++;
+        if(end - start == 1) {
+            singles[nsingles++] = requests[start];
+        } else {
+            for(size_t i = start; i < end; i++) data[i - start] = requests[i].data;
+            if(disk_readv(cache->disk, requests[start].block, data, end - start) == DISK_FAILURE) return DISK_FAILURE;
+        }
+        start = end;
+    }
+    if(nsingles > 0 && disk_batch(cache->disk, singles, nsingles) == DISK_FAILURE) return DISK_FAILURE;
+    return count * BLOCK_SIZE;
+}
+
+/**
+ * Write count blocks into the cache.
+ *
+ * @return number of bytes written (DISK_FAILURE on error)
+**/
+ssize_t cache_write_list(Cache *cache, const size_t *blocks, char **data, size_t count) {
+    if(cache == NULL || blocks == NULL || data == NULL) return DISK_FAILURE;
+    for(size_t i = 0; i < count; i++) {
+        if(cache_write(cache, blocks[i], data[i]) == DISK_FAILURE) return DISK_FAILURE;
+    }
+    return count * BLOCK_SIZE;
+}
+
+/**
+ * Load blocks into the cache ahead of use. Cached blocks are skipped, the rest are read
+ * from disk in batches and cached without their reference bit, so prefetched blocks that
+ * are never used are the first ones the clock hand evicts.
+ *
+ * @param cache
+ * @param blocks    block numbers to load
+ * @param count
+ *
+ * @return number of blocks read from disk (DISK_FAILURE on error)
+**/
+ssize_t cache_prefetch(Cache *cache, const size_t *blocks, size_t count) {
+    if(cache == NULL || blocks == NULL) return DISK_FAILURE;
+    char *buffers = disk_buffer_alloc(DISK_QUEUE_DEPTH);
+    if(buffers == NULL) return DISK_FAILURE;
+    DiskRequest requests[DISK_QUEUE_DEPTH];
+    ssize_t loaded = 0;
+    size_t done = 0;
+    while(done < count && loaded != DISK_FAILURE) {
+        size_t misses = 0;
+        for(; done < count && misses < DISK_QUEUE_DEPTH; done++) {
+            if(blocks[done] >= cache->disk->blocks) {
+                loaded = DISK_FAILURE;
+                break;
+            }
+            if(cache_lookup(cache, blocks[done]) >= 0) continue;
+            bool listed = false;
+            for(size_t i = 0; i < misses && !listed; i++) listed = requests[i].block == blocks[done];
+            if(listed) continue;
+            requests[misses] = (DiskRequest){ .block = blocks[done], .data = buffers + misses * BLOCK_SIZE };
+            misses += 1;
+        }
+        if(loaded == DISK_FAILURE || misses == 0) continue;
+        if(cache_load(cache, requests, misses) == DISK_FAILURE) {
+            loaded = DISK_FAILURE;
+            break;
+        }
+        for(size_t i = 0; i < misses; i++) {
+            ssize_t slot = cache_fill(cache, requests[i].block, requests[i].data);
+            if(slot < 0) {
+                loaded = DISK_FAILURE;
+                break;
+            }
+            cache->flags[slot] &= ~CACHE_REFERENCED;
+        }
+        if(loaded == DISK_FAILURE) break;
+        cache->prefetches += misses;
+        loaded += misses;
+    }
+    disk_buffer_free(buffers, DISK_QUEUE_DEPTH);
+    return loaded;
+}
+
+/**
+ * Write every dirty block back to disk, flush_batch blocks per pass. Each pass is sorted
+ * by block number and contiguous blocks are written with one vectored write, the blocks stay cached.
+ *
+ * @param cache
+ *
+ * @return whether or not every dirty block was written
+**/
+bool cache_flush(Cache *cache) {
+    if(cache == NULL) return false;
+    while(cache->dirty > 0) {
+        if(!cache_writeback(cache, 0, cache->flush_batch)) {
+            error("error writing back dirty blocks");
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Write back up to limit dirty blocks, collected in clock order starting at slot first,
+ * in ascending block order with one disk_writev per run of consecutive blocks (at most
+ * max_run blocks long, all written by the same caller so the disk statistics stay per caller).
+ * Starting from the clock hand picks the blocks closest to eviction.
+ *
+ * @param cache
+ * @param first     slot to start collecting at
+ * @param limit     number of dirty blocks to write back (0 is taken as 1)
+ *
+ * @return whether or not the collected blocks were written
+**/
+bool cache_writeback(Cache *cache, size_t first, size_t limit) {
+    if(limit == 0) limit = 1;
+    if(limit > cache->dirty) limit = cache->dirty;
+    size_t max_run = cache->max_run ? cache->max_run : 1;
+    CacheDirty *dirty = malloc(limit * sizeof(CacheDirty));
+    char **data = malloc((limit < max_run ? limit : max_run) * sizeof(char*));
+    if(dirty == NULL || data == NULL) {
+        free(dirty);
+        free(data);
+        return false;
+    }
+    size_t count = 0;
+    for(size_t i = 0; i < cache->capacity && count < limit; i++) {
+        size_t slot = (first + i) % cache->capacity;
+        if(cache->flags[slot] & CACHE_DIRTY) dirty[count++] = (CacheDirty){ .block = cache->blocks[slot], .slot = slot };
+    }
+    qsort(dirty, count, sizeof(CacheDirty), cache_dirty_compare);
+
+    bool success = true;
+    int previous = cache->disk->tag;
+    for(size_t start = 0; start < count && success; ) {
+        uint8_t tag = cache->tags[dirty[start].slot];
+        size_t end = start + 1;
+        while(end < count && end - start < max_run && dirty[end].block == dirty[end - 1].block + 1 && cache->tags[dirty[end].slot] == tag) end++;
+        for(size_t i = start; i < end; i++) data[i - start] = cache->data + dirty[i].slot * BLOCK_SIZE;
+        disk_tag(cache->disk, tag);
+        if(disk_writev(cache->disk, dirty[start].block, data, end - start) == DISK_FAILURE) {
+            success = false;
+            break;
+        }
+        for(size_t i = start; i < end; i++) cache->flags[dirty[i].slot] &= ~CACHE_DIRTY;
+        cache->runs += 1;
+        cache->writebacks += end - start;
+        cache->dirty -= end - start;
+        start = end;
+    }
+    disk_tag(cache->disk, previous);
+    free(dirty);
+    free(data);
+    return success;
+}
+
+int cache_dirty_compare(const void *a, const void *b) {
+    size_t x = ((const CacheDirty*)a)->block;
+    size_t y = ((const CacheDirty*)b)->block;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Find the slot holding block.
+ *
+ * @return slot number (-1 if the block is not cached)
+**/
+ssize_t cache_lookup(Cache *cache, size_t block) {
+    for(ssize_t slot = cache->buckets[block % cache->nbuckets]; slot >= 0; slot = cache->next[slot]) {
+        if(cache->blocks[slot] == block) return slot;
+    }
+    return -1;
+}
+
+void cache_insert(Cache *cache, size_t slot, size_t block) {
+    size_t bucket = block % cache->nbuckets;
+    cache->blocks[slot] = block;
+    cache->flags[slot] = CACHE_VALID | CACHE_REFERENCED;
+    cache->next[slot] = cache->buckets[bucket];
+    cache->buckets[bucket] = slot;
+}
+
+void cache_remove(Cache *cache, size_t slot) {
+    ssize_t *link = &cache->buckets[cache->blocks[slot] % cache->nbuckets];
+    while(*link != (ssize_t)slot) link = &cache->next[*link];
+    *link = cache->next[slot];
+    cache->flags[slot] = 0;
+}
+
+/**
+ * Pick a slot to reuse with the CLOCK policy: the hand skips (and clears) referenced
+ * slots and stops at the first empty or unreferenced one. A dirty victim is written
+ * back before its slot is handed out, together with the next flush_batch dirty blocks
+ * in clock order so write back under memory pressure is sorted and merged as well.
+ *
+ * @return slot number (-1 if a dirty victim could not be written back)
+**/
+ssize_t cache_victim(Cache *cache) {
+    while(true) {
+        size_t slot = cache->hand;
+        cache->hand = (cache->hand + 1) % cache->capacity;
+        uint8_t flags = cache->flags[slot];
+        if(!(flags & CACHE_VALID)) return slot;
+        if(flags & CACHE_REFERENCED) {
+            cache->flags[slot] &= ~CACHE_REFERENCED;
+            continue;
+        }
+        if((flags & CACHE_DIRTY) && !cache_writeback(cache, slot, cache->flush_batch)) return -1;
+        cache->evictions += 1;
+        cache_remove(cache, slot);
+        return slot;
+    }
+}
+
+/**
+ * Add a clean copy of block to the cache.
+ *
+ * @return slot number (-1 on error)
+**/
+ssize_t cache_fill(Cache *cache, size_t block, const char *data) {
+    ssize_t slot = cache_victim(cache);
+    if(slot < 0) return -1;
+    memcpy(cache->data + slot * BLOCK_SIZE, data, BLOCK_SIZE);
+    cache_insert(cache, slot, block);
+    return slot;
+}
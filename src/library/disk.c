@@ -3,10 +3,82 @@
 #include "../include/log.h"
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+// Maximum number of blocks moved by a single preadv/pwritev
+#ifdef IOV_MAX
+#define DISK_IOV_MAX    (IOV_MAX)
+#else
+#define DISK_IOV_MAX    (1024)
+#endif
+
 // Perform sanity check
 bool    disk_sanity_check(Disk *disk, size_t blocknum, const char *data);
+// Helpers of disk_readv/disk_writev and disk_read_list/disk_write_list
+ssize_t disk_run(Disk *disk, size_t block, char **data, size_t count, bool write);
+ssize_t disk_list(Disk *disk, const size_t *blocks, char **data, size_t count, bool write);
+// Defined in disk_stats.c
+uint64_t disk_now();
+void    disk_account(Disk *disk, size_t block, size_t count, bool write, int tag, uint64_t started);
+
+// File backend (and the memory mapped variant of it)
+typedef struct DiskFile DiskFile;
+struct DiskFile {
+    int fd; // file descriptor of the image
+    char *map; // base of the mapped image, NULL unless the disk uses disk_mmap_ops
+};
+bool    disk_file_open(Disk *disk, const char *path);
+int     disk_file_read(Disk *disk, size_t block, char **data, size_t count);
+int     disk_file_write(Disk *disk, size_t block, char **data, size_t count);
+int     disk_file_move(Disk *disk, size_t block, char **data, size_t count, bool write);
+bool    disk_file_flush(Disk *disk);
+void    disk_file_close(Disk *disk);
+int     disk_file_fd(Disk *disk);
+bool    disk_mmap_open(Disk *disk, const char *path);
+int     disk_mmap_read(Disk *disk, size_t block, char **data, size_t count);
+int     disk_mmap_write(Disk *disk, size_t block, char **data, size_t count);
+bool    disk_mmap_flush(Disk *disk);
+void    disk_mmap_close(Disk *disk);
+char*   disk_mmap_block(Disk *disk, size_t block);
+// Positional transfer on a descriptor, resuming short transfers
+int     disk_transfer(int fd, struct iovec *iov, int iovcnt, off_t offset, bool write);
+// Transfer that copies through an aligned buffer, for unaligned buffers on DISK_DIRECT disks
+int     disk_bounce(int fd, char **data, size_t count, off_t offset, bool write);
+
+const DiskOps disk_file_ops = {
+    .name = "file",
+    .open = disk_file_open,
+    .read = disk_file_read,
+    .write = disk_file_write,
+    .flush = disk_file_flush,
+    .close = disk_file_close,
+    .fd = disk_file_fd,
+};
+
+const DiskOps disk_mmap_ops = {
+    .name = "mmap",
+    .open = disk_mmap_open,
+    .read = disk_mmap_read,
+    .write = disk_mmap_write,
+    .flush = disk_mmap_flush,
+    .close = disk_mmap_close,
+    .map_block = disk_mmap_block,
+    .fd = disk_file_fd,
+};
+
+// Pool of released aligned buffers, shared by every disk
+typedef struct DiskBuffer DiskBuffer;
+struct DiskBuffer {
+    char *data;
+    size_t count;
+};
+static DiskBuffer pool[DISK_BUFFER_POOL];
+static size_t pool_size = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
 
 // We have to read and write entire blocks to truly emulate a disk, 
 // We can write to specific bytes in a disk, we have to read entire blocks and write entire blocks
@@ -28,46 +100,145 @@ bool    disk_sanity_check(Disk *disk, size_t blocknum, const char *data);
  **/
 
 Disk* disk_open(const char * path, size_t blocks) {
-    int fd;
+    return disk_open_flags(path, blocks, 0);
+}
+
+/**
+ * Opens disk at specified path like disk_open, with the backend selected by flags:
+ *
+ * 0            disk_file_ops, blocks are moved with pread/pwrite on the file descriptor.
+ * DISK_MMAP    disk_mmap_ops, the whole image is mapped with mmap, blocks are moved with memcpy
+ *              and disk_map_block hands out pointers into the mapping.
+ * DISK_DIRECT  the image is opened with O_DIRECT so blocks bypass the host page cache,
+ *              buffers that are not BLOCK_SIZE aligned are bounced through disk_buffer_alloc.
+ *
+ * @param       path        Path to disk image to create.
+ * @param       blocks      Number of blocks to allocate for disk image.
+ * @param       flags       Bitwise or of DISK_* open flags.
+ *
+ * @return      Pointer to newly allocated and configured Disk structure (NULL on failure).
+ **/
+Disk* disk_open_flags(const char * path, size_t blocks, int flags) {
+    if((flags & DISK_MMAP) && (flags & DISK_DIRECT)){
+        debug("DISK_MMAP and DISK_DIRECT cannot be combined");
+        return (void*)0;
+    }
+    return disk_open_ops(flags & DISK_MMAP ? &disk_mmap_ops : &disk_file_ops, path, blocks, flags);
+}
+
+/**
+ * Opens a disk of the specified number of blocks on the given backend.
+ *
+ * @param       ops         Backend operations.
+ * @param       path        Path handed to the backend (may be NULL for backends without one).
+ * @param       blocks      Number of blocks of the disk.
+ * @param       flags       Bitwise or of DISK_* open flags.
+ *
+ * @return      Pointer to newly allocated and configured Disk structure (NULL on failure).
+ **/
+Disk* disk_open_ops(const DiskOps *ops, const char *path, size_t blocks, int flags) {
     // todo: check if theres a proper way to check this
     if(blocks == LONG_MAX){
         debug("Error in block size of %zu", blocks);
         return (void*)0;
     }
-    // open file with create if non existant, read write permission
-    if ((fd = open(path, O_CREAT|O_RDWR, 0777)) < 0) {
-        debug("Error in opening file with path: %s due to: %s", path, strerror(errno));
+    if(ops == NULL || ops->open == NULL || ops->read == NULL || ops->write == NULL || ops->flush == NULL || ops->close == NULL) {
+        debug("incomplete disk backend");
         return (void*)0;
-    };
-    Disk* disk = malloc(sizeof(Disk));
+    }
+    Disk* disk = calloc(1, sizeof(Disk));
+    if(disk == NULL) return (void*)0;
+    disk->ops = ops;
+    disk->backend = NULL;
     disk->blocks = blocks;
     disk->reads = 0;
     disk->writes = 0;
     // only set to true when FS is mounted
     disk->mounted = false;
-    disk->fd = fd;
+    disk->flags = flags;
+    disk->queue = NULL;
+    disk->tag = DISK_TAG_OTHER;
+    if(!ops->open(disk, path)) {
+        free(disk);
+        return (void*)0;
+    }
     return disk;
 }
 
+/**
+ * Opens a disk of the specified number of blocks held in anonymous memory, for scratch
+ * file systems. Blocks read as zeroes until written and everything is lost on disk_close.
+ *
+ * @param       blocks      Number of blocks of the disk.
+ * @return      Pointer to newly allocated and configured Disk structure (NULL on failure).
+ **/
+Disk* disk_open_ram(size_t blocks) {
+    return disk_open_ops(&disk_ram_ops, NULL, blocks, 0);
+}
+
 /**
  * Close disk structure by doing the following:
  *
- * Close disk file descriptor.
- * Report number of disk reads and writes.
+ * Wait for outstanding asynchronous requests.
+ * Let the backend flush and release what it holds (the image file, its mapping or memory).
  * Releasing disk structure memory.
  *
  * @param       disk        Pointer to Disk structure.
  */
 
 void disk_close(Disk *disk) {
-    // todo: possible to write a function or macro to make the intialization cleaner
-    if(close(disk->fd) < 0) debug("error in closing: %s", strerror(errno)); ;
+    disk_queue_destroy(disk->queue);
+    disk->ops->close(disk);
     free(disk);
 }
 
+/**
+ * Flush written blocks to stable storage (fsync for image files, msync for mapped images).
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @return      whether or not the flush succeeded
+ */
+bool disk_flush(Disk *disk) {
+    if(disk == NULL) return false;
+    return disk->ops->flush(disk);
+}
+
+/**
+ * Return a pointer to the specified block inside the memory of a backend that keeps its
+ * blocks in memory (DISK_MMAP and RAM disks), so small lookups (an inode, a size) cost a
+ * pointer calculation instead of a copy. Counts as a read of the block.
+ *
+ * @param disk
+ * @param block
+ *
+ * @return pointer to the block (NULL if the disk is not mapped or the block is invalid)
+**/
+const char* disk_map_block(Disk *disk, size_t block) {
+    if(disk == NULL || disk->ops->map_block == NULL || block >= disk->blocks) return NULL;
+    __atomic_fetch_add(&disk->reads, 1, __ATOMIC_RELAXED);
+    return disk->ops->map_block(disk, block);
+}
+
+/**
+ * Whether the backend keeps its blocks in memory, in which case disk_map_block succeeds.
+ **/
+bool disk_mapped(const Disk *disk) {
+    return disk != NULL && disk->ops->map_block != NULL;
+}
+
+/**
+ * File descriptor the blocks live in, at offset block * BLOCK_SIZE.
+ *
+ * @return descriptor (-1 if the backend has none)
+**/
+int disk_fd(Disk *disk) {
+    if(disk == NULL || disk->ops->fd == NULL) return -1;
+    return disk->ops->fd(disk);
+}
+
 /**
  * Read data from disk from specified block to data buffer by doing a sanity check, 
- * seeking the specified block and writing into the data buffer( must be block_size) from the disk block
+ * and reading the disk block into the data buffer( must be block_size) through the backend
  * 
  * @param disk 
  * @param block
@@ -80,22 +251,19 @@ ssize_t disk_read(Disk* disk, size_t block, char* data){
     if(!disk_sanity_check(disk, block, data)){
         return DISK_FAILURE;
     }
-    int curr_offset;
-    if((curr_offset = lseek(disk->fd, block * BLOCK_SIZE, SEEK_SET)) < 0) {
-        debug("SEEK FAILED");
-        return DISK_FAILURE;
-    }
-    if(read(disk->fd, data, BLOCK_SIZE) < 0 ){
-        debug("error in reading: %s at block %zu at offset %d with val %d", strerror(errno), block * BLOCK_SIZE , curr_offset, errno); 
+    uint64_t started = disk_now();
+    if(disk->ops->read(disk, block, &data, 1) < 0){
+        debug("error in reading: %s at block %zu", strerror(errno), block);
         return DISK_FAILURE;
     }
-    disk->reads += 1;
+    disk_account(disk, block, 1, false, disk->tag, started);
+    __atomic_fetch_add(&disk->reads, 1, __ATOMIC_RELAXED);
     return BLOCK_SIZE;
 }
 
 /**
  * Write data to disk at specified block from data buffer by doing a sanity check, 
- * seeking the specified block and writing data buffer( must be block_size) to disk block
+ * and writing data buffer( must be block_size) to the disk block through the backend
  * 
  * @param disk 
  * @param block
@@ -107,16 +275,363 @@ ssize_t disk_write(Disk *disk, size_t block, char *data) {
     if(!disk_sanity_check(disk, block, data)){
         return DISK_FAILURE;
     }
-    if(lseek(disk->fd, block * BLOCK_SIZE, SEEK_SET) < 0) {
-        debug("SEEK FAILED");
+    uint64_t started = disk_now();
+    if(disk->ops->write(disk, block, &data, 1) < 0){
+        debug("error in writing: %s", strerror(errno));
+        return DISK_FAILURE;
+    }
+    disk_account(disk, block, 1, true, disk->tag, started);
+    __atomic_fetch_add(&disk->writes, 1, __ATOMIC_RELAXED);
+    return BLOCK_SIZE;
+}
+
+/**
+ * Read count contiguous blocks starting at the specified block, data[i] receives block + i.
+ * The run is moved with preadv in batches of at most IOV_MAX blocks.
+ *
+ * @param disk
+ * @param block     first block of the run
+ * @param data      array of count block sized buffers
+ * @param count     number of blocks in the run
+ *
+ * @return number of bytes read (DISK_FAILURE on error)
+**/
+ssize_t disk_readv(Disk *disk, size_t block, char **data, size_t count) {
+    return disk_run(disk, block, data, count, false);
+}
+
+/**
+ * Write count contiguous blocks starting at the specified block, data[i] is written to block + i.
+ * The run is moved with pwritev in batches of at most IOV_MAX blocks.
+ *
+ * @param disk
+ * @param block     first block of the run
+ * @param data      array of count block sized buffers
+ * @param count     number of blocks in the run
+ *
+ * @return number of bytes written (DISK_FAILURE on error)
+**/
+ssize_t disk_writev(Disk *disk, size_t block, char **data, size_t count) {
+    return disk_run(disk, block, data, count, true);
+}
+
+/**
+ * Read an arbitrary list of blocks, data[i] receives blocks[i]. Consecutive entries that
+ * are also consecutive on disk are merged into a single preadv.
+ *
+ * @param disk
+ * @param blocks    array of count block numbers
+ * @param data      array of count block sized buffers
+ * @param count     number of blocks in the list
+ *
+ * @return number of bytes read (DISK_FAILURE on error)
+**/
+ssize_t disk_read_list(Disk *disk, const size_t *blocks, char **data, size_t count) {
+    return disk_list(disk, blocks, data, count, false);
+}
+
+/**
+ * Write an arbitrary list of blocks, data[i] is written to blocks[i]. Consecutive entries that
+ * are also consecutive on disk are merged into a single pwritev.
+ *
+ * @param disk
+ * @param blocks    array of count block numbers
+ * @param data      array of count block sized buffers
+ * @param count     number of blocks in the list
+ *
+ * @return number of bytes written (DISK_FAILURE on error)
+**/
+ssize_t disk_write_list(Disk *disk, const size_t *blocks, char **data, size_t count) {
+    return disk_list(disk, blocks, data, count, true);
+}
+
+/**
+ * Move a run of blocks through the backend in one operation, updating the read/write counters by the
+ * number of blocks moved.
+**/
+ssize_t disk_run(Disk *disk, size_t block, char **data, size_t count, bool write) {
+    if(disk == NULL || data == NULL || block + count > disk->blocks || block + count < block) {
         return DISK_FAILURE;
     }
-    if(write(disk->fd, data, BLOCK_SIZE) < 0 ){
-        debug("error in writing: %s", strerror(errno)); 
+    for(size_t i = 0; i < count; i++) {
+        if(data[i] == NULL) return DISK_FAILURE;
+    }
+    if(count == 0) return 0;
+    uint64_t started = disk_now();
+    int status = write ? disk->ops->write(disk, block, data, count) : disk->ops->read(disk, block, data, count);
+    if(status < 0) {
+        debug("error in %s %zu blocks at block %zu: %s", write ? "writing" : "reading", count, block, strerror(errno));
         return DISK_FAILURE;
     }
-    disk->writes += 1;
-    return BLOCK_SIZE;
+    disk_account(disk, block, count, write, disk->tag, started);
+    __atomic_fetch_add(write ? &disk->writes : &disk->reads, count, __ATOMIC_RELAXED);
+    return count * BLOCK_SIZE;
+}
+
+/**
+ * Move a list of blocks, issuing one disk_run per maximal run of consecutive block numbers.
+**/
+ssize_t disk_list(Disk *disk, const size_t *blocks, char **data, size_t count, bool write) {
+    if(disk == NULL || blocks == NULL || data == NULL) return DISK_FAILURE;
+    size_t start = 0;
+    while(start < count) {
+        size_t end = start + 1;
+        while(end < count && blocks[end] == blocks[end - 1] + 1) end++;
+        if(disk_run(disk, blocks[start], data + start, end - start, write) == DISK_FAILURE) return DISK_FAILURE;
+        start = end;
+    }
+    return count * BLOCK_SIZE;
+}
+
+/* File backend */
+
+/**
+ * Open the image file at path, with O_DIRECT (F_NOCACHE on macOS) for DISK_DIRECT disks.
+ **/
+bool disk_file_open(Disk *disk, const char *path) {
+    if(path == NULL) return false;
+    // open file with create if non existant, read write permission
+    int open_flags = O_CREAT|O_RDWR;
+#ifdef O_DIRECT
+    if(disk->flags & DISK_DIRECT) open_flags |= O_DIRECT;
+#endif
+    int fd = open(path, open_flags, 0777);
+    if (fd < 0) {
+        debug("Error in opening file with path: %s due to: %s", path, strerror(errno));
+        return false;
+    };
+#if !defined(O_DIRECT) && defined(F_NOCACHE)
+    // macOS has no O_DIRECT, F_NOCACHE turns the page cache off for the descriptor instead
+    if((disk->flags & DISK_DIRECT) && fcntl(fd, F_NOCACHE, 1) < 0) debug("unable to disable caching: %s", strerror(errno));
+#endif
+    DiskFile *file = malloc(sizeof(DiskFile));
+    if(file == NULL) {
+        close(fd);
+        return false;
+    }
+    file->fd = fd;
+    file->map = NULL;
+    disk->backend = file;
+    return true;
+}
+
+int disk_file_read(Disk *disk, size_t block, char **data, size_t count) {
+    return disk_file_move(disk, block, data, count, false);
+}
+
+int disk_file_write(Disk *disk, size_t block, char **data, size_t count) {
+    return disk_file_move(disk, block, data, count, true);
+}
+
+/**
+ * Move a run of blocks with preadv/pwritev in batches of at most IOV_MAX blocks.
+ * pread/pwrite do not touch the shared file offset, so one syscall per run instead of lseek + read.
+ *
+ * @return 0 on success, -1 on error (errno is set)
+**/
+int disk_file_move(Disk *disk, size_t block, char **data, size_t count, bool write) {
+    DiskFile *file = disk->backend;
+    struct iovec iov[DISK_IOV_MAX];
+    size_t done = 0;
+    while(done < count) {
+        size_t batch = count - done < DISK_IOV_MAX ? count - done : DISK_IOV_MAX;
+        bool aligned = true;
+        for(size_t i = 0; i < batch; i++) {
+            iov[i].iov_base = data[done + i];
+            iov[i].iov_len = BLOCK_SIZE;
+            aligned = aligned && disk_buffer_aligned(data[done + i]);
+        }
+        off_t offset = (block + done) * BLOCK_SIZE;
+        int status = (disk->flags & DISK_DIRECT) && !aligned
+            ? disk_bounce(file->fd, data + done, batch, offset, write)
+            : disk_transfer(file->fd, iov, batch, offset, write);
+        if(status < 0) return -1;
+        done += batch;
+    }
+    return 0;
+}
+
+bool disk_file_flush(Disk *disk) {
+    DiskFile *file = disk->backend;
+    if(fsync(file->fd) < 0) {
+        debug("error in flushing: %s", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void disk_file_close(Disk *disk) {
+    DiskFile *file = disk->backend;
+    if(close(file->fd) < 0) debug("error in closing: %s", strerror(errno));
+    free(file);
+}
+
+int disk_file_fd(Disk *disk) {
+    return ((DiskFile*)disk->backend)->fd;
+}
+
+/* Memory mapped backend */
+
+/**
+ * Open the image file and map all of it into memory, growing the file first so every block is backed.
+ **/
+bool disk_mmap_open(Disk *disk, const char *path) {
+    if(!disk_file_open(disk, path)) return false;
+    DiskFile *file = disk->backend;
+    struct stat st;
+    size_t length = disk->blocks * BLOCK_SIZE;
+    void *map = MAP_FAILED;
+    if(length == 0 || fstat(file->fd, &st) < 0) {
+        debug("unable to size image for mapping: %s", strerror(errno));
+    // mapping pages past the end of the file would fault, so extend it (never shrink it)
+    } else if((size_t)st.st_size < length && ftruncate(file->fd, length) < 0) {
+        debug("unable to extend image to %zu bytes: %s", length, strerror(errno));
+    } else if((map = mmap(NULL, length, PROT_READ|PROT_WRITE, MAP_SHARED, file->fd, 0)) == MAP_FAILED) {
+        debug("unable to map image: %s", strerror(errno));
+    }
+    if(map == MAP_FAILED) {
+        disk_file_close(disk);
+        return false;
+    }
+    file->map = map;
+    return true;
+}
+
+int disk_mmap_read(Disk *disk, size_t block, char **data, size_t count) {
+    for(size_t i = 0; i < count; i++) memcpy(data[i], disk_mmap_block(disk, block + i), BLOCK_SIZE);
+    return 0;
+}
+
+int disk_mmap_write(Disk *disk, size_t block, char **data, size_t count) {
+    for(size_t i = 0; i < count; i++) memcpy(disk_mmap_block(disk, block + i), data[i], BLOCK_SIZE);
+    return 0;
+}
+
+bool disk_mmap_flush(Disk *disk) {
+    DiskFile *file = disk->backend;
+    if(msync(file->map, disk->blocks * BLOCK_SIZE, MS_SYNC) < 0) {
+        debug("error in flushing: %s", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void disk_mmap_close(Disk *disk) {
+    DiskFile *file = disk->backend;
+    disk_mmap_flush(disk);
+    if(munmap(file->map, disk->blocks * BLOCK_SIZE) < 0) debug("error in unmapping: %s", strerror(errno));
+    disk_file_close(disk);
+}
+
+char* disk_mmap_block(Disk *disk, size_t block) {
+    return ((DiskFile*)disk->backend)->map + block * BLOCK_SIZE;
+}
+
+/**
+ * Move a run of count blocks through one aligned buffer, copying the caller's
+ * buffers in before a write or out after a read.
+ *
+ * @return 0 on success, -1 on error (errno is set)
+**/
+int disk_bounce(int fd, char **data, size_t count, off_t offset, bool write) {
+    char *bounce = disk_buffer_alloc(count);
+    if(bounce == NULL) return -1;
+    if(write) {
+        for(size_t i = 0; i < count; i++) memcpy(bounce + i * BLOCK_SIZE, data[i], BLOCK_SIZE);
+    }
+    struct iovec iov = { .iov_base = bounce, .iov_len = count * BLOCK_SIZE };
+    int status = disk_transfer(fd, &iov, 1, offset, write);
+    if(status == 0 && !write) {
+        for(size_t i = 0; i < count; i++) memcpy(data[i], bounce + i * BLOCK_SIZE, BLOCK_SIZE);
+    }
+    disk_buffer_free(bounce, count);
+    return status;
+}
+
+/**
+ * Allocate a BLOCK_SIZE aligned buffer of count blocks, reusing a pooled buffer of the
+ * same size when there is one. Block buffers handed to a DISK_DIRECT disk should come
+ * from here, anything else has to be bounced.
+ *
+ * @param       count       Number of blocks.
+ * @return      Pointer to the buffer (NULL on failure).
+ **/
+char* disk_buffer_alloc(size_t count) {
+    if(count == 0) return NULL;
+    pthread_mutex_lock(&pool_lock);
+    for(size_t i = 0; i < pool_size; i++) {
+        if(pool[i].count == count) {
+            char *buffer = pool[i].data;
+            pool[i] = pool[--pool_size];
+            pthread_mutex_unlock(&pool_lock);
+            return buffer;
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+    void *buffer;
+    if(posix_memalign(&buffer, BLOCK_SIZE, count * BLOCK_SIZE) != 0) return NULL;
+    return buffer;
+}
+
+/**
+ * Release a buffer from disk_buffer_alloc, keeping it in the pool while there is room.
+ *
+ * @param       buffer      Buffer to release (NULL is ignored).
+ * @param       count       Number of blocks it was allocated with.
+ **/
+void disk_buffer_free(char *buffer, size_t count) {
+    if(buffer == NULL) return;
+    pthread_mutex_lock(&pool_lock);
+    if(pool_size < DISK_BUFFER_POOL) {
+        pool[pool_size++] = (DiskBuffer){ .data = buffer, .count = count };
+        buffer = NULL;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    free(buffer);
+}
+
+/**
+ * Whether a buffer satisfies the alignment of DISK_DIRECT transfers.
+ **/
+bool disk_buffer_aligned(const char *buffer) {
+    return ((uintptr_t)buffer & (BLOCK_SIZE - 1)) == 0;
+}
+
+/**
+ * Perform a positional vectored transfer until every iovec has been moved.
+ * Short transfers are resumed from where they stopped, and reading past the
+ * end of the image file (a block that has never been written) yields zeroes.
+ *
+ * @return 0 on success, -1 on error (errno is set)
+**/
+int disk_transfer(int fd, struct iovec *iov, int iovcnt, off_t offset, bool write) {
+    while(iovcnt > 0) {
+        ssize_t moved = write ? pwritev(fd, iov, iovcnt, offset) : preadv(fd, iov, iovcnt, offset);
+        if(moved < 0) {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        if(moved == 0) {
+            if(write) {
+                errno = EIO;
+                return -1;
+            }
+            for(int i = 0; i < iovcnt; i++) memset(iov[i].iov_base, 0, iov[i].iov_len);
+            return 0;
+        }
+        offset += moved;
+        // skip the iovecs that are now complete and trim the partially moved one
+        while(iovcnt > 0 && (size_t)moved >= iov->iov_len) {
+            moved -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + moved;
+            iov->iov_len -= moved;
+        }
+    }
+    return 0;
 }
 
 /**
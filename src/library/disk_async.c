@@ -0,0 +1,546 @@
+// asynchronous block requests for the disk emulator
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+// <linux/fs.h>, pulled in by io_uring.h, has its own 1KB BLOCK_SIZE, ours must win
+#undef BLOCK_SIZE
+#endif
+
+#include "../include/disk.h"
+#include "../include/log.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+// A queue moves requests in one of three ways, picked when it is created
+#define DISK_QUEUE_INLINE   (0)   // backends holding their blocks in memory, requests complete during submit
+#define DISK_QUEUE_URING    (1)   // io_uring, one io_uring_enter per submit
+#define DISK_QUEUE_THREADS  (2)   // pool of workers doing pread/pwrite, for kernels without io_uring
+
+#define DISK_WORKERS        (4)   // number of threads in the fallback pool
+
+#ifdef __linux__
+// io_uring submission and completion rings, mapped from the kernel
+typedef struct DiskRing DiskRing;
+struct DiskRing {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+};
+#endif
+
+struct DiskQueue {
+    Disk *disk;
+    int kind;
+    int fd;             // descriptor of the backend, used by io_uring
+    size_t depth;       // maximum number of requests in flight
+    size_t inflight;    // requests submitted but not reaped yet
+
+    // finished requests waiting to be reaped (inline and thread pool)
+    DiskRequest **done;
+    size_t done_head, done_count;
+
+    // thread pool, pending requests are taken by the workers in FIFO order
+    pthread_t workers[DISK_WORKERS];
+    size_t nworkers;
+    pthread_mutex_t lock;
+    pthread_cond_t work, finished;
+    DiskRequest **pending;
+    size_t pending_head, pending_count;
+    bool stopping;
+
+#ifdef __linux__
+    // io_uring, each in flight request owns a slot holding its iovec
+    DiskRing ring;
+    DiskRequest **slots;
+    struct iovec *iovs;
+    size_t *free_slots;
+    size_t nfree;
+#endif
+};
+
+// Defined in disk.c
+bool    disk_sanity_check(Disk *disk, size_t blocknum, const char *data);
+// Defined in disk_stats.c
+uint64_t disk_now();
+void    disk_account(Disk *disk, size_t block, size_t count, bool write, int tag, uint64_t started);
+
+DiskQueue* disk_queue_create(Disk *disk, size_t depth);
+void    disk_complete(DiskQueue *queue, DiskRequest *request, ssize_t moved);
+ssize_t disk_move(Disk *disk, DiskRequest *request);
+void    disk_finished(DiskQueue *queue, DiskRequest *request);
+void*   disk_worker(void *arg);
+bool    disk_threads_start(DiskQueue *queue);
+#ifdef __linux__
+bool    disk_ring_setup(DiskQueue *queue);
+void    disk_ring_teardown(DiskQueue *queue);
+ssize_t disk_ring_submit(DiskQueue *queue, DiskRequest **requests, size_t count);
+size_t  disk_ring_reap(DiskQueue *queue, size_t min_complete);
+void    disk_ring_rollback(DiskQueue *queue);
+#endif
+
+/**
+ * Submit block requests without waiting for them. Each request moves one block between
+ * request->data and request->block. The first call creates the disk's queue, backed by
+ * io_uring when the kernel supports it and by a small thread pool otherwise.
+ *
+ * At most DISK_QUEUE_DEPTH requests can be in flight, requests past that are not submitted.
+ * Submitted requests must stay valid until disk_reap has returned them.
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       requests    Array of requests to submit.
+ * @param       count       Number of requests.
+ * @return      Number of requests submitted (DISK_FAILURE on error).
+ **/
+ssize_t disk_submit(Disk *disk, DiskRequest *requests, size_t count) {
+    if(disk == NULL || requests == NULL) return DISK_FAILURE;
+    if(disk->queue == NULL && (disk->queue = disk_queue_create(disk, DISK_QUEUE_DEPTH)) == NULL) return DISK_FAILURE;
+    DiskQueue *queue = disk->queue;
+
+    size_t room = queue->depth - queue->inflight;
+    count = count < room ? count : room;
+    uint64_t started = disk_now();
+    for(size_t i = 0; i < count; i++) {
+        if(!disk_sanity_check(disk, requests[i].block, requests[i].data)) return DISK_FAILURE;
+        requests[i].result = 0;
+        requests[i].tag = disk->tag;
+        requests[i].started = started;
+    }
+    if(count == 0) return 0;
+
+    switch(queue->kind) {
+#ifdef __linux__
+        case DISK_QUEUE_URING: {
+            // a direct disk needs aligned buffers in the ring, the others are bounced right away
+            DiskRequest *ring[DISK_QUEUE_DEPTH];
+            size_t nring = 0;
+            for(size_t i = 0; i < count; i++) {
+                if((disk->flags & DISK_DIRECT) && !disk_buffer_aligned(requests[i].data)) {
+                    requests[i].result = disk_move(disk, &requests[i]);
+                    disk_finished(queue, &requests[i]);
+                } else {
+                    ring[nring++] = &requests[i];
+                }
+            }
+            if(nring > 0 && disk_ring_submit(queue, ring, nring) < 0) return DISK_FAILURE;
+            return count;
+        }
+#endif
+        case DISK_QUEUE_THREADS:
+            pthread_mutex_lock(&queue->lock);
+            for(size_t i = 0; i < count; i++) {
+                queue->pending[(queue->pending_head + queue->pending_count) % queue->depth] = &requests[i];
+                queue->pending_count += 1;
+            }
+            queue->inflight += count;
+            pthread_cond_broadcast(&queue->work);
+            pthread_mutex_unlock(&queue->lock);
+            return count;
+        default:
+            for(size_t i = 0; i < count; i++) {
+                requests[i].result = disk_move(disk, &requests[i]);
+                disk_finished(queue, &requests[i]);
+            }
+            return count;
+    }
+}
+
+/**
+ * Wait until at least min_complete submitted requests have finished and collect every
+ * finished request, setting its result to BLOCK_SIZE (or DISK_FAILURE) and updating
+ * the disk read and write counters.
+ *
+ * @param       disk            Pointer to Disk structure.
+ * @param       min_complete    Number of completions to wait for (capped at the number in flight).
+ * @return      Number of requests reaped (DISK_FAILURE on error).
+ **/
+ssize_t disk_reap(Disk *disk, size_t min_complete) {
+    if(disk == NULL) return DISK_FAILURE;
+    DiskQueue *queue = disk->queue;
+    if(queue == NULL || queue->inflight == 0) return 0;
+    if(min_complete > queue->inflight) min_complete = queue->inflight;
+
+    size_t reaped = 0;
+    if(queue->kind == DISK_QUEUE_THREADS) pthread_mutex_lock(&queue->lock);
+    while(queue->kind == DISK_QUEUE_THREADS && queue->done_count < min_complete) {
+        pthread_cond_wait(&queue->finished, &queue->lock);
+    }
+    do {
+        while(queue->done_count > 0) {
+            DiskRequest *request = queue->done[queue->done_head];
+            queue->done_head = (queue->done_head + 1) % queue->depth;
+            queue->done_count -= 1;
+            disk_complete(queue, request, request->result);
+            reaped += 1;
+        }
+#ifdef __linux__
+        if(queue->kind == DISK_QUEUE_URING) {
+            reaped += disk_ring_reap(queue, reaped < min_complete ? min_complete - reaped : 0);
+        }
+#endif
+        // requests taken back from a ring the kernel refused finish in the done list
+    } while(queue->done_count > 0);
+    queue->inflight -= reaped;
+    if(queue->kind == DISK_QUEUE_THREADS) pthread_mutex_unlock(&queue->lock);
+    return reaped;
+}
+
+/**
+ * Move a batch of block requests, keeping up to DISK_QUEUE_DEPTH of them in flight,
+ * and wait for all of them to finish. On failure nothing of the batch is left in flight.
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       requests    Array of requests.
+ * @param       count       Number of requests.
+ * @return      Number of bytes moved (DISK_FAILURE if any request failed).
+ **/
+ssize_t disk_batch(Disk *disk, DiskRequest *requests, size_t count) {
+    size_t submitted = 0;
+    while(submitted < count) {
+        ssize_t queued = disk_submit(disk, requests + submitted, count - submitted);
+        if(queued < 0) {
+            disk_reap(disk, SIZE_MAX);
+            return DISK_FAILURE;
+        }
+        submitted += queued;
+        // make room for the rest of the batch, or wait for the tail of it
+        ssize_t reaped = disk_reap(disk, submitted < count ? 1 : SIZE_MAX);
+        if(reaped < 0) return DISK_FAILURE;
+        if(queued == 0 && reaped == 0) {
+            // the queue is full and nothing finishes, give up instead of spinning
+            disk_reap(disk, SIZE_MAX);
+            return DISK_FAILURE;
+        }
+    }
+    for(size_t i = 0; i < count; i++) {
+        if(requests[i].result != BLOCK_SIZE) return DISK_FAILURE;
+    }
+    return count * BLOCK_SIZE;
+}
+
+/**
+ * Wait for everything in flight and release the queue, called from disk_close.
+ **/
+void disk_queue_destroy(DiskQueue *queue) {
+    if(queue == NULL) return;
+    if(queue->disk->queue == queue) disk_reap(queue->disk, SIZE_MAX);
+    if(queue->kind == DISK_QUEUE_THREADS) {
+        pthread_mutex_lock(&queue->lock);
+        queue->stopping = true;
+        pthread_cond_broadcast(&queue->work);
+        pthread_mutex_unlock(&queue->lock);
+    }
+    for(size_t i = 0; i < queue->nworkers; i++) pthread_join(queue->workers[i], NULL);
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->work);
+    pthread_cond_destroy(&queue->finished);
+#ifdef __linux__
+    if(queue->kind == DISK_QUEUE_URING) disk_ring_teardown(queue);
+#endif
+    free(queue->done);
+    free(queue->pending);
+    free(queue);
+}
+
+/**
+ * Create the queue for a disk, choosing inline completion for backends that hold their blocks
+ * in memory, then io_uring for backends with a file descriptor, then the thread pool.
+ **/
+DiskQueue* disk_queue_create(Disk *disk, size_t depth) {
+    DiskQueue *queue = calloc(1, sizeof(DiskQueue));
+    if(queue == NULL) return NULL;
+    queue->disk = disk;
+    queue->depth = depth;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->work, NULL);
+    pthread_cond_init(&queue->finished, NULL);
+    queue->done = calloc(depth, sizeof(DiskRequest*));
+    if(queue->done == NULL) {
+        disk_queue_destroy(queue);
+        return NULL;
+    }
+    if(disk_mapped(disk)) {
+        queue->kind = DISK_QUEUE_INLINE;
+        return queue;
+    }
+    queue->fd = disk_fd(disk);
+#ifdef __linux__
+    if(!(disk->flags & DISK_THREADPOOL) && queue->fd >= 0 && disk_ring_setup(queue)) {
+        queue->kind = DISK_QUEUE_URING;
+        return queue;
+    }
+#endif
+    queue->kind = DISK_QUEUE_THREADS;
+    if(!disk_threads_start(queue)) {
+        disk_queue_destroy(queue);
+        return NULL;
+    }
+    return queue;
+}
+
+/**
+ * Record the outcome of a request. A short transfer (end of the image file, or an
+ * interrupted transfer) is finished synchronously so callers always see whole blocks.
+ **/
+void disk_complete(DiskQueue *queue, DiskRequest *request, ssize_t moved) {
+    Disk *disk = queue->disk;
+    if(moved >= 0 && moved < BLOCK_SIZE) {
+        // retry the whole block, offsets inside a block are not allowed on a direct disk
+        moved = disk_move(disk, request);
+    }
+    if(moved != BLOCK_SIZE) {
+        debug("error in %s block %zu", request->write ? "writing" : "reading", request->block);
+        request->result = DISK_FAILURE;
+        return;
+    }
+    request->result = BLOCK_SIZE;
+    disk_account(disk, request->block, 1, request->write, request->tag, request->started);
+    __atomic_fetch_add(request->write ? &disk->writes : &disk->reads, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Move a single request synchronously through the backend (which bounces unaligned
+ * buffers on direct disks). Counters are left to disk_complete.
+ *
+ * @return BLOCK_SIZE on success (DISK_FAILURE on error)
+ **/
+ssize_t disk_move(Disk *disk, DiskRequest *request) {
+    char *data = request->data;
+    int status = request->write
+        ? disk->ops->write(disk, request->block, &data, 1)
+        : disk->ops->read(disk, request->block, &data, 1);
+    return status < 0 ? DISK_FAILURE : BLOCK_SIZE;
+}
+
+/**
+ * Queue a request that finished without going through io_uring or a worker, to be
+ * collected by the next disk_reap.
+ **/
+void disk_finished(DiskQueue *queue, DiskRequest *request) {
+    queue->done[(queue->done_head + queue->done_count) % queue->depth] = request;
+    queue->done_count += 1;
+    queue->inflight += 1;
+}
+
+/* Thread pool fallback */
+
+bool disk_threads_start(DiskQueue *queue) {
+    queue->pending = calloc(queue->depth, sizeof(DiskRequest*));
+    if(queue->pending == NULL) return false;
+    for(size_t i = 0; i < DISK_WORKERS; i++) {
+        if(pthread_create(&queue->workers[i], NULL, disk_worker, queue) != 0) {
+            debug("unable to start disk worker: %s", strerror(errno));
+            return queue->nworkers > 0;
+        }
+        queue->nworkers += 1;
+    }
+    return true;
+}
+
+/**
+ * Worker loop, takes pending requests and moves them through the backend. Only the raw
+ * transfer happens here, counters are updated by the reaping thread.
+ **/
+void* disk_worker(void *arg) {
+    DiskQueue *queue = arg;
+    pthread_mutex_lock(&queue->lock);
+    while(true) {
+        while(queue->pending_count == 0 && !queue->stopping) pthread_cond_wait(&queue->work, &queue->lock);
+        if(queue->pending_count == 0) break;
+        DiskRequest *request = queue->pending[queue->pending_head];
+        queue->pending_head = (queue->pending_head + 1) % queue->depth;
+        queue->pending_count -= 1;
+        pthread_mutex_unlock(&queue->lock);
+
+        ssize_t moved = disk_move(queue->disk, request);
+
+        pthread_mutex_lock(&queue->lock);
+        request->result = moved;
+        queue->done[(queue->done_head + queue->done_count) % queue->depth] = request;
+        queue->done_count += 1;
+        pthread_cond_signal(&queue->finished);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+}
+
+#ifdef __linux__
+/* io_uring backend, driven through the raw syscalls so no liburing is needed */
+
+bool disk_ring_setup(DiskQueue *queue) {
+    DiskRing *ring = &queue->ring;
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, queue->depth, &params);
+    if(ring->fd < 0) {
+        debug("io_uring unavailable, falling back to threads: %s", strerror(errno));
+        return false;
+    }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        if(ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = MAP_FAILED;
+    ring->sqes = MAP_FAILED;
+    if(ring->sq_ring != MAP_FAILED) {
+        ring->cq_ring = (params.features & IORING_FEAT_SINGLE_MMAP) ? ring->sq_ring
+            : mmap(NULL, ring->cq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    if(ring->cq_ring != MAP_FAILED) {
+        ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    }
+    queue->slots = calloc(queue->depth, sizeof(DiskRequest*));
+    queue->iovs = calloc(queue->depth, sizeof(struct iovec));
+    queue->free_slots = calloc(queue->depth, sizeof(size_t));
+    if(ring->sqes == MAP_FAILED || !queue->slots || !queue->iovs || !queue->free_slots) {
+        debug("unable to map io_uring rings: %s", strerror(errno));
+        disk_ring_teardown(queue);
+        return false;
+    }
+
+    char *sq = ring->sq_ring, *cq = ring->cq_ring;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // the kernel may round the ring up, never keep more in flight than we have slots for
+    for(size_t i = 0; i < queue->depth; i++) queue->free_slots[i] = queue->depth - 1 - i;
+    queue->nfree = queue->depth;
+    return true;
+}
+
+void disk_ring_teardown(DiskQueue *queue) {
+    DiskRing *ring = &queue->ring;
+    if(ring->sqes != MAP_FAILED && ring->sqes) munmap(ring->sqes, ring->sqes_size);
+    if(ring->cq_ring != MAP_FAILED && ring->cq_ring && ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    if(ring->sq_ring != MAP_FAILED && ring->sq_ring) munmap(ring->sq_ring, ring->sq_ring_size);
+    if(ring->fd >= 0) close(ring->fd);
+    free(queue->slots);
+    free(queue->iovs);
+    free(queue->free_slots);
+}
+
+/**
+ * Fill one submission entry per request and hand the whole batch to the kernel with a
+ * single io_uring_enter.
+ **/
+ssize_t disk_ring_submit(DiskQueue *queue, DiskRequest **requests, size_t count) {
+    DiskRing *ring = &queue->ring;
+    unsigned tail = *ring->sq_tail;
+    unsigned mask = *ring->sq_mask;
+    for(size_t i = 0; i < count; i++) {
+        size_t slot = queue->free_slots[--queue->nfree];
+        queue->slots[slot] = requests[i];
+        queue->iovs[slot].iov_base = requests[i]->data;
+        queue->iovs[slot].iov_len = BLOCK_SIZE;
+
+        unsigned index = tail & mask;
+        struct io_uring_sqe *sqe = &ring->sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = requests[i]->write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->fd = queue->fd;
+        sqe->off = requests[i]->block * BLOCK_SIZE;
+        sqe->addr = (unsigned long)&queue->iovs[slot];
+        sqe->len = 1;
+        sqe->user_data = slot;
+        ring->sq_array[index] = index;
+        tail++;
+    }
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+    queue->inflight += count;
+
+    size_t submitted = 0;
+    while(submitted < count) {
+        int ret = syscall(__NR_io_uring_enter, ring->fd, count - submitted, 0, 0, NULL, 0);
+        if(ret < 0) {
+            if(errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                // completion ring is full, drain it before retrying
+                if(errno != EINTR) syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+                continue;
+            }
+            debug("io_uring_enter failed: %s", strerror(errno));
+            disk_ring_rollback(queue);
+            break;
+        }
+        submitted += ret;
+    }
+    return count;
+}
+
+/**
+ * Collect completions from the ring, entering the kernel only when fewer than
+ * min_complete are already available. Requests taken back from the ring are left in
+ * the done list, so this returns early once nothing is left in the ring.
+ **/
+size_t disk_ring_reap(DiskQueue *queue, size_t min_complete) {
+    DiskRing *ring = &queue->ring;
+    size_t reaped = 0;
+    bool entering = true;
+    while(true) {
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        while(head != tail) {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            size_t slot = cqe->user_data;
+            DiskRequest *request = queue->slots[slot];
+            queue->free_slots[queue->nfree++] = slot;
+            disk_complete(queue, request, cqe->res < 0 ? DISK_FAILURE : cqe->res);
+            head++;
+            reaped++;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+        if(reaped >= min_complete || queue->nfree == queue->depth) break;
+        if(!entering) {
+            // the kernel still completes what it took, poll for it
+            struct timespec pause = {0, 100000};
+            nanosleep(&pause, NULL);
+            continue;
+        }
+        unsigned unsubmitted = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        int ret = syscall(__NR_io_uring_enter, ring->fd, unsubmitted, min_complete - reaped, IORING_ENTER_GETEVENTS, NULL, 0);
+        if(ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            debug("io_uring_enter failed: %s", strerror(errno));
+            disk_ring_rollback(queue);
+            entering = false;
+        }
+    }
+    return reaped;
+}
+
+/**
+ * Take back the entries the kernel has not consumed after io_uring_enter failed for good,
+ * nothing would push them any more. Their requests are moved synchronously and queued on
+ * the done list, staying counted in flight until disk_reap collects them.
+ **/
+void disk_ring_rollback(DiskQueue *queue) {
+    DiskRing *ring = &queue->ring;
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sq_tail;
+    unsigned mask = *ring->sq_mask;
+    __atomic_store_n(ring->sq_tail, head, __ATOMIC_RELEASE);
+    for(unsigned t = head; t != tail; t++) {
+        size_t slot = ring->sqes[ring->sq_array[t & mask]].user_data;
+        DiskRequest *request = queue->slots[slot];
+        queue->free_slots[queue->nfree++] = slot;
+        request->result = disk_move(queue->disk, request);
+        queue->inflight -= 1;
+        disk_finished(queue, request);
+    }
+}
+#endif
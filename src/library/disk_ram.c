@@ -0,0 +1,69 @@
+// in-memory RAM disk backend for the disk emulator
+#include "../include/disk.h"
+#include "../include/log.h"
+#include <sys/mman.h>
+
+bool    disk_ram_open(Disk *disk, const char *path);
+int     disk_ram_read(Disk *disk, size_t block, char **data, size_t count);
+int     disk_ram_write(Disk *disk, size_t block, char **data, size_t count);
+bool    disk_ram_flush(Disk *disk);
+void    disk_ram_close(Disk *disk);
+char*   disk_ram_block(Disk *disk, size_t block);
+
+const DiskOps disk_ram_ops = {
+    .name = "ram",
+    .open = disk_ram_open,
+    .read = disk_ram_read,
+    .write = disk_ram_write,
+    .flush = disk_ram_flush,
+    .close = disk_ram_close,
+    .map_block = disk_ram_block,
+};
+
+/**
+ * Reserve anonymous memory for every block of the disk. Pages are only backed
+ * once they are written, blocks that were never written read as zeroes.
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       path        Ignored, RAM disks have no image.
+ * @return      whether or not the memory could be reserved
+ **/
+bool disk_ram_open(Disk *disk, const char *path) {
+    size_t length = disk->blocks * BLOCK_SIZE;
+    if(length == 0 || length / BLOCK_SIZE != disk->blocks) {
+        debug("invalid RAM disk size of %zu blocks", disk->blocks);
+        return false;
+    }
+    void *memory = mmap(NULL, length, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(memory == MAP_FAILED) {
+        debug("unable to allocate RAM disk of %zu blocks: %s", disk->blocks, strerror(errno));
+        return false;
+    }
+    disk->backend = memory;
+    return true;
+}
+
+int disk_ram_read(Disk *disk, size_t block, char **data, size_t count) {
+    for(size_t i = 0; i < count; i++) memcpy(data[i], disk_ram_block(disk, block + i), BLOCK_SIZE);
+    return 0;
+}
+
+int disk_ram_write(Disk *disk, size_t block, char **data, size_t count) {
+    for(size_t i = 0; i < count; i++) memcpy(disk_ram_block(disk, block + i), data[i], BLOCK_SIZE);
+    return 0;
+}
+
+/**
+ * Nothing to flush, there is no stable storage behind a RAM disk.
+ **/
+bool disk_ram_flush(Disk *disk) {
+    return true;
+}
+
+void disk_ram_close(Disk *disk) {
+    if(munmap(disk->backend, disk->blocks * BLOCK_SIZE) < 0) debug("error in unmapping: %s", strerror(errno));
+}
+
+char* disk_ram_block(Disk *disk, size_t block) {
+    return (char*)disk->backend + block * BLOCK_SIZE;
+}
@@ -0,0 +1,136 @@
+// I/O statistics of the disk emulator
+#include "../include/disk.h"
+#include "../include/log.h"
+#include <time.h>
+
+uint64_t disk_now();
+void    disk_account(Disk *disk, size_t block, size_t count, bool write, int tag, uint64_t started);
+size_t  disk_latency_bucket(uint64_t ns);
+uint64_t disk_latency_bucket_floor(size_t bucket);
+
+static const char *tag_names[DISK_TAGS] = { "other", "scan", "inode", "data", "indirect", "bitmap" };
+
+/**
+ * Set the caller that following requests are accounted to.
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       tag         DISK_TAG_* of the caller (anything else counts as DISK_TAG_OTHER).
+ * @return      The previous tag, to be restored by the caller.
+ **/
+int disk_tag(Disk *disk, int tag) {
+    if(disk == NULL) return DISK_TAG_OTHER;
+    int previous = disk->tag;
+    disk->tag = tag >= 0 && tag < DISK_TAGS ? tag : DISK_TAG_OTHER;
+    return previous;
+}
+
+/**
+ * Copy the statistics collected since the disk was opened (or last reset).
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       stats       Filled with the statistics.
+ **/
+void disk_stats(Disk *disk, DiskStats *stats) {
+    if(disk == NULL || stats == NULL) return;
+    *stats = disk->stats;
+}
+
+void disk_stats_reset(Disk *disk) {
+    if(disk == NULL) return;
+    memset(&disk->stats, 0, sizeof(DiskStats));
+}
+
+/**
+ * Estimate a latency percentile from a histogram.
+ *
+ * @param       stats       Statistics of one direction.
+ * @param       percentile  Percentile between 0 and 100.
+ * @return      Upper bound in ns of the bucket holding the percentile (0 without operations).
+ **/
+uint64_t disk_latency_percentile(const DiskOpStats *stats, double percentile) {
+    size_t total = 0;
+    for(size_t i = 0; i < DISK_LATENCY_BUCKETS; i++) total += stats->histogram[i];
+    if(total == 0) return 0;
+    if(percentile < 0) percentile = 0;
+    if(percentile > 100) percentile = 100;
+    size_t rank = (size_t)(percentile / 100 * total + 0.5);
+    if(rank == 0) rank = 1;
+    size_t seen = 0;
+    for(size_t i = 0; i < DISK_LATENCY_BUCKETS; i++) {
+        seen += stats->histogram[i];
+        if(seen < rank) continue;
+        uint64_t limit = i + 1 < DISK_LATENCY_BUCKETS ? disk_latency_bucket_floor(i + 1) - 1 : UINT64_MAX;
+        return limit < stats->max_ns ? limit : stats->max_ns;
+    }
+    return stats->max_ns;
+}
+
+const char* disk_tag_name(int tag) {
+    return tag >= 0 && tag < DISK_TAGS ? tag_names[tag] : tag_names[DISK_TAG_OTHER];
+}
+
+/**
+ * Monotonic clock in ns, for timing operations.
+ **/
+uint64_t disk_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/**
+ * Record a completed operation of count blocks starting at block.
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       block       First block of the operation.
+ * @param       count       Number of blocks moved.
+ * @param       write       Whether the operation was a write.
+ * @param       tag         Caller the operation is accounted to.
+ * @param       started     disk_now() when the operation started.
+ *
+ * Operations complete on several threads at once (thread pool, parallel mount scan), so every
+ * counter is updated atomically, relaxed ordering is enough as they are only ever summed up.
+ **/
+void disk_account(Disk *disk, size_t block, size_t count, bool write, int tag, uint64_t started) {
+    uint64_t elapsed = disk_now() - started;
+    size_t bytes = count * BLOCK_SIZE;
+    DiskOpStats *op = write ? &disk->stats.write : &disk->stats.read;
+    __atomic_fetch_add(&op->ops, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&op->bytes, bytes, __ATOMIC_RELAXED);
+    size_t expected = __atomic_exchange_n(&disk->next_block, block + count, __ATOMIC_RELAXED);
+    __atomic_fetch_add(block == expected ? &op->sequential : &op->random, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&op->total_ns, elapsed, __ATOMIC_RELAXED);
+    uint64_t longest = __atomic_load_n(&op->max_ns, __ATOMIC_RELAXED);
+    while(elapsed > longest && !__atomic_compare_exchange_n(&op->max_ns, &longest, elapsed, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    __atomic_fetch_add(&op->histogram[disk_latency_bucket(elapsed)], 1, __ATOMIC_RELAXED);
+
+    DiskTagStats *caller = &disk->stats.tags[tag >= 0 && tag < DISK_TAGS ? tag : DISK_TAG_OTHER];
+    if(write) {
+        __atomic_fetch_add(&caller->writes, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&caller->write_bytes, bytes, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&caller->write_ns, elapsed, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_add(&caller->reads, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&caller->read_bytes, bytes, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&caller->read_ns, elapsed, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Histogram bucket of a latency: values below 4 map to themselves, above that the exponent
+ * picks a group of 4 buckets and the two bits below the leading one pick the bucket in it.
+ **/
+size_t disk_latency_bucket(uint64_t ns) {
+    if(ns < 4) return ns;
+    int exponent = 63 - __builtin_clzll(ns);
+    return 4 * (exponent - 1) + ((ns >> (exponent - 2)) & 3);
+}
+
+/**
+ * Smallest latency that falls in a bucket.
+ **/
+uint64_t disk_latency_bucket_floor(size_t bucket) {
+    if(bucket < 4) return bucket;
+    size_t exponent = bucket / 4 + 1;
+    return (uint64_t)(4 + bucket % 4) << (exponent - 2);
+}
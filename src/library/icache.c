@@ -0,0 +1,243 @@
+// write-back in-core inode cache for simple FS
+#include "../include/icache.h"
+#include "../include/log.h"
+
+#include <string.h>
+
+ssize_t icache_lookup(InodeCache *cache, size_t number);
+void    icache_insert(InodeCache *cache, size_t slot, size_t number);
+void    icache_remove(InodeCache *cache, size_t slot);
+ssize_t icache_victim(InodeCache *cache);
+bool    icache_writeback(InodeCache *cache, size_t first, size_t limit);
+int     icache_dirty_compare(const void *a, const void *b);
+
+// A dirty slot waiting to be stored
+typedef struct InodeDirty InodeDirty;
+struct InodeDirty {
+    size_t number;
+    size_t slot;
+};
+
+/**
+ * Create a cache of capacity inodes of record_size bytes each.
+ *
+ * @param       capacity    Number of inodes to cache (0 selects ICACHE_DEFAULT_INODES).
+ * @param       record_size Size of an inode.
+ * @param       load        Reads an inode that is not cached.
+ * @param       store       Writes dirty inodes back.
+ * @param       context     Passed to load and store.
+ * @return      Pointer to newly allocated InodeCache structure (NULL on failure).
+ **/
+InodeCache* icache_create(size_t capacity, size_t record_size, InodeLoad load, InodeStore store, void *context) {
+    if(record_size == 0 || load == NULL || store == NULL) return NULL;
+    if(capacity == 0) capacity = ICACHE_DEFAULT_INODES;
+    InodeCache *cache = calloc(1, sizeof(InodeCache));
+    if(cache == NULL) return NULL;
+    cache->capacity = capacity;
+    cache->record_size = record_size;
+    cache->load = load;
+    cache->store = store;
+    cache->context = context;
+    cache->nbuckets = capacity * 2;
+    cache->records = calloc(capacity, record_size);
+    cache->numbers = calloc(capacity, sizeof(size_t));
+    cache->flags = calloc(capacity, sizeof(uint8_t));
+    cache->refs = calloc(capacity, sizeof(size_t));
+    cache->next = malloc(capacity * sizeof(ssize_t));
+    cache->buckets = malloc(cache->nbuckets * sizeof(ssize_t));
+    if(!cache->records || !cache->numbers || !cache->flags || !cache->refs || !cache->next || !cache->buckets) {
+        error("unable to allocate an inode cache of %zu inodes", capacity);
+        icache_destroy(cache);
+        return NULL;
+    }
+    for(size_t i = 0; i < cache->nbuckets; i++) cache->buckets[i] = -1;
+    return cache;
+}
+
+/**
+ * Store dirty inodes and release the cache.
+ *
+ * @param       cache       Pointer to InodeCache structure (NULL is ignored).
+ **/
+void icache_destroy(InodeCache *cache) {
+    if(cache == NULL) return;
+    if(cache->flags && cache->dirty > 0) icache_flush(cache);
+    free(cache->records);
+    free(cache->numbers);
+    free(cache->flags);
+    free(cache->refs);
+    free(cache->next);
+    free(cache->buckets);
+    free(cache);
+}
+
+/**
+ * Take a reference to an inode. A hit costs a hash lookup, on a miss a slot is claimed
+ * and the inode is loaded into it, or zeroed when the caller is about to overwrite all of it.
+ * The inode stays in its slot until the reference is given back with icache_put.
+ *
+ * @param cache
+ * @param number    inode number
+ * @param load      whether the current contents are needed
+ *
+ * @return pointer to the cached inode (NULL if it could not be loaded or every slot is referenced)
+**/
+void* icache_get(InodeCache *cache, size_t number, bool load) {
+    if(cache == NULL) return NULL;
+    ssize_t slot = icache_lookup(cache, number);
+    if(slot >= 0) {
+        cache->hits += 1;
+    } else {
+        cache->misses += 1;
+        if((slot = icache_victim(cache)) < 0) return NULL;
+        char *record = cache->records + slot * cache->record_size;
+        if(load && !cache->load(cache->context, number, record)) return NULL;
+        if(!load) memset(record, 0, cache->record_size);
+        icache_insert(cache, slot, number);
+    }
+    cache->flags[slot] |= ICACHE_REFERENCED;
+    cache->refs[slot] += 1;
+    return cache->records + slot * cache->record_size;
+}
+
+/**
+ * Give back a reference taken with icache_get.
+ *
+ * @param cache
+ * @param record    pointer returned by icache_get
+ * @param dirty     whether the inode was changed and has to be stored
+**/
+void icache_put(InodeCache *cache, const void *record, bool dirty) {
+    if(cache == NULL || record == NULL) return;
+    size_t slot = ((const char*)record - cache->records) / cache->record_size;
+    if(slot >= cache->capacity || cache->refs[slot] == 0) {
+        error("inode cache reference was not taken");
+        return;
+    }
+    cache->refs[slot] -= 1;
+    if(dirty && !(cache->flags[slot] & ICACHE_DIRTY)) {
+        cache->flags[slot] |= ICACHE_DIRTY;
+        cache->dirty += 1;
+    }
+}
+
+/**
+ * Store every dirty inode in one sorted batch, so inodes sharing a table block are
+ * written together. The inodes stay cached.
+ *
+ * @param cache
+ *
+ * @return whether or not every dirty inode was stored
+**/
+bool icache_flush(InodeCache *cache) {
+    if(cache == NULL) return false;
+    if(cache->dirty > 0 && !icache_writeback(cache, 0, cache->dirty)) {
+        error("error storing dirty inodes");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Store up to limit dirty inodes, collected in clock order starting at slot first and
+ * handed to the store callback sorted by inode number.
+ *
+ * @param cache
+ * @param first     slot to start collecting at
+ * @param limit     number of dirty inodes to store (0 is taken as 1)
+ *
+ * @return whether or not the collected inodes were stored
+**/
+bool icache_writeback(InodeCache *cache, size_t first, size_t limit) {
+    if(limit == 0) limit = 1;
+    if(limit > cache->dirty) limit = cache->dirty;
+    InodeDirty *dirty = malloc(limit * sizeof(InodeDirty));
+    size_t *numbers = malloc(limit * sizeof(size_t));
+    const void **records = malloc(limit * sizeof(void*));
+    bool success = dirty != NULL && numbers != NULL && records != NULL;
+    size_t count = 0;
+    for(size_t i = 0; success && i < cache->capacity && count < limit; i++) {
+        size_t slot = (first + i) % cache->capacity;
+        if(cache->flags[slot] & ICACHE_DIRTY) dirty[count++] = (InodeDirty){ .number = cache->numbers[slot], .slot = slot };
+    }
+    if(success) {
+        qsort(dirty, count, sizeof(InodeDirty), icache_dirty_compare);
+        for(size_t i = 0; i < count; i++) {
+            numbers[i] = dirty[i].number;
+            records[i] = cache->records + dirty[i].slot * cache->record_size;
+        }
+        success = cache->store(cache->context, numbers, records, count);
+    }
+    for(size_t i = 0; success && i < count; i++) cache->flags[dirty[i].slot] &= ~ICACHE_DIRTY;
+    if(success) {
+        cache->writebacks += count;
+        cache->dirty -= count;
+    }
+    free(dirty);
+    free(numbers);
+    free(records);
+    return success;
+}
+
+int icache_dirty_compare(const void *a, const void *b) {
+    size_t x = ((const InodeDirty*)a)->number;
+    size_t y = ((const InodeDirty*)b)->number;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Find the slot holding inode number.
+ *
+ * @return slot number (-1 if the inode is not cached)
+**/
+ssize_t icache_lookup(InodeCache *cache, size_t number) {
+    for(ssize_t slot = cache->buckets[number % cache->nbuckets]; slot >= 0; slot = cache->next[slot]) {
+        if(cache->numbers[slot] == number) return slot;
+    }
+    return -1;
+}
+
+void icache_insert(InodeCache *cache, size_t slot, size_t number) {
+    size_t bucket = number % cache->nbuckets;
+    cache->numbers[slot] = number;
+    cache->flags[slot] = ICACHE_VALID;
+    cache->refs[slot] = 0;
+    cache->next[slot] = cache->buckets[bucket];
+    cache->buckets[bucket] = slot;
+}
+
+void icache_remove(InodeCache *cache, size_t slot) {
+    ssize_t *link = &cache->buckets[cache->numbers[slot] % cache->nbuckets];
+    while(*link != (ssize_t)slot) link = &cache->next[*link];
+    *link = cache->next[slot];
+    cache->flags[slot] = 0;
+}
+
+/**
+ * Pick a slot to reuse with the CLOCK policy: the hand passes over referenced slots
+ * (clearing their bit) and slots that are in use, and stops at the first empty or
+ * unreferenced one. A dirty victim is stored first, together with the next
+ * ICACHE_FLUSH_BATCH dirty inodes in clock order.
+ *
+ * @return slot number (-1 if every slot is in use or a dirty victim could not be stored)
+**/
+ssize_t icache_victim(InodeCache *cache) {
+    // two sweeps clear every reference bit, a third finds nothing only if every slot is in use
+    for(size_t i = 0; i < 3 * cache->capacity; i++) {
+        size_t slot = cache->hand;
+        cache->hand = (cache->hand + 1) % cache->capacity;
+        uint8_t flags = cache->flags[slot];
+        if(!(flags & ICACHE_VALID)) return slot;
+        if(cache->refs[slot] > 0) continue;
+        if(flags & ICACHE_REFERENCED) {
+            cache->flags[slot] &= ~ICACHE_REFERENCED;
+            continue;
+        }
+        if((flags & ICACHE_DIRTY) && !icache_writeback(cache, slot, ICACHE_FLUSH_BATCH)) return -1;
+        cache->evictions += 1;
+        icache_remove(cache, slot);
+        return slot;
+    }
+    error("every inode in the cache is in use");
+    return -1;
+}
@@ -1,14 +1,177 @@
 // simple file system
 #include "../include/sfs.h"
 #include "../include/log.h"
+#include "../include/utils.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
 
 
 const int INODE_SIZE = sizeof(Inode);
+
+// One slice of the mount scan, the inode table blocks [first, last) (see fs_inode_table_block)
+typedef struct FsScan FsScan;
+struct FsScan {
+    FileSystem *fs;
+    size_t first;
+    size_t last;
+    bool blocks; // collect the blocks the inodes use
+    bool inodes; // collect the inodes in use
+    bool shared; // other slices are scanned at the same time, so the block cache is off limits
+    uint64_t *used_blocks; // partial bitmap of used blocks
+    uint64_t *used_inodes; // partial bitmap of used inodes
+    uint32_t *tail_masks; // slots in use of each shared small file block, shared by the slices (NULL unless they are rebuilt)
+    bool success;
+};
+
+// An indirect block found by the mount scan, with the number of data blocks of the file
+// beneath it (the number of extents for an extent block)
+typedef struct ScanIndirect ScanIndirect;
+struct ScanIndirect {
+    size_t block;
+    size_t level;
+    size_t used;
+};
+
+// The bytes a write puts into the file: the caller's pieces, in file order and apart from each
+// other, and the bytes of a small file that moves to blocks
+typedef struct WriteSource WriteSource;
+struct WriteSource {
+    const FsVector *pieces;
+    size_t count;
+    size_t cursor; // first piece that can reach the next block looked at
+    size_t end; // bytes from here on are not written
+    size_t size; // old size of the file, bytes below it that nothing covers keep their contents
+    const char *prefix; // bytes of the small file
+    size_t prefix_length;
+};
+
+// Runs of blocks, grown as needed
+typedef struct RunList RunList;
+struct RunList {
+    Extent *runs;
+    size_t count;
+    size_t capacity;
+};
+
+// Blocks a write took and gave up, each write keeps its own. The ones it gave up are freed once it
+// succeeds, when it fails the ones it took are freed instead and the file keeps the blocks it had
+typedef struct WriteLog WriteLog;
+struct WriteLog {
+    RunList taken;
+    RunList given;
+};
+
+// How a write fills one block
+typedef struct WriteSpan WriteSpan;
+struct WriteSpan {
+    char *direct; // piece covering the whole block, the block is written straight from it (NULL if none)
+    bool kept; // some byte below the old size is covered by nothing, the old contents are needed
+    bool empty; // no byte comes from a piece or from the small file
+    bool zero; // every byte that comes from a piece or from the small file is null
+};
+
 ssize_t get_inode(FileSystem *fs, Inode *inode, size_t inode_number);
+ssize_t set_inode(FileSystem *fs, const Inode *inode, size_t inode_number);
+bool fs_load_inode(void *context, size_t inode_number, void *record);
+bool fs_store_inodes(void *context, const size_t *numbers, const void *const *records, size_t count);
+const Block* read_block_view(FileSystem *fs, size_t block_number, Block *buffer, int tag);
+bool fs_read_range(FileSystem *fs, const size_t *physical, size_t count, char *data, size_t head, size_t length, Block *edges);
+bool read_block_views(FileSystem *fs, const size_t *block_numbers, Block *buffers, const Block **views, size_t count, int tag);
+ssize_t fs_read_block(FileSystem *fs, size_t block_number, char *data, int tag);
+ssize_t fs_write_block(FileSystem *fs, size_t block_number, char *data, int tag);
+bool fs_transfer_blocks(FileSystem *fs, const size_t *block_numbers, char **data, size_t count, bool write, int tag);
+void fs_readahead(FileSystem *fs, size_t inode_number, const Inode *inode, size_t offset, size_t length, const size_t *physical, size_t count, const size_t *resolved);
+const Inode* fs_file_inode(File *file);
+bool fs_file_map(File *file, const Inode *inode, size_t end);
+size_t fs_readahead_limit(const FileSystem *fs);
+bool inode_map_blocks(FileSystem *fs, size_t inode_number, const Inode *inode, size_t first, size_t count, size_t *physical);
+bool block_map_resolve(FileSystem *fs, BlockMap *map, const Inode *inode, size_t first, size_t count, size_t *physical);
+size_t inode_goal(FileSystem *fs, size_t inode_number, const Inode *inode);
+size_t fs_direct_pointers(const FileSystem *fs);
+size_t fs_indirect_levels(const FileSystem *fs);
+size_t fs_max_blocks(const FileSystem *fs);
+size_t indirect_span(size_t level);
+size_t inode_tree_root(size_t level);
+size_t inode_tree(const FileSystem *fs, size_t logical, size_t *tree_first);
+BlockMap* fs_block_map(FileSystem *fs, size_t inode_number);
+BlockMap* block_map_bind(BlockMap *map, size_t inode_number);
+void fs_block_maps_changed(FileSystem *fs, size_t inode_number, const BlockMap *current);
+void fs_files_moved(FileSystem *fs, size_t inode_number, const File *writer);
+void block_map_invalidate(BlockMap *map);
+bool block_map_flush(FileSystem *fs, BlockMap *map);
+Block* block_map_node(FileSystem *fs, BlockMap *map, size_t level, size_t block_number, size_t first, bool fresh);
+ssize_t block_map_walk(FileSystem *fs, BlockMap *map, const Inode *inode, size_t logical);
+bool block_map_lookup(FileSystem *fs, BlockMap *map, const Inode *inode, size_t logical, size_t *physical);
+bool block_map_assign(FileSystem *fs, BlockMap *map, Inode *inode, size_t logical, size_t block_number);
+bool block_map_prepare(FileSystem *fs, WriteLog *log, BlockMap *map, Inode *inode, size_t logical, size_t frontier, size_t *goal);
+bool block_map_hole(FileSystem *fs, BlockMap *map, Inode *inode, size_t logical, size_t frontier);
+ssize_t fs_write_range(FileSystem *fs, size_t inode_number, const FsVector *pieces, size_t npieces, bool holes, File *file);
+WriteSpan write_span(WriteSource *source, size_t block_start);
+void write_fill(WriteSource *source, size_t block_start, char *target);
+void fs_sort_vectors(FsVector *pieces, size_t count);
+bool fs_zero_data(const char *data, size_t length);
+ssize_t inode_map_holes(FileSystem *fs, WriteLog *log, BlockMap *map, Inode *inode, Extent *extents, size_t inode_number, size_t logical, size_t count, size_t old_blocks, size_t goal);
+ssize_t inode_allocate_blocks(FileSystem *fs, WriteLog *log, BlockMap *map, Inode *inode, Extent *extents, size_t inode_number, size_t logical, size_t count, size_t old_blocks, size_t *goal, size_t *physical);
+size_t block_map_boundary(const FileSystem *fs, size_t logical);
+bool fs_release_tree(FileSystem *fs, size_t block_number, size_t level, size_t used);
+bool inode_map_extents(FileSystem *fs, const Inode *inode, size_t first, size_t count, size_t *physical);
+bool fs_uses_extents(const FileSystem *fs);
+bool fs_inline_data(const FileSystem *fs);
+bool fs_small_file(const FileSystem *fs, const Inode *inode);
+bool fs_read_small(FileSystem *fs, const Inode *inode, char *data, size_t length, size_t offset);
+ssize_t fs_write_small(FileSystem *fs, size_t inode_number, Inode *inode, const FsVector *pieces, size_t count);
+bool fs_tail_store(FileSystem *fs, size_t inode_number, Inode *inode, const char *content, size_t size);
+void fs_tail_release(FileSystem *fs, const Inode *inode);
+size_t tail_slots(size_t size);
+uint32_t tail_mask(size_t slot, size_t count);
+bool inode_load_extents(FileSystem *fs, const Inode *inode, Extent *extents);
+bool inode_store_extents(FileSystem *fs, const Inode *inode, const Extent *extents);
+size_t inode_allocate_extents(FileSystem *fs, WriteLog *log, size_t inode_number, Inode *inode, Extent *extents, size_t goal, size_t count, size_t *physical);
+bool inode_add_extent(FileSystem *fs, WriteLog *log, size_t inode_number, Inode *inode, Extent *extents, Extent extent, size_t goal);
+bool inode_hole_extents(FileSystem *fs, WriteLog *log, size_t inode_number, Inode *inode, Extent *extents, size_t count, size_t goal);
+size_t inode_fill_extents(FileSystem *fs, WriteLog *log, size_t inode_number, Inode *inode, Extent *extents, size_t logical, size_t goal, size_t count, size_t *physical);
+bool inode_release_extents(FileSystem *fs, const Inode *inode);
+size_t fs_allocate_file_run(FileSystem *fs, WriteLog *log, size_t inode_number, size_t goal, size_t count, size_t *first);
+void fs_release_file_run(FileSystem *fs, WriteLog *log, size_t first, size_t count);
+void fs_write_log_end(FileSystem *fs, WriteLog *log, bool success);
+bool run_list_add(RunList *list, size_t first, size_t count);
+size_t fs_release_reservations(FileSystem *fs);
+Reservation* fs_reservation(FileSystem *fs, size_t inode_number, bool claim);
+void fs_reserve_window(FileSystem *fs, size_t inode_number);
+size_t fs_group_allocate(FileSystem *fs, size_t g, size_t from, size_t count, bool partial, size_t *first, size_t *longest);
+void fs_release_block(FileSystem *fs, size_t block_number);
+ssize_t fs_group_claim_inode(FileSystem *fs, size_t g, size_t from, size_t stop, bool with_blocks);
+void fs_release_inode(FileSystem *fs, size_t inode_number);
+bool fs_data_block(const FileSystem *fs, size_t block_number);
+size_t fs_inode_block(const FileSystem *fs, size_t inode_number);
+size_t fs_inode_table_block(const FileSystem *fs, size_t index);
+void fs_group_layout(const SuperBlock *meta, size_t g, BlockGroup *group);
+bool fs_layout_groups(SuperBlock *meta, size_t group_blocks);
+bool fs_initialize_groups(FileSystem *fs);
+bool fs_transfer_group_bitmaps(FileSystem *fs, bool inodes, bool write);
+bool fs_store_group_table(FileSystem *fs);
+void fs_count_groups(FileSystem *fs);
+bool fs_format_groups(Disk *disk, const SuperBlock *meta);
+size_t fs_bitmap_blocks(size_t blocks);
+bool fs_format_tables(Disk *disk, const SuperBlock *meta);
+bool fs_format_bitmap(Disk *disk, size_t first, size_t count, size_t lo, size_t hi, Block *buffer);
+bool fs_scan_inode_table(FileSystem *fs, bool blocks, bool inodes, bool tails);
+bool fs_store_tail_masks(FileSystem *fs, const uint32_t *masks);
+bool fs_transfer_bitmap(FileSystem *fs, uint64_t *words, size_t first, size_t blocks, bool write);
+bool fs_load_bitmap(FileSystem *fs, uint64_t *words, size_t stored, size_t bits, size_t first);
+bool fs_store_bitmaps(FileSystem *fs);
+bool fs_write_super_block(FileSystem *fs, uint32_t state);
+void* fs_scan_range(void *arg);
+bool fs_scan_read(FsScan *scan, const size_t *block_numbers, Block *buffers, const Block **views, size_t count);
+bool mark_indirect_blocks(FsScan *scan, const ScanIndirect *found, size_t count, Block *buffers);
+size_t mark_inode_pointers(FsScan *scan, const Inode *inode, ScanIndirect *found);
+size_t mark_inode_extents(FsScan *scan, const Inode *inode, ScanIndirect *found);
+void mark_extent_blocks(FsScan *scan, const Extent *extent);
+Block* fs_block_alloc(size_t count);
+void fs_block_free(Block *blocks, size_t count);
 
 
 /** Debug FS, read superblock and its information, read inode table and report infromation about node
@@ -17,26 +180,52 @@ ssize_t get_inode(FileSystem *fs, Inode *inode, size_t inode_number);
  * 
 **/
 void fs_debug(Disk *disk){
-    Block block;
+    Block *block = fs_block_alloc(1);
 
     // Read super block
-    if (disk_read(disk, 0, block.data) == DISK_FAILURE) {
+    if (block == NULL || disk_read(disk, 0, block->data) == DISK_FAILURE) {
+        fs_block_free(block, 1);
         return;
     }
 
     printf("SuperBlock:\n");
-    printf("    %u blocks\n"         , block.super_block.blocks);
-    printf("    %u inode blocks\n"   , block.super_block.inode_blocks);
-    printf("    %u inodes\n"         , block.super_block.inodes);
+    printf("    %u blocks\n"         , block->super_block.blocks);
+    printf("    %u inode blocks\n"   , block->super_block.inode_blocks);
+    printf("    %u inodes\n"         , block->super_block.inodes);
+    if (block->super_block.features_magic == FEATURES_MAGIC && (block->super_block.features & FS_FEATURE_BITMAP) && !(block->super_block.features & FS_FEATURE_GROUPS)) {
+        printf("    %u bitmap blocks\n" , block->super_block.bitmap_blocks);
+    }
+    if (block->super_block.features_magic == FEATURES_MAGIC && (block->super_block.features & FS_FEATURE_INODE_BITMAP) && !(block->super_block.features & FS_FEATURE_GROUPS)) {
+        printf("    %u inode bitmap blocks\n" , block->super_block.inode_bitmap_blocks);
+    }
+    if (block->super_block.features_magic == FEATURES_MAGIC && (block->super_block.features & FS_FEATURE_GROUPS)) {
+        printf("    %u groups of %u blocks\n", block->super_block.group_count, block->super_block.group_blocks);
+        printf("    %u inode blocks per group\n", block->super_block.group_inode_blocks);
+    }
+    if (block->super_block.features_magic == FEATURES_MAGIC && (block->super_block.features & FS_FEATURE_EXTENTS)) {
+        printf("    extent mapped inodes\n");
+    } else if (block->super_block.features_magic == FEATURES_MAGIC && (block->super_block.features & FS_FEATURE_TRIPLE_INDIRECT)) {
+        printf("    double and triple indirect blocks\n");
+    }
+    if (block->super_block.features_magic == FEATURES_MAGIC && (block->super_block.features & FS_FEATURE_INLINE_DATA)) {
+        printf("    small files inline or in shared blocks\n");
+    }
+    if (block->super_block.features_magic == FEATURES_MAGIC) {
+        printf("    %s\n", block->super_block.state == FS_STATE_CLEAN ? "clean" : "not cleanly unmounted");
+    }
 
     /* Read Inodes */
     printf("Inodes:\n");
-    printf("    %u inode blocks\n"   , block.super_block.inode_blocks);
-    printf("    %u inodes\n"         , block.super_block.inodes);
+    printf("    %u inode blocks\n"   , block->super_block.inode_blocks);
+    printf("    %u inodes\n"         , block->super_block.inodes);
+    fs_block_free(block, 1);
 }
 
 /** Format Disk by, writing to superblock (with appropriate magic number, number of blocks,
  *  number of inode blocks, and number of inodes) and clear all remaining blocks
+ *
+ * A disk without a file system also gets an empty inode table and an on disk free block
+ * bitmap, disks that already hold one keep their layout (and their files).
  * 
  * SHOULD NOT CLEAR A mounted Disk!
  * 
@@ -45,18 +234,43 @@ void fs_debug(Disk *disk){
  * 
 **/
 bool fs_format(Disk *disk){
+    return fs_format_features(disk, 0, 0);
+}
+
+/** Format Disk like fs_format, a disk without a file system gets the optional features as well.
+ *  A disk that already holds one keeps the features it was formatted with.
+ *
+ * @param disk pointer to disk
+ * @param features FS_FEATURE_* flags, FS_FEATURE_EXTENTS selects extent mapped inodes,
+ *        FS_FEATURE_GROUPS splits the disk into block groups,
+ *        FS_FEATURE_TRIPLE_INDIRECT gives inodes double and triple indirect blocks,
+ *        FS_FEATURE_INLINE_DATA keeps small files in their inode or in shared blocks
+ * @param group_blocks number of blocks per group (0 selects FS_GROUP_BLOCKS)
+ * @return whether or not all disk operations were succesful
+ *
+**/
+bool fs_format_features(Disk *disk, uint32_t features, size_t group_blocks){
     if(disk == NULL || disk->mounted) {
         error("disk has already been mounted or disk is a null pointer");
         return false;
     }
     // create the block and set the appropriate values
-    Block super_block;
-    // retrieve superblock from disk
-    if(disk_read(disk, 0, (char*)(&super_block)) != BLOCK_SIZE) return false;
-    // verify and set appropriate values for superblock
-    if(!verify_superblock(&super_block, disk)) return false;
-    // treat super block like a stream of bytes and typecast to char array
-    if(disk_write(disk, 0, (char*)(&super_block)) == DISK_FAILURE) return false;
+    Block *super_block = fs_block_alloc(1);
+    // retrieve superblock from disk, verify and set appropriate values for superblock
+    // and treat super block like a stream of bytes and typecast to char array
+    bool success = super_block != NULL
+        && disk_read(disk, 0, super_block->data) == BLOCK_SIZE;
+    bool fresh = success && super_block->super_block.magic_number != MAGIC_NUMBER;
+    success = success && verify_superblock(super_block, disk);
+    if(success && fresh) super_block->super_block.features |= features;
+    bool groups = super_block != NULL && (super_block->super_block.features & FS_FEATURE_GROUPS);
+    // the super block goes last, so a disk is only recognised once its tables are in place
+    success = success
+        && (!fresh || !groups || fs_layout_groups(&super_block->super_block, group_blocks))
+        && (!fresh || (groups ? fs_format_groups(disk, &super_block->super_block) : fs_format_tables(disk, &super_block->super_block)))
+        && disk_write(disk, 0, super_block->data) != DISK_FAILURE;
+    fs_block_free(super_block, 1);
+    if(!success) return false;
     // todo
     // for(size_t i = 1; i < disk->blocks; i++){
     //     if(disk_write(disk, i, empty_data) == DISK_FAILURE) {
@@ -71,7 +285,8 @@ bool fs_format(Disk *disk){
  * Read and check superblock vertify attributes, 
  * Record FS disk attribute and set Disk mount status,
  * copy superblock to FS meta attribute, 
- * initilize FS free blocks bitmap
+ * initilize FS free blocks bitmap (read from disk after a clean unmount, otherwise rebuilt from the inode table),
+ * mark the super block as mounted, so a crash before fs_unmount is noticed by the next mount
  * 
  * SHOULD NOT MOUNT ON A DISK THAT HAS ALREADY BEEN MOUNTED
  * 
@@ -92,57 +307,147 @@ bool    fs_mount(FileSystem *fs, Disk *disk){
     // format the disk with appropriate information
     if(!fs_format(disk)) return false;
 
-    Block super_block;
-    // retrieve the super block from disk
-    if(disk_read(disk, 0, (char*)(&super_block)) != BLOCK_SIZE) return false;
-    // intialize meta with the fetched info from on disk superblock
-    if(!fs_initialize_meta(fs, &super_block, disk)) return false;
+    Block *super_block = fs_block_alloc(1);
+    // retrieve the super block from disk and intialize meta with the fetched info from on disk superblock
+    bool success = super_block != NULL
+        && disk_read(disk, 0, super_block->data) == BLOCK_SIZE
+        && fs_initialize_meta(fs, super_block, disk);
+    fs_block_free(super_block, 1);
+    if(!success) return false;
+    // disks that keep their blocks in memory (mapped images, RAM disks) are served without copies
+    if(!disk_mapped(disk) && (fs->cache = cache_create(disk, fs->cache_blocks)) == NULL) {
+        fs_unmount(fs);
+        return false;
+    }
+    // inodes are kept apart from their table blocks, so hot inodes cost neither a block copy nor a disk read
+    if(fs->cache && (fs->icache = icache_create(fs->icache_inodes, sizeof(Inode), fs_load_inode, fs_store_inodes, fs)) == NULL) {
+        fs_unmount(fs);
+        return false;
+    }
     // intialize free blocks and also set all to true except inode and super block
-    if(!fs_initialize_free_block_bitmap(fs)) return false;
+    if(!fs_initialize_free_block_bitmap(fs)) {
+        fs_unmount(fs);
+        return false;
+    }
+    // the mark has to reach the disk before anything else changes
+    if(fs->meta.features_magic == FEATURES_MAGIC
+        && (!fs_write_super_block(fs, FS_STATE_MOUNTED) || !disk_flush(disk))) {
+        fs_unmount(fs);
+        return false;
+    }
     return true;
 };
 
 /**
  * Unmount FileSystem from internal Disk by doing the following: 
  * 
+ * Store the dirty inodes of the inode cache in the inode table and release the inode cache,
+ * Store the free block and inode bitmaps (if the disk has them),
+ * Write the dirty blocks of the block cache back to disk and release the cache,
+ * Mark the super block clean, with the allocation counters, once everything else is on disk,
  * Set Disk mounted status and FileSystem disk attribute,
  * Release free blocks bitmap.
  *
  * @param       fs      Pointer to FileSystem structure.
  **/
 void    fs_unmount(FileSystem *fs){
+    if(fs == NULL || fs->disk == NULL) return;
+    // reserved blocks do not belong to any file
+    fs_release_reservations(fs);
+    // only a file system that finished mounting has bitmaps worth storing
+    bool clean = fs->meta.state == FS_STATE_MOUNTED;
+    if(fs->icache != NULL && !icache_flush(fs->icache)) {
+        error("unable to store cached inodes");
+        clean = false;
+    }
+    icache_destroy(fs->icache);
+    fs->icache = NULL;
+    if(clean && !fs_store_bitmaps(fs)) {
+        error("unable to store the free block and inode bitmaps");
+        clean = false;
+    }
+    if(fs->cache != NULL && !cache_flush(fs->cache)) {
+        error("unable to write back cached blocks");
+        clean = false;
+    }
+    if(clean && (!disk_flush(fs->disk) || !fs_write_super_block(fs, FS_STATE_CLEAN))) {
+        error("unable to mark the file system clean");
+    }
+    cache_destroy(fs->cache);
+    free(fs->free_blocks);
+    free(fs->free_inodes);
+    for(size_t g = 0; fs->groups != NULL && g < fs->group_count; g++) pthread_mutex_destroy(&fs->groups[g].lock);
+    free(fs->groups);
+    fs->groups = NULL;
+    fs->group_count = 0;
+    fs->disk->mounted = false;
+    fs->disk = NULL;
+    fs->cache = NULL;
+    fs->free_blocks = NULL;
+    fs->free_count = 0;
+    fs->free_blocks_dirty = false;
+    fs->free_inodes = NULL;
+    fs->free_inode_count = 0;
+    fs->free_inodes_dirty = false;
+    memset(fs->readahead, 0, sizeof(fs->readahead));
+    for(size_t i = 0; i < FS_READAHEAD_SLOTS; i++) fs_block_free(fs->maps[i].buffers, FS_INDIRECT_LEVELS);
+    memset(fs->maps, 0, sizeof(fs->maps));
+    fs->files = NULL;
+    fs->tail_block = 0;
 };
 
+/**
+ * Store the dirty inodes and the free block and inode bitmaps, write every dirty block of the block cache back to disk and flush the disk.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @return      Whether or not everything reached the disk.
+ **/
+bool    fs_sync(FileSystem *fs){
+    if(fs == NULL || fs->disk == NULL) return false;
+    if(fs->icache != NULL && !icache_flush(fs->icache)) return false;
+    if(!fs_store_bitmaps(fs)) return false;
+    if(fs->cache != NULL && !cache_flush(fs->cache)) return false;
+    return disk_flush(fs->disk);
+}
+
 /**
  * Allocate an Inode in the FileSystem Inode table by doing the following:
  *
- * Search Inode table for free inode.
+ * Find a free inode in the free inode bitmap, next fit from the inode after the last one handed out.
+ * Groups without free data blocks are passed over while another group has some, the data of
+ * a file is placed in the group of its inode.
  * Reserve free inode in Inode table.
  *
  * BE SURE TO UPDATE TO DISK
- * 
- * todo: use an inode_bitmap instead of iterating through entire inode tables
  *
  * @param       fs      Pointer to FileSystem structure.
- * @return      Inode number of allocated Inode.
+ * @return      Inode number of allocated Inode (-1 if the table is full).
  **/
 ssize_t fs_create(FileSystem *fs){
-    // iterate through all the inode blocks
-    for(ssize_t i = 1; i < fs->meta.inode_blocks + 1; i++){
-        Block inode_super_block;
-        // retrieve inode from disk
-        if(disk_read(fs->disk, i, (char*)(&inode_super_block)) != BLOCK_SIZE) return -1;
-        // iterate through all inodes inode table
-        for(ssize_t j = 0; j < INODES_PER_BLOCK; j++){
-            // if free then handle
-            if(inode_super_block.inodes[j].valid == false){
-                inode_super_block.inodes[j].valid = true;
-                if(disk_write(fs->disk, i, (char*)&inode_super_block) == DISK_FAILURE) return -1;
-                return (i-1) * INODES_PER_BLOCK + j;
-            }
+    if(fs == NULL || fs->free_inodes == NULL || __atomic_load_n(&fs->free_inode_count, __ATOMIC_RELAXED) == 0) return -1;
+    size_t hint = __atomic_load_n(&fs->inode_hint, __ATOMIC_RELAXED);
+    if(hint >= fs->meta.inodes) hint = 0;
+    size_t home = hint / fs->groups[0].inodes;
+    ssize_t inode_number = -1;
+    for(int pass = 0; pass < 2 && inode_number < 0; pass++){
+        // the home group is searched from the hint on first and from its start last
+        for(size_t i = 0; i <= fs->group_count && inode_number < 0; i++){
+            size_t g = (home + i) % fs->group_count;
+            BlockGroup *group = &fs->groups[g];
+            size_t from = i == 0 ? hint : group->first_inode;
+            size_t stop = i == fs->group_count ? hint : group->first_inode + group->inodes;
+            inode_number = fs_group_claim_inode(fs, g, from, stop, pass == 0);
         }
     }
-    return -1;
+    if(inode_number < 0) return -1;
+    // clear stale block pointers left behind by a removed inode
+    Inode inode = { .valid = true };
+    if(set_inode(fs, &inode, inode_number) < 0) {
+        fs_release_inode(fs, inode_number);
+        return -1;
+    }
+    __atomic_store_n(&fs->inode_hint, inode_number + 1, __ATOMIC_RELAXED);
+    return inode_number;
 }
 
 /**
@@ -150,7 +455,7 @@ ssize_t fs_create(FileSystem *fs){
  *
  * Load and check status of Inode.
  * Release any direct blocks.
- * Release any indirect blocks.
+ * Release any indirect blocks (or the extents and the extent block).
  * Mark Inode as free in Inode table.
  *
  * @param       fs              Pointer to FileSystem structure.
@@ -158,47 +463,73 @@ ssize_t fs_create(FileSystem *fs){
  * @return      Whether or not removing the specified Inode was successful.
  **/
 bool    fs_remove(FileSystem *fs, size_t inode_number){
-    Block block;
-    int inode_block_number = (inode_number/INODES_PER_BLOCK) + 1;
-    int inode_offset = (inode_number % INODES_PER_BLOCK);
-    if(inode_block_number > fs->meta.inode_blocks){
-        error("inode block number exceeds number of blocks provided");
-        return false;
-    }
-    // read inode table from disk
-    if(disk_read(fs->disk, inode_block_number, (char*)(&block)) != BLOCK_SIZE) return false;
-    if(!block.inodes[inode_offset].valid){
+    Inode inode;
+    if(get_inode(fs, &inode, inode_number) < 0) return false;
+    if(!inode.valid){
         error("not valid inode to remove");
         return false;
     }
-    for(int i = 0; i < POINTERS_PER_INODE ; i++){
-        fs->free_blocks[block.inodes[inode_offset].direct[i]] = true;
+    // only the blocks within the size of the inode are in use, pointers past it may be stale
+    size_t used_blocks = (inode.size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if(fs_small_file(fs, &inode)) {
+        if(inode.size > INLINE_DATA_SIZE) fs_tail_release(fs, &inode);
+        used_blocks = 0;
+    } else if(fs_uses_extents(fs)) {
+        if(!inode_release_extents(fs, &inode)) return false;
+        used_blocks = 0;
     }
-    if(block.inodes[inode_offset].size > POINTERS_PER_INODE * BLOCK_SIZE) {
-        // read and free the indirect blocks
-        Block indirect_block;
-        fs->free_blocks[block.inodes[inode_offset].indirect] = true;
-        if(disk_read(fs->disk, block.inodes[inode_offset].indirect, (char*)&indirect_block) != BLOCK_SIZE) {
-            error("error in reading from block");
-            return false;
-        }
-        ssize_t leftoverblocks = (block.inodes[inode_offset].size - (POINTERS_PER_INODE * BLOCK_SIZE));
-        size_t curr = 0;
-        while(leftoverblocks > 0){
-            fs->free_blocks[indirect_block.block_pointers[curr]] = true;
-            leftoverblocks -= BLOCK_SIZE;
-            curr += 1;
-        }
+    size_t direct = fs_direct_pointers(fs);
+    for(size_t i = 0; i < direct && i < used_blocks; i++){
+        if(inode.pointers[i] != 0) fs_release_block(fs, inode.pointers[i]);
+    }
+    // free the indirect blocks, level by level, with the blocks they map
+    size_t tree_first = direct;
+    for(size_t level = 1; level <= fs_indirect_levels(fs) && used_blocks > tree_first; level++) {
+        size_t used = min(used_blocks - tree_first, indirect_span(level));
+        size_t root = inode.pointers[inode_tree_root(level)];
+        if(root != 0 && !fs_release_tree(fs, root, level, used)) return false;
+        tree_first += indirect_span(level);
     }
 
-    block.inodes[inode_offset].size = 0;
-    block.inodes[inode_offset].valid = false;
-    // write inode table back to disk
-    // I realise I dont have to do all the conversion to stream of bytes, we can simply cast it as an array of bytes and move on.
-    disk_write(fs->disk, inode_block_number,(char*)&block);
-    return true;
+    fs->readahead[inode_number % FS_READAHEAD_SLOTS].valid = false;
+    fs_block_maps_changed(fs, inode_number, NULL);
+    fs_files_moved(fs, inode_number, NULL);
+    fs_release_reservation(fs, inode_number);
+    fs_release_inode(fs, inode_number);
+    inode = (Inode){0};
+    return set_inode(fs, &inode, inode_number) == 0;
 };
 
+/**
+ * Release an indirect block and everything beneath it. Blocks at level 1 point to data blocks,
+ * blocks at higher levels point to indirect blocks of the level below.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       block_number    Indirect block.
+ * @param       level           Its level.
+ * @param       used            Number of data blocks of the file beneath it.
+ * @return      Whether or not every indirect block could be read.
+ **/
+bool fs_release_tree(FileSystem *fs, size_t block_number, size_t level, size_t used) {
+    if(!fs_data_block(fs, block_number)) {
+        error("invalid indirect block %zu", block_number);
+        return false;
+    }
+    Block *buffer = fs_block_alloc(1);
+    const Block *pointers = buffer ? read_block_view(fs, block_number, buffer, DISK_TAG_INDIRECT) : NULL;
+    bool success = pointers != NULL;
+    size_t span = indirect_span(level - 1);
+    for(size_t i = 0; success && i * span < used; i++) {
+        // holes have no block, nor anything beneath them
+        if(pointers->block_pointers[i] == 0) continue;
+        if(level == 1) fs_release_block(fs, pointers->block_pointers[i]);
+        else success = fs_release_tree(fs, pointers->block_pointers[i], level - 1, min(span, used - i * span));
+    }
+    fs_block_free(buffer, 1);
+    fs_release_block(fs, block_number);
+    return success;
+}
+
 /**
  * Return size of specified Inode.
  *
@@ -207,294 +538,3344 @@ bool    fs_remove(FileSystem *fs, size_t inode_number){
  * @return      Size of specified Inode (-1 if does not exist).
  **/
 ssize_t fs_stat(FileSystem *fs, size_t inode_number){
-    if(fs == NULL) {
-        return -1;
-    }
-    int inode_block_number = (inode_number / INODES_PER_BLOCK )+ 1;
-    if(inode_block_number > fs->meta.inode_blocks){
+    Inode inode;
+    if(fs == NULL || fs_inode_block(fs, inode_number) == 0 || get_inode(fs, &inode, inode_number) < 0) {
         return -1;
     }
-    int inode_offset = inode_number % INODES_PER_BLOCK;
-    Block block;
-    disk_read(fs->disk, inode_block_number, (char*)(&block));
-    if(block.inodes[inode_offset].valid){
-        return block.inodes[inode_offset].size;
-    } 
-    return -1;
+    return inode.valid ? (ssize_t)inode.size : -1;
 };
 
 /**
- * Read from the specified Inode into the data buffer exactly length bytes
+ * Read from the specified Inode into the data buffer at most length bytes
  * beginning from the specified offset by doing the following:
  *
  * Load Inode information.
- * Continuously read blocks and copy data to buffer.
+ * Resolve every block of the requested range to its physical block (each indirect block is read once).
+ * Prefetch the blocks that follow if the Inode is being read sequentially.
+ * Read the blocks window by window, each window is submitted to the disk in one go (see fs_read_range).
  *
- * Data is read from direct blocks first, and then from indirect blocks.
+ * Reads that run past the end of the file are cut short at the end of the file.
  *
  * @param       fs              Pointer to FileSystem structure.
  * @param       inode_number    Inode to read data from.
  * @param       data            Buffer to copy data to.
  * @param       length          Number of bytes to read.
  * @param       offset          Byte offset from which to begin reading.
- * @return      Number of bytes read (-1 on error).
+ * @return      Number of bytes read (0 at end of file, -1 on error).
  **/
 ssize_t fs_read(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset){
     Inode inode;
-    if(get_inode(fs, &inode, inode_number)){
+    if(get_inode(fs, &inode, inode_number) < 0){
         error("error getting inode");
         return -1;
     }
-    if(!inode.valid) {
+    if(!inode.valid || data == NULL) {
         return -1;
     }
-    // if either offset or the length + offset is bigger than 
-    // total size in inode then return error
-    // todo: allow for reading of length past the end of file next time
-    if(offset > inode.size || offset + length > inode.size){
+    if(offset > inode.size){
         return -1;
     }
+    length = min(length, inode.size - offset);
+    if(length == 0) return 0;
+    if(fs_small_file(fs, &inode)) return fs_read_small(fs, &inode, data, length, offset) ? (ssize_t)length : -1;
 
-    // the block to start at in the inode -> the offset divided by block size
-    int block_offset = offset / BLOCK_SIZE;
-    // the byte offset within the block to start at
-    int in_offset = offset % BLOCK_SIZE;
-    // the total number of bytes left to be read
-    int to_read = length;
-    while(to_read > 0) {
-        if (block_offset < 5) {
-            // handle direct
-            // read the corresponding block into buffer
-            Block buffer;
-            disk_read(fs->disk, inode.direct[block_offset], (char*)(&buffer));
-
-            // accoutn for when the offset in the block is 0, in which case only read block
-            // size minus the offset. set offset to 0 as the next block will be read from the start;
-            // increment block_offset and decrement number of bytes left to be read
-            int bytes_to_read_from_block = BLOCK_SIZE - in_offset;
-            memcpy(data, buffer.data, bytes_to_read_from_block);
-            in_offset = 0;
-            to_read -=  bytes_to_read_from_block;
-        } else{
-            // handle indirect
-            Block indirect_pointers;
-            // todo: optimize this so the indirect pointers are not read everytime
-            disk_read(fs->disk, inode.indirect, (char*)(&indirect_pointers));
-
-            Block buffer;
-            disk_read(fs->disk, indirect_pointers.block_pointers[block_offset - POINTERS_PER_INODE], (char*)(&buffer));
-
-            int bytes_to_read_from_block = BLOCK_SIZE - in_offset;
-            in_offset = 0;
-            to_read -=  bytes_to_read_from_block;
-        }
-        block_offset += 1;
+    // logical blocks covered by the read
+    size_t first = offset / BLOCK_SIZE;
+    size_t count = (offset + length - 1) / BLOCK_SIZE - first + 1;
+    size_t *physical = malloc(count * sizeof(size_t));
+    // only the first and the last block can be partly covered, no other block needs a buffer of its own
+    Block *edges = fs_block_alloc(2);
+    bool success = physical != NULL && edges != NULL && inode_map_blocks(fs, inode_number, &inode, first, count, physical);
+    if(success) {
+        fs_readahead(fs, inode_number, &inode, offset, length, physical, count, NULL);
+        success = fs_read_range(fs, physical, count, data, offset % BLOCK_SIZE, length, edges);
+        if(!success) error("error reading data blocks of inode %zu", inode_number);
     }
+    free(physical);
+    fs_block_free(edges, 2);
+    return success ? (ssize_t)length : -1;
+}
 
-    return length;
+/**
+ * Read length bytes, starting head bytes into the first of count blocks, into data. Blocks of
+ * a mapped disk are copied out of the mapping. The other blocks are transferred window by window,
+ * blocks that are covered whole go straight into data and only a partly covered first and last
+ * block are read into edges and copied from there. Misses of the block cache that are contiguous
+ * on disk are read with one vectored read (see cache_read_list).
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       physical        Physical block numbers.
+ * @param       count           Number of blocks.
+ * @param       data            Buffer to read into.
+ * @param       head            Offset of the first byte within the first block.
+ * @param       length          Number of bytes to read.
+ * @param       edges           Two buffers for the first and the last block.
+ * @return      Whether or not every block could be read.
+ **/
+bool fs_read_range(FileSystem *fs, const size_t *physical, size_t count, char *data, size_t head, size_t length, Block *edges) {
+    for(size_t window = 0; window < count; window += FS_IO_WINDOW) {
+        size_t n = min(FS_IO_WINDOW, count - window);
+        size_t numbers[FS_IO_WINDOW];
+        char *targets[FS_IO_WINDOW];
+        size_t reads = 0;
+        for(size_t b = window; b < window + n; b++) {
+            // bytes [lo, lo + bytes) of block b land at data + position
+            size_t lo = b == 0 ? head : 0;
+            size_t position = b * BLOCK_SIZE + lo - head;
+            size_t bytes = min(BLOCK_SIZE - lo, length - position);
+            // a hole reads as null bytes
+            if(physical[b] == 0) {
+                memset(data + position, 0, bytes);
+                continue;
+            }
+            const char *mapped = disk_map_block(fs->disk, physical[b]);
+            if(mapped) {
+                memcpy(data + position, mapped + lo, bytes);
+                continue;
+            }
+            numbers[reads] = physical[b];
+            targets[reads++] = bytes == BLOCK_SIZE ? data + position : edges[b == 0 ? 0 : 1].data;
+        }
+        if(reads > 0 && !fs_transfer_blocks(fs, numbers, targets, reads, false, DISK_TAG_DATA)) return false;
+        for(size_t i = 0; i < reads; i++) {
+            if(targets[i] != edges[0].data && targets[i] != edges[1].data) continue;
+            size_t b = targets[i] == edges[0].data ? 0 : count - 1;
+            size_t lo = b == 0 ? head : 0;
+            size_t position = b * BLOCK_SIZE + lo - head;
+            memcpy(data + position, targets[i] + lo, min(BLOCK_SIZE - lo, length - position));
+        }
+    }
+    return true;
 }
 
 /**
- * Write to the specified Inode from the data buffer exactly length bytes
- * beginning from the specified offset by doing the following:
+ * Read several pieces of the specified Inode with one pass over its blocks. Each block the pieces
+ * touch is mapped once and read once, the reads go out window by window like those of fs_read. A block
+ * only one piece touches and covers whole is read straight into it, the others are read into bounce
+ * buffers and copied to every piece that wants part of them. The pieces stop at the end of the file.
  *
- * Load Inode information.
- * Continuously copy data from buffer to blocks.
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode to read data from.
+ * @param       vectors         Pieces to read, in any order.
+ * @param       count           Number of pieces.
+ * @return      Number of bytes read, the sum over the pieces (-1 on error).
+ **/
+ssize_t fs_readv(FileSystem *fs, size_t inode_number, const FsVector *vectors, size_t count) {
+    Inode inode;
+    if(fs == NULL || (vectors == NULL && count > 0) || get_inode(fs, &inode, inode_number) < 0 || !inode.valid) return -1;
+    FsVector *pieces = malloc(max(count, (size_t)1) * sizeof(FsVector));
+    if(pieces == NULL) return -1;
+    size_t n = 0;
+    size_t total = 0;
+    size_t blocks = 0;
+    for(size_t i = 0; i < count; i++) {
+        if(vectors[i].data == NULL) {
+            free(pieces);
+            return -1;
+        }
+        if(vectors[i].offset >= inode.size || vectors[i].length == 0) continue;
+        FsVector piece = vectors[i];
+        piece.length = min(piece.length, inode.size - piece.offset);
+        blocks += (piece.offset + piece.length - 1) / BLOCK_SIZE - piece.offset / BLOCK_SIZE + 1;
+        total += piece.length;
+        pieces[n++] = piece;
+    }
+    if(n == 0 || fs_small_file(fs, &inode)) {
+        bool success = true;
+        for(size_t p = 0; success && p < n; p++) success = fs_read_small(fs, &inode, pieces[p].data, pieces[p].length, pieces[p].offset);
+        free(pieces);
+        return success ? (ssize_t)total : -1;
+    }
+    fs_sort_vectors(pieces, n);
+
+    // the blocks the pieces touch, each once and in file order, with the buffer each is read into
+    size_t *logical = malloc(blocks * sizeof(size_t));
+    size_t *physical = malloc(blocks * sizeof(size_t));
+    char **targets = malloc(blocks * sizeof(char*));
+    size_t *firsts = malloc(n * sizeof(size_t)); // index of the first block of each piece
+    Block *bounce = NULL;
+    size_t bounced = 0;
+    bool success = logical && physical && targets && firsts;
+    size_t unique = 0;
+    for(size_t p = 0; success && p < n; p++) {
+        size_t first = pieces[p].offset / BLOCK_SIZE;
+        size_t last = (pieces[p].offset + pieces[p].length - 1) / BLOCK_SIZE;
+        // a piece starts at or after the pieces before it, the blocks it shares with them come first
+        size_t k = p > 0 ? firsts[p - 1] : 0;
+        while(k < unique && logical[k] < first) k++;
+        firsts[p] = k;
+        for(size_t b = first; b <= last; b++, k++) {
+            size_t lo = max(pieces[p].offset, b * BLOCK_SIZE);
+            size_t hi = min(pieces[p].offset + pieces[p].length, (b + 1) * BLOCK_SIZE);
+            char *whole = hi - lo == BLOCK_SIZE ? pieces[p].data + (lo - pieces[p].offset) : NULL;
+            if(k < unique) {
+                // another piece wants the block as well
+                targets[k] = NULL;
+            } else {
+                logical[unique] = b;
+                targets[unique++] = whole;
+            }
+        }
+    }
+    // runs of consecutive blocks are mapped with one walk each
+    for(size_t k = 0; success && k < unique; ) {
+        size_t j = k + 1;
+        while(j < unique && logical[j] == logical[j - 1] + 1) j++;
+        success = inode_map_blocks(fs, inode_number, &inode, logical[k], j - k, physical + k);
+        k = j;
+    }
+    for(size_t k = 0; success && k < unique; k++) bounced += targets[k] == NULL;
+    if(success && bounced > 0) success = (bounce = fs_block_alloc(bounced)) != NULL;
+    for(size_t k = 0, b = 0; success && k < unique; k++) {
+        if(targets[k] == NULL) targets[k] = bounce[b++].data;
+    }
+
+    for(size_t window = 0; success && window < unique; window += FS_IO_WINDOW) {
+        size_t numbers[FS_IO_WINDOW];
+        char *data[FS_IO_WINDOW];
+        size_t reads = 0;
+        for(size_t k = window; k < min(window + FS_IO_WINDOW, unique); k++) {
+            // a hole reads as null bytes
+            if(physical[k] == 0) {
+                memset(targets[k], 0, BLOCK_SIZE);
+                continue;
+            }
+            const char *mapped = disk_map_block(fs->disk, physical[k]);
+            if(mapped) {
+                memcpy(targets[k], mapped, BLOCK_SIZE);
+                continue;
+            }
+            numbers[reads] = physical[k];
+            data[reads++] = targets[k];
+        }
+        if(reads > 0) success = fs_transfer_blocks(fs, numbers, data, reads, false, DISK_TAG_DATA);
+    }
+    // the bounced blocks go to every piece that touches them
+    for(size_t p = 0; success && p < n; p++) {
+        size_t first = pieces[p].offset / BLOCK_SIZE;
+        size_t last = (pieces[p].offset + pieces[p].length - 1) / BLOCK_SIZE;
+        for(size_t b = first, k = firsts[p]; b <= last; b++, k++) {
+            size_t lo = max(pieces[p].offset, b * BLOCK_SIZE);
+            size_t hi = min(pieces[p].offset + pieces[p].length, (b + 1) * BLOCK_SIZE);
+            char *destination = pieces[p].data + (lo - pieces[p].offset);
+            if(targets[k] != destination) memcpy(destination, targets[k] + (lo - b * BLOCK_SIZE), hi - lo);
+        }
+    }
+    if(!success) error("error reading data blocks of inode %zu", inode_number);
+    free(pieces);
+    free(logical);
+    free(physical);
+    free(targets);
+    free(firsts);
+    fs_block_free(bounce, bounced);
+    return success ? (ssize_t)total : -1;
+}
+
+/**
+ * Describe where the bytes of the specified Inode are kept on disk, from the block holding offset on.
+ * Blocks that follow each other in the file and on disk are put together into one extent, so is a run
+ * of holes. The blocks are resolved window by window like those of fs_read, call again from the end of
+ * the last extent for the ones that did not fit. The disk holds the bytes of blocks still dirty in the
+ * block cache only after fs_sync.
  *
- * Data is read from direct blocks first, and then from indirect blocks.
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode to describe.
+ * @param       offset          Byte offset to start at.
+ * @param       extents         Extents to fill in file order.
+ * @param       count           Number of extents there is room for.
+ * @return      Number of extents filled (0 at end of file, -1 on error).
+ **/
+ssize_t fs_extents(FileSystem *fs, size_t inode_number, size_t offset, FsExtent *extents, size_t count) {
+    Inode inode;
+    if(fs == NULL || extents == NULL || get_inode(fs, &inode, inode_number) < 0 || !inode.valid) return -1;
+    if(offset >= inode.size || count == 0) return 0;
+    if(fs_small_file(fs, &inode)) {
+        extents[0] = (FsExtent){ .offset = offset, .length = inode.size - offset, .block = 0 };
+        return 1;
+    }
+
+    size_t blocks = (inode.size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    size_t n = 0;
+    for(size_t logical = offset / BLOCK_SIZE; logical < blocks; ) {
+        size_t window = min(FS_IO_WINDOW, blocks - logical);
+        size_t physical[FS_IO_WINDOW];
+        if(!inode_map_blocks(fs, inode_number, &inode, logical, window, physical)) {
+            error("error mapping blocks of inode %zu", inode_number);
+            return -1;
+        }
+        for(size_t i = 0; i < window; i++, logical++) {
+            size_t length = min((size_t)BLOCK_SIZE, inode.size - logical * BLOCK_SIZE);
+            if(n > 0) {
+                // every extent but the last one of the file covers whole blocks
+                FsExtent *last = &extents[n - 1];
+                size_t next = last->block == 0 ? 0 : last->block + last->length / BLOCK_SIZE;
+                if(physical[i] == next) {
+                    last->length += length;
+                    continue;
+                }
+            }
+            if(n == count) return n;
+            extents[n++] = (FsExtent){ .offset = logical * BLOCK_SIZE, .length = length, .block = physical[i] };
+        }
+    }
+    return n;
+}
+
+/**
+ * Write to the specified Inode from the data buffer exactly length bytes
+ * beginning from the specified offset (see fs_write_range).
+ *
+ * Writing past the end of the file fills the gap between the old end and offset with null bytes.
+ * Blocks that would hold nothing but null bytes, in the gap or written by the caller, are left
+ * as holes and take no space until something else is written to them.
  *
  * @param       fs              Pointer to FileSystem structure.
  * @param       inode_number    Inode to write data to.
  * @param       data            Buffer with data to copy
  * @param       length          Number of bytes to write.
  * @param       offset          Byte offset from which to begin writing.
- * @return      Number of bytes read (-1 on error).
+ * @return      Number of bytes written (-1 on error).
  **/
 ssize_t fs_write(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset){
+    if(data == NULL) return -1;
+    if(length == 0) return 0;
+    FsVector piece = { .data = data, .length = length, .offset = offset };
+    return fs_write_range(fs, inode_number, &piece, 1, true, NULL);
+}
+
+/**
+ * Write several pieces to the specified Inode with as few passes over its blocks as possible.
+ * The pieces are written in file order, pieces whose blocks touch go out together: their blocks
+ * are mapped and allocated once and written in one batch, straight from the pieces where one
+ * covers a block whole. A piece that overlaps the ones before it in the file is written after them.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode to write data to.
+ * @param       vectors         Pieces to write, in any order.
+ * @param       count           Number of pieces.
+ * @return      Number of bytes written, a short count means the pieces past it in file order were not (-1 on error).
+ **/
+ssize_t fs_writev(FileSystem *fs, size_t inode_number, const FsVector *vectors, size_t count) {
+    if(fs == NULL || (vectors == NULL && count > 0)) return -1;
+    FsVector *pieces = malloc(max(count, (size_t)1) * sizeof(FsVector));
+    if(pieces == NULL) return -1;
+    size_t n = 0;
+    for(size_t i = 0; i < count; i++) {
+        if(vectors[i].data == NULL) {
+            free(pieces);
+            return -1;
+        }
+        if(vectors[i].length > 0) pieces[n++] = vectors[i];
+    }
+    fs_sort_vectors(pieces, n);
+
+    ssize_t total = 0;
+    for(size_t i = 0; i < n; ) {
+        size_t run_end = pieces[i].offset + pieces[i].length;
+        size_t bytes = pieces[i].length;
+        size_t j = i + 1;
+        while(j < n && pieces[j].offset >= run_end && pieces[j].offset / BLOCK_SIZE <= (run_end - 1) / BLOCK_SIZE + 1) {
+            run_end = pieces[j].offset + pieces[j].length;
+            bytes += pieces[j++].length;
+        }
+        ssize_t written = fs_write_range(fs, inode_number, pieces + i, j - i, true, NULL);
+        if(written < 0 && total == 0) total = -1;
+        if(written < 0) break;
+        total += written;
+        if((size_t)written < bytes) break;
+        i = j;
+    }
+    free(pieces);
+    return total;
+}
+
+/**
+ * Write pieces of data to an Inode by doing the following:
+ *
+ * Load Inode information.
+ * Resolve the blocks covered by the write, blocks past the end of the file and holes have none yet.
+ * Leave the ones that would only hold null bytes as holes (if holes is set) and allocate the rest in runs.
+ * Read the partially covered blocks that already hold data and fill them in.
+ * Write the blocks window by window, each window is submitted to the disk in one go,
+ * blocks a piece covers whole go out straight from it.
+ * Save the changed indirect blocks (or the extents) and the Inode.
+ *
+ * The write covers [start, end), from the end of the file or the first piece, whichever comes first,
+ * to the end of the last piece. Bytes in it that no piece covers keep their contents below the old
+ * end of the file and are null past it, like the gap left by writing past the end of the file.
+ * Writes are cut short when the disk or the block map of the Inode is full.
+ * On a file system with extents the new blocks are added to the last extent when they follow it,
+ * holes are extents that start at block 0.
+ * Blocks that already hold data keep it, writing null bytes over them does not make them holes.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode to write data to.
+ * @param       pieces          Pieces to write, in file order, apart from each other and not empty,
+ *                              the blocks of each one touch those of the next.
+ * @param       npieces         Number of pieces (at least 1).
+ * @param       holes           Whether blocks of null bytes are left as holes.
+ * @param       file            Handle the write goes through, its BlockMap is used (NULL for the one of the inode's slot).
+ * @return      Number of bytes of the pieces written, in file order (-1 on error).
+ **/
+ssize_t fs_write_range(FileSystem *fs, size_t inode_number, const FsVector *pieces, size_t npieces, bool holes, File *file){
     Inode inode;
-    if(get_inode(fs, &inode, inode_number)){
+    if(get_inode(fs, &inode, inode_number) < 0){
         error("error getting inode");
         return -1;
     }
+    if(!inode.valid) {
+        return -1;
+    }
+    // an extent mapped inode is only limited by its size field
+    size_t max_size = fs_uses_extents(fs) ? UINT32_MAX : min(fs_max_blocks(fs) * BLOCK_SIZE, (size_t)UINT32_MAX);
+    size_t offset = pieces[0].offset;
+    if(offset >= max_size) return -1;
+    size_t end = min(pieces[npieces - 1].offset + pieces[npieces - 1].length, max_size);
+    // a small file that grows past FS_TAIL_MAX moves to blocks, its bytes are written again in front of the new ones
+    Inode small = inode;
+    char *prefix = NULL;
+    size_t prefix_length = 0;
+    if(fs_small_file(fs, &inode)) {
+        if(end <= FS_TAIL_MAX) return fs_write_small(fs, inode_number, &inode, pieces, npieces);
+        prefix_length = inode.size;
+        if((prefix = malloc(FS_TAIL_MAX)) == NULL || !fs_read_small(fs, &inode, prefix, prefix_length, 0)) {
+            free(prefix);
+            return -1;
+        }
+        memset(inode.pointers, 0, sizeof(inode.pointers));
+        inode.size = 0;
+    }
+
     // there are 3 cases for a fs_write
     // 1. When data exists and the new write's offset overlaps with old data
     // 2. When data exsits and the new write is appended to current data
     // 3. when data exists and there is a "gap" between current new data and old data, in which
     // case 0 or null "\0" bytes should be written to the gap
-    if(offset > inode.size) {
-        // the block to start at in the inode -> the offset divided by block size
-        int block_offset = inode.size / BLOCK_SIZE;
-        // the byte offset within the block to start at
-        int in_offset = inode.size % BLOCK_SIZE;
-
-        int block_offset_write = offset / BLOCK_SIZE;
-        int in_offset_write = offset/BLOCK_SIZE;
-        size_t to_set_to_null = offset - inode.size;
-        size_t bound = BLOCK_SIZE;
-        while(to_set_to_null > 0) {
-            if(block_offset == block_offset_write) {
-                bound = in_offset_write;
-            }
-            if (block_offset < 5) {
-                // handle direct
-                // read the corresponding block into buffer
-                Block buffer;
-                disk_read(fs->disk, inode.direct[block_offset], (char*)(&buffer));
-                for(int i = in_offset; i < bound; i++){
-                    buffer.data[in_offset] = NULL;
-                }
-                disk_write(fs->disk, inode.direct[block_offset], (char*)(&buffer));
-                to_set_to_null -= BLOCK_SIZE - in_offset;
-                in_offset = 0;
-            } else{
-                // handle indirect
-                Block indirect_pointers;
-                // todo: optimize this so the indirect pointers are not read everytime
-                disk_read(fs->disk, inode.indirect, (char*)(&indirect_pointers));
-
-                Block buffer;
-                disk_read(fs->disk, indirect_pointers.block_pointers[block_offset - POINTERS_PER_INODE], (char*)(&buffer));
-                for(int i = in_offset; i < bound; i++){
-                    buffer.data[in_offset] = NULL;
+    // all three are handled by writing the byte range [start, end), where [start, offset) is the gap
+    size_t start = min(offset, (size_t)inode.size);
+    size_t first = start / BLOCK_SIZE;
+    size_t count = (end - 1) / BLOCK_SIZE - first + 1;
+    size_t old_blocks = (inode.size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    WriteSource source = {
+        .pieces = pieces, .count = npieces, .end = end, .size = inode.size,
+        .prefix = prefix, .prefix_length = prefix_length,
+    };
+
+    size_t *physical = malloc(count * sizeof(size_t));
+    WriteSpan *spans = malloc(count * sizeof(WriteSpan));
+    // fresh blocks hold null bytes outside the write (holes and blocks past the end of the file),
+    // zero ones would hold nothing else and stay holes
+    bool *fresh = malloc(2 * count * sizeof(bool));
+    bool *zero = fresh + count;
+    // blocks covered whole by a piece are written from it, only blocks where a piece starts or ends
+    // and the first block can mix in old bytes, a small file's bytes or the gap (the stages),
+    // blocks without a byte of the write are written from one null block (the last stage)
+    size_t stages = min(count, 2 * npieces + 1);
+    Block *stage = fs_block_alloc(stages + 1);
+    char *null_block = stage ? stage[stages].data : NULL;
+    size_t staged = 0;
+    Extent *extents = NULL;
+    BlockMap *map = NULL;
+    // a write that fails gives back the blocks it took
+    WriteLog runs = {0};
+    WriteLog *log = &runs;
+    if(physical == NULL || spans == NULL || fresh == NULL || stage == NULL) goto failure;
+    memset(null_block, 0, BLOCK_SIZE);
+    if(fs_uses_extents(fs)) {
+        extents = malloc(EXTENTS_MAX * sizeof(Extent));
+        if(extents == NULL || !inode_load_extents(fs, &inode, extents)) goto failure;
+    } else if((map = file != NULL ? block_map_bind(&file->map, inode_number) : fs_block_map(fs, inode_number)) == NULL) {
+        goto failure;
+    }
+
+    // blocks that already belong to the file, holes among them are block 0
+    size_t mapped = old_blocks > first ? min(old_blocks - first, count) : 0;
+    if(mapped > 0) {
+        bool resolved = map != NULL ? block_map_resolve(fs, map, &inode, first, mapped, physical) : inode_map_extents(fs, &inode, first, mapped, physical);
+        if(!resolved) goto failure;
+    }
+    for(size_t i = mapped; i < count; i++) physical[i] = 0;
+    for(size_t i = 0; i < count; i++) {
+        spans[i] = write_span(&source, (first + i) * BLOCK_SIZE);
+        fresh[i] = physical[i] == 0;
+        zero[i] = holes && fresh[i] && spans[i].zero;
+    }
+    // blocks are allocated in runs that continue after the block in front of them (the last
+    // block of the file for new blocks), the write is cut short when the disk is full
+    size_t goal = mapped > 0 && physical[mapped - 1] != 0 ? physical[mapped - 1] + 1 : inode_goal(fs, inode_number, &inode);
+    // a write that continues where the blocks of the previous one ended is appending
+    Reservation *reservation = fs_reservation(fs, inode_number, false);
+    bool appending = reservation != NULL && reservation->next == goal;
+    bool remapped = false;
+    for(size_t i = 0; i < count; ) {
+        if(!fresh[i]) {
+            goal = physical[i] + 1;
+            i++;
+            continue;
+        }
+        // a run of holes or of blocks to allocate, either all in the file or all past its end
+        bool old = first + i < old_blocks;
+        size_t j = i + 1;
+        while(j < count && fresh[j] && (first + j < old_blocks) == old && zero[j] == zero[i]) j++;
+        ssize_t done = j - i;
+        if(zero[i] && !old) done = inode_map_holes(fs, log, map, &inode, extents, inode_number, first + i, j - i, old_blocks, goal);
+        else if(!zero[i]) done = inode_allocate_blocks(fs, log, map, &inode, extents, inode_number, first + i, j - i, old_blocks, &goal, physical + i);
+        if(done < 0) goto failure;
+        remapped = remapped || (done > 0 && !(zero[i] && old));
+        // open handles resolved these blocks as holes
+        if(done > 0 && old) fs_files_moved(fs, inode_number, file);
+        if((size_t)done < j - i) {
+            count = i + done;
+            break;
+        }
+        i = j;
+    }
+    // the other walks of the file hold its indirect blocks from before the new pointers
+    if(remapped && map != NULL) fs_block_maps_changed(fs, inode_number, map);
+    if(appending && count > mapped) fs_reserve_window(fs, inode_number);
+    end = min(end, (first + count) * BLOCK_SIZE);
+    source.end = end;
+    source.cursor = 0;
+    // when the disk fills up before offset the part of the gap that got blocks is kept
+    bool no_space = end <= offset;
+    if(no_space) error("no space left to write to inode %zu", inode_number);
+    // a small file stays where it is until it has a block
+    if(prefix != NULL && count == 0) goto failure;
+
+    for(size_t window = 0; window < count; window += FS_IO_WINDOW) {
+        size_t n = min(FS_IO_WINDOW, count - window);
+        size_t read_numbers[FS_IO_WINDOW];
+        char *read_data[FS_IO_WINDOW];
+        size_t write_numbers[FS_IO_WINDOW];
+        char *write_data[FS_IO_WINDOW];
+        size_t write_blocks[FS_IO_WINDOW];
+        bool fill[FS_IO_WINDOW];
+        size_t reads = 0;
+        size_t writes = 0;
+        for(size_t b = window; b < window + n; b++) {
+            // holes stay holes
+            if(physical[b] == 0) continue;
+            const WriteSpan *span = &spans[b];
+            char *target;
+            fill[writes] = false;
+            if(span->direct != NULL) {
+                target = span->direct;
+            } else if(span->empty && (fresh[b] || !span->kept)) {
+                target = null_block;
+            } else if(staged == stages) {
+                error("write to inode %zu needs more than %zu stage blocks", inode_number, stages);
+                goto failure;
+            } else {
+                target = stage[staged++].data;
+                fill[writes] = true;
+                // partially covered blocks keep the bytes outside the write, read them in one batch
+                if(fresh[b]) {
+                    memset(target, 0, BLOCK_SIZE);
+                } else if(span->kept) {
+                    read_numbers[reads] = physical[b];
+                    read_data[reads++] = target;
                 }
-                disk_write(fs->disk, inode.direct[block_offset], (char*)(&buffer));
-                to_set_to_null -= BLOCK_SIZE - in_offset;
-                in_offset = 0;
             }
-            block_offset += 1;
+            write_numbers[writes] = physical[b];
+            write_blocks[writes] = b;
+            write_data[writes++] = target;
+        }
+        if(reads > 0 && !fs_transfer_blocks(fs, read_numbers, read_data, reads, false, DISK_TAG_DATA)) goto failure;
+        for(size_t i = 0; i < writes; i++) {
+            if(fill[i]) write_fill(&source, (first + write_blocks[i]) * BLOCK_SIZE, write_data[i]);
         }
+        if(writes > 0 && !fs_transfer_blocks(fs, write_numbers, write_data, writes, true, DISK_TAG_DATA)) goto failure;
     }
 
-    int left_to_write = length;
-    int block_offset = inode.size / BLOCK_SIZE;
-    int in_offset = offset/BLOCK_SIZE;
-    char * data_pointer;
-    while(left_to_write > 0) {
-         if (block_offset < 5) {
-            // handle direct
-            // read the corresponding block into buffer
-            Block buffer;
-            disk_read(fs->disk, inode.direct[block_offset], (char*)(&buffer));
+    if(map != NULL && !block_map_flush(fs, map)) goto failure;
+    // once the inode is full new extents always land in the extent block
+    if(remapped && extents != NULL && inode.extent_count > EXTENTS_PER_INODE && !inode_store_extents(fs, &inode, extents)) goto failure;
+    inode.size = max((size_t)inode.size, end);
+    if(set_inode(fs, &inode, inode_number) < 0) goto failure;
+    if(prefix != NULL && small.size > INLINE_DATA_SIZE) fs_tail_release(fs, &small);
+    fs_write_log_end(fs, log, true);
+    size_t written = 0;
+    for(size_t p = 0; p < npieces && pieces[p].offset < end; p++) {
+        written += min(pieces[p].offset + pieces[p].length, end) - pieces[p].offset;
+    }
+    free(prefix);
+    free(extents);
+    free(physical);
+    free(spans);
+    free(fresh);
+    fs_block_free(stage, stages + 1);
+    return no_space ? -1 : (ssize_t)written;
 
-            int bytes_to_write = BLOCK_SIZE - in_offset;
-            if(bytes_to_write > left_to_write) {
-                bytes_to_write = left_to_write;
-            }
-            memcpy(data_pointer, buffer.data + in_offset, bytes_to_write);
-            in_offset = 0;
-            data_pointer += bytes_to_write;
-            left_to_write -=  bytes_to_write;
-        } else{
-            // handle indirect
-            Block indirect_pointers;
-            // todo: optimize this so the indirect pointers are not read everytime
-            disk_read(fs->disk, inode.indirect, (char*)(&indirect_pointers));
-        
-            // read the corresponding block into buffer
-            Block buffer;
-            disk_read(fs->disk,  indirect_pointers.block_pointers[block_offset - POINTERS_PER_INODE], (char*)(&buffer));
-
-            int bytes_to_write = BLOCK_SIZE - in_offset;
-            if(bytes_to_write > left_to_write) {
-                bytes_to_write = left_to_write;
-            }
-            memcpy(data_pointer, buffer.data + in_offset, bytes_to_write);
-            in_offset = 0;
-            data_pointer += bytes_to_write;
-            left_to_write -=  bytes_to_write;
-        }
-        block_offset += 1;
+failure:
+    // the indirect blocks held by the walk may have changes the inode never got, and
+    // the ones it had to let go of on the way may already be on disk
+    if(map != NULL) fs_block_maps_changed(fs, inode_number, NULL);
+    fs_write_log_end(fs, log, false);
+    free(prefix);
+    free(extents);
+    free(physical);
+    free(spans);
+    free(fresh);
+    fs_block_free(stage, stages + 1);
+    return -1;
+}
+
+/**
+ * How a write fills the block that starts at block_start. Blocks have to be asked about in file order.
+ *
+ * @param       source          Bytes of the write, its cursor moves to the first piece that reaches the block.
+ * @param       block_start     Byte offset of the block.
+ * @return      What the block is written from and whether its old contents are needed.
+ **/
+WriteSpan write_span(WriteSource *source, size_t block_start) {
+    size_t block_end = block_start + BLOCK_SIZE;
+    size_t hi = min(block_end, source->end);
+    WriteSpan span = { .direct = NULL, .kept = false, .empty = true, .zero = true };
+    // bytes of a small file moving to blocks
+    if(block_start < source->prefix_length) {
+        span.empty = false;
+        span.zero = fs_zero_data(source->prefix + block_start, min(block_end, source->prefix_length) - block_start);
     }
+    const FsVector *pieces = source->pieces;
+    while(source->cursor < source->count && pieces[source->cursor].offset + pieces[source->cursor].length <= block_start) source->cursor++;
+    // bytes before covered that are below the old size are either written or kept
+    size_t covered = block_start;
+    for(size_t p = source->cursor; p < source->count && pieces[p].offset < hi; p++) {
+        size_t lo = max(pieces[p].offset, block_start);
+        size_t top = min(pieces[p].offset + pieces[p].length, hi);
+        if(lo == block_start && top == block_end) span.direct = pieces[p].data + (block_start - pieces[p].offset);
+        if(min(lo, source->size) > covered) span.kept = true;
+        covered = top;
+        span.empty = false;
+        span.zero = span.zero && fs_zero_data(pieces[p].data + (lo - pieces[p].offset), top - lo);
+    }
+    if(min(block_end, source->size) > covered) span.kept = true;
+    return span;
+}
 
-    return length;
+/**
+ * Put the bytes a write has for the block that starts at block_start into target, which holds the
+ * old contents of the block where they are kept. Blocks have to be filled in file order.
+ *
+ * @param       source          Bytes of the write, its cursor moves to the first piece that reaches the block.
+ * @param       block_start     Byte offset of the block.
+ * @param       target          BLOCK_SIZE buffer to fill.
+ **/
+void write_fill(WriteSource *source, size_t block_start, char *target) {
+    size_t block_end = block_start + BLOCK_SIZE;
+    size_t hi = min(block_end, source->end);
+    // past the old end of the file there is nothing to keep, the gap is null
+    size_t from = max(block_start, source->size);
+    if(from < block_end) memset(target + (from - block_start), 0, block_end - from);
+    // a small file moving to blocks fills the gap with its bytes first
+    if(block_start < source->prefix_length) memcpy(target, source->prefix + block_start, min(block_end, source->prefix_length) - block_start);
+    const FsVector *pieces = source->pieces;
+    while(source->cursor < source->count && pieces[source->cursor].offset + pieces[source->cursor].length <= block_start) source->cursor++;
+    for(size_t p = source->cursor; p < source->count && pieces[p].offset < hi; p++) {
+        size_t lo = max(pieces[p].offset, block_start);
+        size_t top = min(pieces[p].offset + pieces[p].length, hi);
+        memcpy(target + (lo - block_start), pieces[p].data + (lo - pieces[p].offset), top - lo);
+    }
 }
 
-ssize_t get_inode(FileSystem *fs, Inode *inode, size_t inode_number) {
-    if(fs == NULL || inode == NULL ){
-        return -1;
-    };
-    int inode_block_number = (inode_number / INODES_PER_BLOCK ) + 1;
-    if(inode_block_number > fs->meta.inode_blocks){
-        error("invalid Inode numbers given");
-        return -1;
+/**
+ * Sort pieces by their offset in the file. Pieces at the same offset keep their order.
+ * Insertion sort, pieces usually come in file order already and then it makes one pass.
+ *
+ * @param       pieces          Pieces to sort.
+ * @param       count           Number of pieces.
+ **/
+void fs_sort_vectors(FsVector *pieces, size_t count) {
+    for(size_t i = 1; i < count; i++) {
+        FsVector piece = pieces[i];
+        size_t j = i;
+        for(; j > 0 && pieces[j - 1].offset > piece.offset; j--) pieces[j] = pieces[j - 1];
+        pieces[j] = piece;
     }
-    int inode_offset = inode_number % INODES_PER_BLOCK;
-    Block block;
-    disk_read(fs->disk, inode_block_number, (char*)(&block));
-    if(!memcpy((char*)inode, (char*)(block.inodes + (sizeof(Inode) * inode_offset)), sizeof(Inode))){
-        error("failed to copy to inode");
-        return -1;
+}
+
+/**
+ * Whether length bytes are all null. The bytes are OR-ed together a 64 byte line at a time
+ * (eight words the compiler turns into vector instructions), the check stops at the first line that is not zero.
+ *
+ * @param       data            Bytes to check (may be NULL if length is 0).
+ * @param       length          Number of bytes.
+ * @return      Whether or not every byte is 0.
+ **/
+bool fs_zero_data(const char *data, size_t length) {
+    size_t i = 0;
+    for(; i + 64 <= length; i += 64) {
+        uint64_t words[8];
+        memcpy(words, data + i, sizeof(words));
+        uint64_t any = 0;
+        for(size_t w = 0; w < 8; w++) any |= words[w];
+        if(any != 0) return false;
     }
-    return 1;
+    for(; i < length; i++) {
+        if(data[i] != 0) return false;
+    }
+    return true;
 }
 
 /**
- * function that intializes and sets the free blocks bit map in memory
-**/
-bool fs_initialize_free_block_bitmap(FileSystem *fs){
-    // intialize free _blocks and also set all to true except inode and super block
-    fs->free_blocks = malloc(sizeof(bool) * fs->meta.blocks);
-    fs->free_blocks[0] = false;
-    for(int i = fs->meta.inode_blocks + 1; i < fs->meta.blocks; i++){
-        fs->free_blocks[i] = true;
-    }
-
-    Block inode_block;
-    // iterate through the inode blocks
-    for(size_t i = 1; i <= fs->meta.inode_blocks; i++){
-        // read the inode table from disk
-        if(disk_read(fs->disk, i, (char*)(&inode_block)) < 0){
-            error("error in reading from buffer");
-            return false;
+ * Make count blocks past the end of a file holes.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       log             Blocks the write took and gave up (NULL outside a write).
+ * @param       map             BlockMap of the Inode (NULL with extents).
+ * @param       inode           Inode to grow.
+ * @param       extents         Every extent of the Inode (NULL without extents).
+ * @param       inode_number    Inode being written.
+ * @param       logical         First block of the holes.
+ * @param       count           Number of blocks.
+ * @param       old_blocks      Number of blocks the file had before the write.
+ * @param       goal            Where an extent block would go.
+ * @return      Number of blocks made holes, fewer when the Inode has no room for another extent (-1 on error).
+ **/
+ssize_t inode_map_holes(FileSystem *fs, WriteLog *log, BlockMap *map, Inode *inode, Extent *extents, size_t inode_number, size_t logical, size_t count, size_t old_blocks, size_t goal) {
+    if(extents != NULL) return inode_hole_extents(fs, log, inode_number, inode, extents, count, goal) ? (ssize_t)count : 0;
+    for(size_t i = 0; i < count; i++) {
+        if(!block_map_hole(fs, map, inode, logical + i, max(old_blocks, logical + i))) return -1;
+    }
+    return count;
+}
+
+/**
+ * Allocate blocks for count logical blocks of a file that have none, the holes of the file or blocks past its end.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       log             Blocks the write took and gave up (NULL outside a write).
+ * @param       map             BlockMap of the Inode (NULL with extents).
+ * @param       inode           Inode to change.
+ * @param       extents         Every extent of the Inode (NULL without extents).
+ * @param       inode_number    Inode the blocks are for.
+ * @param       logical         First block.
+ * @param       count           Number of blocks, all holes or all past the end of the file.
+ * @param       old_blocks      Number of blocks the file had before the write.
+ * @param       goal            Where to allocate, moved past the new blocks.
+ * @param       physical        Filled with the allocated blocks.
+ * @return      Number of blocks allocated, fewer when the disk is full (-1 on error).
+ **/
+ssize_t inode_allocate_blocks(FileSystem *fs, WriteLog *log, BlockMap *map, Inode *inode, Extent *extents, size_t inode_number, size_t logical, size_t count, size_t old_blocks, size_t *goal, size_t *physical) {
+    size_t i = 0;
+    if(extents != NULL && logical >= old_blocks) {
+        i = inode_allocate_extents(fs, log, inode_number, inode, extents, *goal, count, physical);
+    }
+    while(extents != NULL && logical < old_blocks && i < count) {
+        size_t run = inode_fill_extents(fs, log, inode_number, inode, extents, logical + i, *goal, count - i, physical + i);
+        if(run == 0) break;
+        i += run;
+        *goal = physical[i - 1] + 1;
+    }
+    if(extents != NULL) {
+        if(i > 0) *goal = physical[i - 1] + 1;
+        return i;
+    }
+    while(i < count) {
+        size_t block_logical = logical + i;
+        // the indirect blocks a new block needs are allocated in front of it, runs stop where
+        // the next indirect block begins so it sits in front of the blocks it maps
+        if(!block_map_prepare(fs, log, map, inode, block_logical, max(old_blocks, block_logical), goal)) break;
+        size_t block;
+        size_t run = fs_allocate_file_run(fs, log, inode_number, *goal, min(count - i, block_map_boundary(fs, block_logical)), &block);
+        if(run == 0) break;
+        for(size_t j = 0; j < run; j++, i++) {
+            physical[i] = block + j;
+            if(!block_map_assign(fs, map, inode, logical + i, block + j)) return -1;
         }
-        // iterate through the ivinodes, if valid then find the blocks its points to and mark them as used
-        for(int idx = 0; idx < INODES_PER_BLOCK; idx++){
-            if(inode_block.inodes[idx].valid == 1){
-                // for each direct pointer to block, we set the free block entry of that block to false
-                for(int j = 0; j < POINTERS_PER_INODE; j++){
-                    if(inode_block.inodes[idx].direct[j] > fs->meta.inode_blocks && inode_block.inodes[idx].direct[j] < fs->meta.blocks) {
-                        fs->free_blocks[inode_block.inodes[idx].direct[j]] = false;
-                    }
-                }
-                // Check if the size is bigger than total number of direct pointers to block
-                // in which case we can set the indirect block to false, it is being used as a block that holds pointers to other blocks
-                if(inode_block.inodes[idx].size > POINTERS_PER_INODE * BLOCK_SIZE) {
-                    fs->free_blocks[inode_block.inodes[idx].indirect] = false;
-
-                    // Read the pointer block from memory 
-                    Block block_pointers;
-                    if(disk_read(fs->disk, inode_block.inodes[idx].indirect, (char*)(&block_pointers)) != BLOCK_SIZE) return false;
-
-                    // Calculate left over in bytes
-                    ssize_t leftoverblocks_bytes = (inode_block.inodes[idx].size - (POINTERS_PER_INODE * BLOCK_SIZE));
-                    size_t curr = 0;
-
-                    // while there are still bytes that are left over, we set the free blocks to false
-                    while(leftoverblocks_bytes > 0){
-                        fs->free_blocks[block_pointers.block_pointers[curr]] = false;
-                        leftoverblocks_bytes -= BLOCK_SIZE;
-                        curr += 1;
-                    }
-                }
+        *goal = block + run;
+    }
+    return i;
+}
+
+/**
+ * Allocate the blocks of an Inode from offset to offset + length ahead of the writes that will fill
+ * them, without changing its size. Holes in the file get blocks of null bytes. The blocks past its
+ * end are not written, they are reserved in one run as the reservation window of the file and its
+ * appends take them from there. Like any window they are given back when the file is released,
+ * removed or the file system unmounted, or when other files run short of space.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode to allocate blocks for.
+ * @param       offset          Byte offset the range starts at.
+ * @param       length          Number of bytes in the range.
+ * @return      Whether or not the whole range has blocks (on a full or fragmented disk the blocks that could be had are kept).
+ **/
+bool fs_fallocate(FileSystem *fs, size_t inode_number, size_t offset, size_t length) {
+    Inode inode;
+    if(fs == NULL || length == 0 || get_inode(fs, &inode, inode_number) < 0 || !inode.valid) return false;
+    size_t size = inode.size;
+    size_t end = offset + length;
+    size_t max_size = fs_uses_extents(fs) ? UINT32_MAX : min(fs_max_blocks(fs) * BLOCK_SIZE, (size_t)UINT32_MAX);
+    if(end > max_size) return false;
+    // writing null bytes over a hole does not change what it reads as
+    if(offset < size && !fs_small_file(fs, &inode)) {
+        size_t first = offset / BLOCK_SIZE;
+        size_t count = (min(end, size) - 1) / BLOCK_SIZE - first + 1;
+        size_t *physical = malloc(count * sizeof(size_t));
+        char *zeroes = calloc(FS_IO_WINDOW, BLOCK_SIZE);
+        bool success = physical != NULL && zeroes != NULL && inode_map_blocks(fs, inode_number, &inode, first, count, physical);
+        for(size_t i = 0; success && i < count; ) {
+            size_t j = i;
+            while(j < count && j - i < FS_IO_WINDOW && physical[j] == 0) j++;
+            if(j == i) {
+                i++;
+                continue;
             }
+            size_t hole = (first + i) * BLOCK_SIZE;
+            FsVector piece = { .data = zeroes, .length = min((j - i) * BLOCK_SIZE, size - hole), .offset = hole };
+            success = fs_write_range(fs, inode_number, &piece, 1, false, NULL) == (ssize_t)piece.length;
+            i = j;
         }
+        free(physical);
+        free(zeroes);
+        if(!success) return false;
     }
-    return true;
+    if(end <= size) return true;
+
+    // a small file moves to blocks as a whole when it grows past FS_TAIL_MAX, from the start of its group
+    if(fs_small_file(fs, &inode)) {
+        if(end <= FS_TAIL_MAX) return true;
+        inode.size = 0;
+    }
+    size_t blocks = (inode.size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    size_t needed = (end + BLOCK_SIZE - 1) / BLOCK_SIZE - blocks;
+    if(needed == 0) return true;
+    size_t goal = inode_goal(fs, inode_number, &inode);
+    // the range replaces the window the file had, windows of other files go only when space runs short
+    fs_release_reservation(fs, inode_number);
+    size_t start;
+    size_t run = fs_allocate_run(fs, goal, needed, &start);
+    if(run < needed && __atomic_load_n(&fs->free_count, __ATOMIC_RELAXED) < needed - run && fs_release_reservations(fs) > 0) {
+        if(run > 0) fs_release_run(fs, start, run);
+        run = fs_allocate_run(fs, goal, needed, &start);
+    }
+    if(run == 0) {
+        error("no space left to reserve blocks for inode %zu", inode_number);
+        return false;
+    }
+    Reservation *reservation = fs_reservation(fs, inode_number, true);
+    if(reservation == NULL) {
+        error("no reservation window left for inode %zu", inode_number);
+        fs_release_run(fs, start, run);
+        return false;
+    }
+    // the windows reserved once the range is used up start small again
+    *reservation = (Reservation){ .valid = true, .inode_number = inode_number, .next = goal, .start = start, .count = run };
+    return run == needed;
 }
 
+/**
+ * Open an Inode. The handle keeps a reference to the Inode in the inode cache and resolves the
+ * blocks of the file as its reads reach them, each block once.
+ * Without an inode cache the disk keeps its blocks in memory and the Inode is copied from there.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode to open.
+ * @return      Handle positioned at the start of the file (NULL if the Inode is not valid).
+ **/
+File* fs_open(FileSystem *fs, size_t inode_number) {
+    if(fs == NULL) return NULL;
+    if(fs_inode_block(fs, inode_number) == 0) {
+        error("invalid Inode numbers given");
+        return NULL;
+    }
+    File *file = calloc(1, sizeof(File));
+    if(file == NULL) return NULL;
+    file->fs = fs;
+    file->inode_number = inode_number;
+    file->edges = fs_block_alloc(2);
+    if(fs->icache) file->inode = icache_get(fs->icache, inode_number, true);
+    const Inode *inode = file->edges != NULL && (fs->icache == NULL || file->inode != NULL) ? fs_file_inode(file) : NULL;
+    if(inode == NULL || !inode->valid) {
+        error("unable to open inode %zu", inode_number);
+        fs_close(file);
+        return NULL;
+    }
+    file->next = fs->files;
+    fs->files = file;
+    return file;
+}
 
 /**
- * function that intialize the fs meta from the super block on disk
- * 1. if any of fs, disk or super_block is NUll, then return
- * 2. set fs disk
- * 3. set mounted = true
- * 4. set fs meta
-**/
-bool fs_initialize_meta(FileSystem *fs, Block* super_block, Disk* disk){
-    if (fs == NULL || super_block == NULL || disk == NULL) return false;
-    fs->disk = disk;
-    disk->mounted = true;
+ * Close a handle, the reference to its Inode is given back. The blocks reserved for appends are given
+ * back as well when the file was written through the handle.
+ *
+ * @param       file            Handle returned by fs_open (NULL is ignored).
+ **/
+void fs_close(File *file) {
+    if(file == NULL) return;
+    File **link = &file->fs->files;
+    while(*link != NULL && *link != file) link = &(*link)->next;
+    if(*link != NULL) *link = file->next;
+    if(file->written) fs_release_reservation(file->fs, file->inode_number);
+    if(file->inode != NULL) icache_put(file->fs->icache, file->inode, false);
+    fs_block_free(file->map.buffers, FS_INDIRECT_LEVELS);
+    free(file->blocks);
+    fs_block_free(file->edges, 2);
+    free(file);
+}
+
+/**
+ * Read up to length bytes from the position of a handle and move the position past them. The blocks
+ * come from the ones the handle resolved, like fs_read otherwise.
+ *
+ * @param       file            Handle returned by fs_open.
+ * @param       data            Buffer to read into.
+ * @param       length          Number of bytes to read.
+ * @return      Number of bytes read (0 at end of file, -1 on error).
+ **/
+ssize_t fs_file_read(File *file, char *data, size_t length) {
+    if(file == NULL || data == NULL) return -1;
+    FileSystem *fs = file->fs;
+    const Inode *inode = fs_file_inode(file);
+    if(inode == NULL || !inode->valid) return -1;
+    size_t offset = file->position;
+    if(offset >= inode->size || length == 0) return 0;
+    length = min(length, inode->size - offset);
+
+    bool success;
+    if(fs_small_file(fs, inode)) {
+        success = fs_read_small(fs, inode, data, length, offset);
+    } else {
+        size_t first = offset / BLOCK_SIZE;
+        size_t count = (offset + length - 1) / BLOCK_SIZE - first + 1;
+        success = fs_file_map(file, inode, first + count + fs_readahead_limit(fs));
+        if(success) {
+            fs_readahead(fs, file->inode_number, inode, offset, length, file->blocks + first, count, file->blocks);
+            success = fs_read_range(fs, file->blocks + first, count, data, offset % BLOCK_SIZE, length, file->edges);
+            if(!success) error("error reading data blocks of inode %zu", file->inode_number);
+        }
+    }
+    if(!success) return -1;
+    file->position += length;
+    return length;
+}
+
+/**
+ * Write length bytes at the position of a handle (see fs_write) and move the position past them.
+ *
+ * @param       file            Handle returned by fs_open.
+ * @param       data            Buffer with data to copy
+ * @param       length          Number of bytes to write.
+ * @return      Number of bytes written (-1 on error).
+ **/
+ssize_t fs_file_write(File *file, char *data, size_t length) {
+    if(file == NULL || data == NULL) return -1;
+    if(length == 0) return 0;
+    FileSystem *fs = file->fs;
+    FsVector piece = { .data = data, .length = length, .offset = file->position };
+    ssize_t written = fs_write_range(fs, file->inode_number, &piece, 1, true, file);
+    file->written = true;
+    // holes from the first block written on may have blocks now
+    file->mapped = min(file->mapped, file->position / BLOCK_SIZE);
+    if(written > 0) file->position += written;
+    return written;
+}
+
+/**
+ * Move the position of a handle.
+ *
+ * @param       file            Handle returned by fs_open.
+ * @param       position        Byte offset the next read or write starts at, it may lie past the end of the file.
+ * @return      Whether or not the position was moved.
+ **/
+bool fs_file_seek(File *file, size_t position) {
+    if(file == NULL || position > UINT32_MAX) return false;
+    file->position = position;
+    return true;
+}
+
+/**
+ * Inode of a handle, the pinned one in the inode cache or a fresh copy.
+ *
+ * @param       file            Handle returned by fs_open.
+ * @return      Pointer to the Inode (NULL on error).
+ **/
+const Inode* fs_file_inode(File *file) {
+    if(file->inode != NULL) return file->inode;
+    return get_inode(file->fs, &file->copy, file->inode_number) < 0 ? NULL : &file->copy;
+}
+
+/**
+ * Resolve the blocks of a handle's file up to end (or its size) through its BlockMap, the blocks after
+ * it are left until a read gets near them. Blocks resolved before are kept until a hole of the file gets
+ * a block (or the file is removed), see fs_files_moved.
+ *
+ * @param       file            Handle returned by fs_open.
+ * @param       inode           Its Inode.
+ * @param       end             Logical block to resolve up to (excluded).
+ * @return      Whether or not every block could be resolved.
+ **/
+bool fs_file_map(File *file, const Inode *inode, size_t end) {
+    FileSystem *fs = file->fs;
+    size_t file_blocks = (inode->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    size_t blocks = min(end, file_blocks);
+    if(file->mapped >= blocks) return true;
+    if(blocks > file->capacity) {
+        size_t capacity = max(blocks, min(2 * file->capacity, file_blocks));
+        size_t *resized = realloc(file->blocks, capacity * sizeof(size_t));
+        if(resized == NULL) return false;
+        file->blocks = resized;
+        file->capacity = capacity;
+    }
+    size_t *physical = file->blocks + file->mapped;
+    if(fs_uses_extents(fs)) {
+        if(!inode_map_extents(fs, inode, file->mapped, blocks - file->mapped, physical)) return false;
+    } else {
+        BlockMap *map = block_map_bind(&file->map, file->inode_number);
+        if(map == NULL || !block_map_resolve(fs, map, inode, file->mapped, blocks - file->mapped, physical)) return false;
+    }
+    file->mapped = blocks;
+    return true;
+}
+
+/**
+ * Copy the specified Inode out of the inode cache, or out of the inode table when there is none.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode           Inode to copy into.
+ * @param       inode_number    Inode to look up.
+ * @return      0 on success (-1 on error).
+ **/
+ssize_t get_inode(FileSystem *fs, Inode *inode, size_t inode_number) {
+    if(fs == NULL || inode == NULL ){
+        return -1;
+    };
+    size_t inode_block_number = fs_inode_block(fs, inode_number);
+    if(inode_block_number == 0){
+        error("invalid Inode numbers given");
+        return -1;
+    }
+    if(fs->icache) {
+        const Inode *cached = icache_get(fs->icache, inode_number, true);
+        if(cached == NULL) return -1;
+        *inode = *cached;
+        icache_put(fs->icache, cached, false);
+        return 0;
+    }
+    int inode_offset = inode_number % INODES_PER_BLOCK;
+    Block *buffer = fs_block_alloc(1);
+    if(buffer == NULL) return -1;
+    const Block *block = read_block_view(fs, inode_block_number, buffer, DISK_TAG_INODE);
+    if(block != NULL) *inode = block->inodes[inode_offset];
+    fs_block_free(buffer, 1);
+    return block == NULL ? -1 : 0;
+}
+
+/**
+ * Return a read-only view of a block. On a memory mapped disk this is a pointer into the
+ * mapping and nothing is copied, otherwise the block is read through the block cache into the caller's buffer.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       block_number    Block to view.
+ * @param       buffer          Fallback buffer for disks that are not mapped.
+ * @param       tag             DISK_TAG_* the read is accounted to.
+ * @return      Pointer to the block contents (NULL on error).
+ **/
+const Block* read_block_view(FileSystem *fs, size_t block_number, Block *buffer, int tag) {
+    const char *mapped = disk_map_block(fs->disk, block_number);
+    if(mapped) return (const Block*)mapped;
+    if(fs_read_block(fs, block_number, buffer->data, tag) != BLOCK_SIZE) return NULL;
+    return buffer;
+}
+
+/**
+ * Read several blocks at once and return a read-only view of each. On a memory mapped disk
+ * the views point into the mapping, otherwise the blocks missing from the block cache are
+ * submitted to the disk together and everything is read into the caller's buffers.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       block_numbers   Blocks to view (at most FS_IO_WINDOW).
+ * @param       buffers         Fallback buffers for disks that are not mapped, one per block.
+ * @param       views           Filled with a pointer to the contents of each block.
+ * @param       count           Number of blocks.
+ * @param       tag             DISK_TAG_* the reads are accounted to.
+ * @return      Whether or not every block could be read.
+ **/
+bool read_block_views(FileSystem *fs, const size_t *block_numbers, Block *buffers, const Block **views, size_t count, int tag) {
+    if(count > FS_IO_WINDOW) return false;
+    size_t numbers[FS_IO_WINDOW];
+    char *data[FS_IO_WINDOW];
+    size_t reads = 0;
+    for(size_t i = 0; i < count; i++) {
+        if((views[i] = (const Block*)disk_map_block(fs->disk, block_numbers[i]))) continue;
+        numbers[reads] = block_numbers[i];
+        data[reads++] = buffers[i].data;
+        views[i] = &buffers[i];
+    }
+    return reads == 0 || fs_transfer_blocks(fs, numbers, data, reads, false, tag);
+}
+
+/**
+ * Read a block through the block cache (straight from the disk when there is no cache).
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       block_number    Block to read.
+ * @param       data            BLOCK_SIZE buffer to read into.
+ * @param       tag             DISK_TAG_* the read is accounted to in the disk statistics.
+ * @return      BLOCK_SIZE on success (DISK_FAILURE on error).
+ **/
+ssize_t fs_read_block(FileSystem *fs, size_t block_number, char *data, int tag) {
+    int previous = disk_tag(fs->disk, tag);
+    ssize_t result = fs->cache ? cache_read(fs->cache, block_number, data)
+                               : disk_read(fs->disk, block_number, data);
+    disk_tag(fs->disk, previous);
+    return result;
+}
+
+/**
+ * Write a block through the block cache. With a cache the block reaches the disk
+ * when it is evicted or flushed.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       block_number    Block to write.
+ * @param       data            BLOCK_SIZE buffer to write from.
+ * @param       tag             DISK_TAG_* the write is accounted to, also when the cache writes it back later.
+ * @return      BLOCK_SIZE on success (DISK_FAILURE on error).
+ **/
+ssize_t fs_write_block(FileSystem *fs, size_t block_number, char *data, int tag) {
+    int previous = disk_tag(fs->disk, tag);
+    ssize_t result = fs->cache ? cache_write(fs->cache, block_number, data)
+                               : disk_write(fs->disk, block_number, data);
+    disk_tag(fs->disk, previous);
+    return result;
+}
+
+/**
+ * Read or write several blocks through the block cache. Without a cache all blocks
+ * are submitted to the disk in one batch.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       block_numbers   Blocks to transfer (at most FS_IO_WINDOW).
+ * @param       data            One BLOCK_SIZE buffer per block.
+ * @param       count           Number of blocks.
+ * @param       write           Whether to write the blocks instead of reading them.
+ * @param       tag             DISK_TAG_* the transfers are accounted to.
+ * @return      Whether or not every block was transferred.
+ **/
+bool fs_transfer_blocks(FileSystem *fs, const size_t *block_numbers, char **data, size_t count, bool write, int tag) {
+    if(!fs->cache && count > FS_IO_WINDOW) return false;
+    int previous = disk_tag(fs->disk, tag);
+    ssize_t result;
+    if(fs->cache) {
+        result = write ? cache_write_list(fs->cache, block_numbers, data, count)
+                       : cache_read_list(fs->cache, block_numbers, data, count);
+    } else {
+        DiskRequest requests[FS_IO_WINDOW];
+        for(size_t i = 0; i < count; i++) {
+            requests[i] = (DiskRequest){ .block = block_numbers[i], .data = data[i], .write = write };
+        }
+        result = disk_batch(fs->disk, requests, count);
+    }
+    disk_tag(fs->disk, previous);
+    return result != DISK_FAILURE;
+}
+
+/**
+ * Write the specified Inode back into the inode table. With an inode cache only the cached
+ * copy is replaced, nothing is read, and the table block is written when the inode is flushed.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode           Inode to save.
+ * @param       inode_number    Inode to overwrite.
+ * @return      0 on success (-1 on error).
+ **/
+ssize_t set_inode(FileSystem *fs, const Inode *inode, size_t inode_number) {
+    size_t inode_block_number = fs_inode_block(fs, inode_number);
+    if(inode_block_number == 0) return -1;
+    if(fs->icache) {
+        Inode *cached = icache_get(fs->icache, inode_number, false);
+        if(cached == NULL) return -1;
+        *cached = *inode;
+        icache_put(fs->icache, cached, true);
+        return 0;
+    }
+    Block *block = fs_block_alloc(1);
+    bool success = block != NULL && fs_read_block(fs, inode_block_number, block->data, DISK_TAG_INODE) == BLOCK_SIZE;
+    if(success) {
+        block->inodes[inode_number % INODES_PER_BLOCK] = *inode;
+        success = fs_write_block(fs, inode_block_number, block->data, DISK_TAG_INODE) != DISK_FAILURE;
+    }
+    fs_block_free(block, 1);
+    return success ? 0 : -1;
+}
+
+/**
+ * Load an Inode out of the inode table for the inode cache.
+ *
+ * @param       context         Pointer to FileSystem structure.
+ * @param       inode_number    Inode to load.
+ * @param       record          Inode to copy into.
+ * @return      Whether or not its table block could be read.
+ **/
+bool fs_load_inode(void *context, size_t inode_number, void *record) {
+    FileSystem *fs = context;
+    Block *buffer = fs_block_alloc(1);
+    const Block *block = buffer ? read_block_view(fs, fs_inode_block(fs, inode_number), buffer, DISK_TAG_INODE) : NULL;
+    if(block != NULL) *(Inode*)record = block->inodes[inode_number % INODES_PER_BLOCK];
+    fs_block_free(buffer, 1);
+    return block != NULL;
+}
+
+/**
+ * Store dirty Inodes of the inode cache in the inode table. The Inodes come sorted, so
+ * each table block is read and written once for all of its Inodes.
+ *
+ * @param       context         Pointer to FileSystem structure.
+ * @param       numbers         Inodes to store, in ascending order.
+ * @param       records         Their contents.
+ * @param       count           Number of Inodes.
+ * @return      Whether or not every table block was written.
+ **/
+bool fs_store_inodes(void *context, const size_t *numbers, const void *const *records, size_t count) {
+    FileSystem *fs = context;
+    Block *block = fs_block_alloc(1);
+    bool success = block != NULL;
+    for(size_t start = 0; success && start < count; ) {
+        size_t block_number = fs_inode_block(fs, numbers[start]);
+        size_t end = start;
+        success = fs_read_block(fs, block_number, block->data, DISK_TAG_INODE) == BLOCK_SIZE;
+        for(; success && end < count && fs_inode_block(fs, numbers[end]) == block_number; end++) {
+            block->inodes[numbers[end] % INODES_PER_BLOCK] = *(const Inode*)records[end];
+        }
+        success = success && fs_write_block(fs, block_number, block->data, DISK_TAG_INODE) != DISK_FAILURE;
+        start = end;
+    }
+    fs_block_free(block, 1);
+    return success;
+}
+
+/**
+ * Resolve count logical blocks of an Inode, starting at first, to their physical block numbers,
+ * holes resolve to block 0. The blocks must lie within the size of the Inode. The indirect blocks are walked through the
+ * BlockMap of the Inode, so each of them is read at most once for a range of blocks.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode to map.
+ * @param       inode           Its contents.
+ * @param       first           First logical block.
+ * @param       count           Number of logical blocks.
+ * @param       physical        Filled with the physical block number of each logical block.
+ * @return      Whether or not every block could be resolved.
+ **/
+bool inode_map_blocks(FileSystem *fs, size_t inode_number, const Inode *inode, size_t first, size_t count, size_t *physical) {
+    if(fs_uses_extents(fs)) return inode_map_extents(fs, inode, first, count, physical);
+    BlockMap *map = fs_block_map(fs, inode_number);
+    return map != NULL && block_map_resolve(fs, map, inode, first, count, physical);
+}
+
+/**
+ * Map a range of logical blocks of an Inode with block pointers to physical blocks through a BlockMap.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       map             BlockMap of the Inode.
+ * @param       inode           Its contents.
+ * @param       first           First logical block.
+ * @param       count           Number of logical blocks.
+ * @param       physical        Filled with the physical block number of each logical block.
+ * @return      Whether or not every block could be resolved.
+ **/
+bool block_map_resolve(FileSystem *fs, BlockMap *map, const Inode *inode, size_t first, size_t count, size_t *physical) {
+    for(size_t i = 0; i < count; i++) {
+        if(!block_map_lookup(fs, map, inode, first + i, &physical[i])) return false;
+        // a pointer into the superblock, the bitmaps or the inode table means the inode is corrupt
+        if(physical[i] != 0 && !fs_data_block(fs, physical[i])) {
+            error("invalid block %zu in inode map", physical[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Block a growing Inode continues at, the one after its last block. An empty file, or one that
+ * ends in a hole, starts at the first data block of the group of its inode.
+ **/
+size_t inode_goal(FileSystem *fs, size_t inode_number, const Inode *inode) {
+    size_t blocks = (inode->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    size_t last;
+    if(blocks > 0 && inode_map_blocks(fs, inode_number, inode, blocks - 1, 1, &last) && last != 0) return last + 1;
+    return fs->groups[inode_number / fs->groups[0].inodes].data_start;
+}
+
+/**
+ * Number of direct pointers of an Inode, the indirect blocks map the blocks after them.
+ **/
+size_t fs_direct_pointers(const FileSystem *fs) {
+    return (fs->meta.features & FS_FEATURE_TRIPLE_INDIRECT) ? DIRECT_POINTERS_DEEP : POINTERS_PER_INODE;
+}
+
+/**
+ * Number of levels of indirect blocks an Inode can have.
+ **/
+size_t fs_indirect_levels(const FileSystem *fs) {
+    return (fs->meta.features & FS_FEATURE_TRIPLE_INDIRECT) ? FS_INDIRECT_LEVELS : 1;
+}
+
+/**
+ * Most blocks a file can have.
+ **/
+size_t fs_max_blocks(const FileSystem *fs) {
+    size_t blocks = fs_direct_pointers(fs);
+    for(size_t level = 1; level <= fs_indirect_levels(fs); level++) blocks += indirect_span(level);
+    return blocks;
+}
+
+/**
+ * Number of data blocks beneath an indirect block of a level (1 for level 0, the data blocks themselves).
+ **/
+size_t indirect_span(size_t level) {
+    size_t span = 1;
+    for(size_t l = 0; l < level; l++) span *= POINTERS_PER_BLOCK;
+    return span;
+}
+
+/**
+ * Index in Inode.pointers of the top indirect block of a level.
+ **/
+size_t inode_tree_root(size_t level) {
+    return level == 1 ? POINTERS_PER_INODE : DIRECT_POINTERS_DEEP + level - 2;
+}
+
+/**
+ * Find the indirect block at the top of the tree that maps a logical block of a file.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       logical         Logical block past the direct pointers.
+ * @param       tree_first      Set to the first logical block the tree maps.
+ * @return      Level of the top indirect block (0 if the block is past the largest file).
+ **/
+size_t inode_tree(const FileSystem *fs, size_t logical, size_t *tree_first) {
+    size_t first = fs_direct_pointers(fs);
+    for(size_t level = 1; level <= fs_indirect_levels(fs); level++) {
+        if(logical < first + indirect_span(level)) {
+            *tree_first = first;
+            return level;
+        }
+        first += indirect_span(level);
+    }
+    return 0;
+}
+
+/**
+ * Return the BlockMap of an Inode, the slot starts over when it held another Inode.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode being mapped.
+ * @return      Pointer to the BlockMap (NULL if its buffers could not be allocated).
+ **/
+BlockMap* fs_block_map(FileSystem *fs, size_t inode_number) {
+    return block_map_bind(&fs->maps[inode_number % FS_READAHEAD_SLOTS], inode_number);
+}
+
+/**
+ * Prepare a BlockMap for walks of an Inode, it starts over when it held another Inode or was dropped.
+ *
+ * @param       map             BlockMap to use.
+ * @param       inode_number    Inode being mapped.
+ * @return      Pointer to the BlockMap (NULL if its buffers could not be allocated).
+ **/
+BlockMap* block_map_bind(BlockMap *map, size_t inode_number) {
+    if(map->buffers == NULL && (map->buffers = fs_block_alloc(FS_INDIRECT_LEVELS)) == NULL) return NULL;
+    if(!map->valid || map->inode_number != inode_number) {
+        block_map_invalidate(map);
+        map->valid = true;
+        map->inode_number = inode_number;
+    }
+    return map;
+}
+
+/**
+ * Drop the BlockMaps holding indirect blocks of an Inode that changed, the one of its slot and those
+ * of its open handles, except the one the change was made through.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode whose indirect blocks changed.
+ * @param       current         BlockMap that made the change and holds them as they are now (NULL drops them all).
+ **/
+void fs_block_maps_changed(FileSystem *fs, size_t inode_number, const BlockMap *current) {
+    BlockMap *map = &fs->maps[inode_number % FS_READAHEAD_SLOTS];
+    if(map != current && map->inode_number == inode_number) block_map_invalidate(map);
+    for(File *file = fs->files; file != NULL; file = file->next) {
+        if(&file->map != current && file->inode_number == inode_number) block_map_invalidate(&file->map);
+    }
+}
+
+/**
+ * Have the open handles of an Inode resolve its blocks again, a hole got a block or the Inode was removed.
+ * The handle the write goes through only resolves the blocks from its position on again, see fs_file_write.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode whose blocks moved.
+ * @param       writer          Handle the write goes through (NULL if none).
+ **/
+void fs_files_moved(FileSystem *fs, size_t inode_number, const File *writer) {
+    for(File *file = fs->files; file != NULL; file = file->next) {
+        if(file != writer && file->inode_number == inode_number) file->mapped = 0;
+    }
+}
+
+/**
+ * Forget the indirect blocks held by a BlockMap, changes that were not flushed are dropped.
+ **/
+void block_map_invalidate(BlockMap *map) {
+    map->valid = false;
+    for(size_t l = 0; l < FS_INDIRECT_LEVELS; l++) {
+        map->blocks[l] = 0;
+        map->dirty[l] = false;
+    }
+}
+
+/**
+ * Write the changed indirect blocks held by a BlockMap back.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       map             BlockMap to flush.
+ * @return      Whether or not every changed block could be written.
+ **/
+bool block_map_flush(FileSystem *fs, BlockMap *map) {
+    for(size_t l = 0; l < FS_INDIRECT_LEVELS; l++) {
+        if(!map->dirty[l]) continue;
+        if(fs_write_block(fs, map->blocks[l], map->buffers[l].data, DISK_TAG_INDIRECT) == DISK_FAILURE) return false;
+        map->dirty[l] = false;
+    }
+    return true;
+}
+
+/**
+ * Hold an indirect block in a BlockMap, reading it unless it is already held.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       map             BlockMap of the Inode.
+ * @param       level           Level of the indirect block.
+ * @param       block_number    Indirect block.
+ * @param       first           First logical block it maps.
+ * @param       fresh           Whether the block was just allocated, it is zeroed instead of read.
+ * @return      Pointer to its contents (NULL on error).
+ **/
+Block* block_map_node(FileSystem *fs, BlockMap *map, size_t level, size_t block_number, size_t first, bool fresh) {
+    size_t l = level - 1;
+    Block *buffer = &map->buffers[l];
+    if(!fresh && map->blocks[l] == block_number && map->first[l] == first) return buffer;
+    if(map->dirty[l] && fs_write_block(fs, map->blocks[l], buffer->data, DISK_TAG_INDIRECT) == DISK_FAILURE) return NULL;
+    map->blocks[l] = 0;
+    map->dirty[l] = false;
+    if(fresh) {
+        memset(buffer->data, 0, BLOCK_SIZE);
+    } else if(!fs_data_block(fs, block_number)) {
+        error("invalid indirect block %zu in inode map", block_number);
+        return NULL;
+    } else if(fs_read_block(fs, block_number, buffer->data, DISK_TAG_INDIRECT) != BLOCK_SIZE) {
+        return NULL;
+    }
+    map->blocks[l] = block_number;
+    map->first[l] = first;
+    map->dirty[l] = fresh;
+    return buffer;
+}
+
+/**
+ * Walk down to the indirect block of level 1 that maps a logical block. The walk starts from
+ * the lowest indirect block held by the BlockMap that covers the block, from the inode otherwise.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       map             BlockMap of the Inode.
+ * @param       inode           Inode to walk.
+ * @param       logical         Logical block past the direct pointers.
+ * @return      Index of the pointer to the block in map->buffers[0] (-2 if an indirect block on the way is a hole, -1 on error).
+ **/
+ssize_t block_map_walk(FileSystem *fs, BlockMap *map, const Inode *inode, size_t logical) {
+    size_t tree_first;
+    size_t top = inode_tree(fs, logical, &tree_first);
+    if(top == 0) return -1;
+    size_t level = 1;
+    while(level <= top && !(map->blocks[level - 1] && logical >= map->first[level - 1] && logical - map->first[level - 1] < indirect_span(level))) level++;
+    size_t node = inode->pointers[inode_tree_root(top)];
+    size_t node_first = tree_first;
+    if(level <= top) {
+        node = map->blocks[level - 1];
+        node_first = map->first[level - 1];
+    } else {
+        level = top;
+    }
+    for(; level > 1; level--) {
+        if(node == 0) return -2;
+        Block *pointers = block_map_node(fs, map, level, node, node_first, false);
+        if(pointers == NULL) return -1;
+        size_t span = indirect_span(level - 1);
+        size_t index = (logical - node_first) / span;
+        node = pointers->block_pointers[index];
+        node_first += index * span;
+    }
+    if(node == 0) return -2;
+    if(block_map_node(fs, map, 1, node, node_first, false) == NULL) return -1;
+    return logical - node_first;
+}
+
+/**
+ * Look up the physical block of a logical block of an Inode.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       map             BlockMap of the Inode.
+ * @param       inode           Inode to look in.
+ * @param       logical         Logical block within the size of the Inode.
+ * @param       physical        Set to its physical block (0 for a hole).
+ * @return      Whether or not the block could be looked up.
+ **/
+bool block_map_lookup(FileSystem *fs, BlockMap *map, const Inode *inode, size_t logical, size_t *physical) {
+    if(logical < fs_direct_pointers(fs)) {
+        *physical = inode->pointers[logical];
+        return true;
+    }
+    ssize_t index = block_map_walk(fs, map, inode, logical);
+    if(index == -2) {
+        *physical = 0;
+        return true;
+    }
+    if(index < 0) return false;
+    *physical = map->buffers[0].block_pointers[index];
+    return true;
+}
+
+/**
+ * Point a logical block of an Inode to a physical block. The indirect blocks on the way
+ * must exist, block_map_prepare allocates them.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       map             BlockMap of the Inode.
+ * @param       inode           Inode to change.
+ * @param       logical         Logical block.
+ * @param       block_number    Physical block.
+ * @return      Whether or not the indirect blocks could be read.
+ **/
+bool block_map_assign(FileSystem *fs, BlockMap *map, Inode *inode, size_t logical, size_t block_number) {
+    if(logical < fs_direct_pointers(fs)) {
+        inode->pointers[logical] = block_number;
+        return true;
+    }
+    ssize_t index = block_map_walk(fs, map, inode, logical);
+    if(index < 0) return false;
+    map->buffers[0].block_pointers[index] = block_number;
+    map->dirty[0] = true;
+    return true;
+}
+
+/**
+ * Allocate the indirect blocks a block of a file needs before it can be assigned. An indirect
+ * block exists when it maps blocks in front of the frontier and its pointer is not a hole,
+ * pointers past the frontier lie beyond the end of the file and may be stale.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       log             Blocks the write took and gave up (NULL outside a write).
+ * @param       map             BlockMap of the Inode.
+ * @param       inode           Inode to change.
+ * @param       logical         Block about to be assigned.
+ * @param       frontier        Blocks before it are part of the file (the old end of the file or logical, whichever is larger).
+ * @param       goal            Where to allocate, moved past the new indirect blocks.
+ * @return      Whether or not the indirect blocks could be allocated (false when the disk is full).
+ **/
+bool block_map_prepare(FileSystem *fs, WriteLog *log, BlockMap *map, Inode *inode, size_t logical, size_t frontier, size_t *goal) {
+    size_t tree_first;
+    if(logical < fs_direct_pointers(fs)) return true;
+    size_t top = inode_tree(fs, logical, &tree_first);
+    if(top == 0) return false;
+
+    uint32_t *parent = &inode->pointers[inode_tree_root(top)];
+    uint32_t *root = NULL; // pointer to the first new indirect block
+    size_t node_first = tree_first;
+    size_t allocated[FS_INDIRECT_LEVELS];
+    size_t count = 0;
+    for(size_t level = top; level >= 1; level--) {
+        bool fresh = node_first >= frontier || *parent == 0;
+        if(fresh) {
+            size_t block;
+            if(fs_allocate_file_run(fs, log, map->inode_number, *goal, 1, &block) == 0) goto failure;
+            if(count == 0) root = parent;
+            allocated[count++] = block;
+            *parent = block;
+            if(level < top) map->dirty[level] = true;
+            *goal = block + 1;
+        }
+        Block *pointers = block_map_node(fs, map, level, *parent, node_first, fresh);
+        if(pointers == NULL) goto failure;
+        size_t span = indirect_span(level - 1);
+        size_t index = (logical - node_first) / span;
+        parent = &pointers->block_pointers[index];
+        node_first += index * span;
+    }
+    return true;
+
+failure:
+    // a hole stays a hole, the blocks beneath the released ones were never part of the file
+    if(root != NULL) *root = 0;
+    for(size_t i = 0; i < count; i++) {
+        for(size_t l = 0; l < FS_INDIRECT_LEVELS; l++) {
+            if(map->blocks[l] == allocated[i]) {
+                map->blocks[l] = 0;
+                map->dirty[l] = false;
+            }
+        }
+        fs_release_file_run(fs, log, allocated[i], 1);
+    }
+    return false;
+}
+
+/**
+ * Make a block past the end of a file a hole. When the indirect block that would map it does
+ * not exist yet, the pointer to it is cleared instead and everything beneath it is a hole.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       map             BlockMap of the Inode.
+ * @param       inode           Inode to change.
+ * @param       logical         Block to make a hole.
+ * @param       frontier        Blocks before it are part of the file (see block_map_prepare).
+ * @return      Whether or not the indirect blocks on the way could be read.
+ **/
+bool block_map_hole(FileSystem *fs, BlockMap *map, Inode *inode, size_t logical, size_t frontier) {
+    size_t tree_first;
+    if(logical < fs_direct_pointers(fs)) {
+        inode->pointers[logical] = 0;
+        return true;
+    }
+    size_t top = inode_tree(fs, logical, &tree_first);
+    if(top == 0) return false;
+    uint32_t *parent = &inode->pointers[inode_tree_root(top)];
+    size_t node_first = tree_first;
+    for(size_t level = top; level >= 1; level--) {
+        if(node_first >= frontier || *parent == 0) {
+            if(*parent != 0 && level < top) map->dirty[level] = true;
+            *parent = 0;
+            return true;
+        }
+        Block *pointers = block_map_node(fs, map, level, *parent, node_first, false);
+        if(pointers == NULL) return false;
+        size_t span = indirect_span(level - 1);
+        size_t index = (logical - node_first) / span;
+        parent = &pointers->block_pointers[index];
+        node_first += index * span;
+    }
+    if(*parent != 0) map->dirty[0] = true;
+    *parent = 0;
+    return true;
+}
+
+/**
+ * Number of blocks from a logical block until the next one that needs a new indirect block.
+ **/
+size_t block_map_boundary(const FileSystem *fs, size_t logical) {
+    size_t tree_first;
+    if(logical < fs_direct_pointers(fs)) return fs_direct_pointers(fs) - logical;
+    if(inode_tree(fs, logical, &tree_first) == 0) return 0;
+    return POINTERS_PER_BLOCK - (logical - tree_first) % POINTERS_PER_BLOCK;
+}
+
+/**
+ * Whether or not small files are kept out of data blocks.
+ **/
+bool fs_inline_data(const FileSystem *fs) {
+    return fs->meta.features & FS_FEATURE_INLINE_DATA;
+}
+
+/**
+ * Whether or not the bytes of an Inode are kept in the Inode or in a shared block, which its size decides.
+ **/
+bool fs_small_file(const FileSystem *fs, const Inode *inode) {
+    return fs_inline_data(fs) && inode->size <= FS_TAIL_MAX;
+}
+
+/**
+ * Number of slots of a shared block a small file of a size takes.
+ **/
+size_t tail_slots(size_t size) {
+    return size <= INLINE_DATA_SIZE ? 0 : (size + FS_TAIL_SLOT_SIZE - 1) / FS_TAIL_SLOT_SIZE;
+}
+
+/**
+ * Mask of count slots starting at slot, slot + count is at most FS_TAIL_SLOTS.
+ **/
+uint32_t tail_mask(size_t slot, size_t count) {
+    return (uint32_t)(((1ull << count) - 1) << slot);
+}
+
+/**
+ * Copy bytes of a small file out of its Inode or its shared block.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode           Small file.
+ * @param       data            Buffer to copy to.
+ * @param       length          Number of bytes, within the size of the file.
+ * @param       offset          Byte offset to copy from.
+ * @return      Whether or not the shared block could be read.
+ **/
+bool fs_read_small(FileSystem *fs, const Inode *inode, char *data, size_t length, size_t offset) {
+    if(inode->size <= INLINE_DATA_SIZE) {
+        memcpy(data, inode->inline_data + offset, length);
+        return true;
+    }
+    if(!fs_data_block(fs, inode->tail_block) || inode->tail_slot == 0 || inode->tail_slot + tail_slots(inode->size) > FS_TAIL_SLOTS) {
+        error("invalid small file block %u slot %u", inode->tail_block, inode->tail_slot);
+        return false;
+    }
+    Block *buffer = fs_block_alloc(1);
+    const Block *block = buffer ? read_block_view(fs, inode->tail_block, buffer, DISK_TAG_DATA) : NULL;
+    if(block != NULL) memcpy(data, block->data + inode->tail_slot * FS_TAIL_SLOT_SIZE + offset, length);
+    fs_block_free(buffer, 1);
+    return block != NULL;
+}
+
+/**
+ * Write to a file that stays within FS_TAIL_MAX bytes. Its bytes go to the Inode while they fit,
+ * then to slots of a shared block. A file that outgrows its slots takes the free slots after them,
+ * or moves to slots where it fits.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode to write to.
+ * @param       inode           Its contents, saved with the new size.
+ * @param       pieces          Pieces to write, in file order and apart from each other, the last one ends by FS_TAIL_MAX.
+ * @param       count           Number of pieces.
+ * @return      Number of bytes written (-1 on error).
+ **/
+ssize_t fs_write_small(FileSystem *fs, size_t inode_number, Inode *inode, const FsVector *pieces, size_t count) {
+    char content[FS_TAIL_MAX];
+    size_t size = inode->size;
+    size_t new_size = max(size, pieces[count - 1].offset + pieces[count - 1].length);
+    if(!fs_read_small(fs, inode, content, size, 0)) return -1;
+    // like a gap left by fs_write, the bytes between the old end and the pieces are null
+    if(new_size > size) memset(content + size, 0, new_size - size);
+    size_t length = 0;
+    for(size_t p = 0; p < count; p++) {
+        memcpy(content + pieces[p].offset, pieces[p].data, pieces[p].length);
+        length += pieces[p].length;
+    }
+    Inode old = *inode;
+    if(new_size <= INLINE_DATA_SIZE) {
+        memcpy(inode->inline_data, content, new_size);
+    } else if(!fs_tail_store(fs, inode_number, inode, content, new_size)) {
+        return -1;
+    }
+    inode->size = new_size;
+    if(set_inode(fs, inode, inode_number) < 0) return -1;
+    // the slots the file moved away from
+    if(size > INLINE_DATA_SIZE && (old.tail_block != inode->tail_block || old.tail_slot != inode->tail_slot)) fs_tail_release(fs, &old);
+    return length;
+}
+
+/**
+ * Store the bytes of a small file in slots of a shared block. The file keeps its slots if the ones
+ * after them are free to grow into, otherwise it is packed into fs->tail_block, or a new shared block
+ * is allocated in the group of its inode. The Inode is pointed at the slots, the caller saves it.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode of the file.
+ * @param       inode           Its contents, still with its old size.
+ * @param       content         Bytes of the file.
+ * @param       size            Number of bytes, more than INLINE_DATA_SIZE.
+ * @return      Whether or not the bytes could be stored.
+ **/
+bool fs_tail_store(FileSystem *fs, size_t inode_number, Inode *inode, const char *content, size_t size) {
+    size_t slots = tail_slots(size);
+    size_t old_slots = tail_slots(inode->size);
+    Block *block = fs_block_alloc(1);
+    if(block == NULL) return false;
+    size_t block_number = 0;
+    size_t slot = 0;
+    if(old_slots > 0 && fs_read_block(fs, inode->tail_block, block->data, DISK_TAG_DATA) == BLOCK_SIZE
+        && inode->tail_slot + slots <= FS_TAIL_SLOTS
+        && !(block->tail_used & tail_mask(inode->tail_slot + old_slots, slots - old_slots))) {
+        block_number = inode->tail_block;
+        slot = inode->tail_slot;
+    } else if(fs->tail_block != 0 && fs_read_block(fs, fs->tail_block, block->data, DISK_TAG_DATA) == BLOCK_SIZE) {
+        for(size_t s = 1; s + slots <= FS_TAIL_SLOTS && block_number == 0; s++) {
+            if(block->tail_used & tail_mask(s, slots)) continue;
+            block_number = fs->tail_block;
+            slot = s;
+        }
+    }
+    if(block_number == 0) {
+        if(fs_allocate_run(fs, fs->groups[inode_number / fs->groups[0].inodes].data_start, 1, &block_number) == 0) {
+            fs_block_free(block, 1);
+            return false;
+        }
+        memset(block->data, 0, BLOCK_SIZE);
+        block->tail_used = tail_mask(0, 1);
+        slot = 1;
+        fs->tail_block = block_number;
+    }
+    block->tail_used |= tail_mask(slot, slots);
+    memcpy(block->data + slot * FS_TAIL_SLOT_SIZE, content, size);
+    bool success = fs_write_block(fs, block_number, block->data, DISK_TAG_DATA) != DISK_FAILURE;
+    fs_block_free(block, 1);
+    if(success) {
+        inode->tail_block = block_number;
+        inode->tail_slot = slot;
+    }
+    return success;
+}
+
+/**
+ * Give the slots of a small file back, and its shared block once no file uses it anymore.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode           Small file larger than INLINE_DATA_SIZE bytes.
+ **/
+void fs_tail_release(FileSystem *fs, const Inode *inode) {
+    size_t slots = tail_slots(inode->size);
+    if(!fs_data_block(fs, inode->tail_block) || inode->tail_slot == 0 || inode->tail_slot + slots > FS_TAIL_SLOTS) return;
+    Block *block = fs_block_alloc(1);
+    if(block == NULL || fs_read_block(fs, inode->tail_block, block->data, DISK_TAG_DATA) != BLOCK_SIZE) {
+        fs_block_free(block, 1);
+        return;
+    }
+    block->tail_used &= ~tail_mask(inode->tail_slot, slots);
+    if(block->tail_used == tail_mask(0, 1)) {
+        if(fs->tail_block == inode->tail_block) fs->tail_block = 0;
+        fs_release_block(fs, inode->tail_block);
+    } else {
+        fs_write_block(fs, inode->tail_block, block->data, DISK_TAG_DATA);
+    }
+    fs_block_free(block, 1);
+}
+
+/**
+ * Resolve count logical blocks of an extent mapped Inode, starting at first, to their physical
+ * block numbers (0 for the blocks of a hole extent). The extent block is read at most once, and only if the Inode has one.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode           Inode to map.
+ * @param       first           First logical block.
+ * @param       count           Number of logical blocks.
+ * @param       physical        Filled with the physical block number of each logical block.
+ * @return      Whether or not every block could be resolved.
+ **/
+bool inode_map_extents(FileSystem *fs, const Inode *inode, size_t first, size_t count, size_t *physical) {
+    Extent *extents = malloc(EXTENTS_MAX * sizeof(Extent));
+    if(extents == NULL || !inode_load_extents(fs, inode, extents)) {
+        free(extents);
+        return false;
+    }
+    size_t i = 0;
+    size_t base = 0; // logical block the extent starts at
+    for(size_t e = 0; e < inode->extent_count && i < count; base += extents[e].length, e++) {
+        for(; i < count && first + i < base + extents[e].length; i++) {
+            physical[i] = extents[e].start == 0 ? 0 : extents[e].start + (first + i - base);
+        }
+    }
+    free(extents);
+    if(i < count) {
+        error("extents end before block %zu", first + i);
+        return false;
+    }
+    for(i = 0; i < count; i++) {
+        // a block in the superblock, the bitmaps or the inode table means the inode is corrupt
+        if(physical[i] != 0 && !fs_data_block(fs, physical[i])) {
+            error("invalid block %zu in inode map", physical[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Whether the inodes of the file system are mapped with extents.
+ **/
+bool fs_uses_extents(const FileSystem *fs) {
+    return (fs->meta.features & FS_FEATURE_EXTENTS) != 0;
+}
+
+/**
+ * Copy every extent of an Inode, the ones in the Inode and the ones in its extent block.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode           Inode whose extents to load.
+ * @param       extents         Room for EXTENTS_MAX extents.
+ * @return      Whether or not the extents could be read.
+ **/
+bool inode_load_extents(FileSystem *fs, const Inode *inode, Extent *extents) {
+    size_t count = inode->extent_count;
+    if(count > EXTENTS_MAX) {
+        error("inode has %zu extents", count);
+        return false;
+    }
+    memcpy(extents, inode->extents, min(count, (size_t)EXTENTS_PER_INODE) * sizeof(Extent));
+    if(count <= EXTENTS_PER_INODE) return true;
+    if(!fs_data_block(fs, inode->extent_block)) {
+        error("invalid extent block %u", inode->extent_block);
+        return false;
+    }
+    Block *buffer = fs_block_alloc(1);
+    const Block *block = buffer == NULL ? NULL : read_block_view(fs, inode->extent_block, buffer, DISK_TAG_INDIRECT);
+    if(block != NULL) memcpy(extents + EXTENTS_PER_INODE, block->extents, (count - EXTENTS_PER_INODE) * sizeof(Extent));
+    fs_block_free(buffer, 1);
+    return block != NULL;
+}
+
+/**
+ * Write the extents of an Inode that do not fit in it to its extent block.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode           Inode with more than EXTENTS_PER_INODE extents.
+ * @param       extents         Every extent of the Inode.
+ * @return      Whether or not the extent block was written.
+ **/
+bool inode_store_extents(FileSystem *fs, const Inode *inode, const Extent *extents) {
+    Block *block = fs_block_alloc(1);
+    if(block == NULL) return false;
+    memset(block->data, 0, BLOCK_SIZE);
+    memcpy(block->extents, extents + EXTENTS_PER_INODE, (inode->extent_count - EXTENTS_PER_INODE) * sizeof(Extent));
+    bool success = fs_write_block(fs, inode->extent_block, block->data, DISK_TAG_INDIRECT) != DISK_FAILURE;
+    fs_block_free(block, 1);
+    return success;
+}
+
+/**
+ * Allocate count blocks at the end of an extent mapped Inode, in runs that are as long as
+ * possible. A run that follows the last extent on disk grows it, any other run becomes a new extent.
+ * The extent block is allocated behind the run that first needs it. Allocation stops early
+ * when the disk is full or the Inode has EXTENTS_MAX extents.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       log             Blocks the write took and gave up (NULL outside a write).
+ * @param       inode_number    Inode to extend.
+ * @param       inode           Its contents, its extents and extent count are updated.
+ * @param       extents         Every extent of the Inode, updated as well.
+ * @param       goal            Preferred first block.
+ * @param       count           Number of blocks wanted.
+ * @param       physical        Filled with the allocated blocks in file order.
+ * @return      Number of blocks allocated.
+ **/
+size_t inode_allocate_extents(FileSystem *fs, WriteLog *log, size_t inode_number, Inode *inode, Extent *extents, size_t goal, size_t count, size_t *physical) {
+    size_t allocated = 0;
+    while(allocated < count) {
+        size_t block;
+        size_t run = fs_allocate_file_run(fs, log, inode_number, goal, count - allocated, &block);
+        if(run == 0) break;
+        size_t n = inode->extent_count;
+        if(n > 0 && extents[n - 1].start != 0 && extents[n - 1].start + extents[n - 1].length == block) {
+            extents[n - 1].length += run;
+            memcpy(inode->extents, extents, min(n, (size_t)EXTENTS_PER_INODE) * sizeof(Extent));
+        } else if(!inode_add_extent(fs, log, inode_number, inode, extents, (Extent){ .start = block, .length = run }, block + run)) {
+            fs_release_file_run(fs, log, block, run);
+            break;
+        }
+        for(size_t j = 0; j < run; j++) physical[allocated++] = block + j;
+        goal = block + run;
+    }
+    return allocated;
+}
+
+/**
+ * Append an extent to an extent mapped Inode. The extent block is allocated when the extents
+ * no longer fit in the Inode.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       log             Blocks the write took and gave up (NULL outside a write).
+ * @param       inode_number    Inode to extend.
+ * @param       inode           Its contents, its extents and extent count are updated.
+ * @param       extents         Every extent of the Inode, updated as well.
+ * @param       extent          Extent to append.
+ * @param       goal            Where the extent block would go.
+ * @return      Whether or not there was room for the extent.
+ **/
+bool inode_add_extent(FileSystem *fs, WriteLog *log, size_t inode_number, Inode *inode, Extent *extents, Extent extent, size_t goal) {
+    size_t n = inode->extent_count;
+    if(n == EXTENTS_MAX) return false;
+    if(n == EXTENTS_PER_INODE) {
+        size_t extent_block;
+        if(fs_allocate_file_run(fs, log, inode_number, goal, 1, &extent_block) == 0) return false;
+        inode->extent_block = extent_block;
+    }
+    extents[n] = extent;
+    inode->extent_count = n + 1;
+    // the first extents live in the inode as well
+    memcpy(inode->extents, extents, min(n + 1, (size_t)EXTENTS_PER_INODE) * sizeof(Extent));
+    return true;
+}
+
+/**
+ * Append a hole of count blocks to an extent mapped Inode, a hole that follows another one grows it.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       log             Blocks the write took and gave up (NULL outside a write).
+ * @param       inode_number    Inode to extend.
+ * @param       inode           Its contents, its extents and extent count are updated.
+ * @param       extents         Every extent of the Inode, updated as well.
+ * @param       count           Number of blocks of the hole.
+ * @param       goal            Where the extent block would go.
+ * @return      Whether or not there was room for the hole.
+ **/
+bool inode_hole_extents(FileSystem *fs, WriteLog *log, size_t inode_number, Inode *inode, Extent *extents, size_t count, size_t goal) {
+    size_t n = inode->extent_count;
+    if(n > 0 && extents[n - 1].start == 0 && extents[n - 1].length + count <= UINT32_MAX) {
+        extents[n - 1].length += count;
+        memcpy(inode->extents, extents, min(n, (size_t)EXTENTS_PER_INODE) * sizeof(Extent));
+        return true;
+    }
+    return inode_add_extent(fs, log, inode_number, inode, extents, (Extent){ .start = 0, .length = count }, goal);
+}
+
+/**
+ * Allocate one run of blocks for a hole of an extent mapped Inode, starting at logical. The hole
+ * extent is split around the run, and the run joins the extents next to it when it continues them on disk.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       log             Blocks the write took and gave up (NULL outside a write).
+ * @param       inode_number    Inode to change.
+ * @param       inode           Its contents, its extents and extent count are updated.
+ * @param       extents         Every extent of the Inode, updated as well.
+ * @param       logical         First block to fill, it lies in a hole.
+ * @param       goal            Preferred first block.
+ * @param       count           Number of blocks wanted, the run stops at the end of the hole.
+ * @param       physical        Filled with the allocated blocks.
+ * @return      Number of blocks allocated (0 if the disk is full or the Inode has no room for the extents).
+ **/
+size_t inode_fill_extents(FileSystem *fs, WriteLog *log, size_t inode_number, Inode *inode, Extent *extents, size_t logical, size_t goal, size_t count, size_t *physical) {
+    size_t n = inode->extent_count;
+    size_t e = 0;
+    size_t base = 0; // logical block extent e starts at
+    while(e < n && base + extents[e].length <= logical) base += extents[e++].length;
+    if(e == n || extents[e].start != 0) {
+        error("block %zu is not in a hole", logical);
+        return 0;
+    }
+    size_t before = logical - base;
+    size_t block;
+    size_t run = fs_allocate_file_run(fs, log, inode_number, goal, min(count, extents[e].length - before), &block);
+    if(run == 0) return 0;
+    size_t after = extents[e].length - before - run;
+
+    // extents [lo, hi) are replaced by the parts
+    Extent parts[3];
+    size_t nparts = 0;
+    size_t lo = e;
+    size_t hi = e + 1;
+    if(before > 0) parts[nparts++] = (Extent){ .start = 0, .length = before };
+    parts[nparts++] = (Extent){ .start = block, .length = run };
+    if(after > 0) parts[nparts++] = (Extent){ .start = 0, .length = after };
+    if(before == 0 && e > 0 && extents[e - 1].start != 0 && extents[e - 1].start + extents[e - 1].length == block) {
+        parts[0] = (Extent){ .start = extents[e - 1].start, .length = extents[e - 1].length + run };
+        lo = e - 1;
+    }
+    if(after == 0 && e + 1 < n && extents[e + 1].start == block + run) {
+        parts[nparts - 1].length += extents[e + 1].length;
+        hi = e + 2;
+    }
+    size_t total = n - (hi - lo) + nparts;
+    size_t extent_block = 0;
+    if(total > EXTENTS_MAX || (total > EXTENTS_PER_INODE && n <= EXTENTS_PER_INODE
+        && fs_allocate_file_run(fs, log, inode_number, block + run, 1, &extent_block) == 0)) {
+        fs_release_file_run(fs, log, block, run);
+        return 0;
+    }
+    if(extent_block != 0) inode->extent_block = extent_block;
+    // the extents fit in the inode again
+    if(total <= EXTENTS_PER_INODE && n > EXTENTS_PER_INODE) fs_release_file_run(fs, log, inode->extent_block, 1);
+    memmove(extents + lo + nparts, extents + hi, (n - hi) * sizeof(Extent));
+    memcpy(extents + lo, parts, nparts * sizeof(Extent));
+    inode->extent_count = total;
+    memcpy(inode->extents, extents, min(total, (size_t)EXTENTS_PER_INODE) * sizeof(Extent));
+    for(size_t j = 0; j < run; j++) physical[j] = block + j;
+    return run;
+}
+
+/**
+ * Return the blocks of an extent mapped Inode and its extent block to the free block bitmap.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode           Inode being removed.
+ * @return      Whether or not the extents could be read.
+ **/
+bool inode_release_extents(FileSystem *fs, const Inode *inode) {
+    Extent *extents = malloc(EXTENTS_MAX * sizeof(Extent));
+    bool success = extents != NULL && inode_load_extents(fs, inode, extents);
+    for(size_t e = 0; success && e < inode->extent_count; e++) {
+        if(extents[e].start != 0) fs_release_run(fs, extents[e].start, extents[e].length);
+    }
+    if(success && inode->extent_count > EXTENTS_PER_INODE) fs_release_block(fs, inode->extent_block);
+    free(extents);
+    return success;
+}
+
+/**
+ * Track the read pattern of an Inode and prefetch into the block cache ahead of sequential reads.
+ * A read that starts where the previous one stopped (or at the start of the file) is sequential
+ * and doubles the readahead window up to FS_READAHEAD_MAX blocks, any other read halves it.
+ * The blocks of the current read that are not cached yet and the window past it are loaded
+ * in one batch, the indirect block is resolved through the cache as well.
+ * Disks that keep their blocks in memory have no block cache and nothing to read ahead.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode being read.
+ * @param       inode           Inode being read.
+ * @param       offset          Byte offset of the read.
+ * @param       length          Number of bytes read (within the size of the Inode).
+ * @param       physical        Physical blocks of the read.
+ * @param       count           Number of blocks of the read.
+ * @param       resolved        Physical blocks of the file from its start when the caller has them, at least
+ *                              fs_readahead_limit blocks past the read (NULL looks them up).
+ **/
+void fs_readahead(FileSystem *fs, size_t inode_number, const Inode *inode, size_t offset, size_t length, const size_t *physical, size_t count, const size_t *resolved) {
+    Readahead *stream = &fs->readahead[inode_number % FS_READAHEAD_SLOTS];
+    if(!stream->valid || stream->inode_number != inode_number) {
+        *stream = (Readahead){ .valid = true, .inode_number = inode_number };
+    }
+    if(offset == stream->offset) {
+        stream->window = stream->window ? min(stream->window * 2, FS_READAHEAD_MAX) : FS_READAHEAD_MIN;
+    } else {
+        stream->window = stream->window / 2 >= FS_READAHEAD_MIN ? stream->window / 2 : 0;
+        stream->ahead = 0;
+    }
+    stream->offset = offset + length;
+    if(fs->cache == NULL || stream->window == 0) return;
+
+    // keep everything a prefetch loads well inside the cache so it is not evicted before use
+    size_t limit = fs->cache->capacity / 4;
+    size_t window = min(stream->window, fs_readahead_limit(fs));
+    size_t first = offset / BLOCK_SIZE;
+    size_t file_blocks = (inode->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    size_t start = max(first + count, stream->ahead);
+    size_t stop = min(first + count + window, file_blocks);
+    if(start >= stop) return;
+
+    size_t current = count + (stop - start) <= limit ? count : 0;
+    size_t *blocks = malloc((current + stop - start) * sizeof(size_t));
+    if(blocks == NULL) return;
+    memcpy(blocks, physical, current * sizeof(size_t));
+    if(resolved != NULL) memcpy(blocks + current, resolved + start, (stop - start) * sizeof(size_t));
+    if(resolved != NULL || inode_map_blocks(fs, inode_number, inode, start, stop - start, blocks + current)) {
+        // holes have nothing to load
+        size_t total = 0;
+        for(size_t i = 0; i < current + stop - start; i++) {
+            if(blocks[i] != 0) blocks[total++] = blocks[i];
+        }
+        int previous = disk_tag(fs->disk, DISK_TAG_DATA);
+        if(total == 0 || cache_prefetch(fs->cache, blocks, total) != DISK_FAILURE) stream->ahead = stop;
+        disk_tag(fs->disk, previous);
+    }
+    free(blocks);
+}
+
+/**
+ * Most blocks fs_readahead loads past a read, none without a block cache.
+ **/
+size_t fs_readahead_limit(const FileSystem *fs) {
+    return fs->cache == NULL ? 0 : min((size_t)FS_READAHEAD_MAX, fs->cache->capacity / 4);
+}
+
+/**
+ * Allocate up to count contiguous blocks for an Inode that grows. Blocks reserved for the
+ * Inode are handed out first when goal is where they start. Blocks reserved for other files
+ * are only given up when the free blocks outside the reservations fall short of count, not
+ * when they are merely scattered.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       log             Blocks the write took and gave up (NULL outside a write).
+ * @param       inode_number    Inode the blocks are for.
+ * @param       goal            Preferred first block, usually the one after the last block of the file.
+ * @param       count           Number of blocks wanted.
+ * @param       first           Set to the first allocated block.
+ * @return      Number of blocks allocated (0 if the disk is full).
+ **/
+size_t fs_allocate_file_run(FileSystem *fs, WriteLog *log, size_t inode_number, size_t goal, size_t count, size_t *first) {
+    Reservation *reservation = fs_reservation(fs, inode_number, false);
+    bool continuing = reservation != NULL && reservation->next == goal;
+    size_t run;
+    if(continuing && reservation->count > 0) {
+        run = min(count, reservation->count);
+        *first = reservation->start;
+        reservation->start += run;
+        reservation->count -= run;
+        reservation->next = *first + run;
+    } else {
+        size_t window = continuing ? reservation->window : 0;
+        // a window the file does not continue into is of no use to it
+        fs_release_reservation(fs, inode_number);
+        run = fs_allocate_run(fs, goal, count, first);
+        bool short_of_space = run == 0 || __atomic_load_n(&fs->free_count, __ATOMIC_RELAXED) < count - run;
+        if(run < count && short_of_space && fs_release_reservations(fs) > 0) {
+            if(run > 0) fs_release_run(fs, *first, run);
+            run = fs_allocate_run(fs, goal, count, first);
+        }
+        // remember where the file continues, the next write may reserve blocks there
+        if(run > 0 && (reservation = fs_reservation(fs, inode_number, true)) != NULL) {
+            *reservation = (Reservation){ .valid = true, .inode_number = inode_number, .next = *first + run, .window = window };
+        }
+    }
+    // a write that cannot give the run back when it fails does not take it
+    if(run > 0 && log != NULL && !run_list_add(&log->taken, *first, run)) {
+        fs_release_run(fs, *first, run);
+        return 0;
+    }
+    return run;
+}
+
+/**
+ * Give back blocks of a file. During a write they are only freed once the write succeeds, until then
+ * the Inode on disk may still use them.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       log             Blocks the write took and gave up (NULL outside a write).
+ * @param       first           First block of the run.
+ * @param       count           Number of blocks.
+ **/
+void fs_release_file_run(FileSystem *fs, WriteLog *log, size_t first, size_t count) {
+    if(log != NULL && run_list_add(&log->given, first, count)) return;
+    fs_release_run(fs, first, count);
+}
+
+/**
+ * End the write in progress. When it succeeded the blocks it gave up are freed, when it failed
+ * the blocks it took are.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       log             Blocks the write took and gave up.
+ * @param       success         Whether or not the Inode was saved.
+ **/
+void fs_write_log_end(FileSystem *fs, WriteLog *log, bool success) {
+    const RunList *freed = success ? &log->given : &log->taken;
+    for(size_t i = 0; i < freed->count; i++) fs_release_run(fs, freed->runs[i].start, freed->runs[i].length);
+    free(log->taken.runs);
+    free(log->given.runs);
+    *log = (WriteLog){0};
+}
+
+/**
+ * Add a run to a list, a run that continues the last one grows it.
+ *
+ * @return      Whether or not there was room for the run.
+ **/
+bool run_list_add(RunList *list, size_t first, size_t count) {
+    if(list->count > 0) {
+        Extent *last = &list->runs[list->count - 1];
+        if(last->start + last->length == first && last->length + count <= UINT32_MAX) {
+            last->length += count;
+            return true;
+        }
+    }
+    if(list->count == list->capacity) {
+        size_t capacity = max((size_t)16, 2 * list->capacity);
+        Extent *runs = realloc(list->runs, capacity * sizeof(Extent));
+        if(runs == NULL) return false;
+        list->runs = runs;
+        list->capacity = capacity;
+    }
+    list->runs[list->count++] = (Extent){ .start = first, .length = count };
+    return true;
+}
+
+/**
+ * Reserve a window of blocks for an Inode that is being appended to, so the next small appends
+ * stay contiguous while other files grow at the same time. The window is looked for from the end
+ * of the file on, it starts at FS_RESERVE_MIN blocks and doubles every time it is used up, up to FS_RESERVE_MAX.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode that was appended to.
+ **/
+void fs_reserve_window(FileSystem *fs, size_t inode_number) {
+    Reservation *reservation = fs_reservation(fs, inode_number, false);
+    if(reservation == NULL || reservation->count > 0) return;
+    size_t window = reservation->window == 0 ? FS_RESERVE_MIN : min(2 * reservation->window, (size_t)FS_RESERVE_MAX);
+    size_t run = fs_allocate_run(fs, reservation->next, window, &reservation->start);
+    reservation->count = run;
+    reservation->window = window;
+}
+
+/**
+ * Give the blocks reserved for an Inode back, done when it is closed or removed.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode whose reservation ends.
+ **/
+void fs_release_reservation(FileSystem *fs, size_t inode_number) {
+    if(fs == NULL) return;
+    Reservation *reservation = fs_reservation(fs, inode_number, false);
+    if(reservation == NULL) return;
+    if(reservation->count > 0) fs_release_run(fs, reservation->start, reservation->count);
+    *reservation = (Reservation){0};
+}
+
+/**
+ * Find the reservation of an Inode, looked for from the slot of its number on so files whose
+ * numbers collide keep a reservation each. A file without one can take a free slot, or else the
+ * slot of a file whose window is used up, a window another file still holds is never taken.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode to look up.
+ * @param       claim           Whether to hand out a slot when the Inode has none.
+ * @return      Pointer to the reservation (NULL if there is none, or no slot to claim).
+ **/
+Reservation* fs_reservation(FileSystem *fs, size_t inode_number, bool claim) {
+    Reservation *unused = NULL;
+    Reservation *idle = NULL;
+    for(size_t i = 0; i < FS_READAHEAD_SLOTS; i++) {
+        Reservation *reservation = &fs->reservations[(inode_number + i) % FS_READAHEAD_SLOTS];
+        if(reservation->valid && reservation->inode_number == inode_number) return reservation;
+        if(!reservation->valid && unused == NULL) unused = reservation;
+        if(reservation->valid && reservation->count == 0 && idle == NULL) idle = reservation;
+    }
+    if(!claim) return NULL;
+    return unused != NULL ? unused : idle;
+}
+
+/**
+ * Give the blocks reserved for every Inode back.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @return      Number of blocks given back.
+ **/
+size_t fs_release_reservations(FileSystem *fs) {
+    size_t released = 0;
+    for(size_t i = 0; i < FS_READAHEAD_SLOTS; i++) {
+        if(!fs->reservations[i].valid) continue;
+        released += fs->reservations[i].count;
+        fs_release_reservation(fs, fs->reservations[i].inode_number);
+    }
+    return released;
+}
+
+/**
+ * Allocate up to count contiguous free data blocks. The group of goal is searched from goal on,
+ * then the other groups in turn, and the first run of count free blocks is taken. If there
+ * is none the longest run found is. Only one group is locked at a time, so threads
+ * allocating in different groups do not wait for each other.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @param       goal    Preferred first block.
+ * @param       count   Number of blocks wanted.
+ * @param       first   Set to the first allocated block.
+ * @return      Number of blocks allocated (0 if the disk is full).
+ **/
+size_t fs_allocate_run(FileSystem *fs, size_t goal, size_t count, size_t *first) {
+    if(count == 0) return 0;
+    size_t home = fs_block_group(fs, goal);
+    if(home >= fs->group_count) {
+        home = 0;
+        goal = fs->groups[0].data_start;
+    }
+    while(__atomic_load_n(&fs->free_count, __ATOMIC_RELAXED) > 0) {
+        size_t best = 0;
+        size_t best_group = home;
+        for(size_t i = 0; i < fs->group_count; i++) {
+            size_t g = (home + i) % fs->group_count;
+            size_t longest;
+            size_t run = fs_group_allocate(fs, g, i == 0 ? goal : fs->groups[g].data_start, count, false, first, &longest);
+            if(run > 0) return run;
+            if(longest > best) {
+                best = longest;
+                best_group = g;
+            }
+        }
+        if(best == 0) return 0;
+        // another thread may have taken the run in the meantime, then look again
+        size_t longest;
+        size_t run = fs_group_allocate(fs, best_group, best_group == home ? goal : fs->groups[best_group].data_start, count, true, first, &longest);
+        if(run > 0) return run;
+    }
+    return 0;
+}
+
+/**
+ * Search the free block bitmap of one group for count contiguous free blocks, from `from` to the
+ * end of the group and then from its first data block, a 64 bit word at a time.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @param       g       Group to search.
+ * @param       from    Block to start at.
+ * @param       count   Number of blocks wanted.
+ * @param       partial Whether to take the longest run when there is no run of count blocks.
+ * @param       first   Set to the first allocated block.
+ * @param       longest Set to the length of the longest run seen (at most count).
+ * @return      Number of blocks allocated.
+ **/
+size_t fs_group_allocate(FileSystem *fs, size_t g, size_t from, size_t count, bool partial, size_t *first, size_t *longest) {
+    BlockGroup *group = &fs->groups[g];
+    size_t best = 0;
+    size_t best_first = 0;
+    pthread_mutex_lock(&group->lock);
+    if(from < group->data_start || from >= group->end) from = group->data_start;
+    for(int pass = 0; pass < 2 && best < count && group->free_blocks > 0; pass++) {
+        size_t bit = pass == 0 ? from : group->data_start;
+        size_t stop = pass == 0 ? group->end : from;
+        while(best < count && (bit = bitmap_find(fs->free_blocks, stop, bit)) < stop) {
+            size_t run = bitmap_run(fs->free_blocks, stop, bit, count);
+            if(run > best) {
+                best = run;
+                best_first = bit;
+            }
+            bit += run;
+        }
+    }
+    *longest = best;
+    if(best < count && !partial) best = 0;
+    if(best > 0) {
+        bitmap_clear_range(fs->free_blocks, best_first, best);
+        group->free_blocks -= best;
+        group->blocks_dirty = true;
+        __atomic_sub_fetch(&fs->free_count, best, __ATOMIC_RELAXED);
+        __atomic_store_n(&fs->free_blocks_dirty, true, __ATOMIC_RELAXED);
+        *first = best_first;
+    }
+    pthread_mutex_unlock(&group->lock);
+    return best;
+}
+
+/**
+ * Return a data block to the free block bitmap. Block numbers outside the data blocks
+ * (stale pointers) and blocks that are already free are ignored.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       block_number    Block to release.
+ **/
+void fs_release_block(FileSystem *fs, size_t block_number) {
+    fs_release_run(fs, block_number, 1);
+}
+
+/**
+ * Return count contiguous blocks starting at first to the free block bitmap, like fs_release_block.
+ * The group of each part of the run is locked once.
+ **/
+void fs_release_run(FileSystem *fs, size_t first, size_t count) {
+    size_t end = first + count;
+    for(size_t block = first; block < end; ) {
+        size_t g = fs_block_group(fs, block);
+        if(g >= fs->group_count) return;
+        BlockGroup *group = &fs->groups[g];
+        size_t stop = min(end, group->end);
+        size_t released = 0;
+        pthread_mutex_lock(&group->lock);
+        for(size_t b = max(block, group->data_start); b < stop; b++) {
+            if(bitmap_test(fs->free_blocks, b)) continue;
+            bitmap_set(fs->free_blocks, b);
+            released += 1;
+        }
+        if(released > 0) {
+            group->free_blocks += released;
+            group->blocks_dirty = true;
+            __atomic_add_fetch(&fs->free_count, released, __ATOMIC_RELAXED);
+            __atomic_store_n(&fs->free_blocks_dirty, true, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&group->lock);
+        block = stop;
+    }
+}
+
+/**
+ * Take the first free inode in [from, stop) of a group.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @param       g       Group to search.
+ * @param       from    First inode to look at.
+ * @param       stop    Inode after the last one to look at (within the group).
+ * @param       with_blocks Whether to pass over the group if it has no free data blocks.
+ * @return      Inode number (-1 if there is none).
+ **/
+ssize_t fs_group_claim_inode(FileSystem *fs, size_t g, size_t from, size_t stop, bool with_blocks) {
+    BlockGroup *group = &fs->groups[g];
+    ssize_t inode_number = -1;
+    pthread_mutex_lock(&group->lock);
+    bool usable = group->free_inodes > 0 && from < stop && (!with_blocks || group->free_blocks > 0);
+    size_t found = usable ? bitmap_find(fs->free_inodes, stop, from) : stop;
+    if(found < stop) {
+        bitmap_clear(fs->free_inodes, found);
+        group->free_inodes -= 1;
+        group->inodes_dirty = true;
+        __atomic_sub_fetch(&fs->free_inode_count, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&fs->free_inodes_dirty, true, __ATOMIC_RELAXED);
+        inode_number = found;
+    }
+    pthread_mutex_unlock(&group->lock);
+    return inode_number;
+}
+
+/**
+ * Return an inode to the free inode bitmap.
+ **/
+void fs_release_inode(FileSystem *fs, size_t inode_number) {
+    BlockGroup *group = &fs->groups[inode_number / fs->groups[0].inodes];
+    pthread_mutex_lock(&group->lock);
+    if(!bitmap_test(fs->free_inodes, inode_number)) {
+        bitmap_set(fs->free_inodes, inode_number);
+        group->free_inodes += 1;
+        group->inodes_dirty = true;
+        __atomic_add_fetch(&fs->free_inode_count, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&fs->free_inodes_dirty, true, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&group->lock);
+}
+
+/**
+ * Group a block belongs to.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       block_number    Block to look up.
+ * @return      Group number (fs->group_count if the block is past the last group).
+ **/
+size_t fs_block_group(const FileSystem *fs, size_t block_number) {
+    size_t g = fs->meta.group_blocks ? block_number / fs->meta.group_blocks : 0;
+    if(g >= fs->group_count || block_number >= fs->groups[g].end) return fs->group_count;
+    return g;
+}
+
+/**
+ * Whether a block is a data block, as opposed to the super block, a bitmap or the inode table.
+ **/
+bool fs_data_block(const FileSystem *fs, size_t block_number) {
+    size_t g = fs_block_group(fs, block_number);
+    return g < fs->group_count && block_number >= fs->groups[g].data_start;
+}
+
+/**
+ * Block of the inode table that holds an inode.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode to look up.
+ * @return      Block number (0 if there is no such inode).
+ **/
+size_t fs_inode_block(const FileSystem *fs, size_t inode_number) {
+    if(fs == NULL || fs->groups == NULL || inode_number >= fs->meta.inodes) return 0;
+    const BlockGroup *group = &fs->groups[inode_number / fs->groups[0].inodes];
+    return group->inode_table + (inode_number - group->first_inode) / INODES_PER_BLOCK;
+}
+
+/**
+ * Block of the inode table with the specified index, the slices of the groups taken in order.
+ * Index i holds inodes [i * INODES_PER_BLOCK, (i + 1) * INODES_PER_BLOCK).
+ **/
+size_t fs_inode_table_block(const FileSystem *fs, size_t index) {
+    const BlockGroup *group = &fs->groups[index / fs->groups[0].inode_blocks];
+    return group->inode_table + index % fs->groups[0].inode_blocks;
+}
+
+bool fs_block_is_free(const FileSystem *fs, size_t block_number) {
+    if(fs == NULL || fs->free_blocks == NULL || block_number >= fs->meta.blocks) return false;
+    return bitmap_test(fs->free_blocks, block_number);
+}
+
+/**
+ * Number of blocks needed for a free block bitmap of a disk.
+ **/
+size_t fs_bitmap_blocks(size_t blocks) {
+    return (blocks + BITS_PER_BLOCK - 1) / BITS_PER_BLOCK;
+}
+
+/**
+ * Allocate count Block buffers from the disk buffer pool. They are BLOCK_SIZE aligned,
+ * so they can be handed to disks opened with DISK_DIRECT without bouncing.
+ *
+ * @param       count   Number of blocks.
+ * @return      Pointer to the first block (NULL on failure).
+ **/
+Block* fs_block_alloc(size_t count) {
+    return (Block*)disk_buffer_alloc(count);
+}
+
+/**
+ * Return Block buffers from fs_block_alloc to the disk buffer pool.
+ **/
+void fs_block_free(Block *blocks, size_t count) {
+    disk_buffer_free((char*)blocks, count);
+}
+
+/**
+ * function that intializes and sets the free blocks bit map and the free inode bit map in memory
+ * Disks formatted with FS_FEATURE_BITMAP / FS_FEATURE_INODE_BITMAP have them on disk, they are
+ * only trusted (together with the counters in the super block) after a clean unmount.
+ * Whatever is missing is rebuilt from the inode table.
+**/
+bool fs_initialize_free_block_bitmap(FileSystem *fs){
+    // the bitmaps are kept in whole blocks so they can be read and written in place
+    fs->free_blocks = calloc(fs_bitmap_blocks(fs->meta.blocks), BLOCK_SIZE);
+    fs->free_inodes = calloc(fs_bitmap_blocks(fs->meta.inodes), BLOCK_SIZE);
+    if(fs->free_blocks == NULL || fs->free_inodes == NULL) return false;
+    fs->free_blocks_dirty = false;
+    fs->free_inodes_dirty = false;
+    fs->inode_hint = 0;
+    bool clean = fs->meta.state == FS_STATE_CLEAN;
+    bool groups = fs->meta.features & FS_FEATURE_GROUPS;
+    bool blocks_stored = clean && (fs->meta.features & FS_FEATURE_BITMAP);
+    bool inodes_stored = clean && (fs->meta.features & FS_FEATURE_INODE_BITMAP);
+    if(blocks_stored && !(groups ? fs_transfer_group_bitmaps(fs, false, false)
+                                 : fs_load_bitmap(fs, fs->free_blocks, fs->meta.bitmap_blocks, fs->meta.blocks, 1 + fs->meta.inode_blocks))) return false;
+    if(inodes_stored && !(groups ? fs_transfer_group_bitmaps(fs, true, false)
+                                 : fs_load_bitmap(fs, fs->free_inodes, fs->meta.inode_bitmap_blocks, fs->meta.inodes, 1 + fs->meta.inode_blocks + fs->meta.bitmap_blocks))) return false;
+    if(blocks_stored && inodes_stored) {
+        fs_count_groups(fs);
+        fs->free_count = fs->meta.free_block_count;
+        fs->free_inode_count = fs->meta.free_inode_count;
+        fs->inode_hint = fs->meta.inode_hint;
+        return true;
+    }
+    // the slot masks of the shared blocks may be behind their files after a crash
+    bool tails = !clean && fs_inline_data(fs);
+    if(!fs_scan_inode_table(fs, !blocks_stored, !inodes_stored, tails)) return false;
+    // rebuilt bitmaps replace whatever is on disk
+    fs->free_blocks_dirty = !blocks_stored;
+    fs->free_inodes_dirty = !inodes_stored;
+    fs_count_groups(fs);
+    for(size_t g = 0; g < fs->group_count; g++) {
+        fs->groups[g].blocks_dirty = fs->free_blocks_dirty;
+        fs->groups[g].inodes_dirty = fs->free_inodes_dirty;
+    }
+    fs->free_count = bitmap_count(fs->free_blocks, fs->meta.blocks);
+    fs->free_inode_count = bitmap_count(fs->free_inodes, fs->meta.inodes);
+    return true;
+}
+
+/**
+ * Count the free blocks and free inodes of every group in the bitmaps.
+ * The parts of the bitmaps that belong to a group start on a word boundary.
+ **/
+void fs_count_groups(FileSystem *fs) {
+    for(size_t g = 0; g < fs->group_count; g++) {
+        BlockGroup *group = &fs->groups[g];
+        group->free_blocks = bitmap_count(fs->free_blocks + group->first / BITMAP_WORD_BITS, group->end - group->first);
+        group->free_inodes = bitmap_count(fs->free_inodes + group->first_inode / BITMAP_WORD_BITS, group->inodes);
+    }
+}
+
+/**
+ * Rebuild the free block bitmap and/or the free inode bitmap from the inode table.
+ * The inode table is split into fs->scan_threads slices scanned at the same time, each
+ * slice collects the blocks and inodes it finds in use in its own bitmaps, which are
+ * OR-merged once every slice is done. One thread gives the same result serially.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @param       blocks  Whether to rebuild the free block bitmap (the indirect blocks are only read for it).
+ * @param       inodes  Whether to rebuild the free inode bitmap.
+ * @param       tails   Whether to rebuild the slot masks of the shared small file blocks (needs blocks).
+ * @return      Whether or not the inode table could be read (and the masks written).
+ **/
+bool fs_scan_inode_table(FileSystem *fs, bool blocks, bool inodes, bool tails){
+    size_t threads = min(max(fs->scan_threads, (size_t)1), (size_t)FS_SCAN_THREADS_MAX);
+    threads = max(min(threads, (size_t)fs->meta.inode_blocks), (size_t)1);
+    FsScan scans[FS_SCAN_THREADS_MAX];
+    pthread_t ids[FS_SCAN_THREADS_MAX];
+    bool started[FS_SCAN_THREADS_MAX] = {false};
+    size_t block_words = BITMAP_WORDS(fs->meta.blocks);
+    size_t inode_words = BITMAP_WORDS(fs->meta.inodes);
+    uint32_t *tail_masks = blocks && tails ? calloc(fs->meta.blocks, sizeof(uint32_t)) : NULL;
+    bool success = !(blocks && tails) || tail_masks != NULL;
+    for(size_t t = 0; t < threads; t++){
+        scans[t] = (FsScan){
+            .fs = fs,
+            .first = fs->meta.inode_blocks * t / threads,
+            .last = fs->meta.inode_blocks * (t + 1) / threads,
+            .blocks = blocks,
+            .inodes = inodes,
+            .shared = threads > 1,
+            .used_blocks = calloc(block_words, sizeof(uint64_t)),
+            .used_inodes = calloc(inode_words, sizeof(uint64_t)),
+            .tail_masks = tail_masks,
+        };
+        success = success && scans[t].used_blocks != NULL && scans[t].used_inodes != NULL;
+    }
+
+    int previous = disk_tag(fs->disk, DISK_TAG_SCAN);
+    // slices whose thread cannot be started are scanned by this one
+    for(size_t t = 1; success && t < threads; t++){
+        started[t] = pthread_create(&ids[t], NULL, fs_scan_range, &scans[t]) == 0;
+    }
+    for(size_t t = 0; success && t < threads; t++){
+        if(!started[t]) fs_scan_range(&scans[t]);
+    }
+    for(size_t t = 1; t < threads; t++){
+        if(started[t]) pthread_join(ids[t], NULL);
+        success = success && scans[t].success;
+    }
+    success = success && scans[0].success;
+    disk_tag(fs->disk, previous);
+
+    if(success){
+        for(size_t t = 1; t < threads; t++){
+            for(size_t w = 0; w < block_words; w++) scans[0].used_blocks[w] |= scans[t].used_blocks[w];
+            for(size_t w = 0; w < inode_words; w++) scans[0].used_inodes[w] |= scans[t].used_inodes[w];
+        }
+        // intialize free _blocks and also set all to true except inode and super block (and the tables of the other groups)
+        if(blocks){
+            for(size_t g = 0; g < fs->group_count; g++){
+                BlockGroup *group = &fs->groups[g];
+                if(group->data_start < group->end) bitmap_set_range(fs->free_blocks, group->data_start, group->end - group->data_start);
+            }
+            for(size_t w = 0; w < block_words; w++) fs->free_blocks[w] &= ~scans[0].used_blocks[w];
+        }
+        if(inodes){
+            bitmap_set_range(fs->free_inodes, 0, fs->meta.inodes);
+            for(size_t w = 0; w < inode_words; w++) fs->free_inodes[w] &= ~scans[0].used_inodes[w];
+        }
+        if(tail_masks) success = fs_store_tail_masks(fs, tail_masks);
+    }
+    for(size_t t = 0; t < threads; t++){
+        free(scans[t].used_blocks);
+        free(scans[t].used_inodes);
+    }
+    free(tail_masks);
+    return success;
+}
+
+/**
+ * Write the slot masks found by the mount scan into the shared small file blocks whose mask
+ * differs, so slots a crash left marked free are not handed out again while a file uses them.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @param       masks   Slots in use of each block, 0 for blocks that are not shared.
+ * @return      Whether or not every mask that changed was written.
+ **/
+bool fs_store_tail_masks(FileSystem *fs, const uint32_t *masks){
+    Block *block = fs_block_alloc(1);
+    bool success = block != NULL;
+    for(size_t b = fs->data_start; success && b < fs->meta.blocks; b++){
+        if(masks[b] == 0) continue;
+        uint32_t used = masks[b] | tail_mask(0, 1);
+        success = fs_read_block(fs, b, block->data, DISK_TAG_DATA) == BLOCK_SIZE;
+        if(!success || block->tail_used == used) continue;
+        block->tail_used = used;
+        success = fs_write_block(fs, b, block->data, DISK_TAG_DATA) != DISK_FAILURE;
+    }
+    if(!success) error("unable to rebuild the slot masks of the shared blocks");
+    fs_block_free(block, 1);
+    return success;
+}
+
+/**
+ * Scan one slice of the inode table, marking the valid inodes and the blocks they use.
+ * The slice is read FS_IO_WINDOW blocks at a time, and the indirect blocks found in
+ * a window are read together as well, so the disk always has a full batch of requests.
+ *
+ * @param       arg     Pointer to the FsScan of the slice, its success field is set.
+ * @return      NULL (runs as a thread).
+ **/
+void* fs_scan_range(void *arg){
+    FsScan *scan = arg;
+    FileSystem *fs = scan->fs;
+    Block *inode_buffers = fs_block_alloc(FS_IO_WINDOW);
+    Block *pointer_buffers = fs_block_alloc(FS_IO_WINDOW);
+    bool success = inode_buffers != NULL && pointer_buffers != NULL;
+    // iterate through the inode blocks a window at a time
+    for(size_t window = scan->first; success && window < scan->last; window += FS_IO_WINDOW){
+        size_t n = min(FS_IO_WINDOW, scan->last - window);
+        size_t numbers[FS_IO_WINDOW];
+        const Block *inode_blocks[FS_IO_WINDOW];
+        for(size_t i = 0; i < n; i++) numbers[i] = fs_inode_table_block(fs, window + i);
+        // read the inode table from disk (or view it in place on a mapped disk)
+        if(!fs_scan_read(scan, numbers, inode_buffers, inode_blocks, n)){
+            error("error in reading from buffer");
+            success = false;
+            break;
+        }
+
+        // indirect blocks waiting to be read, an inode adds up to FS_INDIRECT_LEVELS of them
+        ScanIndirect found[FS_IO_WINDOW + FS_INDIRECT_LEVELS];
+        size_t pending = 0;
+        for(size_t i = 0; success && i < n; i++){
+            // iterate through the inodes, if valid then find the blocks its points to and mark them as used
+            for(int idx = 0; idx < INODES_PER_BLOCK; idx++){
+                const Inode *inode = &inode_blocks[i]->inodes[idx];
+                // fs_create only hands out inodes whose valid field is zero
+                if(scan->inodes && inode->valid) bitmap_set(scan->used_inodes, (window + i) * INODES_PER_BLOCK + idx);
+                if(!scan->blocks || inode->valid != 1) continue;
+                if(fs_small_file(fs, inode)){
+                    // a small file has at most its shared block
+                    if(inode->size > INLINE_DATA_SIZE && inode->tail_block >= fs->data_start && inode->tail_block < fs->meta.blocks) {
+                        bitmap_set(scan->used_blocks, inode->tail_block);
+                        size_t slots = tail_slots(inode->size);
+                        if(scan->tail_masks && inode->tail_slot > 0 && inode->tail_slot + slots <= FS_TAIL_SLOTS) {
+                            __atomic_fetch_or(&scan->tail_masks[inode->tail_block], tail_mask(inode->tail_slot, slots), __ATOMIC_RELAXED);
+                        }
+                    }
+                } else if(fs_uses_extents(fs)){
+                    pending += mark_inode_extents(scan, inode, &found[pending]);
+                } else {
+                    pending += mark_inode_pointers(scan, inode, &found[pending]);
+                }
+                // read the pointer blocks once a full batch has been collected
+                if(pending >= FS_IO_WINDOW){
+                    success = mark_indirect_blocks(scan, found, pending, pointer_buffers);
+                    pending = 0;
+                }
+            }
+        }
+        if(success && pending > 0){
+            success = mark_indirect_blocks(scan, found, pending, pointer_buffers);
+        }
+    }
+    fs_block_free(inode_buffers, FS_IO_WINDOW);
+    fs_block_free(pointer_buffers, FS_IO_WINDOW);
+    scan->success = success;
+    return NULL;
+}
+
+/**
+ * Read blocks for the mount scan. A scan running alone goes through read_block_views, slices
+ * scanned at the same time read straight from the disk (the block cache is not thread safe),
+ * runs of consecutive blocks with one vectored read.
+ *
+ * @param       scan            Slice being scanned.
+ * @param       block_numbers   Blocks to view (at most FS_IO_WINDOW).
+ * @param       buffers         Fallback buffers for disks that are not mapped, one per block.
+ * @param       views           Filled with a pointer to the contents of each block.
+ * @param       count           Number of blocks.
+ * @return      Whether or not every block could be read.
+ **/
+bool fs_scan_read(FsScan *scan, const size_t *block_numbers, Block *buffers, const Block **views, size_t count){
+    if(!scan->shared) return read_block_views(scan->fs, block_numbers, buffers, views, count, DISK_TAG_SCAN);
+    Disk *disk = scan->fs->disk;
+    char *data[FS_IO_WINDOW];
+    for(size_t start = 0; start < count; ){
+        if((views[start] = (const Block*)disk_map_block(disk, block_numbers[start]))){
+            start++;
+            continue;
+        }
+        size_t end = start + 1;
+        while(end < count && block_numbers[end] == block_numbers[end - 1] + 1) end++;
+        for(size_t i = start; i < end; i++){
+            data[i - start] = buffers[i].data;
+            views[i] = &buffers[i];
+        }
+        if(disk_readv(disk, block_numbers[start], data, end - start) == DISK_FAILURE) return false;
+        start = end;
+    }
+    return true;
+}
+
+/**
+ * Read or write a bitmap stored in consecutive blocks, FS_IO_WINDOW blocks at a time.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @param       words   Bitmap, whole blocks of words.
+ * @param       first   First block of the bitmap on disk.
+ * @param       blocks  Number of blocks to transfer.
+ * @param       write   Whether to write the bitmap instead of reading it.
+ * @return      Whether or not every block was transferred.
+ **/
+bool fs_transfer_bitmap(FileSystem *fs, uint64_t *words, size_t first, size_t blocks, bool write){
+    char *bitmap = (char*)words;
+    for(size_t window = 0; window < blocks; window += FS_IO_WINDOW){
+        size_t n = min(FS_IO_WINDOW, blocks - window);
+        size_t numbers[FS_IO_WINDOW];
+        char *data[FS_IO_WINDOW];
+        for(size_t i = 0; i < n; i++){
+            numbers[i] = first + window + i;
+            data[i] = bitmap + (window + i) * BLOCK_SIZE;
+        }
+        if(!fs_transfer_blocks(fs, numbers, data, n, write, DISK_TAG_BITMAP)) return false;
+    }
+    return true;
+}
+
+/**
+ * Read a bitmap of bits entries stored on disk, bits past the last entry are cleared.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @param       words   Bitmap, room for fs_bitmap_blocks(bits) blocks.
+ * @param       stored  Number of blocks reserved for the bitmap on disk.
+ * @param       bits    Number of entries.
+ * @param       first   First block of the bitmap on disk.
+ * @return      Whether or not the bitmap could be read.
+ **/
+bool fs_load_bitmap(FileSystem *fs, uint64_t *words, size_t stored, size_t bits, size_t first){
+    size_t blocks = fs_bitmap_blocks(bits);
+    if(stored < blocks){
+        error("bitmap of %zu blocks is too small for %zu entries", stored, bits);
+        return false;
+    }
+    if(!fs_transfer_bitmap(fs, words, first, blocks, false)) return false;
+    bitmap_clear_range(words, bits, blocks * BITS_PER_BLOCK - bits);
+    return true;
+}
+
+/**
+ * Write the super block with the specified state and the current allocation counters.
+ * Only used on disks with the feature fields, older super blocks are never rewritten by a mount.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @param       state   FS_STATE_MOUNTED or FS_STATE_CLEAN.
+ * @return      Whether or not the super block was written.
+ **/
+bool fs_write_super_block(FileSystem *fs, uint32_t state){
+    Block *block = fs_block_alloc(1);
+    if(block == NULL) return false;
+    fs->meta.state = state;
+    fs->meta.free_block_count = fs->free_count;
+    fs->meta.free_inode_count = fs->free_inode_count;
+    fs->meta.inode_hint = fs->inode_hint;
+    memset(block->data, 0, BLOCK_SIZE);
+    block->super_block = fs->meta;
+    bool success = disk_write(fs->disk, 0, block->data) != DISK_FAILURE;
+    fs_block_free(block, 1);
+    return success;
+}
+
+/**
+ * Write the bitmaps kept on disk back to their blocks if they changed since they were read or last stored.
+ * With block groups only the bitmaps of the groups that changed are written.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @return      Whether or not the bitmaps were stored.
+ **/
+bool fs_store_bitmaps(FileSystem *fs){
+    if(fs->meta.features & FS_FEATURE_GROUPS){
+        bool changed = fs->free_blocks_dirty || fs->free_inodes_dirty;
+        if(fs->free_blocks_dirty && !fs_transfer_group_bitmaps(fs, false, true)) return false;
+        if(fs->free_inodes_dirty && !fs_transfer_group_bitmaps(fs, true, true)) return false;
+        // the counters in the group descriptors go with the bitmaps
+        if(changed && !fs_store_group_table(fs)) return false;
+        fs->free_blocks_dirty = false;
+        fs->free_inodes_dirty = false;
+        return true;
+    }
+    if((fs->meta.features & FS_FEATURE_BITMAP) && fs->free_blocks_dirty){
+        if(!fs_transfer_bitmap(fs, fs->free_blocks, 1 + fs->meta.inode_blocks, fs_bitmap_blocks(fs->meta.blocks), true)) return false;
+        fs->free_blocks_dirty = false;
+    }
+    if((fs->meta.features & FS_FEATURE_INODE_BITMAP) && fs->free_inodes_dirty){
+        size_t first = 1 + fs->meta.inode_blocks + fs->meta.bitmap_blocks;
+        if(!fs_transfer_bitmap(fs, fs->free_inodes, first, fs_bitmap_blocks(fs->meta.inodes), true)) return false;
+        fs->free_inodes_dirty = false;
+    }
+    return true;
+}
+
+/**
+ * Write an empty inode table, a free block bitmap with every data block free and
+ * a free inode bitmap with every inode free to a disk that is being formatted.
+ *
+ * @param       disk    Disk being formatted.
+ * @param       meta    Super block of the new file system.
+ * @return      Whether or not the tables were written.
+ **/
+bool fs_format_tables(Disk *disk, const SuperBlock *meta){
+    size_t bitmap_start = 1 + meta->inode_blocks;
+    size_t inode_bitmap_start = bitmap_start + meta->bitmap_blocks;
+    size_t data_start = inode_bitmap_start + meta->inode_bitmap_blocks;
+    if(data_start >= meta->blocks){
+        error("disk of %u blocks is too small for a file system", meta->blocks);
+        return false;
+    }
+    Block *blocks = fs_block_alloc(FS_IO_WINDOW);
+    if(blocks == NULL) return false;
+    memset(blocks, 0, FS_IO_WINDOW * BLOCK_SIZE);
+    char *zeros[FS_IO_WINDOW];
+    for(size_t i = 0; i < FS_IO_WINDOW; i++) zeros[i] = blocks[i].data;
+    bool success = true;
+    for(size_t window = 1; success && window <= meta->inode_blocks; window += FS_IO_WINDOW){
+        size_t n = min(FS_IO_WINDOW, meta->inode_blocks + 1 - window);
+        success = disk_writev(disk, window, zeros, n) != DISK_FAILURE;
+    }
+    success = success
+        && fs_format_bitmap(disk, bitmap_start, meta->bitmap_blocks, data_start, meta->blocks, blocks)
+        && fs_format_bitmap(disk, inode_bitmap_start, meta->inode_bitmap_blocks, 0, meta->inodes, blocks);
+    fs_block_free(blocks, FS_IO_WINDOW);
+    return success;
+}
+
+/**
+ * Read or write the free block (or free inode) bitmaps of the groups, FS_IO_WINDOW groups at a time.
+ * Writes skip the groups whose part of the bitmap is unchanged.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @param       inodes  Whether to transfer the free inode bitmaps instead of the free block bitmaps.
+ * @param       write   Whether to write the bitmaps instead of reading them.
+ * @return      Whether or not every bitmap was transferred.
+ **/
+bool fs_transfer_group_bitmaps(FileSystem *fs, bool inodes, bool write){
+    Block *buffers = fs_block_alloc(FS_IO_WINDOW);
+    if(buffers == NULL) return false;
+    uint64_t *words = inodes ? fs->free_inodes : fs->free_blocks;
+    bool success = true;
+    for(size_t g = 0; success && g < fs->group_count; ){
+        size_t numbers[FS_IO_WINDOW];
+        char *data[FS_IO_WINDOW];
+        BlockGroup *members[FS_IO_WINDOW];
+        size_t n = 0;
+        for(; g < fs->group_count && n < FS_IO_WINDOW; g++){
+            BlockGroup *group = &fs->groups[g];
+            if(write && !(inodes ? group->inodes_dirty : group->blocks_dirty)) continue;
+            members[n] = group;
+            numbers[n] = inodes ? group->inode_bitmap : group->block_bitmap;
+            data[n] = buffers[n].data;
+            n++;
+        }
+        for(size_t i = 0; write && i < n; i++){
+            size_t first = inodes ? members[i]->first_inode : members[i]->first;
+            size_t bits = inodes ? members[i]->inodes : members[i]->end - members[i]->first;
+            memset(data[i], 0, BLOCK_SIZE);
+            memcpy(data[i], words + first / BITMAP_WORD_BITS, BITMAP_WORDS(bits) * sizeof(uint64_t));
+        }
+        success = n == 0 || fs_transfer_blocks(fs, numbers, data, n, write, DISK_TAG_BITMAP);
+        for(size_t i = 0; success && i < n; i++){
+            size_t first = inodes ? members[i]->first_inode : members[i]->first;
+            size_t bits = inodes ? members[i]->inodes : members[i]->end - members[i]->first;
+            if(!write) memcpy(words + first / BITMAP_WORD_BITS, data[i], BITMAP_WORDS(bits) * sizeof(uint64_t));
+            if(write && inodes) members[i]->inodes_dirty = false;
+            if(write && !inodes) members[i]->blocks_dirty = false;
+        }
+    }
+    fs_block_free(buffers, FS_IO_WINDOW);
+    return success;
+}
+
+/**
+ * Write the group descriptors, with the current free counts of the groups, after the super block.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @return      Whether or not the descriptors were written.
+ **/
+bool fs_store_group_table(FileSystem *fs){
+    Block *block = fs_block_alloc(1);
+    if(block == NULL) return false;
+    bool success = true;
+    for(size_t t = 0; success && t < fs->meta.group_table_blocks; t++){
+        memset(block->data, 0, BLOCK_SIZE);
+        for(size_t i = 0; i < GROUPS_PER_BLOCK && t * GROUPS_PER_BLOCK + i < fs->group_count; i++){
+            const BlockGroup *group = &fs->groups[t * GROUPS_PER_BLOCK + i];
+            block->groups[i] = (GroupsDescriptor){
+                .block_bitmap = group->block_bitmap,
+                .inode_bitmap = group->inode_bitmap,
+                .inode_table = group->inode_table,
+                .data_start = group->data_start,
+                .free_blocks = group->free_blocks,
+                .free_inodes = group->free_inodes,
+            };
+        }
+        success = fs_write_block(fs, 1 + t, block->data, DISK_TAG_BITMAP) != DISK_FAILURE;
+    }
+    fs_block_free(block, 1);
+    return success;
+}
+
+/**
+ * Work out where the tables and the data blocks of a group are.
+ * Without FS_FEATURE_GROUPS the only group covers the whole disk.
+ *
+ * @param       meta    Super block of the file system.
+ * @param       g       Group number.
+ * @param       group   Filled with the layout of the group, its counters are zeroed.
+ **/
+void fs_group_layout(const SuperBlock *meta, size_t g, BlockGroup *group){
+    if(!(meta->features & FS_FEATURE_GROUPS)){
+        *group = (BlockGroup){
+            .end = meta->blocks,
+            .data_start = 1 + meta->inode_blocks + meta->bitmap_blocks + meta->inode_bitmap_blocks,
+            .inode_table = 1,
+            .inode_blocks = meta->inode_blocks,
+            .inodes = meta->inodes,
+        };
+        return;
+    }
+    size_t first = g * meta->group_blocks;
+    // group 0 starts with the super block and the group descriptors
+    size_t start = first + (g == 0 ? 1 + meta->group_table_blocks : 0);
+    *group = (BlockGroup){
+        .first = first,
+        .end = min(first + meta->group_blocks, (size_t)meta->blocks),
+        .block_bitmap = start,
+        .inode_bitmap = start + 1,
+        .inode_table = start + 2,
+        .inode_blocks = meta->group_inode_blocks,
+        .data_start = start + 2 + meta->group_inode_blocks,
+        .first_inode = g * meta->group_inode_blocks * INODES_PER_BLOCK,
+        .inodes = meta->group_inode_blocks * INODES_PER_BLOCK,
+    };
+}
+
+/**
+ * Split a disk that is being formatted into groups of group_blocks blocks (rounded down to a
+ * multiple of 64, at most BITS_PER_BLOCK and no larger than the disk) and size the inode table and the counters to match.
+ * Each group gets a tenth of its blocks for inodes. A last group that is too small for its tables
+ * and a data block is left out.
+ *
+ * @param       meta            Super block of the new file system.
+ * @param       group_blocks    Blocks per group (0 selects FS_GROUP_BLOCKS).
+ * @return      Whether or not the disk is large enough.
+ **/
+bool fs_layout_groups(SuperBlock *meta, size_t group_blocks){
+    size_t size = group_blocks ? group_blocks : FS_GROUP_BLOCKS;
+    // a disk smaller than a group is one group of its own size
+    size = min(size, (size_t)BITMAP_WORDS(meta->blocks) * BITMAP_WORD_BITS);
+    size = min(size - size % BITMAP_WORD_BITS, (size_t)BITS_PER_BLOCK);
+    if(size == 0){
+        error("a group needs at least %d blocks", BITMAP_WORD_BITS);
+        return false;
+    }
+    size_t count = (meta->blocks + size - 1) / size;
+    meta->group_blocks = size;
+    meta->group_inode_blocks = min((size_t)ceil(0.1 * size), (size_t)(BITS_PER_BLOCK / INODES_PER_BLOCK));
+    meta->group_table_blocks = (count + GROUPS_PER_BLOCK - 1) / GROUPS_PER_BLOCK;
+    meta->group_count = count;
+    BlockGroup group;
+    fs_group_layout(meta, count - 1, &group);
+    if(group.data_start >= group.end) meta->group_count = --count;
+    fs_group_layout(meta, 0, &group);
+    if(count == 0 || group.data_start >= group.end){
+        error("disk of %u blocks is too small for groups of %zu blocks", meta->blocks, size);
+        return false;
+    }
+    meta->inode_blocks = count * meta->group_inode_blocks;
+    meta->inodes = meta->inode_blocks * INODES_PER_BLOCK;
+    meta->total_inodes = meta->inodes;
+    meta->bitmap_blocks = 0;
+    meta->inode_bitmap_blocks = 0;
+    meta->free_block_count = 0;
+    for(size_t g = 0; g < count; g++){
+        fs_group_layout(meta, g, &group);
+        meta->free_block_count += group.end - group.data_start;
+    }
+    meta->free_inode_count = meta->inodes;
+    return true;
+}
+
+/**
+ * Set up the groups of a file system being mounted, with their locks.
+ *
+ * @param       fs      Pointer to FileSystem structure with its meta set.
+ * @return      Whether or not the groups in the super block make sense.
+ **/
+bool fs_initialize_groups(FileSystem *fs){
+    const SuperBlock *meta = &fs->meta;
+    bool groups = meta->features & FS_FEATURE_GROUPS;
+    size_t count = groups ? meta->group_count : 1;
+    if(groups && (count == 0 || meta->group_blocks == 0 || meta->group_blocks % BITMAP_WORD_BITS
+        || meta->group_blocks > BITS_PER_BLOCK || meta->group_inode_blocks == 0
+        || meta->group_inode_blocks * INODES_PER_BLOCK > BITS_PER_BLOCK)){
+        error("invalid block groups in super block");
+        return false;
+    }
+    BlockGroup *table = calloc(count, sizeof(BlockGroup));
+    if(table == NULL) return false;
+    for(size_t g = 0; g < count; g++){
+        fs_group_layout(meta, g, &table[g]);
+        if(table[g].inodes == 0 || (groups && (table[g].data_start >= table[g].end || table[g].end > meta->blocks))){
+            error("invalid layout of group %zu", g);
+            free(table);
+            return false;
+        }
+    }
+    for(size_t g = 0; g < count; g++) pthread_mutex_init(&table[g].lock, NULL);
+    fs->groups = table;
+    fs->group_count = count;
+    fs->data_start = table[0].data_start;
+    return true;
+}
+
+/**
+ * Write the tables of every group of a disk that is being formatted: an empty slice of the
+ * inode table, a free block bitmap with the data blocks of the group free, a free inode bitmap
+ * with its inodes free, and the group descriptors after the super block.
+ *
+ * @param       disk    Disk being formatted.
+ * @param       meta    Super block of the new file system.
+ * @return      Whether or not the tables were written.
+ **/
+bool fs_format_groups(Disk *disk, const SuperBlock *meta){
+    Block *blocks = fs_block_alloc(FS_IO_WINDOW + 1);
+    if(blocks == NULL) return false;
+    memset(blocks, 0, FS_IO_WINDOW * BLOCK_SIZE);
+    Block *scratch = &blocks[FS_IO_WINDOW];
+    char *zeros[FS_IO_WINDOW];
+    for(size_t i = 0; i < FS_IO_WINDOW; i++) zeros[i] = blocks[i].data;
+    bool success = true;
+    BlockGroup group;
+    for(size_t g = 0; success && g < meta->group_count; g++){
+        fs_group_layout(meta, g, &group);
+        for(size_t window = 0; success && window < group.inode_blocks; window += FS_IO_WINDOW){
+            size_t n = min(FS_IO_WINDOW, group.inode_blocks - window);
+            success = disk_writev(disk, group.inode_table + window, zeros, n) != DISK_FAILURE;
+        }
+        success = success
+            && fs_format_bitmap(disk, group.block_bitmap, 1, group.data_start - group.first, group.end - group.first, scratch)
+            && fs_format_bitmap(disk, group.inode_bitmap, 1, 0, group.inodes, scratch);
+    }
+    for(size_t t = 0; success && t < meta->group_table_blocks; t++){
+        memset(scratch->data, 0, BLOCK_SIZE);
+        for(size_t i = 0; i < GROUPS_PER_BLOCK && t * GROUPS_PER_BLOCK + i < meta->group_count; i++){
+            fs_group_layout(meta, t * GROUPS_PER_BLOCK + i, &group);
+            scratch->groups[i] = (GroupsDescriptor){
+                .block_bitmap = group.block_bitmap,
+                .inode_bitmap = group.inode_bitmap,
+                .inode_table = group.inode_table,
+                .data_start = group.data_start,
+                .free_blocks = group.end - group.data_start,
+                .free_inodes = group.inodes,
+            };
+        }
+        success = disk_write(disk, 1 + t, scratch->data) != DISK_FAILURE;
+    }
+    fs_block_free(blocks, FS_IO_WINDOW + 1);
+    return success;
+}
+
+/**
+ * Write a bitmap of count blocks starting at block first, with the bits of entries [lo, hi) set.
+ * Bitmap block i covers entries [i * BITS_PER_BLOCK, (i + 1) * BITS_PER_BLOCK).
+ *
+ * @param       disk    Disk being formatted.
+ * @param       first   First block of the bitmap.
+ * @param       count   Number of bitmap blocks.
+ * @param       lo      First entry to set.
+ * @param       hi      Entry after the last one to set.
+ * @param       buffer  Buffer for one block.
+ * @return      Whether or not the bitmap was written.
+ **/
+bool fs_format_bitmap(Disk *disk, size_t first, size_t count, size_t lo, size_t hi, Block *buffer){
+    uint64_t *words = (uint64_t*)buffer->data;
+    for(size_t i = 0; i < count; i++){
+        size_t start = max(lo, i * BITS_PER_BLOCK);
+        size_t stop = min(hi, (i + 1) * BITS_PER_BLOCK);
+        memset(words, 0, BLOCK_SIZE);
+        if(start < stop) bitmap_set_range(words, start - i * BITS_PER_BLOCK, stop - start);
+        if(disk_write(disk, first + i, buffer->data) == DISK_FAILURE) return false;
+    }
+    return true;
+}
+
+/**
+ * Read indirect blocks and mark the blocks they point to as used, FS_IO_WINDOW at a time. The
+ * indirect blocks found in blocks of higher levels are marked and read the same way, until level 1.
+ * On a file system with extents these are extent blocks, and used counts extents.
+ *
+ * @param       scan            Slice being scanned.
+ * @param       found           Indirect blocks to read.
+ * @param       count           Number of indirect blocks.
+ * @param       buffers         FS_IO_WINDOW buffers for disks that are not mapped.
+ * @return      Whether or not the indirect blocks could be read.
+ **/
+bool mark_indirect_blocks(FsScan *scan, const ScanIndirect *found, size_t count, Block *buffers){
+    FileSystem *fs = scan->fs;
+    ScanIndirect *queue = malloc(count * sizeof(ScanIndirect));
+    size_t capacity = count;
+    if(queue == NULL) return false;
+    memcpy(queue, found, count * sizeof(ScanIndirect));
+    bool success = true;
+    for(size_t head = 0; success && head < count; ){
+        size_t n = min(FS_IO_WINDOW, count - head);
+        size_t numbers[FS_IO_WINDOW];
+        const Block *pointer_blocks[FS_IO_WINDOW];
+        for(size_t i = 0; i < n; i++) numbers[i] = queue[head + i].block;
+        if(!fs_scan_read(scan, numbers, buffers, pointer_blocks, n)){
+            success = false;
+            break;
+        }
+        for(size_t i = 0; success && i < n; i++){
+            ScanIndirect indirect = queue[head + i];
+            if(fs_uses_extents(fs)){
+                for(size_t curr = 0; curr < indirect.used; curr++) mark_extent_blocks(scan, &pointer_blocks[i]->extents[curr]);
+                continue;
+            }
+            // while there are still pointers in use, we set the free blocks to false
+            size_t span = indirect_span(indirect.level - 1);
+            for(size_t curr = 0; curr * span < indirect.used; curr++){
+                uint32_t pointer = pointer_blocks[i]->block_pointers[curr];
+                if(pointer < fs->data_start || pointer >= fs->meta.blocks) continue;
+                bitmap_set(scan->used_blocks, pointer);
+                if(indirect.level == 1) continue;
+                if(count == capacity){
+                    ScanIndirect *grown = realloc(queue, 2 * capacity * sizeof(ScanIndirect));
+                    if(grown == NULL){
+                        success = false;
+                        break;
+                    }
+                    queue = grown;
+                    capacity *= 2;
+                }
+                queue[count++] = (ScanIndirect){pointer, indirect.level - 1, min(span, indirect.used - curr * span)};
+            }
+        }
+        head += n;
+    }
+    free(queue);
+    return success;
+}
+
+/**
+ * Mark the direct blocks and the top indirect blocks of an Inode as used. The indirect blocks
+ * are handed back, so they can be read with the next batch.
+ *
+ * @param       scan            Slice being scanned.
+ * @param       inode           Valid Inode.
+ * @param       found           Filled with its top indirect blocks, at most FS_INDIRECT_LEVELS.
+ * @return      Number of indirect blocks handed back.
+ **/
+size_t mark_inode_pointers(FsScan *scan, const Inode *inode, ScanIndirect *found){
+    FileSystem *fs = scan->fs;
+    size_t direct = fs_direct_pointers(fs);
+    // for each direct pointer to block, we mark the block as used
+    for(size_t j = 0; j < direct; j++){
+        if(inode->pointers[j] >= fs->data_start && inode->pointers[j] < fs->meta.blocks) {
+            bitmap_set(scan->used_blocks, inode->pointers[j]);
+        }
+    }
+    // the indirect blocks are in use when the size reaches past the blocks before them
+    size_t used_blocks = (inode->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    size_t tree_first = direct;
+    size_t count = 0;
+    for(size_t level = 1; level <= fs_indirect_levels(fs) && used_blocks > tree_first; level++){
+        uint32_t root = inode->pointers[inode_tree_root(level)];
+        if(root >= fs->data_start && root < fs->meta.blocks) {
+            bitmap_set(scan->used_blocks, root);
+            found[count++] = (ScanIndirect){root, level, min(used_blocks - tree_first, indirect_span(level))};
+        }
+        tree_first += indirect_span(level);
+    }
+    return count;
+}
+
+/**
+ * Mark the blocks of the extents kept in an extent mapped Inode as used. If the Inode has an
+ * extent block it is marked as well and handed back, so it can be read with the next batch.
+ *
+ * @param       scan            Slice being scanned.
+ * @param       inode           Valid Inode.
+ * @param       found           Set to the extent block of the Inode, if it has one.
+ * @return      Number of extent blocks handed back (0 or 1).
+ **/
+size_t mark_inode_extents(FsScan *scan, const Inode *inode, ScanIndirect *found){
+    FileSystem *fs = scan->fs;
+    size_t count = min((size_t)inode->extent_count, (size_t)EXTENTS_MAX);
+    for(size_t e = 0; e < count && e < EXTENTS_PER_INODE; e++) mark_extent_blocks(scan, &inode->extents[e]);
+    if(count <= EXTENTS_PER_INODE || inode->extent_block < fs->data_start || inode->extent_block >= fs->meta.blocks) return 0;
+    bitmap_set(scan->used_blocks, inode->extent_block);
+    *found = (ScanIndirect){inode->extent_block, 1, count - EXTENTS_PER_INODE};
+    return 1;
+}
+
+/**
+ * Mark the blocks of an extent as used, the part of it outside the data blocks is ignored (all of a hole).
+ **/
+void mark_extent_blocks(FsScan *scan, const Extent *extent){
+    FileSystem *fs = scan->fs;
+    if(extent->start == 0) return;
+    size_t first = max((size_t)extent->start, fs->data_start);
+    size_t end = min((size_t)extent->start + extent->length, (size_t)fs->meta.blocks);
+    if(first < end) bitmap_set_range(scan->used_blocks, first, end - first);
+}
+
+/**
+ * function that intialize the fs meta from the super block on disk
+ * 1. if any of fs, disk or super_block is NUll, then return
+ * 2. set fs meta
+ * 3. set up the block groups
+ * 4. set fs disk and mounted = true
+**/
+bool fs_initialize_meta(FileSystem *fs, Block* super_block, Disk* disk){
+    if (fs == NULL || super_block == NULL || disk == NULL) return false;
     fs->meta = (super_block->super_block);
+    // older images have arbitrary bytes where the feature fields are
+    if(fs->meta.features_magic != FEATURES_MAGIC){
+        fs->meta.features = 0;
+        fs->meta.bitmap_blocks = 0;
+        fs->meta.inode_bitmap_blocks = 0;
+        fs->meta.state = 0;
+    }
+    if(!(fs->meta.features & FS_FEATURE_GROUPS)){
+        fs->meta.group_blocks = 0;
+        fs->meta.group_inode_blocks = 0;
+        fs->meta.group_count = 0;
+        fs->meta.group_table_blocks = 0;
+    }
+    // a file system without groups is one group
+    if(!fs_initialize_groups(fs)) return false;
+    fs->disk = disk;
+    disk->mounted = true;
     return true;
 }
 
@@ -505,10 +3886,31 @@ bool fs_initialize_meta(FileSystem *fs, Block* super_block, Disk* disk){
  * 4. inode_blocks = ceil(10% of total num of blocks)
  * 5. total inodes = inode_blocks * INODES per block
  * 6. total blocks = blocks (extended with block group in future)
+ * 7. a file system with block groups keeps the inode table of its groups
+ * 8. a disk without a file system gets the feature fields, with a free block bitmap
+ *    sized for its blocks and a free inode bitmap sized for its inodes,
+ *    the rest of the block of an existing super block is left alone
 **/
 bool verify_superblock(Block* super_block, Disk* disk) {
     if(super_block == NULL || disk == NULL) return false;
     uint32_t num_inode_blocks = round(ceil(0.1 * disk->blocks));
+    const SuperBlock *existing = &super_block->super_block;
+    // with block groups the inode table is made of the slices of the groups
+    if(existing->magic_number == MAGIC_NUMBER && existing->features_magic == FEATURES_MAGIC && (existing->features & FS_FEATURE_GROUPS)) {
+        num_inode_blocks = existing->group_count * existing->group_inode_blocks;
+    }
+    if(super_block->super_block.magic_number != MAGIC_NUMBER) {
+        SuperBlock *meta = &super_block->super_block;
+        memset(super_block->data, 0, BLOCK_SIZE);
+        meta->features_magic = FEATURES_MAGIC;
+        meta->features = FS_FEATURE_BITMAP | FS_FEATURE_INODE_BITMAP;
+        meta->bitmap_blocks = fs_bitmap_blocks(disk->blocks);
+        meta->inode_bitmap_blocks = fs_bitmap_blocks(num_inode_blocks * INODES_PER_BLOCK);
+        // fs_format_tables leaves everything free, which is what the counters say
+        meta->state = FS_STATE_CLEAN;
+        meta->free_block_count = disk->blocks - (1 + num_inode_blocks + meta->bitmap_blocks + meta->inode_bitmap_blocks);
+        meta->free_inode_count = num_inode_blocks * INODES_PER_BLOCK;
+    }
     super_block->super_block.magic_number = MAGIC_NUMBER;
     super_block->super_block.blocks = disk->blocks;
     super_block->super_block.inode_blocks = num_inode_blocks;
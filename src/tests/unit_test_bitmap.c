@@ -0,0 +1,111 @@
+#include "../include/bitmap.h"
+#include "../include/log.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+// Constants for test
+#define BITS    (300)
+
+int test_bitmap_bits() {
+    uint64_t words[BITMAP_WORDS(BITS)] = {0};
+    assert(BITMAP_WORDS(BITS) == 5);
+
+    debug("Check setting and clearing single bits");
+    bitmap_set(words, 0);
+    bitmap_set(words, 63);
+    bitmap_set(words, 64);
+    bitmap_set(words, BITS - 1);
+    assert(bitmap_test(words, 0) && bitmap_test(words, 63) && bitmap_test(words, 64));
+    assert(!bitmap_test(words, 1) && !bitmap_test(words, 65));
+    assert(bitmap_count(words, BITS) == 4);
+    assert(bitmap_count(words, 64) == 2);
+    bitmap_clear(words, 63);
+    assert(!bitmap_test(words, 63));
+    assert(bitmap_count(words, BITS) == 3);
+
+    debug("Check ranges across word boundaries");
+    memset(words, 0, sizeof(words));
+    bitmap_set_range(words, 10, 200);
+    assert(bitmap_count(words, BITS) == 200);
+    assert(!bitmap_test(words, 9) && bitmap_test(words, 10) && bitmap_test(words, 209) && !bitmap_test(words, 210));
+    assert(words[1] == ~0ull && words[2] == ~0ull);
+    bitmap_clear_range(words, 60, 70);
+    assert(bitmap_count(words, BITS) == 130);
+    assert(bitmap_test(words, 59) && !bitmap_test(words, 60) && !bitmap_test(words, 129) && bitmap_test(words, 130));
+    bitmap_set_range(words, 0, 0);
+    assert(bitmap_count(words, BITS) == 130);
+    return EXIT_SUCCESS;
+}
+
+int test_bitmap_find() {
+    uint64_t words[BITMAP_WORDS(BITS)] = {0};
+
+    debug("Check searching an empty bitmap");
+    assert(bitmap_find(words, BITS, 0) == BITS);
+    assert(bitmap_find(words, BITS, BITS) == BITS);
+
+    debug("Check searching across words");
+    bitmap_set(words, 5);
+    bitmap_set(words, 200);
+    assert(bitmap_find(words, BITS, 0) == 5);
+    assert(bitmap_find(words, BITS, 5) == 5);
+    assert(bitmap_find(words, BITS, 6) == 200);
+    assert(bitmap_find(words, BITS, 201) == BITS);
+    assert(bitmap_find(words, 200, 6) == 200);
+
+    debug("Check bits past the end are not found");
+    memset(words, 0, sizeof(words));
+    words[4] = ~0ull;
+    assert(bitmap_find(words, 256, 0) == 256);
+    assert(bitmap_find(words, 260, 0) == 256);
+    return EXIT_SUCCESS;
+}
+
+int test_bitmap_run() {
+    uint64_t words[BITMAP_WORDS(BITS)] = {0};
+
+    debug("Check runs of clear and set bits");
+    assert(bitmap_run(words, BITS, 0, BITS) == 0);
+    bitmap_set_range(words, 3, 4);
+    assert(bitmap_run(words, BITS, 3, BITS) == 4);
+    assert(bitmap_run(words, BITS, 4, BITS) == 3);
+    assert(bitmap_run(words, BITS, 3, 2) == 2);
+
+    debug("Check runs over whole words");
+    bitmap_set_range(words, 50, 200);
+    assert(bitmap_run(words, BITS, 50, BITS) == 200);
+    assert(bitmap_run(words, BITS, 64, BITS) == 186);
+    assert(bitmap_run(words, BITS, 50, 100) == 100);
+
+    debug("Check runs stop at the end of the bitmap");
+    bitmap_set_range(words, 250, 50);
+    assert(bitmap_run(words, BITS, 250, BITS) == 50);
+    assert(bitmap_run(words, 280, 250, BITS) == 30);
+    assert(bitmap_run(words, BITS, BITS, BITS) == 0);
+    return EXIT_SUCCESS;
+}
+
+// entry point into test
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s NUMBER\n\n", argv[0]);
+        fprintf(stderr, "Where NUMBER is right of the following:\n");
+        fprintf(stderr, "    0. Test bitmap bits and ranges\n");
+        fprintf(stderr, "    1. Test bitmap_find\n");
+        fprintf(stderr, "    2. Test bitmap_run\n");
+        return EXIT_FAILURE;
+    }
+
+    int number = atoi(argv[1]);
+    int status = EXIT_FAILURE;
+
+    switch (number) {
+        case 0:  status = test_bitmap_bits(); break;
+        case 1:  status = test_bitmap_find(); break;
+        case 2:  status = test_bitmap_run(); break;
+        default: fprintf(stderr, "Unknown NUMBER: %d\n", number); break;
+    }
+
+    return status;
+}
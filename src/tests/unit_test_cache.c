@@ -0,0 +1,271 @@
+#include "../include/cache.h"
+#include "../include/log.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+
+// Constants for test
+#define DISK_PATH   "unit_cache.image"
+#define DISK_BLOCKS (16)
+
+void test_cleanup() {
+    unlink(DISK_PATH);
+}
+
+// fill every block of the disk with its own block number
+Disk* open_numbered_disk() {
+    Disk *disk = disk_open(DISK_PATH, DISK_BLOCKS);
+    assert(disk);
+    char data[BLOCK_SIZE];
+    for (size_t i = 0; i < DISK_BLOCKS; i++) {
+        memset(data, 'a' + i, BLOCK_SIZE);
+        assert(disk_write(disk, i, data) == BLOCK_SIZE);
+    }
+    disk->reads = disk->writes = 0;
+    return disk;
+}
+
+int test_cache_read() {
+    Disk *disk = open_numbered_disk();
+    Cache *cache = cache_create(disk, 4);
+    assert(cache);
+    assert(cache->capacity == 4);
+
+    debug("Check reading (miss, then hit)");
+    char data[BLOCK_SIZE];
+    assert(cache_read(cache, 2, data) == BLOCK_SIZE);
+    assert(data[0] == 'c' && data[BLOCK_SIZE - 1] == 'c');
+    assert(cache_read(cache, 2, data) == BLOCK_SIZE);
+    assert(data[0] == 'c');
+    assert(cache->misses == 1);
+    assert(cache->hits   == 1);
+    assert(disk->reads   == 1);
+
+    debug("Check reading (bad block)");
+    assert(cache_read(cache, DISK_BLOCKS, data) == DISK_FAILURE);
+
+    debug("Check reading a list (misses batched, duplicates cached once)");
+    char buffers[5][BLOCK_SIZE];
+    char *pointers[5] = { buffers[0], buffers[1], buffers[2], buffers[3], buffers[4] };
+    size_t blocks[5] = { 2, 3, 4, 3, 5 };
+    assert(cache_read_list(cache, blocks, pointers, 5) == 5 * BLOCK_SIZE);
+    for (size_t i = 0; i < 5; i++) {
+        assert(buffers[i][0] == 'a' + blocks[i]);
+    }
+    assert(cache->hits      == 2);
+    assert(cache->misses    == 5);
+    assert(cache->evictions == 0);
+
+    cache_destroy(cache);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_cache_write() {
+    Disk *disk = open_numbered_disk();
+    Cache *cache = cache_create(disk, 4);
+    assert(cache);
+
+    debug("Check writing (stays in cache)");
+    char data[BLOCK_SIZE];
+    memset(data, 'Z', BLOCK_SIZE);
+    assert(cache_write(cache, 1, data) == BLOCK_SIZE);
+    assert(disk->writes == 0);
+    assert(disk->reads  == 0);
+    assert(cache->dirty == 1);
+    memset(data, 0, BLOCK_SIZE);
+    assert(cache_read(cache, 1, data) == BLOCK_SIZE);
+    assert(data[0] == 'Z');
+    assert(disk->reads == 0);
+
+    debug("Check flushing");
+    assert(cache_flush(cache));
+    assert(disk->writes      == 1);
+    assert(cache->writebacks == 1);
+    assert(cache->dirty      == 0);
+    assert(cache_flush(cache));
+    assert(disk->writes == 1);
+    assert(disk_read(disk, 1, data) == BLOCK_SIZE);
+    assert(data[BLOCK_SIZE - 1] == 'Z');
+
+    debug("Check eviction writes back dirty blocks");
+    memset(data, 'Y', BLOCK_SIZE);
+    assert(cache_write(cache, 7, data) == BLOCK_SIZE);
+    for (size_t i = 8; i < 8 + 8; i++) {
+        assert(cache_read(cache, i, data) == BLOCK_SIZE);
+    }
+    assert(cache->evictions  > 0);
+    assert(cache->writebacks == 2);
+    assert(disk_read(disk, 7, data) == BLOCK_SIZE);
+    assert(data[0] == 'Y');
+
+    debug("Check destroying flushes");
+    memset(data, 'X', BLOCK_SIZE);
+    assert(cache_write(cache, 0, data) == BLOCK_SIZE);
+    cache_destroy(cache);
+    assert(disk_read(disk, 0, data) == BLOCK_SIZE);
+    assert(data[0] == 'X');
+
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_cache_clock() {
+    Disk *disk = open_numbered_disk();
+    Cache *cache = cache_create(disk, 4);
+    assert(cache);
+
+    debug("Check referenced blocks survive a sweep");
+    char data[BLOCK_SIZE];
+    for (size_t i = 0; i < 4; i++) {
+        assert(cache_read(cache, i, data) == BLOCK_SIZE);
+    }
+    // the hand clears every reference bit and evicts block 0
+    assert(cache_read(cache, 4, data) == BLOCK_SIZE);
+    assert(cache->evictions == 1);
+    // block 1 is referenced again, so block 2 goes next
+    assert(cache_read(cache, 1, data) == BLOCK_SIZE);
+    assert(cache_read(cache, 5, data) == BLOCK_SIZE);
+    size_t misses = cache->misses;
+    assert(cache_read(cache, 1, data) == BLOCK_SIZE);
+    assert(cache->misses == misses);
+    assert(cache_read(cache, 2, data) == BLOCK_SIZE);
+    assert(cache->misses == misses + 1);
+
+    cache_destroy(cache);
+
+    debug("Check default capacity");
+    cache = cache_create(disk, 0);
+    assert(cache);
+    assert(cache->capacity == CACHE_DEFAULT_BLOCKS);
+    cache_destroy(cache);
+    assert(cache_create(NULL, 4) == NULL);
+
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_cache_prefetch() {
+    Disk *disk = open_numbered_disk();
+    Cache *cache = cache_create(disk, 8);
+    assert(cache);
+
+    debug("Check prefetching (cached blocks and duplicates skipped)");
+    char data[BLOCK_SIZE];
+    assert(cache_read(cache, 3, data) == BLOCK_SIZE);
+    size_t blocks[5] = { 3, 4, 5, 4, 6 };
+    assert(cache_prefetch(cache, blocks, 5) == 3);
+    assert(cache->prefetches == 3);
+    assert(disk->reads == 4);
+
+    debug("Check prefetched blocks are hits");
+    size_t hits = cache->hits;
+    for (size_t i = 4; i < 7; i++) {
+        assert(cache_read(cache, i, data) == BLOCK_SIZE);
+        assert(data[0] == 'a' + i);
+    }
+    assert(cache->hits == hits + 3);
+    assert(disk->reads == 4);
+
+    debug("Check prefetching (bad block)");
+    size_t bad[1] = { DISK_BLOCKS };
+    assert(cache_prefetch(cache, bad, 1) == DISK_FAILURE);
+
+    cache_destroy(cache);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_cache_flush() {
+    Disk *disk = open_numbered_disk();
+    Cache *cache = cache_create(disk, 16);
+    assert(cache);
+    assert(cache->flush_batch == CACHE_FLUSH_BATCH);
+    assert(cache->max_run     == CACHE_MAX_RUN);
+
+    debug("Check flushing merges sorted runs");
+    char data[BLOCK_SIZE];
+    size_t blocks[8] = { 9, 3, 12, 4, 8, 11, 5, 10 };
+    for (size_t i = 0; i < 8; i++) {
+        memset(data, 'A' + blocks[i], BLOCK_SIZE);
+        assert(cache_write(cache, blocks[i], data) == BLOCK_SIZE);
+    }
+    assert(cache_flush(cache));
+    assert(cache->runs       == 2);
+    assert(cache->writebacks == 8);
+    assert(disk->writes      == 8);
+    for (size_t i = 0; i < 8; i++) {
+        assert(disk_read(disk, blocks[i], data) == BLOCK_SIZE);
+        assert(data[0] == 'A' + blocks[i] && data[BLOCK_SIZE - 1] == 'A' + blocks[i]);
+    }
+
+    debug("Check maximum run length");
+    cache->max_run = 2;
+    for (size_t i = 0; i < 8; i++) {
+        assert(cache_write(cache, blocks[i], data) == BLOCK_SIZE);
+    }
+    assert(cache_flush(cache));
+    assert(cache->runs == 2 + 5);
+
+    debug("Check flush batch size");
+    cache->max_run = CACHE_MAX_RUN;
+    cache->flush_batch = 3;
+    for (size_t i = 0; i < 8; i++) {
+        assert(cache_write(cache, blocks[i], data) == BLOCK_SIZE);
+    }
+    assert(cache_flush(cache));
+    assert(cache->dirty == 0);
+    assert(cache->writebacks == 24);
+    assert(cache->runs >= 2 + 5 + 3);
+
+    cache_destroy(cache);
+
+    debug("Check eviction writes back a sorted batch");
+    cache = cache_create(disk, 4);
+    assert(cache);
+    size_t runs = cache->runs;
+    for (size_t b = 7; b > 3; b--) {
+        assert(cache_write(cache, b, data) == BLOCK_SIZE);
+    }
+    assert(cache_read(cache, 0, data) == BLOCK_SIZE);
+    assert(cache->runs == runs + 1);
+    assert(cache->writebacks == 4);
+    assert(cache->dirty == 0);
+
+    cache_destroy(cache);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+// entry point
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s NUMBER\n\n", argv[0]);
+        fprintf(stderr, "Where NUMBER is right of the following:\n");
+        fprintf(stderr, "    0. Test cache_read\n");
+        fprintf(stderr, "    1. Test cache_write\n");
+        fprintf(stderr, "    2. Test cache replacement\n");
+        fprintf(stderr, "    3. Test cache_prefetch\n");
+        fprintf(stderr, "    4. Test cache_flush\n");
+        return EXIT_FAILURE;
+    }
+
+    int number = atoi(argv[1]);
+    int status = EXIT_FAILURE;
+
+    assert(atexit(test_cleanup) == EXIT_SUCCESS);
+
+    switch (number) {
+        case 0:  status = test_cache_read(); break;
+        case 1:  status = test_cache_write(); break;
+        case 2:  status = test_cache_clock(); break;
+        case 3:  status = test_cache_prefetch(); break;
+        case 4:  status = test_cache_flush(); break;
+        default: fprintf(stderr, "Unknown NUMBER: %d\n", number); break;
+    }
+
+    return status;
+}
@@ -1,6 +1,8 @@
 #include "../include/disk.h"
 #include "../include/log.h"
 #include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <stdio.h>
 
@@ -25,7 +27,7 @@ int test_disk_open() {
     debug("Check disk attributes");
     disk = disk_open(DISK_PATH, 10);
     assert(disk);
-    assert(disk->fd      >= 0);
+    assert(disk_fd(disk) >= 0);
     assert(disk->blocks  == 10);
     assert(disk->reads   == 0);
     assert(disk->writes  == 0);
@@ -43,7 +45,7 @@ int test_disk_read() {
     for (size_t i = 0; i < DISK_BLOCKS*BLOCK_SIZE; i++) {
         data[i] = i / BLOCK_SIZE;
     }
-    assert(write(disk->fd, data, DISK_BLOCKS*BLOCK_SIZE) == DISK_BLOCKS*BLOCK_SIZE);
+    assert(write(disk_fd(disk), data, DISK_BLOCKS*BLOCK_SIZE) == DISK_BLOCKS*BLOCK_SIZE);
     
     debug("Check bad disk");
     assert(disk_read(NULL, 0, data) == DISK_FAILURE);
@@ -99,6 +101,457 @@ int test_disk_write() {
     return EXIT_SUCCESS;
 }
 
+int test_disk_readv() {
+    Disk *disk = disk_open(DISK_PATH, DISK_BLOCKS);
+    assert(disk);
+
+    char data[DISK_BLOCKS*BLOCK_SIZE] = {0};
+    for (size_t i = 0; i < DISK_BLOCKS*BLOCK_SIZE; i++) {
+        data[i] = i / BLOCK_SIZE;
+    }
+    assert(write(disk_fd(disk), data, DISK_BLOCKS*BLOCK_SIZE) == DISK_BLOCKS*BLOCK_SIZE);
+
+    char *buffers[DISK_BLOCKS];
+    for (size_t b = 0; b < DISK_BLOCKS; b++) {
+        buffers[b] = data + (DISK_BLOCKS - 1 - b) * BLOCK_SIZE;
+    }
+    memset(data, 0xff, sizeof(data));
+
+    debug("Check bad disk");
+    assert(disk_readv(NULL, 0, buffers, DISK_BLOCKS) == DISK_FAILURE);
+
+    debug("Check bad run");
+    assert(disk_readv(disk, 1, buffers, DISK_BLOCKS) == DISK_FAILURE);
+
+    debug("Check bad data");
+    assert(disk_readv(disk, 0, NULL, DISK_BLOCKS) == DISK_FAILURE);
+
+    debug("Check reading whole disk into reversed buffers");
+    assert(disk_readv(disk, 0, buffers, DISK_BLOCKS) == DISK_BLOCKS*BLOCK_SIZE);
+    for (size_t b = 0; b < DISK_BLOCKS; b++) {
+        for (size_t i = 0; i < BLOCK_SIZE; i++) {
+            assert(buffers[b][i] == b);
+        }
+    }
+    assert(disk->reads == DISK_BLOCKS);
+
+    debug("Check reading a scatter list");
+    size_t blocks[] = {3, 0, 1, 2};
+    memset(data, 0xff, sizeof(data));
+    assert(disk_read_list(disk, blocks, buffers, DISK_BLOCKS) == DISK_BLOCKS*BLOCK_SIZE);
+    for (size_t b = 0; b < DISK_BLOCKS; b++) {
+        for (size_t i = 0; i < BLOCK_SIZE; i++) {
+            assert(buffers[b][i] == blocks[b]);
+        }
+    }
+    assert(disk->reads == 2*DISK_BLOCKS);
+
+    debug("Check reading a scatter list (bad block)");
+    size_t bad_blocks[] = {0, DISK_BLOCKS};
+    assert(disk_read_list(disk, bad_blocks, buffers, 2) == DISK_FAILURE);
+
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_disk_writev() {
+    Disk *disk = disk_open(DISK_PATH, DISK_BLOCKS);
+    assert(disk);
+
+    char data[DISK_BLOCKS*BLOCK_SIZE] = {0};
+    char *buffers[DISK_BLOCKS];
+    for (size_t b = 0; b < DISK_BLOCKS; b++) {
+        buffers[b] = data + b * BLOCK_SIZE;
+        memset(buffers[b], b + 1, BLOCK_SIZE);
+    }
+
+    debug("Check bad disk");
+    assert(disk_writev(NULL, 0, buffers, DISK_BLOCKS) == DISK_FAILURE);
+
+    debug("Check bad run");
+    assert(disk_writev(disk, DISK_BLOCKS - 1, buffers, 2) == DISK_FAILURE);
+
+    debug("Check writing whole disk");
+    assert(disk_writev(disk, 0, buffers, DISK_BLOCKS) == DISK_BLOCKS*BLOCK_SIZE);
+    assert(disk->writes == DISK_BLOCKS);
+    for (size_t b = 0; b < DISK_BLOCKS; b++) {
+        memset(data, 0, BLOCK_SIZE);
+        assert(disk_read(disk, b, data) == BLOCK_SIZE);
+        for (size_t i = 0; i < BLOCK_SIZE; i++) {
+            assert(data[i] == b + 1);
+        }
+    }
+
+    debug("Check writing a scatter list");
+    size_t blocks[] = {2, 3, 0};
+    for (size_t b = 0; b < 3; b++) {
+        memset(buffers[b], 0x40 + b, BLOCK_SIZE);
+    }
+    assert(disk_write_list(disk, blocks, buffers, 3) == 3*BLOCK_SIZE);
+    assert(disk->writes == DISK_BLOCKS + 3);
+
+    char block[BLOCK_SIZE];
+    for (size_t b = 0; b < 3; b++) {
+        assert(disk_read(disk, blocks[b], block) == BLOCK_SIZE);
+        for (size_t i = 0; i < BLOCK_SIZE; i++) {
+            assert(block[i] == 0x40 + b);
+        }
+    }
+    assert(disk_read(disk, 1, block) == BLOCK_SIZE);
+    assert(block[0] == 2);
+
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_disk_mmap() {
+    debug("Check mapping an empty image");
+    Disk *disk = disk_open_flags(DISK_PATH, DISK_BLOCKS, DISK_MMAP);
+    assert(disk);
+    assert(disk_mapped(disk));
+    assert(disk->blocks  == DISK_BLOCKS);
+    assert(disk->reads   == 0);
+    assert(disk->writes  == 0);
+
+    debug("Check bad block");
+    assert(disk_map_block(disk, DISK_BLOCKS) == NULL);
+
+    char data[BLOCK_SIZE] = {0};
+    for (size_t b = 0; b < DISK_BLOCKS; b++) {
+        debug("Check write block %lu", b);
+        memset(data, b + 1, BLOCK_SIZE);
+        assert(disk_write(disk, b, data) == BLOCK_SIZE);
+
+        const char *mapped = disk_map_block(disk, b);
+        assert(mapped);
+        for (size_t i = 0; i < BLOCK_SIZE; i++) {
+            assert(mapped[i] == b + 1);
+        }
+        assert(disk->writes == b + 1);
+        assert(disk->reads  == b + 1);
+    }
+    assert(disk_flush(disk));
+    disk_close(disk);
+
+    debug("Check mapped writes through the fd backend");
+    disk = disk_open(DISK_PATH, DISK_BLOCKS);
+    assert(disk);
+    assert(disk_mapped(disk) == false);
+    assert(disk_map_block(disk, 0) == NULL);
+    for (size_t b = 0; b < DISK_BLOCKS; b++) {
+        assert(disk_read(disk, b, data) == BLOCK_SIZE);
+        for (size_t i = 0; i < BLOCK_SIZE; i++) {
+            assert(data[i] == b + 1);
+        }
+    }
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+// Descriptor of the io_uring instance the disk queue set up, -1 when it uses something else
+int ring_fd() {
+    int fd = -1;
+    DIR *dir = opendir("/proc/self/fd");
+    if (dir == NULL) return -1;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char path[PATH_MAX], target[PATH_MAX];
+        snprintf(path, sizeof(path), "/proc/self/fd/%s", entry->d_name);
+        ssize_t length = readlink(path, target, sizeof(target) - 1);
+        if (length < 0) continue;
+        target[length] = 0;
+        if (strstr(target, "io_uring")) fd = atoi(entry->d_name);
+    }
+    closedir(dir);
+    return fd;
+}
+
+void check_disk_submit(int flags) {
+    unlink(DISK_PATH);
+    Disk *disk = disk_open_flags(DISK_PATH, DISK_BLOCKS, flags);
+    assert(disk);
+
+    char data[DISK_BLOCKS*BLOCK_SIZE];
+    DiskRequest requests[DISK_BLOCKS];
+    for (size_t b = 0; b < DISK_BLOCKS; b++) {
+        memset(data + b*BLOCK_SIZE, b + 1, BLOCK_SIZE);
+        requests[b] = (DiskRequest){ .block = b, .data = data + b*BLOCK_SIZE, .write = true };
+    }
+
+    debug("Check bad disk");
+    assert(disk_submit(NULL, requests, DISK_BLOCKS) == DISK_FAILURE);
+    assert(disk_reap(NULL, 1) == DISK_FAILURE);
+
+    debug("Check reaping with nothing in flight");
+    assert(disk_reap(disk, 1) == 0);
+
+    debug("Check bad block");
+    DiskRequest bad = { .block = DISK_BLOCKS, .data = data };
+    assert(disk_submit(disk, &bad, 1) == DISK_FAILURE);
+
+    debug("Check submitting writes in one batch");
+    assert(disk_submit(disk, requests, DISK_BLOCKS) == DISK_BLOCKS);
+    size_t reaped = 0;
+    while (reaped < DISK_BLOCKS) {
+        ssize_t result = disk_reap(disk, 1);
+        assert(result >= 1);
+        reaped += result;
+    }
+    assert(reaped == DISK_BLOCKS);
+    assert(disk->writes == DISK_BLOCKS);
+    for (size_t b = 0; b < DISK_BLOCKS; b++) {
+        assert(requests[b].result == BLOCK_SIZE);
+    }
+
+    debug("Check reading back with disk_batch");
+    memset(data, 0, sizeof(data));
+    for (size_t b = 0; b < DISK_BLOCKS; b++) {
+        requests[b] = (DiskRequest){ .block = DISK_BLOCKS - 1 - b, .data = data + b*BLOCK_SIZE };
+    }
+    assert(disk_batch(disk, requests, DISK_BLOCKS) == DISK_BLOCKS*BLOCK_SIZE);
+    assert(disk->reads == DISK_BLOCKS);
+    for (size_t b = 0; b < DISK_BLOCKS; b++) {
+        for (size_t i = 0; i < BLOCK_SIZE; i++) {
+            assert(data[b*BLOCK_SIZE + i] == DISK_BLOCKS - b);
+        }
+    }
+
+    debug("Check batches deeper than the queue");
+    char *blocks = malloc(3*DISK_QUEUE_DEPTH*BLOCK_SIZE);
+    DiskRequest *many = malloc(3*DISK_QUEUE_DEPTH*sizeof(DiskRequest));
+    for (size_t i = 0; i < 3*DISK_QUEUE_DEPTH; i++) {
+        many[i] = (DiskRequest){ .block = i % DISK_BLOCKS, .data = blocks + i*BLOCK_SIZE };
+    }
+    assert(disk_batch(disk, many, 3*DISK_QUEUE_DEPTH) == 3*DISK_QUEUE_DEPTH*BLOCK_SIZE);
+    for (size_t i = 0; i < 3*DISK_QUEUE_DEPTH; i++) {
+        assert(blocks[i*BLOCK_SIZE] == i % DISK_BLOCKS + 1);
+    }
+
+    int fd = ring_fd();
+    if (flags == 0 && fd >= 0) {
+        debug("Check batches once the kernel refuses the ring");
+        // the rings stay mapped, io_uring_enter fails for good on what is now /dev/null
+        int null = open("/dev/null", O_RDWR);
+        assert(null >= 0);
+        assert(dup2(null, fd) == fd);
+        close(null);
+        memset(blocks, 0, 3*DISK_QUEUE_DEPTH*BLOCK_SIZE);
+        for (size_t i = 0; i < 3*DISK_QUEUE_DEPTH; i++) {
+            many[i] = (DiskRequest){ .block = i % DISK_BLOCKS, .data = blocks + i*BLOCK_SIZE };
+        }
+        assert(disk_batch(disk, many, 3*DISK_QUEUE_DEPTH) == 3*DISK_QUEUE_DEPTH*BLOCK_SIZE);
+        for (size_t i = 0; i < 3*DISK_QUEUE_DEPTH; i++) {
+            assert(blocks[i*BLOCK_SIZE] == i % DISK_BLOCKS + 1);
+        }
+        assert(disk_submit(disk, requests, DISK_BLOCKS) == DISK_BLOCKS);
+        assert(disk_reap(disk, SIZE_MAX) == DISK_BLOCKS);
+        assert(disk_reap(disk, 1) == 0);
+    }
+    free(blocks);
+    free(many);
+
+    disk_close(disk);
+}
+
+int test_disk_submit() {
+    debug("Check io_uring");
+    check_disk_submit(0);
+    debug("Check thread pool");
+    check_disk_submit(DISK_THREADPOOL);
+    debug("Check mapped disk");
+    check_disk_submit(DISK_MMAP);
+    return EXIT_SUCCESS;
+}
+
+int test_disk_direct() {
+    debug("Check DISK_MMAP and DISK_DIRECT together");
+    assert(disk_open_flags(DISK_PATH, DISK_BLOCKS, DISK_MMAP|DISK_DIRECT) == NULL);
+
+    Disk *disk = disk_open_flags(DISK_PATH, DISK_BLOCKS, DISK_DIRECT);
+    assert(disk);
+
+    debug("Check buffer alignment and reuse");
+    char *aligned = disk_buffer_alloc(DISK_BLOCKS);
+    assert(aligned);
+    assert(disk_buffer_aligned(aligned));
+    assert(disk_buffer_alloc(0) == NULL);
+    disk_buffer_free(aligned, DISK_BLOCKS);
+    assert(disk_buffer_alloc(DISK_BLOCKS) == aligned);
+
+    debug("Check aligned vectored writes");
+    char *buffers[DISK_BLOCKS];
+    for (size_t b = 0; b < DISK_BLOCKS; b++) {
+        buffers[b] = aligned + b*BLOCK_SIZE;
+        memset(buffers[b], b + 1, BLOCK_SIZE);
+    }
+    assert(disk_writev(disk, 0, buffers, DISK_BLOCKS) == DISK_BLOCKS*BLOCK_SIZE);
+
+    debug("Check unaligned reads are bounced");
+    char *unaligned = malloc(DISK_BLOCKS*BLOCK_SIZE + 1) + 1;
+    for (size_t b = 0; b < DISK_BLOCKS; b++) {
+        buffers[b] = unaligned + b*BLOCK_SIZE;
+    }
+    assert(disk_read(disk, 1, unaligned) == BLOCK_SIZE);
+    assert(unaligned[0] == 2 && unaligned[BLOCK_SIZE - 1] == 2);
+    memset(unaligned, 0, DISK_BLOCKS*BLOCK_SIZE);
+    assert(disk_readv(disk, 0, buffers, DISK_BLOCKS) == DISK_BLOCKS*BLOCK_SIZE);
+    for (size_t b = 0; b < DISK_BLOCKS; b++) {
+        assert(buffers[b][0] == b + 1 && buffers[b][BLOCK_SIZE - 1] == b + 1);
+    }
+
+    debug("Check unaligned asynchronous requests");
+    DiskRequest requests[DISK_BLOCKS];
+    for (size_t b = 0; b < DISK_BLOCKS; b++) {
+        memset(buffers[b], 0x30 + b, BLOCK_SIZE);
+        requests[b] = (DiskRequest){ .block = b, .data = b % 2 ? buffers[b] : aligned + b*BLOCK_SIZE, .write = true };
+        memset(requests[b].data, 0x30 + b, BLOCK_SIZE);
+    }
+    assert(disk_batch(disk, requests, DISK_BLOCKS) == DISK_BLOCKS*BLOCK_SIZE);
+    for (size_t b = 0; b < DISK_BLOCKS; b++) {
+        assert(disk_read(disk, b, unaligned) == BLOCK_SIZE);
+        assert(unaligned[0] == 0x30 + b && unaligned[BLOCK_SIZE - 1] == 0x30 + b);
+    }
+    assert(disk->writes == 2*DISK_BLOCKS);
+
+    free(unaligned - 1);
+    disk_buffer_free(aligned, DISK_BLOCKS);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_disk_ram() {
+    debug("Check RAM disk attributes");
+    Disk *disk = disk_open_ram(DISK_BLOCKS);
+    assert(disk);
+    assert(disk->ops == &disk_ram_ops);
+    assert(disk->blocks  == DISK_BLOCKS);
+    assert(disk->reads   == 0);
+    assert(disk->writes  == 0);
+    assert(disk_fd(disk) < 0);
+    assert(disk_mapped(disk));
+
+    debug("Check unwritten blocks are zero");
+    char data[BLOCK_SIZE];
+    memset(data, 0xff, BLOCK_SIZE);
+    assert(disk_read(disk, DISK_BLOCKS - 1, data) == BLOCK_SIZE);
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        assert(data[i] == 0);
+    }
+
+    debug("Check bad block");
+    assert(disk_read(disk, DISK_BLOCKS, data) == DISK_FAILURE);
+    assert(disk_write(disk, DISK_BLOCKS, data) == DISK_FAILURE);
+    assert(disk_map_block(disk, DISK_BLOCKS) == NULL);
+
+    debug("Check vectored writes and mapped reads");
+    char buffers[DISK_BLOCKS][BLOCK_SIZE];
+    char *pointers[DISK_BLOCKS];
+    for (size_t b = 0; b < DISK_BLOCKS; b++) {
+        memset(buffers[b], b + 1, BLOCK_SIZE);
+        pointers[b] = buffers[b];
+    }
+    assert(disk_writev(disk, 0, pointers, DISK_BLOCKS) == DISK_BLOCKS*BLOCK_SIZE);
+    assert(disk->writes == DISK_BLOCKS);
+    for (size_t b = 0; b < DISK_BLOCKS; b++) {
+        const char *mapped = disk_map_block(disk, b);
+        assert(mapped && mapped[0] == b + 1 && mapped[BLOCK_SIZE - 1] == b + 1);
+    }
+
+    debug("Check asynchronous requests");
+    DiskRequest requests[DISK_BLOCKS];
+    for (size_t b = 0; b < DISK_BLOCKS; b++) {
+        memset(buffers[b], 0, BLOCK_SIZE);
+        requests[b] = (DiskRequest){ .block = DISK_BLOCKS - 1 - b, .data = buffers[b] };
+    }
+    assert(disk_batch(disk, requests, DISK_BLOCKS) == DISK_BLOCKS*BLOCK_SIZE);
+    for (size_t b = 0; b < DISK_BLOCKS; b++) {
+        assert(buffers[b][0] == DISK_BLOCKS - b);
+    }
+    assert(disk_flush(disk));
+    disk_close(disk);
+
+    debug("Check incomplete backends");
+    DiskOps ops = disk_ram_ops;
+    ops.flush = NULL;
+    assert(disk_open_ops(&ops, NULL, DISK_BLOCKS, 0) == NULL);
+    assert(disk_open_ops(NULL, NULL, DISK_BLOCKS, 0) == NULL);
+    assert(disk_open_ram(0) == NULL);
+    return EXIT_SUCCESS;
+}
+
+int test_disk_stats() {
+    debug("Check statistics start empty");
+    Disk *disk = disk_open_ram(DISK_BLOCKS);
+    assert(disk);
+    DiskStats stats;
+    disk_stats(disk, &stats);
+    assert(stats.read.ops == 0 && stats.write.ops == 0);
+    assert(disk_latency_percentile(&stats.read, 50) == 0);
+
+    debug("Check sequential and random classification");
+    char data[BLOCK_SIZE] = {0};
+    assert(disk_write(disk, 0, data) == BLOCK_SIZE);
+    assert(disk_write(disk, 1, data) == BLOCK_SIZE);
+    assert(disk_write(disk, 3, data) == BLOCK_SIZE);
+    assert(disk_read(disk, 0, data) == BLOCK_SIZE);
+    assert(disk_read(disk, 1, data) == BLOCK_SIZE);
+    disk_stats(disk, &stats);
+    assert(stats.write.ops == 3 && stats.write.sequential == 2 && stats.write.random == 1);
+    assert(stats.read.ops == 2 && stats.read.sequential == 1 && stats.read.random == 1);
+    assert(stats.write.bytes == 3*BLOCK_SIZE && stats.read.bytes == 2*BLOCK_SIZE);
+
+    debug("Check vectored operations count once with all their bytes");
+    char buffers[DISK_BLOCKS][BLOCK_SIZE];
+    char *pointers[DISK_BLOCKS];
+    for (size_t b = 0; b < DISK_BLOCKS; b++) {
+        pointers[b] = buffers[b];
+    }
+    assert(disk_readv(disk, 0, pointers, DISK_BLOCKS) == DISK_BLOCKS*BLOCK_SIZE);
+    disk_stats(disk, &stats);
+    assert(stats.read.ops == 3 && stats.read.bytes == (2 + DISK_BLOCKS)*BLOCK_SIZE);
+
+    debug("Check histogram and percentiles");
+    size_t total = 0;
+    for (size_t i = 0; i < DISK_LATENCY_BUCKETS; i++) {
+        total += stats.read.histogram[i];
+    }
+    assert(total == stats.read.ops);
+    uint64_t p50 = disk_latency_percentile(&stats.read, 50);
+    uint64_t p99 = disk_latency_percentile(&stats.read, 99);
+    assert(p50 <= p99 && p99 <= stats.read.max_ns);
+    assert(disk_latency_percentile(&stats.read, 100) == stats.read.max_ns);
+    assert(stats.read.total_ns >= stats.read.max_ns);
+
+    debug("Check per caller breakdown");
+    assert(stats.tags[DISK_TAG_OTHER].reads == 3 && stats.tags[DISK_TAG_OTHER].writes == 3);
+    assert(disk_tag(disk, DISK_TAG_INODE) == DISK_TAG_OTHER);
+    assert(disk_read(disk, 0, data) == BLOCK_SIZE);
+    DiskRequest requests[2] = {
+        { .block = 1, .data = buffers[0] },
+        { .block = 2, .data = buffers[1], .write = true },
+    };
+    assert(disk_tag(disk, DISK_TAG_DATA) == DISK_TAG_INODE);
+    assert(disk_batch(disk, requests, 2) == 2*BLOCK_SIZE);
+    assert(disk_tag(disk, DISK_TAGS) == DISK_TAG_DATA);
+    assert(disk->tag == DISK_TAG_OTHER);
+    disk_stats(disk, &stats);
+    assert(stats.tags[DISK_TAG_INODE].reads == 1 && stats.tags[DISK_TAG_INODE].read_bytes == BLOCK_SIZE);
+    assert(stats.tags[DISK_TAG_DATA].reads == 1 && stats.tags[DISK_TAG_DATA].writes == 1);
+    assert(stats.tags[DISK_TAG_DATA].write_bytes == BLOCK_SIZE);
+    assert(stats.read.ops == 5 && stats.write.ops == 4);
+    assert(strcmp(disk_tag_name(DISK_TAG_SCAN), "scan") == 0);
+    assert(strcmp(disk_tag_name(-1), "other") == 0);
+
+    debug("Check reset");
+    disk_stats_reset(disk);
+    disk_stats(disk, &stats);
+    assert(stats.read.ops == 0 && stats.write.ops == 0 && stats.read.max_ns == 0);
+    assert(stats.tags[DISK_TAG_DATA].reads == 0);
+    assert(disk->reads == 4 + DISK_BLOCKS);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
 int test_disk_close() {
     Disk *disk = disk_open(DISK_PATH, DISK_BLOCKS);
     assert(disk);
@@ -116,6 +569,13 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "    1. Test disk_read\n");
         fprintf(stderr, "    2. Test disk_write\n");
         fprintf(stderr, "    3. Test disk_close\n");
+        fprintf(stderr, "    4. Test disk_readv\n");
+        fprintf(stderr, "    5. Test disk_writev\n");
+        fprintf(stderr, "    6. Test disk_mmap\n");
+        fprintf(stderr, "    7. Test disk_submit\n");
+        fprintf(stderr, "    8. Test disk_direct\n");
+        fprintf(stderr, "    9. Test disk_ram\n");
+        fprintf(stderr, "   10. Test disk_stats\n");
         return EXIT_FAILURE;
     }
 
@@ -129,6 +589,13 @@ int main(int argc, char *argv[]) {
         case 1:  status = test_disk_read(); break;
         case 2:  status = test_disk_write(); break;
         case 3:  status = test_disk_close(); break;
+        case 4:  status = test_disk_readv(); break;
+        case 5:  status = test_disk_writev(); break;
+        case 6:  status = test_disk_mmap(); break;
+        case 7:  status = test_disk_submit(); break;
+        case 8:  status = test_disk_direct(); break;
+        case 9:  status = test_disk_ram(); break;
+        case 10: status = test_disk_stats(); break;
         default: fprintf(stderr, "Unknown NUMBER: %d\n", number); break;
     }
 
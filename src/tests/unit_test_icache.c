@@ -0,0 +1,150 @@
+#include "../include/icache.h"
+#include "../include/log.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+// Constants for test
+#define TABLE_INODES    (32)
+
+// Inode table the cache loads from and stores to
+typedef struct Table Table;
+struct Table {
+    uint64_t records[TABLE_INODES];
+    size_t loads;
+    size_t stores; // calls of table_store
+    size_t stored; // inodes stored
+    bool sorted; // every batch came sorted
+};
+
+bool table_load(void *context, size_t number, void *record) {
+    Table *table = context;
+    if(number >= TABLE_INODES) return false;
+    table->loads += 1;
+    memcpy(record, &table->records[number], sizeof(uint64_t));
+    return true;
+}
+
+bool table_store(void *context, const size_t *numbers, const void *const *records, size_t count) {
+    Table *table = context;
+    table->stores += 1;
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0 && numbers[i] <= numbers[i - 1]) table->sorted = false;
+        memcpy(&table->records[numbers[i]], records[i], sizeof(uint64_t));
+        table->stored += 1;
+    }
+    return true;
+}
+
+Table* open_numbered_table() {
+    Table *table = calloc(1, sizeof(Table));
+    assert(table);
+    for (size_t i = 0; i < TABLE_INODES; i++) table->records[i] = 1000 + i;
+    table->sorted = true;
+    return table;
+}
+
+int test_icache_get() {
+    Table *table = open_numbered_table();
+    InodeCache *cache = icache_create(4, sizeof(uint64_t), table_load, table_store, table);
+    assert(cache);
+    assert(cache->capacity == 4);
+
+    debug("Check getting inodes (miss, then hit)");
+    uint64_t *record = icache_get(cache, 3, true);
+    assert(record && *record == 1003);
+    icache_put(cache, record, false);
+    assert(icache_get(cache, 3, true) == record);
+    icache_put(cache, record, false);
+    assert(cache->misses == 1 && cache->hits == 1);
+    assert(table->loads == 1);
+
+    debug("Check getting inodes (load failure)");
+    assert(icache_get(cache, TABLE_INODES, true) == NULL);
+
+    debug("Check new contents are not loaded");
+    record = icache_get(cache, 7, false);
+    assert(record && *record == 0);
+    *record = 7;
+    icache_put(cache, record, true);
+    assert(table->loads == 1);
+    assert(cache->dirty == 1);
+    assert(table->records[7] == 1007);
+
+    debug("Check flushing stores dirty inodes and keeps them");
+    assert(icache_flush(cache));
+    assert(table->records[7] == 7);
+    assert(cache->dirty == 0 && cache->writebacks == 1);
+    record = icache_get(cache, 7, true);
+    assert(*record == 7 && cache->hits == 2);
+    icache_put(cache, record, false);
+
+    icache_destroy(cache);
+    free(table);
+    return EXIT_SUCCESS;
+}
+
+int test_icache_evict() {
+    Table *table = open_numbered_table();
+    InodeCache *cache = icache_create(4, sizeof(uint64_t), table_load, table_store, table);
+    assert(cache);
+
+    debug("Check dirty inodes are stored sorted when evicted");
+    for (size_t i = 8; i > 0; i--) {
+        uint64_t *record = icache_get(cache, i, true);
+        assert(record);
+        *record += 1;
+        icache_put(cache, record, true);
+    }
+    assert(cache->evictions == 4);
+    assert(table->sorted);
+    for (size_t i = 5; i <= 8; i++) assert(table->records[i] == 1001 + i);
+    assert(table->stores == 1 && table->stored == 4);
+
+    debug("Check inodes in use are never evicted");
+    uint64_t *pinned[4];
+    for (size_t i = 0; i < 4; i++) {
+        pinned[i] = icache_get(cache, 20 + i, true);
+        assert(pinned[i] && *pinned[i] == 1020 + i);
+    }
+    assert(icache_get(cache, 30, true) == NULL);
+    icache_put(cache, pinned[2], false);
+    uint64_t *record = icache_get(cache, 30, true);
+    assert(record == pinned[2] && *record == 1030);
+    for (size_t i = 1; i <= 8; i++) assert(table->records[i] == 1001 + i);
+    icache_put(cache, record, false);
+    for (size_t i = 0; i < 4; i++) {
+        if (i != 2) icache_put(cache, pinned[i], false);
+    }
+
+    debug("Check destroying stores what is left");
+    record = icache_get(cache, 31, false);
+    *record = 31;
+    icache_put(cache, record, true);
+    icache_destroy(cache);
+    assert(table->records[31] == 31);
+    free(table);
+    return EXIT_SUCCESS;
+}
+
+// entry point into test
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s NUMBER\n\n", argv[0]);
+        fprintf(stderr, "Where NUMBER is right of the following:\n");
+        fprintf(stderr, "    0. Test icache_get, icache_put and icache_flush\n");
+        fprintf(stderr, "    1. Test icache eviction\n");
+        return EXIT_FAILURE;
+    }
+
+    int number = atoi(argv[1]);
+    int status = EXIT_FAILURE;
+
+    switch (number) {
+        case 0:  status = test_icache_get(); break;
+        case 1:  status = test_icache_evict(); break;
+        default: fprintf(stderr, "Unknown NUMBER: %d\n", number); break;
+    }
+
+    return status;
+}
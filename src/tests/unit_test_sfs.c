@@ -1,14 +1,39 @@
 #include "../include/sfs.h"
 #include "../include/log.h"
+#include "../include/utils.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 
 #include <unistd.h>
 
 // test functions
 
+// compares an inode against a reference file byte for byte, reading it in chunks of the given size
+void check_inode_contents(FileSystem *fs, size_t inode_number, const char *path, size_t chunk) {
+    FILE *stream = fopen(path, "r");
+    assert(stream);
+    char *expected = malloc(1<<20);
+    size_t size = fread(expected, 1, 1<<20, stream);
+    fclose(stream);
+
+    assert(fs_stat(fs, inode_number) == size);
+    char *buffer = malloc(chunk);
+    size_t offset = 0;
+    while (offset < size) {
+        ssize_t result = fs_read(fs, inode_number, buffer, chunk, offset);
+        assert(result == min(chunk, size - offset));
+        assert(memcmp(buffer, expected + offset, result) == 0);
+        offset += result;
+    }
+    assert(fs_read(fs, inode_number, buffer, chunk, size) == 0);
+    free(buffer);
+    free(expected);
+}
+
 void test_cleanup() {
     unlink("data/image.unit");
 }
@@ -23,11 +48,13 @@ int test_fs_mount() {
     assert(fs.disk           == disk);
     assert(fs.disk->mounted  == true);
     assert(fs.free_blocks);
-    assert(fs.free_blocks[0] == false);
-    assert(fs.free_blocks[1] == false);
-    assert(fs.free_blocks[2] == false);
-    assert(fs.free_blocks[3] == true);
-    assert(fs.free_blocks[4] == true);
+    assert(!fs_block_is_free(&fs, 0));
+    assert(!fs_block_is_free(&fs, 1));
+    assert(!fs_block_is_free(&fs, 2));
+    assert(fs_block_is_free(&fs, 3));
+    assert(fs_block_is_free(&fs, 4));
+    assert(fs.free_inodes);
+    assert(fs.free_inode_count == INODES_PER_BLOCK - 1);
 
     debug("Check mounting filesystem (already mounted)");
     assert(fs_mount(&fs, disk) == false);
@@ -43,26 +70,26 @@ int test_fs_mount() {
     assert(fs.disk           == disk);
     assert(fs.disk->mounted  == true);
     assert(fs.free_blocks);
-    assert(fs.free_blocks[0] == false);
-    assert(fs.free_blocks[1] == false);
-    assert(fs.free_blocks[2] == false);
-    assert(fs.free_blocks[3] == true);
-    assert(fs.free_blocks[4] == false);
-    assert(fs.free_blocks[5] == false);
-    assert(fs.free_blocks[6] == false);
-    assert(fs.free_blocks[7] == false);
-    assert(fs.free_blocks[8] == false);
-    assert(fs.free_blocks[9] == false);
-    assert(fs.free_blocks[10] == false);
-    assert(fs.free_blocks[11] == false);
-    assert(fs.free_blocks[12] == false);
-    assert(fs.free_blocks[13] == false);
-    assert(fs.free_blocks[14] == false);
-    assert(fs.free_blocks[15] == true);
-    assert(fs.free_blocks[16] == true);
-    assert(fs.free_blocks[17] == true);
-    assert(fs.free_blocks[18] == true);
-    assert(fs.free_blocks[19] == true);
+    assert(!fs_block_is_free(&fs, 0));
+    assert(!fs_block_is_free(&fs, 1));
+    assert(!fs_block_is_free(&fs, 2));
+    assert(fs_block_is_free(&fs, 3));
+    assert(!fs_block_is_free(&fs, 4));
+    assert(!fs_block_is_free(&fs, 5));
+    assert(!fs_block_is_free(&fs, 6));
+    assert(!fs_block_is_free(&fs, 7));
+    assert(!fs_block_is_free(&fs, 8));
+    assert(!fs_block_is_free(&fs, 9));
+    assert(!fs_block_is_free(&fs, 10));
+    assert(!fs_block_is_free(&fs, 11));
+    assert(!fs_block_is_free(&fs, 12));
+    assert(!fs_block_is_free(&fs, 13));
+    assert(!fs_block_is_free(&fs, 14));
+    assert(fs_block_is_free(&fs, 15));
+    assert(fs_block_is_free(&fs, 16));
+    assert(fs_block_is_free(&fs, 17));
+    assert(fs_block_is_free(&fs, 18));
+    assert(fs_block_is_free(&fs, 19));
 
     debug("Check mounting filesystem (already mounted)");
     assert(fs_mount(&fs, disk) == false);
@@ -87,15 +114,25 @@ int test_fs_create() {
         assert(fs_create(&fs) == i);
 
         Block block;
+        assert(fs_sync(&fs));
         assert(disk_read(fs.disk, 1, block.data) != DISK_FAILURE);
         assert(block.inodes[i].valid == true);
         assert(block.inodes[i].size  == 0);
     }
 
     debug("Check creating inodes (table full)");
+    assert(fs.free_inode_count == 0);
     assert(fs_create(&fs) < 0);
     assert(fs_create(&fs) < 0);
 
+    debug("Check creating inodes reuses removed ones (next fit)");
+    assert(fs_remove(&fs, 7));
+    assert(fs_remove(&fs, 3));
+    assert(fs.free_inode_count == 2);
+    assert(fs_create(&fs) == 3);
+    assert(fs_create(&fs) == 7);
+    assert(fs_create(&fs) < 0);
+
     fs_unmount(&fs);
     disk_close(disk);
     return EXIT_SUCCESS;
@@ -115,16 +152,17 @@ int test_fs_remove() {
 
     debug("Check removing inode 2");
     assert(fs_remove(&fs, 2));
-    assert(fs.free_blocks[4]);
-    assert(fs.free_blocks[5]);
-    assert(fs.free_blocks[6]);
-    assert(fs.free_blocks[7]);
-    assert(fs.free_blocks[8]);
-    assert(fs.free_blocks[9]);
-    assert(fs.free_blocks[13]);
-    assert(fs.free_blocks[14]);
+    assert(fs_block_is_free(&fs, 4));
+    assert(fs_block_is_free(&fs, 5));
+    assert(fs_block_is_free(&fs, 6));
+    assert(fs_block_is_free(&fs, 7));
+    assert(fs_block_is_free(&fs, 8));
+    assert(fs_block_is_free(&fs, 9));
+    assert(fs_block_is_free(&fs, 13));
+    assert(fs_block_is_free(&fs, 14));
 
     Block block;
+    assert(fs_sync(&fs));
     assert(disk_read(fs.disk, 1, block.data) != DISK_FAILURE);
     assert(block.inodes[2].valid == false);
     assert(block.inodes[2].size  == 0);
@@ -159,8 +197,1742 @@ int test_fs_stat() {
     assert(fs_stat(&fs, 1) == -1);
     assert(fs_stat(&fs, 2) == 27160);
 
+    debug("Check stat on inode 2 (cached inode table)");
+    size_t reads = disk->reads;
+    assert(fs_stat(&fs, 2) == 27160);
+    assert(fs_stat(&fs, 3) >= 0);
+    assert(disk->reads == reads);
+    assert(fs.cache->hits >= 2);
+
+    fs_unmount(&fs);
+    disk_close(disk);
+
+    disk = disk_open_flags("data/image.20", 20, DISK_MMAP);
+    assert(disk);
+    assert(fs_mount(&fs, disk));
+
+    debug("Check stat on inode 2 (mapped disk)");
+    size_t writes = disk->writes;
+    assert(fs_stat(&fs, 1) == -1);
+    assert(fs_stat(&fs, 2) == 27160);
+    assert(disk->writes == writes);
+
+    fs_unmount(&fs);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_fs_read() {
+    Disk *disk = disk_open("data/image.5", 5);
+    assert(disk);
+
+    FileSystem fs = {0};
+    assert(fs_mount(&fs, disk));
+
+    debug("Check reading inode 1");
+    check_inode_contents(&fs, 1, "data/image.5.1.txt", 4*BUFSIZ);
+    check_inode_contents(&fs, 1, "data/image.5.1.txt", 100);
+
+    debug("Check reading invalid inodes");
+    char buffer[BLOCK_SIZE];
+    assert(fs_read(&fs, 2, buffer, BLOCK_SIZE, 0) == -1);
+    assert(fs_read(&fs, 1, buffer, BLOCK_SIZE, 966) == -1);
+
+    fs_unmount(&fs);
+    disk_close(disk);
+
+    disk = disk_open("data/image.20", 20);
+    assert(disk);
+    assert(fs_mount(&fs, disk));
+
+    debug("Check reading inodes 2 and 3 (direct and indirect blocks)");
+    check_inode_contents(&fs, 2, "data/image.20.2.txt", 4*BUFSIZ);
+    check_inode_contents(&fs, 2, "data/image.20.2.txt", 1000);
+    check_inode_contents(&fs, 3, "data/image.20.3.txt", 4*BUFSIZ);
+
+    debug("Check reads are accounted to their callers");
+    DiskStats stats;
+    disk_stats(disk, &stats);
+    assert(stats.tags[DISK_TAG_SCAN].reads > 0);
+    assert(stats.tags[DISK_TAG_DATA].reads > 0);
+    assert(stats.tags[DISK_TAG_DATA].writes == 0);
+
+    fs_unmount(&fs);
+    disk_close(disk);
+
+    assert(system("cp data/image.200 data/image.unit") == EXIT_SUCCESS);
+    disk = disk_open("data/image.unit", 200);
+    assert(disk);
+    assert(fs_mount(&fs, disk));
+
+    debug("Check readahead on sequential reads of inode 9");
+    const size_t chunk = 32 * 1024;
+    char *data = malloc(chunk);
+    Readahead *stream = &fs.readahead[9 % FS_READAHEAD_SLOTS];
+    size_t offset = 0;
+    for (size_t i = 0; i < 5; i++, offset += chunk) {
+        assert(fs_read(&fs, 9, data, chunk, offset) == chunk);
+    }
+    assert(stream->valid && stream->inode_number == 9);
+    assert(stream->window == FS_READAHEAD_MAX);
+    assert(fs.cache->prefetches > 0);
+    // the rest of the file (including the blocks behind the indirect block) is already cached
+    size_t reads = disk->reads;
+    while (offset < 409305) {
+        assert(fs_read(&fs, 9, data, chunk, offset) > 0);
+        offset += chunk;
+    }
+    assert(disk->reads == reads);
+    check_inode_contents(&fs, 9, "data/image.200.9.txt", chunk);
+
+    debug("Check readahead shrinks on random reads");
+    assert(fs_read(&fs, 9, data, chunk, 200000) == chunk);
+    size_t window = stream->window;
+    assert(fs_read(&fs, 9, data, chunk, 10000) == chunk);
+    assert(stream->window == window / 2);
+    assert(fs_read(&fs, 9, data, chunk, 300000) == chunk);
+    assert(fs_read(&fs, 9, data, chunk, 100000) == chunk);
+    assert(fs_read(&fs, 9, data, chunk, 5000) == chunk);
+    assert(stream->window == 0);
+    free(data);
+    fs_unmount(&fs);
+
+    debug("Check a large unaligned read is merged into a few vectored reads");
+    assert(fs_mount(&fs, disk));
+    FILE *file = fopen("data/image.200.9.txt", "r");
+    assert(file);
+    char *expected = malloc(409305);
+    assert(fread(expected, 1, 409305, file) == 409305);
+    fclose(file);
+    data = malloc(409305);
+    disk_stats_reset(disk);
+    assert(fs_read(&fs, 9, data, 409305, 100) == 409305 - 100);
+    assert(memcmp(data, expected + 100, 409305 - 100) == 0);
+    disk_stats(disk, &stats);
+    assert(stats.tags[DISK_TAG_DATA].reads > 0);
+    assert(stats.read.ops * 8 < 409305 / BLOCK_SIZE);
+    assert(fs_read(&fs, 9, data, 5000, 409305 - 5000) == 5000);
+    assert(memcmp(data, expected + 409305 - 5000, 5000) == 0);
+
+    free(expected);
+    free(data);
+    fs_unmount(&fs);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int check_fs_write(int flags) {
+    assert(system("cp data/image.200 data/image.unit") == EXIT_SUCCESS);
+
+    Disk *disk = disk_open_flags("data/image.unit", 200, flags);
+    assert(disk);
+
+    FileSystem fs = {0};
+    assert(fs_mount(&fs, disk));
+
+    size_t size = 6*BLOCK_SIZE + 123;
+    char *data = malloc(size);
+    char *buffer = malloc(size);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = i % 251;
+    }
+
+    debug("Check writing a new inode in chunks");
+    ssize_t inode_number = fs_create(&fs);
+    assert(inode_number >= 0);
+    assert(fs_write(&fs, inode_number, data, 1000, 0) == 1000);
+    assert(fs_write(&fs, inode_number, data + 1000, size - 1000, 1000) == size - 1000);
+    assert(fs_stat(&fs, inode_number) == size);
+    assert(fs_read(&fs, inode_number, buffer, size, 0) == size);
+    assert(memcmp(buffer, data, size) == 0);
+
+    debug("Check overwriting across blocks");
+    memset(data + BLOCK_SIZE - 10, 'x', 2*BLOCK_SIZE);
+    assert(fs_write(&fs, inode_number, data + BLOCK_SIZE - 10, 2*BLOCK_SIZE, BLOCK_SIZE - 10) == 2*BLOCK_SIZE);
+    assert(fs_stat(&fs, inode_number) == size);
+    assert(fs_read(&fs, inode_number, buffer, size, 0) == size);
+    assert(memcmp(buffer, data, size) == 0);
+
+    debug("Check overwriting whole blocks reads nothing");
+    DiskStats stats;
+    disk_stats_reset(disk);
+    size_t lookups = fs.cache ? fs.cache->hits + fs.cache->misses : 0;
+    memset(data + 2*BLOCK_SIZE, 'y', 3*BLOCK_SIZE);
+    assert(fs_write(&fs, inode_number, data + 2*BLOCK_SIZE, 3*BLOCK_SIZE, 2*BLOCK_SIZE) == 3*BLOCK_SIZE);
+    disk_stats(disk, &stats);
+    assert(stats.tags[DISK_TAG_DATA].reads == 0);
+    assert(!fs.cache || fs.cache->hits + fs.cache->misses == lookups);
+    assert(fs_read(&fs, inode_number, buffer, size, 0) == size);
+    assert(memcmp(buffer, data, size) == 0);
+
+    debug("Check a gap of whole blocks in a new inode");
+    ssize_t sparse = fs_create(&fs);
+    assert(sparse >= 0);
+    assert(fs_write(&fs, sparse, "x", 1, 3*BLOCK_SIZE + 1) == 1);
+    assert(fs_read(&fs, sparse, buffer, 3*BLOCK_SIZE + 2, 0) == 3*BLOCK_SIZE + 2);
+    for (size_t i = 0; i <= 3*BLOCK_SIZE; i++) {
+        assert(buffer[i] == 0);
+    }
+    assert(buffer[3*BLOCK_SIZE + 1] == 'x');
+    assert(fs_remove(&fs, sparse));
+
+    debug("Check writing past the end of the file");
+    assert(fs_write(&fs, inode_number, "end", 3, size + 5000) == 3);
+    assert(fs_stat(&fs, inode_number) == size + 5003);
+    assert(fs_read(&fs, inode_number, buffer, 5003, size) == 5003);
+    for (size_t i = 0; i < 5000; i++) {
+        assert(buffer[i] == 0);
+    }
+    assert(memcmp(buffer + 5000, "end", 3) == 0);
+
+    debug("Check writing when the disk is full");
+    size_t big = 200*BLOCK_SIZE;
+    // null bytes would be left as holes
+    char *filler = malloc(big);
+    assert(filler);
+    memset(filler, 'f', big);
+    ssize_t other = fs_create(&fs);
+    assert(other >= 0);
+    ssize_t written = fs_write(&fs, other, filler, big, 0);
+    assert(written > 0 && written < big);
+    assert(fs_write(&fs, other, filler, big, written) == -1);
+    free(filler);
+
+    if (fs.cache) {
+        debug("Check syncing writes back contiguous runs");
+        size_t writebacks = fs.cache->writebacks;
+        size_t runs = fs.cache->runs;
+        assert(fs_sync(&fs));
+        assert(fs.cache->dirty == 0);
+        assert(fs.cache->runs - runs < fs.cache->writebacks - writebacks);
+    }
+
+    debug("Check contents after remounting");
+    fs_unmount(&fs);
+    disk_close(disk);
+    disk = disk_open_flags("data/image.unit", 200, flags);
+    assert(disk);
+    assert(fs_mount(&fs, disk));
+    assert(fs_read(&fs, inode_number, buffer, size, 0) == size);
+    assert(memcmp(buffer, data, size) == 0);
+    check_inode_contents(&fs, 1, "data/image.200.1.txt", 4*BUFSIZ);
+    check_inode_contents(&fs, 2, "data/image.200.2.txt", 4*BUFSIZ);
+    check_inode_contents(&fs, 9, "data/image.200.9.txt", 4*BUFSIZ);
+    for (size_t b = 0; b < 200; b++) {
+        assert(!fs_block_is_free(&fs, b));
+    }
+
+    free(data);
+    free(buffer);
+    fs_unmount(&fs);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_fs_write() {
+    debug("Check writing with io_uring");
+    check_fs_write(0);
+    debug("Check writing with the thread pool");
+    check_fs_write(DISK_THREADPOOL);
+    debug("Check writing to a mapped disk");
+    check_fs_write(DISK_MMAP);
+    debug("Check writing to a direct disk");
+    check_fs_write(DISK_DIRECT);
+    check_fs_write(DISK_DIRECT|DISK_THREADPOOL);
+    return EXIT_SUCCESS;
+}
+
+int test_fs_ram() {
+    Disk *disk = disk_open_ram(200);
+    assert(disk);
+
+    FileSystem fs = {0};
+    debug("Check mounting a RAM disk");
+    assert(fs_mount(&fs, disk));
+    assert(fs.cache == NULL);
+    assert(fs.group_count == 1);
+    assert(fs.meta.features & FS_FEATURE_BITMAP);
+    assert(fs.meta.features & FS_FEATURE_INODE_BITMAP);
+    assert(fs.meta.bitmap_blocks == 1);
+    assert(fs.meta.inode_bitmap_blocks == 1);
+    assert(fs.data_start == fs.meta.inode_blocks + 3);
+    assert(fs.free_inode_count == fs.meta.inodes);
+    assert(!fs_block_is_free(&fs, fs.meta.inode_blocks + 1));
+    assert(fs_block_is_free(&fs, fs.data_start));
+    assert(fs.free_count == 200 - fs.data_start);
+
+    debug("Check writing and reading back");
+    size_t length = 40 * BLOCK_SIZE + 123;
+    char *data = malloc(length);
+    char *buffer = malloc(length);
+    for (size_t i = 0; i < length; i++) data[i] = i % 251;
+    ssize_t inode_number = fs_create(&fs);
+    assert(inode_number >= 0);
+    assert(fs_write(&fs, inode_number, data, length, 0) == length);
+    assert(fs_read(&fs, inode_number, buffer, length, 0) == length);
+    assert(memcmp(data, buffer, length) == 0);
+
+    debug("Check remounting keeps the data");
+    fs_unmount(&fs);
+    assert(disk->mounted == false);
+    assert(fs_mount(&fs, disk));
+    assert(fs.free_inode_count == fs.meta.inodes - 1);
+    assert(fs_stat(&fs, inode_number) == length);
+    memset(buffer, 0, length);
+    assert(fs_read(&fs, inode_number, buffer, length, 0) == length);
+    assert(memcmp(data, buffer, length) == 0);
+
+    debug("Check the bitmap was stored and the blocks were allocated in one run");
+    assert(fs.free_count == 200 - fs.data_start - 42);
+    for (size_t b = fs.data_start; b < fs.data_start + 42; b++) {
+        assert(!fs_block_is_free(&fs, b));
+    }
+    assert(fs_block_is_free(&fs, fs.data_start + 42));
+    Inode inode;
+    Block block;
+    assert(disk_read(disk, 1 + inode_number / INODES_PER_BLOCK, block.data) == BLOCK_SIZE);
+    inode = block.inodes[inode_number % INODES_PER_BLOCK];
+    for (size_t i = 0; i < POINTERS_PER_INODE; i++) {
+        assert(inode.direct[i] == fs.data_start + i);
+    }
+    assert(inode.indirect == fs.data_start + POINTERS_PER_INODE);
+
+    debug("Check removing frees the blocks on disk");
+    assert(fs_remove(&fs, inode_number));
+    fs_unmount(&fs);
+    assert(fs_mount(&fs, disk));
+    assert(fs.free_count == 200 - fs.data_start);
+    assert(fs.free_inode_count == fs.meta.inodes);
+    assert(fs.inode_hint == inode_number + 1);
+
+    free(data);
+    free(buffer);
+    fs_unmount(&fs);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_fs_recovery() {
+    Disk *disk = disk_open_ram(200);
+    assert(disk);
+
+    FileSystem fs = {0};
+    debug("Check a fresh file system is clean");
+    assert(fs_mount(&fs, disk));
+    Block block;
+    assert(disk_read(disk, 0, block.data) == BLOCK_SIZE);
+    assert(block.super_block.state == FS_STATE_MOUNTED);
+    size_t length = 10 * BLOCK_SIZE;
+    char *data = calloc(1, length);
+    ssize_t first = fs_create(&fs);
+    ssize_t second = fs_create(&fs);
+    assert(first >= 0 && second >= 0);
+    assert(fs_write(&fs, first, data, length, 0) == length);
+    assert(fs_write(&fs, second, data, length, 0) == length);
+    assert(fs_remove(&fs, first));
+    size_t free_count = fs.free_count;
+    size_t free_inode_count = fs.free_inode_count;
+    fs_unmount(&fs);
+    assert(disk_read(disk, 0, block.data) == BLOCK_SIZE);
+    assert(block.super_block.state == FS_STATE_CLEAN);
+    assert(block.super_block.free_block_count == free_count);
+    assert(block.super_block.free_inode_count == free_inode_count);
+
+    debug("Check a clean mount reads the bitmaps instead of the inode table");
+    disk_stats_reset(disk);
+    assert(fs_mount(&fs, disk));
+    DiskStats stats;
+    disk_stats(disk, &stats);
+    assert(stats.tags[DISK_TAG_SCAN].reads == 0);
+    assert(stats.tags[DISK_TAG_BITMAP].reads == 2);
+    assert(stats.read.ops <= 4);
+    assert(fs.free_count == free_count);
+    assert(fs.free_inode_count == free_inode_count);
+    fs_unmount(&fs);
+
+    debug("Check mounting after a crash rebuilds the bitmaps");
+    assert(disk_read(disk, 0, block.data) == BLOCK_SIZE);
+    block.super_block.state = FS_STATE_MOUNTED;
+    block.super_block.free_block_count = 0;
+    assert(disk_write(disk, 0, block.data) == BLOCK_SIZE);
+    // stale bitmaps on disk: nothing free
+    size_t bitmap_start = 1 + block.super_block.inode_blocks;
+    memset(block.data, 0, BLOCK_SIZE);
+    assert(disk_write(disk, bitmap_start, block.data) == BLOCK_SIZE);
+    assert(disk_write(disk, bitmap_start + 1, block.data) == BLOCK_SIZE);
+    assert(fs_mount(&fs, disk));
+    assert(fs.free_blocks_dirty && fs.free_inodes_dirty);
+    assert(fs.free_count == free_count);
+    assert(fs.free_inode_count == free_inode_count);
+    assert(fs_stat(&fs, second) == length);
+    assert(fs_create(&fs) == first);
+    fs_unmount(&fs);
+
+    debug("Check the rebuilt bitmaps were stored");
+    assert(fs_mount(&fs, disk));
+    assert(fs.free_count == free_count);
+    assert(fs.free_inode_count == free_inode_count - 1);
+    fs_unmount(&fs);
+
+    free(data);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+// mount with the specified number of scan threads and compare the bitmaps against the serial scan
+void check_fs_scan(const char *path, size_t blocks, int flags) {
+    Disk *disk = disk_open_flags(path, blocks, flags);
+    assert(disk);
+    FileSystem fs = {0};
+    fs.scan_threads = 1;
+    assert(fs_mount(&fs, disk));
+    size_t block_bytes = BITMAP_WORDS(fs.meta.blocks) * sizeof(uint64_t);
+    size_t inode_bytes = BITMAP_WORDS(fs.meta.inodes) * sizeof(uint64_t);
+    uint64_t *free_blocks = malloc(block_bytes);
+    uint64_t *free_inodes = malloc(inode_bytes);
+    memcpy(free_blocks, fs.free_blocks, block_bytes);
+    memcpy(free_inodes, fs.free_inodes, inode_bytes);
+    size_t free_count = fs.free_count;
+    size_t free_inode_count = fs.free_inode_count;
+    fs_unmount(&fs);
+
+    size_t threads[] = { 0, 2, 3, 8, FS_SCAN_THREADS_MAX, 1000 };
+    for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+        fs.scan_threads = threads[t];
+        disk_stats_reset(disk);
+        assert(fs_mount(&fs, disk));
+        assert(memcmp(free_blocks, fs.free_blocks, block_bytes) == 0);
+        assert(memcmp(free_inodes, fs.free_inodes, inode_bytes) == 0);
+        assert(fs.free_count == free_count);
+        assert(fs.free_inode_count == free_inode_count);
+        DiskStats stats;
+        disk_stats(disk, &stats);
+        assert(disk_mapped(disk) || stats.tags[DISK_TAG_SCAN].reads > 0);
+        fs_unmount(&fs);
+    }
+
+    free(free_blocks);
+    free(free_inodes);
+    disk_close(disk);
+}
+
+int test_fs_scan() {
+    debug("Check parallel scans match the serial scan");
+    check_fs_scan("data/image.20", 20, 0);
+    assert(system("cp data/image.200 data/image.unit") == EXIT_SUCCESS);
+    check_fs_scan("data/image.unit", 200, 0);
+    check_fs_scan("data/image.unit", 200, DISK_MMAP);
+
+    debug("Check parallel scans of a larger table");
+    Disk *disk = disk_open_ram(2000);
+    assert(disk);
+    FileSystem fs = {0};
+    assert(fs_mount(&fs, disk));
+    char *data = calloc(1, 40 * BLOCK_SIZE);
+    for (size_t i = 0; i < 40; i++) {
+        ssize_t inode_number = fs_create(&fs);
+        assert(inode_number >= 0);
+        // spread the files over the table so every slice has some
+        for (size_t skip = 0; skip < i * 7; skip++) {
+            assert(fs_create(&fs) >= 0);
+        }
+        assert(fs_write(&fs, inode_number, data, (i + 1) * BLOCK_SIZE, 0) == (i + 1) * BLOCK_SIZE);
+    }
+    free(data);
+    fs_unmount(&fs);
+    // make the next mount scan
+    Block block;
+    assert(disk_read(disk, 0, block.data) == BLOCK_SIZE);
+    block.super_block.state = FS_STATE_MOUNTED;
+    assert(disk_write(disk, 0, block.data) == BLOCK_SIZE);
+    fs.scan_threads = 1;
+    assert(fs_mount(&fs, disk));
+    size_t free_count = fs.free_count;
+    size_t free_inode_count = fs.free_inode_count;
+    fs_unmount(&fs);
+    for (size_t threads = 2; threads <= 16; threads *= 2) {
+        assert(disk_write(disk, 0, block.data) == BLOCK_SIZE);
+        fs.scan_threads = threads;
+        assert(fs_mount(&fs, disk));
+        assert(fs.free_count == free_count);
+        assert(fs.free_inode_count == free_inode_count);
+        fs_unmount(&fs);
+    }
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_fs_extents() {
+    Disk *disk = disk_open_ram(2000);
+    assert(disk);
+
+    FileSystem fs = {0};
+    debug("Check formatting with extents");
+    assert(fs_format_features(disk, FS_FEATURE_EXTENTS, 0));
+    assert(fs_mount(&fs, disk));
+    assert(fs.meta.features & FS_FEATURE_EXTENTS);
+    assert(fs.meta.features & FS_FEATURE_BITMAP);
+    size_t free_count = fs.free_count;
+
+    debug("Check a file is written as one extent");
+    size_t length = 300 * BLOCK_SIZE + 123;
+    char *data = malloc(length);
+    char *buffer = malloc(length);
+    for (size_t i = 0; i < length; i++) data[i] = i % 251;
+    ssize_t large = fs_create(&fs);
+    assert(large >= 0);
+    assert(fs_write(&fs, large, data, length, 0) == length);
+    assert(fs.free_count == free_count - 301);
+    Block block;
+    assert(disk_read(disk, 1 + large / INODES_PER_BLOCK, block.data) == BLOCK_SIZE);
+    Inode inode = block.inodes[large % INODES_PER_BLOCK];
+    assert(inode.size == length);
+    assert(inode.extent_count == 1);
+    assert(inode.extents[0].start == fs.data_start && inode.extents[0].length == 301);
+    assert(inode.extent_block == 0);
+    assert(fs_read(&fs, large, buffer, length, 0) == length);
+    assert(memcmp(data, buffer, length) == 0);
+
+    debug("Check appending grows the last extent");
+    assert(fs_write(&fs, large, data, BLOCK_SIZE, length) == BLOCK_SIZE);
+    assert(disk_read(disk, 1 + large / INODES_PER_BLOCK, block.data) == BLOCK_SIZE);
+    inode = block.inodes[large % INODES_PER_BLOCK];
+    assert(inode.extent_count == 1 && inode.extents[0].length == 302);
+    fs_release_reservation(&fs, large);
+
+    debug("Check interleaved appends spill into the extent block");
+    ssize_t first = fs_create(&fs);
+    ssize_t second = fs_create(&fs);
+    assert(first >= 0 && second >= 0);
+    size_t appends = 0;
+    // giving the reservations back after every append makes the files take turns block by block
+    for (; appends < EXTENTS_MAX; appends++) {
+        assert(fs_write(&fs, first, data + appends, BLOCK_SIZE, appends * BLOCK_SIZE) == BLOCK_SIZE);
+        fs_release_reservation(&fs, first);
+        assert(fs_write(&fs, second, data, BLOCK_SIZE, appends * BLOCK_SIZE) == BLOCK_SIZE);
+        fs_release_reservation(&fs, second);
+    }
+    assert(disk_read(disk, 1 + first / INODES_PER_BLOCK, block.data) == BLOCK_SIZE);
+    inode = block.inodes[first % INODES_PER_BLOCK];
+    assert(inode.extent_count == EXTENTS_MAX);
+    assert(inode.extent_block >= fs.data_start);
+    assert(!fs_block_is_free(&fs, inode.extent_block));
+    size_t before = fs.free_count;
+    assert(fs_write(&fs, first, data, BLOCK_SIZE, appends * BLOCK_SIZE) == -1);
+    assert(fs.free_count == before);
+    assert(fs_stat(&fs, first) == appends * BLOCK_SIZE);
+    for (size_t i = 0; i < appends; i++) {
+        assert(fs_read(&fs, first, buffer, BLOCK_SIZE, i * BLOCK_SIZE) == BLOCK_SIZE);
+        assert(memcmp(buffer, data + i, BLOCK_SIZE) == 0);
+    }
+
+    debug("Check the mount scan finds every extent");
+    fs_unmount(&fs);
+    assert(disk_read(disk, 0, block.data) == BLOCK_SIZE);
+    block.super_block.state = FS_STATE_MOUNTED;
+    assert(disk_write(disk, 0, block.data) == BLOCK_SIZE);
+    assert(fs_mount(&fs, disk));
+    assert(fs.free_blocks_dirty);
+    assert(fs.free_count == before);
+    assert(fs_read(&fs, large, buffer, length, 0) == length);
+    assert(memcmp(data, buffer, length) == 0);
+
+    debug("Check removing frees the extents and the extent block");
+    assert(fs_remove(&fs, first));
+    assert(fs_remove(&fs, second));
+    assert(fs_remove(&fs, large));
+    assert(fs.free_count == free_count);
+    fs_unmount(&fs);
+    disk_close(disk);
+
+    debug("Check sequential reads of an extent are merged");
+    disk = disk_open("data/image.unit", 200);
+    assert(disk);
+    assert(fs_format_features(disk, FS_FEATURE_EXTENTS, 0));
+    assert(fs_mount(&fs, disk));
+    length = 64 * BLOCK_SIZE;
+    ssize_t inode_number = fs_create(&fs);
+    assert(inode_number >= 0);
+    assert(fs_write(&fs, inode_number, data, length, 0) == length);
+    fs_unmount(&fs);
+    assert(fs_mount(&fs, disk));
+    disk_stats_reset(disk);
+    assert(fs_read(&fs, inode_number, buffer, length, 0) == length);
+    assert(memcmp(data, buffer, length) == 0);
+    DiskStats stats;
+    disk_stats(disk, &stats);
+    assert(stats.tags[DISK_TAG_DATA].read_bytes == length);
+    assert(stats.tags[DISK_TAG_DATA].reads <= length / BLOCK_SIZE / FS_IO_WINDOW);
+    fs_unmount(&fs);
+    disk_close(disk);
+
+    free(data);
+    free(buffer);
+    return EXIT_SUCCESS;
+}
+
+// Blocks allocated by one thread of test_fs_groups
+typedef struct {
+    FileSystem *fs;
+    size_t goal;
+    size_t blocks[100];
+} GroupAllocation;
+
+void *allocate_blocks(void *arg) {
+    GroupAllocation *allocation = arg;
+    for (size_t i = 0; i < 100; i++) {
+        assert(fs_allocate_run(allocation->fs, allocation->goal, 1, &allocation->blocks[i]) == 1);
+    }
+    return NULL;
+}
+
+void *release_blocks(void *arg) {
+    GroupAllocation *allocation = arg;
+    for (size_t i = 0; i < 100; i++) fs_release_run(allocation->fs, allocation->blocks[i], 1);
+    return NULL;
+}
+
+int test_fs_groups() {
+    debug("Check a disk too small for a group is not formatted");
+    Disk *disk = disk_open_ram(5);
+    assert(disk);
+    assert(!fs_format_features(disk, FS_FEATURE_GROUPS, 64));
+    disk_close(disk);
+
+    debug("Check the group layout");
+    disk = disk_open_ram(2000);
+    assert(disk);
+    assert(fs_format_features(disk, FS_FEATURE_GROUPS, 256));
+    FileSystem fs = {0};
+    assert(fs_mount(&fs, disk));
+    assert(fs.group_count == 8);
+    assert(fs.meta.group_blocks == 256 && fs.meta.group_inode_blocks == 26);
+    assert(fs.meta.inodes == 8 * 26 * INODES_PER_BLOCK);
+    assert(fs.data_start == 1 + 1 + 2 + 26);
+    assert(fs.groups[1].block_bitmap == 256 && fs.groups[1].inode_table == 258);
+    assert(fs.groups[1].data_start == 256 + 2 + 26);
+    assert(fs.groups[7].end == 2000);
+    size_t formatted = fs.free_count;
+    assert(formatted == fs.meta.free_block_count);
+    assert(formatted == 7 * (256 - 28) + (2000 - 1792 - 28) - 2);
+    assert(!fs_block_is_free(&fs, 256 + 16) && fs_block_is_free(&fs, 256 + 28));
+    assert(fs_block_group(&fs, 1999) == 7 && fs_block_group(&fs, 255) == 0);
+
+    debug("Check new files go to the group of their inode");
+    size_t blocks = 256 - fs.data_start - 1; // the data blocks of the first group, less the indirect block
+    size_t length = blocks * BLOCK_SIZE;
+    char *data = malloc(length);
+    char *buffer = malloc(length);
+    for (size_t i = 0; i < length; i++) data[i] = i % 253;
+    ssize_t full = fs_create(&fs);
+    assert(full == 0);
+    assert(fs_write(&fs, full, data, length, 0) == length);
+    assert(fs.groups[0].free_blocks == 0);
+    ssize_t next = fs_create(&fs);
+    assert(next == fs.groups[1].first_inode);
+    // 10 data blocks and the indirect block
+    assert(fs_write(&fs, next, data, 10 * BLOCK_SIZE, 0) == 10 * BLOCK_SIZE);
+    assert(fs.groups[1].free_blocks == 256 - 28 - 11);
+    Block block;
+    assert(disk_read(disk, fs.groups[1].inode_table, block.data) == BLOCK_SIZE);
+    assert(block.inodes[0].valid && block.inodes[0].direct[0] == fs.groups[1].data_start);
+
+    debug("Check remounting keeps the groups and the data");
+    size_t free_count = fs.free_count;
+    fs_unmount(&fs);
+    assert(disk_read(disk, 1, block.data) == BLOCK_SIZE);
+    assert(block.groups[0].free_blocks == 0);
+    assert(block.groups[1].free_blocks == 256 - 28 - 11);
+    assert(block.groups[7].data_start == 1792 + 28);
+    assert(fs_mount(&fs, disk));
+    assert(fs.free_count == free_count);
+    assert(fs.groups[0].free_blocks == 0 && fs.groups[1].free_blocks == 256 - 28 - 11);
+    assert(fs_read(&fs, full, buffer, length, 0) == length);
+    assert(memcmp(data, buffer, length) == 0);
+    assert(fs_read(&fs, next, buffer, 10 * BLOCK_SIZE, 0) == 10 * BLOCK_SIZE);
+    assert(memcmp(data, buffer, 10 * BLOCK_SIZE) == 0);
+
+    debug("Check the mount scan rebuilds every group");
+    fs_unmount(&fs);
+    assert(disk_read(disk, 0, block.data) == BLOCK_SIZE);
+    block.super_block.state = FS_STATE_MOUNTED;
+    assert(disk_write(disk, 0, block.data) == BLOCK_SIZE);
+    fs.scan_threads = 4;
+    assert(fs_mount(&fs, disk));
+    assert(fs.free_blocks_dirty);
+    assert(fs.free_count == free_count);
+    assert(fs.free_inode_count == fs.meta.inodes - 2);
+    assert(fs.groups[0].free_blocks == 0 && fs.groups[1].free_inodes == fs.groups[1].inodes - 1);
+
+    debug("Check threads allocating in different groups");
+    GroupAllocation allocations[4];
+    pthread_t threads[4];
+    for (size_t t = 0; t < 4; t++) {
+        allocations[t] = (GroupAllocation){ .fs = &fs, .goal = fs.groups[2 + t].data_start };
+        assert(pthread_create(&threads[t], NULL, allocate_blocks, &allocations[t]) == 0);
+    }
+    for (size_t t = 0; t < 4; t++) assert(pthread_join(threads[t], NULL) == 0);
+    assert(fs.free_count == free_count - 400);
+    for (size_t t = 0; t < 4; t++) {
+        assert(fs.groups[2 + t].free_blocks == 256 - 28 - 100);
+        for (size_t i = 0; i < 100; i++) {
+            assert(allocations[t].blocks[i] == fs.groups[2 + t].data_start + i);
+        }
+    }
+    for (size_t t = 0; t < 4; t++) assert(pthread_create(&threads[t], NULL, release_blocks, &allocations[t]) == 0);
+    for (size_t t = 0; t < 4; t++) assert(pthread_join(threads[t], NULL) == 0);
+    assert(fs.free_count == free_count);
+
+    debug("Check removing gives the blocks back to their groups");
+    assert(fs_remove(&fs, full));
+    assert(fs_remove(&fs, next));
+    assert(fs.groups[0].free_blocks == 256 - 30 && fs.groups[1].free_blocks == 256 - 28);
+    assert(fs.free_count == formatted);
+    fs_unmount(&fs);
+    disk_close(disk);
+
+    free(data);
+    free(buffer);
+    return EXIT_SUCCESS;
+}
+
+int test_fs_indirect() {
+    Disk *disk = disk_open_ram(2000);
+    assert(disk);
+
+    FileSystem fs = {0};
+    debug("Check formatting with double and triple indirect blocks");
+    assert(fs_format_features(disk, FS_FEATURE_TRIPLE_INDIRECT, 0));
+    assert(fs_mount(&fs, disk));
+    assert(fs.meta.features & FS_FEATURE_TRIPLE_INDIRECT);
+    size_t free_count = fs.free_count;
+
+    debug("Check a file reaches into the double indirect block");
+    size_t blocks = DIRECT_POINTERS_DEEP + POINTERS_PER_BLOCK + 100;
+    size_t length = blocks * BLOCK_SIZE - 17;
+    char *data = malloc(length);
+    char *buffer = malloc(length);
+    for (size_t i = 0; i < length; i++) data[i] = i % 253;
+    ssize_t large = fs_create(&fs);
+    assert(large >= 0);
+    assert(fs_write(&fs, large, data, length, 0) == length);
+    // the single indirect block, the double indirect block and one indirect block beneath it
+    assert(fs.free_count == free_count - blocks - 3);
+    Block block;
+    assert(disk_read(disk, 1 + large / INODES_PER_BLOCK, block.data) == BLOCK_SIZE);
+    Inode inode = block.inodes[large % INODES_PER_BLOCK];
+    assert(inode.size == length);
+    assert(inode.direct[0] == fs.data_start && inode.direct[2] == fs.data_start + 2);
+    assert(inode.indirect == fs.data_start + DIRECT_POINTERS_DEEP);
+    size_t double_start = fs.data_start + DIRECT_POINTERS_DEEP + 1 + POINTERS_PER_BLOCK;
+    assert(inode.double_indirect == double_start);
+    assert(inode.triple_indirect == 0);
+    assert(disk_read(disk, inode.double_indirect, block.data) == BLOCK_SIZE);
+    assert(block.block_pointers[0] == double_start + 1 && block.block_pointers[1] == 0);
+    assert(disk_read(disk, double_start + 1, block.data) == BLOCK_SIZE);
+    assert(block.block_pointers[0] == double_start + 2 && block.block_pointers[99] == double_start + 101);
+
+    debug("Check reads walk each indirect block once");
+    DiskStats stats;
+    disk_stats_reset(disk);
+    for (size_t offset = 0; offset < length; offset += BLOCK_SIZE) {
+        size_t bytes = length - offset < BLOCK_SIZE ? length - offset : BLOCK_SIZE;
+        assert(fs_read(&fs, large, buffer + offset, bytes, offset) == bytes);
+    }
+    assert(memcmp(data, buffer, length) == 0);
+    disk_stats(disk, &stats);
+    assert(stats.tags[DISK_TAG_INDIRECT].reads <= 3);
+
+    debug("Check files larger than the single indirect block are allowed");
+    assert(fs_write(&fs, large, data, BLOCK_SIZE, (size_t)UINT32_MAX) == -1);
+    assert(fs_write(&fs, large, data, 10, length) == 10);
+    assert(fs_stat(&fs, large) == length + 10);
+
+    debug("Check the mount scan follows every level");
+    size_t used = fs.free_count;
+    fs_unmount(&fs);
+    assert(disk_read(disk, 0, block.data) == BLOCK_SIZE);
+    block.super_block.state = FS_STATE_MOUNTED;
+    assert(disk_write(disk, 0, block.data) == BLOCK_SIZE);
+    assert(fs_mount(&fs, disk));
+    assert(fs.free_blocks_dirty);
+    assert(fs.free_count == used);
+    assert(fs_read(&fs, large, buffer, length, 0) == length);
+    assert(memcmp(data, buffer, length) == 0);
+
+    debug("Check a write is cut short when the disk fills up");
+    ssize_t rest = fs_create(&fs);
+    assert(rest >= 0);
+    ssize_t written = fs_write(&fs, rest, data, length, 0);
+    assert(written > 0 && written < length);
+    assert(fs.free_count == 0);
+    assert(fs_read(&fs, rest, buffer, written, 0) == written);
+    assert(memcmp(data, buffer, written) == 0);
+
+    debug("Check removing frees every level");
+    assert(fs_remove(&fs, large));
+    assert(fs_remove(&fs, rest));
+    assert(fs.free_count == free_count);
+    fs_unmount(&fs);
+    disk_close(disk);
+
+    free(data);
+    free(buffer);
+    return EXIT_SUCCESS;
+}
+
+int test_fs_reserve() {
+    Disk *disk = disk_open_ram(2000);
+    assert(disk);
+
+    FileSystem fs = {0};
+    assert(fs_format_features(disk, FS_FEATURE_EXTENTS|FS_FEATURE_INLINE_DATA, 0));
+    assert(fs_mount(&fs, disk));
+    size_t free_count = fs.free_count;
+    char *data = malloc(BLOCK_SIZE * 100);
+    char *buffer = malloc(BLOCK_SIZE * 100);
+    for (size_t i = 0; i < BLOCK_SIZE * 100; i++) data[i] = i % 249;
+
+    debug("Check fs_fallocate reserves one run past the end without writing it");
+    ssize_t large = fs_create(&fs);
+    assert(large >= 0);
+    assert(!fs_fallocate(&fs, large, 0, 0));
+    size_t writes = disk->writes;
+    assert(fs_fallocate(&fs, large, 10, 100 * BLOCK_SIZE - 10));
+    assert(disk->writes == writes);
+    assert(fs_stat(&fs, large) == 0);
+    assert(fs.free_count == free_count - 100);
+    Block block;
+    assert(disk_read(disk, 1 + large / INODES_PER_BLOCK, block.data) == BLOCK_SIZE);
+    Inode inode = block.inodes[large % INODES_PER_BLOCK];
+    assert(inode.size == 0 && inode.extent_count == 0);
+
+    debug("Check appends take the reserved blocks");
+    for (size_t offset = 0; offset < 100 * BLOCK_SIZE; offset += 25 * BLOCK_SIZE) {
+        assert(fs_write(&fs, large, data + offset, 25 * BLOCK_SIZE, offset) == 25 * BLOCK_SIZE);
+    }
+    // the last append reserved a window after the range
+    assert(fs.free_count == free_count - 100 - FS_RESERVE_MIN);
+    fs_release_reservation(&fs, large);
+    assert(fs.free_count == free_count - 100);
+    assert(disk_read(disk, 1 + large / INODES_PER_BLOCK, block.data) == BLOCK_SIZE);
+    inode = block.inodes[large % INODES_PER_BLOCK];
+    assert(inode.extent_count == 1 && inode.extents[0].length == 100);
+    assert(fs_read(&fs, large, buffer, 100 * BLOCK_SIZE, 0) == 100 * BLOCK_SIZE);
+    assert(memcmp(data, buffer, 100 * BLOCK_SIZE) == 0);
+    assert(fs_fallocate(&fs, large, 0, BLOCK_SIZE));
+    assert(fs_stat(&fs, large) == 100 * BLOCK_SIZE);
+    assert(fs.free_count == free_count - 100);
+
+    debug("Check a small file reserves the blocks it moves to");
+    ssize_t small = fs_create(&fs);
+    assert(small >= 0);
+    assert(fs_write(&fs, small, data, 100, 0) == 100);
+    assert(fs_fallocate(&fs, small, 0, FS_TAIL_MAX));
+    size_t reserved = fs.free_count;
+    assert(fs_fallocate(&fs, small, 0, 10 * BLOCK_SIZE));
+    assert(fs_stat(&fs, small) == 100);
+    assert(fs.free_count == reserved - 10);
+    assert(fs_write(&fs, small, data + 100, 10 * BLOCK_SIZE - 100, 100) == 10 * BLOCK_SIZE - 100);
+    fs_release_reservation(&fs, small);
+    // the shared block it leaves held no other file
+    assert(fs.free_count == reserved - 10 + 1);
+    assert(disk_read(disk, 1 + small / INODES_PER_BLOCK, block.data) == BLOCK_SIZE);
+    inode = block.inodes[small % INODES_PER_BLOCK];
+    assert(inode.extent_count == 1 && inode.extents[0].length == 10);
+    assert(fs_read(&fs, small, buffer, 10 * BLOCK_SIZE, 0) == 10 * BLOCK_SIZE);
+    assert(memcmp(data, buffer, 10 * BLOCK_SIZE) == 0);
+    assert(fs_remove(&fs, small));
+    assert(fs.free_count == free_count - 100);
+
+    debug("Check interleaved small appends stay contiguous");
+    ssize_t first = fs_create(&fs);
+    ssize_t second = fs_create(&fs);
+    assert(first >= 0 && second >= 0);
+    size_t chunk = 2 * BLOCK_SIZE;
+    for (size_t offset = 0; offset < 100 * BLOCK_SIZE; offset += chunk) {
+        assert(fs_write(&fs, first, data + offset, chunk, offset) == chunk);
+        assert(fs_write(&fs, second, data + offset, chunk, offset) == chunk);
+    }
+    // the files move to a new window each time one is used up, the windows double in size
+    assert(disk_read(disk, 1 + first / INODES_PER_BLOCK, block.data) == BLOCK_SIZE);
+    assert(block.inodes[first % INODES_PER_BLOCK].extent_count <= 7);
+    assert(block.inodes[second % INODES_PER_BLOCK].extent_count <= 7);
+    assert(fs_read(&fs, first, buffer, 100 * BLOCK_SIZE, 0) == 100 * BLOCK_SIZE);
+    assert(memcmp(data, buffer, 100 * BLOCK_SIZE) == 0);
+    assert(fs_read(&fs, second, buffer, 100 * BLOCK_SIZE, 0) == 100 * BLOCK_SIZE);
+    assert(memcmp(data, buffer, 100 * BLOCK_SIZE) == 0);
+
+    debug("Check reservations are given back on release and unmount");
+    // both files spilled into their extent block
+    size_t used = 100 + 2 * 101;
+    reserved = fs.free_count;
+    assert(reserved < free_count - used);
+    fs_release_reservation(&fs, first);
+    assert(fs.free_count > reserved);
+    fs_unmount(&fs);
+    assert(fs_mount(&fs, disk));
+    assert(fs.free_count == free_count - used);
+
+    debug("Check reserved blocks are handed out before the disk is full");
+    ssize_t appender = fs_create(&fs);
+    ssize_t filler = fs_create(&fs);
+    assert(appender >= 0 && filler >= 0);
+    assert(fs_write(&fs, appender, data, BLOCK_SIZE, 0) == BLOCK_SIZE);
+    assert(fs_write(&fs, appender, data, BLOCK_SIZE, BLOCK_SIZE) == BLOCK_SIZE);
+    // the filler runs short of space once only the window of the appender is left
+    size_t filled = 0;
+    while (fs_write(&fs, filler, data, 100 * BLOCK_SIZE, filled) == 100 * BLOCK_SIZE) filled += 100 * BLOCK_SIZE;
+    assert(fs.free_count == 0);
+    assert(fs_write(&fs, appender, data, BLOCK_SIZE, 2 * BLOCK_SIZE) == -1);
+    assert(!fs_fallocate(&fs, appender, 0, 10 * BLOCK_SIZE));
+
+    debug("Check removing gives everything back");
+    assert(fs_remove(&fs, large));
+    assert(fs_remove(&fs, first));
+    assert(fs_remove(&fs, second));
+    assert(fs_remove(&fs, appender));
+    assert(fs_remove(&fs, filler));
+    assert(fs.free_count == free_count);
+    fs_unmount(&fs);
+    disk_close(disk);
+
+    free(data);
+    free(buffer);
+    return EXIT_SUCCESS;
+}
+
+int test_fs_inline() {
+    Disk *disk = disk_open_ram(200);
+    assert(disk);
+
+    FileSystem fs = {0};
+    assert(fs_format_features(disk, FS_FEATURE_INLINE_DATA, 0));
+    assert(fs_mount(&fs, disk));
+    assert(fs.meta.features & FS_FEATURE_INLINE_DATA);
+    size_t free_count = fs.free_count;
+    size_t length = 2 * BLOCK_SIZE;
+    char *data = malloc(length);
+    char *buffer = malloc(length);
+    for (size_t i = 0; i < length; i++) data[i] = 'a' + i % 26;
+
+    debug("Check tiny files live in the inode");
+    ssize_t tiny = fs_create(&fs);
+    assert(tiny >= 0);
+    assert(fs_write(&fs, tiny, data, 10, 0) == 10);
+    assert(fs_write(&fs, tiny, data, 4, 20) == 4);
+    assert(fs.free_count == free_count);
+    Block block;
+    assert(disk_read(disk, 1 + tiny / INODES_PER_BLOCK, block.data) == BLOCK_SIZE);
+    Inode inode = block.inodes[tiny % INODES_PER_BLOCK];
+    assert(inode.size == INLINE_DATA_SIZE);
+    assert(memcmp(inode.inline_data, data, 10) == 0 && inode.inline_data[15] == 0 && memcmp(inode.inline_data + 20, data, 4) == 0);
+    DiskStats stats;
+    disk_stats_reset(disk);
+    assert(fs_read(&fs, tiny, buffer, INLINE_DATA_SIZE, 0) == INLINE_DATA_SIZE);
+    assert(memcmp(buffer, inode.inline_data, INLINE_DATA_SIZE) == 0);
+    disk_stats(disk, &stats);
+    assert(stats.tags[DISK_TAG_DATA].reads == 0);
+
+    debug("Check small files share a block");
+    ssize_t first = fs_create(&fs);
+    ssize_t second = fs_create(&fs);
+    assert(first >= 0 && second >= 0);
+    assert(fs_write(&fs, first, data, 300, 0) == 300);
+    assert(fs.free_count == free_count - 1);
+    assert(fs_write(&fs, second, data + 1, 500, 0) == 500);
+    assert(fs.free_count == free_count - 1);
+    assert(disk_read(disk, 1 + first / INODES_PER_BLOCK, block.data) == BLOCK_SIZE);
+    Inode one = block.inodes[first % INODES_PER_BLOCK];
+    Inode two = block.inodes[second % INODES_PER_BLOCK];
+    assert(one.tail_block == fs.tail_block && two.tail_block == fs.tail_block);
+    assert(one.tail_slot == 1 && two.tail_slot == 4);
+    assert(disk_read(disk, fs.tail_block, block.data) == BLOCK_SIZE);
+    assert(block.tail_used == 0xff);
+    assert(memcmp(block.data + FS_TAIL_SLOT_SIZE, data, 300) == 0);
+    disk_stats_reset(disk);
+    assert(fs_read(&fs, second, buffer, 500, 0) == 500);
+    assert(memcmp(buffer, data + 1, 500) == 0);
+    disk_stats(disk, &stats);
+    assert(stats.tags[DISK_TAG_DATA].reads <= 1);
+
+    debug("Check growing small files");
+    assert(fs_write(&fs, tiny, data, 100, INLINE_DATA_SIZE) == 100);
+    assert(fs_read(&fs, tiny, buffer, 10, 0) == 10 && memcmp(buffer, data, 10) == 0);
+    assert(fs_read(&fs, tiny, buffer, 100, INLINE_DATA_SIZE) == 100 && memcmp(buffer, data, 100) == 0);
+    assert(fs_write(&fs, second, data, 100, 500) == 100);
+    assert(fs_write(&fs, first, data, 700, 300) == 700);
+    assert(fs.free_count == free_count - 1);
+    assert(fs_read(&fs, first, buffer, 1000, 0) == 1000);
+    assert(memcmp(buffer, data, 300) == 0 && memcmp(buffer + 300, data, 700) == 0);
+    assert(fs_read(&fs, second, buffer, 600, 0) == 600);
+    assert(memcmp(buffer, data + 1, 500) == 0 && memcmp(buffer + 500, data, 100) == 0);
+
+    debug("Check a file moves to blocks when it grows past FS_TAIL_MAX");
+    assert(fs_write(&fs, second, data, length, 600) == length);
+    assert(fs_stat(&fs, second) == 600 + length);
+    assert(fs_read(&fs, second, buffer, 600, 0) == 600);
+    assert(memcmp(buffer, data + 1, 500) == 0 && memcmp(buffer + 500, data, 100) == 0);
+    assert(fs_read(&fs, second, buffer, length, 600) == length);
+    assert(memcmp(buffer, data, length) == 0);
+    assert(fs.free_count == free_count - 1 - 3);
+    ssize_t gap = fs_create(&fs);
+    assert(gap >= 0);
+    assert(fs_write(&fs, gap, data, 10, 0) == 10);
+    assert(fs_write(&fs, gap, data, 10, 2000) == 10);
+    assert(fs_read(&fs, gap, buffer, 2010, 0) == 2010);
+    assert(memcmp(buffer, data, 10) == 0 && buffer[10] == 0 && buffer[1999] == 0 && memcmp(buffer + 2000, data, 10) == 0);
+
+    debug("Check the mount scan finds the shared blocks");
+    size_t used = fs.free_count;
+    fs_unmount(&fs);
+    assert(disk_read(disk, 0, block.data) == BLOCK_SIZE);
+    block.super_block.state = FS_STATE_MOUNTED;
+    assert(disk_write(disk, 0, block.data) == BLOCK_SIZE);
+    // a crash left the mask behind its files: their slots free, a slot nobody has in use
+    assert(disk_read(disk, 1 + first / INODES_PER_BLOCK, block.data) == BLOCK_SIZE);
+    size_t shared = block.inodes[first % INODES_PER_BLOCK].tail_block;
+    assert(disk_read(disk, shared, block.data) == BLOCK_SIZE);
+    uint32_t mask = block.tail_used;
+    assert(!(mask & (1u << 31)));
+    block.tail_used = 1u | (1u << 31);
+    assert(disk_write(disk, shared, block.data) == BLOCK_SIZE);
+    assert(fs_mount(&fs, disk));
+    assert(fs.free_count == used);
+    assert(disk_read(disk, shared, block.data) == BLOCK_SIZE);
+    assert(block.tail_used == mask);
+    ssize_t late = fs_create(&fs);
+    assert(late >= 0);
+    assert(fs_write(&fs, late, data + 2, 200, 0) == 200);
+    assert(fs_read(&fs, first, buffer, 1000, 0) == 1000);
+    assert(memcmp(buffer, data, 300) == 0 && memcmp(buffer + 300, data, 700) == 0);
+    assert(fs_remove(&fs, late));
+
+    debug("Check removing frees the shared block with its last file");
+    assert(fs_remove(&fs, second));
+    assert(fs_remove(&fs, gap));
+    assert(fs_remove(&fs, first));
+    assert(fs.free_count == free_count - 1);
+    assert(fs_remove(&fs, tiny));
+    assert(fs.free_count == free_count);
+    fs_unmount(&fs);
+    disk_close(disk);
+
+    free(data);
+    free(buffer);
+    return EXIT_SUCCESS;
+}
+
+int test_fs_icache() {
+    assert(system("cp data/image.200 data/image.unit") == EXIT_SUCCESS);
+    Disk *disk = disk_open("data/image.unit", 200);
+    assert(disk);
+
+    FileSystem fs = {0};
+    fs.icache_inodes = 4;
+    assert(fs_mount(&fs, disk));
+    assert(fs.icache && fs.icache->capacity == 4);
+    char data[2 * BLOCK_SIZE];
+    char buffer[2 * BLOCK_SIZE];
+    for (size_t i = 0; i < sizeof(data); i++) data[i] = 'a' + i % 26;
+
+    debug("Check new inodes are cached without reading their table block");
+    size_t reads = fs.cache->hits + fs.cache->misses;
+    ssize_t inode_number = fs_create(&fs);
+    assert(inode_number >= 0);
+    assert(fs.cache->hits + fs.cache->misses == reads);
+    assert(fs_write(&fs, inode_number, data, sizeof(data), 0) == sizeof(data));
+
+    debug("Check hot inodes touch neither the block cache nor the disk");
+    disk_stats_reset(disk);
+    reads = fs.cache->hits + fs.cache->misses;
+    size_t hits = fs.icache->hits;
+    for (size_t i = 0; i < 100; i++) {
+        assert(fs_stat(&fs, inode_number) == sizeof(data));
+    }
+    assert(fs.icache->hits == hits + 100);
+    assert(fs.cache->hits + fs.cache->misses == reads);
+    for (size_t i = 0; i < 10; i++) {
+        assert(fs_read(&fs, inode_number, buffer, BLOCK_SIZE, BLOCK_SIZE) == BLOCK_SIZE);
+        assert(fs_write(&fs, inode_number, data, 100, 10) == 100);
+    }
+    DiskStats stats;
+    disk_stats(disk, &stats);
+    assert(stats.tags[DISK_TAG_INODE].reads == 0 && stats.tags[DISK_TAG_INODE].writes == 0);
+    assert(fs.icache->dirty == 1);
+
+    debug("Check evicted and flushed inodes reach the inode table");
+    ssize_t files[8];
+    for (size_t i = 0; i < 8; i++) {
+        assert((files[i] = fs_create(&fs)) >= 0);
+        assert(fs_write(&fs, files[i], data, 100 * (i + 1), 0) == (ssize_t)(100 * (i + 1)));
+    }
+    assert(fs.icache->evictions > 0 && fs.icache->writebacks > 0);
+    for (size_t i = 0; i < 8; i++) {
+        assert(fs_stat(&fs, files[i]) == (ssize_t)(100 * (i + 1)));
+    }
+    assert(fs_remove(&fs, files[0]));
+    assert(fs_stat(&fs, files[0]) == -1);
+    fs_unmount(&fs);
+    assert(fs.icache == NULL);
+
+    assert(fs_mount(&fs, disk));
+    assert(fs_stat(&fs, inode_number) == sizeof(data));
+    assert(fs_read(&fs, inode_number, buffer, sizeof(data), 0) == sizeof(data));
+    assert(memcmp(buffer, data, 10) == 0 && memcmp(buffer + 10, data, 100) == 0);
+    assert(fs_stat(&fs, files[0]) == -1);
+    for (size_t i = 1; i < 8; i++) {
+        assert(fs_stat(&fs, files[i]) == (ssize_t)(100 * (i + 1)));
+    }
+    fs_unmount(&fs);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+// write around holes on a file system with the specified features and check they take no space
+void check_fs_holes(uint32_t features) {
+    Disk *disk = disk_open_ram(2000);
+    assert(disk);
+
+    FileSystem fs = {0};
+    assert(fs_format_features(disk, features, 0));
+    assert(fs_mount(&fs, disk));
+    size_t free_count = fs.free_count;
+    size_t length = 40 * BLOCK_SIZE;
+    char *data = malloc(length);
+    char *buffer = malloc(length);
+    assert(data && buffer);
+    for (size_t i = 0; i < length; i++) data[i] = 1 + i % 251;
+    Block block;
+
+    debug("Check a gap past the end of the file is a hole");
+    ssize_t sparse = fs_create(&fs);
+    assert(sparse >= 0);
+    assert(fs_write(&fs, sparse, data, BLOCK_SIZE, 0) == BLOCK_SIZE);
+    assert(fs_write(&fs, sparse, data, BLOCK_SIZE, 30 * BLOCK_SIZE) == BLOCK_SIZE);
+    // count the blocks in use, not the ones reserved for further appends
+    fs_release_reservation(&fs, sparse);
+    // the two data blocks and the indirect block (or the extent block) mapping the second one
+    assert(fs.free_count == free_count - 3);
+    assert(fs_read(&fs, sparse, buffer, 31 * BLOCK_SIZE, 0) == 31 * BLOCK_SIZE);
+    assert(memcmp(buffer, data, BLOCK_SIZE) == 0);
+    for (size_t i = BLOCK_SIZE; i < 30 * BLOCK_SIZE; i++) assert(buffer[i] == 0);
+    assert(memcmp(buffer + 30 * BLOCK_SIZE, data, BLOCK_SIZE) == 0);
+
+    debug("Check written blocks of null bytes are left as holes");
+    memcpy(buffer, data, 8 * BLOCK_SIZE);
+    memset(buffer + 2 * BLOCK_SIZE, 0, 4 * BLOCK_SIZE);
+    size_t before = fs.free_count;
+    assert(fs_write(&fs, sparse, buffer, 8 * BLOCK_SIZE, 40 * BLOCK_SIZE) == 8 * BLOCK_SIZE);
+    fs_release_reservation(&fs, sparse);
+    assert(fs.free_count == before - 4);
+    assert(fs_stat(&fs, sparse) == 48 * BLOCK_SIZE);
+    assert(fs_read(&fs, sparse, buffer, 17 * BLOCK_SIZE, 31 * BLOCK_SIZE) == 17 * BLOCK_SIZE);
+    for (size_t i = 0; i < 9 * BLOCK_SIZE; i++) assert(buffer[i] == 0);
+    assert(memcmp(buffer + 9 * BLOCK_SIZE, data, 2 * BLOCK_SIZE) == 0);
+    for (size_t i = 11 * BLOCK_SIZE; i < 15 * BLOCK_SIZE; i++) assert(buffer[i] == 0);
+    assert(memcmp(buffer + 15 * BLOCK_SIZE, data + 6 * BLOCK_SIZE, 2 * BLOCK_SIZE) == 0);
+
+    debug("Check writing into a hole fills only that block");
+    assert(disk_read(disk, 1 + sparse / INODES_PER_BLOCK, block.data) == BLOCK_SIZE);
+    size_t extent_count = block.inodes[sparse % INODES_PER_BLOCK].extent_count;
+    before = fs.free_count;
+    assert(fs_write(&fs, sparse, data, 200, 10 * BLOCK_SIZE + 100) == 200);
+    fs_release_reservation(&fs, sparse);
+    assert(fs.free_count == before - 1);
+    if (features & FS_FEATURE_EXTENTS) {
+        // the hole is split around the new block
+        assert(disk_read(disk, 1 + sparse / INODES_PER_BLOCK, block.data) == BLOCK_SIZE);
+        assert(block.inodes[sparse % INODES_PER_BLOCK].extent_count == extent_count + 2);
+    }
+    assert(fs_read(&fs, sparse, buffer, 31 * BLOCK_SIZE, 0) == 31 * BLOCK_SIZE);
+    assert(memcmp(buffer, data, BLOCK_SIZE) == 0);
+    for (size_t i = BLOCK_SIZE; i < 30 * BLOCK_SIZE; i++) {
+        if (i < 10 * BLOCK_SIZE + 100 || i >= 10 * BLOCK_SIZE + 300) assert(buffer[i] == 0);
+    }
+    assert(memcmp(buffer + 10 * BLOCK_SIZE + 100, data, 200) == 0);
+    assert(memcmp(buffer + 30 * BLOCK_SIZE, data, BLOCK_SIZE) == 0);
+
+    debug("Check a file of null bytes takes no blocks");
+    ssize_t empty = fs_create(&fs);
+    assert(empty >= 0);
+    memset(buffer, 0, length);
+    before = fs.free_count;
+    assert(fs_write(&fs, empty, buffer, length, 0) == length);
+    assert(fs_write(&fs, empty, buffer, 1, 200 * BLOCK_SIZE) == 1);
+    assert(fs.free_count == before);
+    assert(fs_stat(&fs, empty) == 200 * BLOCK_SIZE + 1);
+    memset(buffer, 1, length);
+    assert(fs_read(&fs, empty, buffer, length, 160 * BLOCK_SIZE) == length);
+    for (size_t i = 0; i < length; i++) assert(buffer[i] == 0);
+
+    debug("Check fs_fallocate allocates the holes");
+    before = fs.free_count;
+    assert(fs_fallocate(&fs, sparse, 0, 31 * BLOCK_SIZE));
+    fs_release_reservation(&fs, sparse);
+    assert(fs.free_count == before - 28);
+    assert(fs_read(&fs, sparse, buffer, 31 * BLOCK_SIZE, 0) == 31 * BLOCK_SIZE);
+    assert(memcmp(buffer, data, BLOCK_SIZE) == 0);
+    assert(buffer[BLOCK_SIZE] == 0 && buffer[29 * BLOCK_SIZE] == 0);
+    assert(memcmp(buffer + 10 * BLOCK_SIZE + 100, data, 200) == 0);
+    assert(memcmp(buffer + 30 * BLOCK_SIZE, data, BLOCK_SIZE) == 0);
+
+    debug("Check mounting after a crash counts the same free blocks");
+    before = fs.free_count;
+    fs_unmount(&fs);
+    assert(disk_read(disk, 0, block.data) == BLOCK_SIZE);
+    block.super_block.state = FS_STATE_MOUNTED;
+    assert(disk_write(disk, 0, block.data) == BLOCK_SIZE);
+    assert(fs_mount(&fs, disk));
+    assert(fs.free_blocks_dirty);
+    assert(fs.free_count == before);
+
+    debug("Check removing gives everything back");
+    assert(fs_remove(&fs, sparse));
+    assert(fs_remove(&fs, empty));
+    assert(fs.free_count == free_count);
+    fs_unmount(&fs);
+    disk_close(disk);
+
+    free(data);
+    free(buffer);
+}
+
+int test_fs_holes() {
+    check_fs_holes(0);
+    check_fs_holes(FS_FEATURE_EXTENTS);
+    return EXIT_SUCCESS;
+}
+
+int test_fs_open() {
+    unlink("data/image.unit");
+    Disk *disk = disk_open("data/image.unit", 2000);
+    assert(disk);
+
+    FileSystem fs = {0};
+    // small enough that streaming pushes the indirect block out of the block cache
+    fs.cache_blocks = 16;
+    assert(fs_format(disk));
+    assert(fs_mount(&fs, disk));
+    assert(fs.icache);
+    const size_t chunk = 32 * 1024;
+    size_t length = 600 * BLOCK_SIZE;
+    char *data = malloc(length);
+    char *buffer = malloc(chunk);
+    assert(data && buffer);
+    for (size_t i = 0; i < length; i++) data[i] = 1 + i % 253;
+
+    debug("Check writing through a handle");
+    ssize_t inode_number = fs_create(&fs);
+    assert(inode_number >= 0);
+    File *file = fs_open(&fs, inode_number);
+    assert(file && file->inode && file->position == 0);
+    for (size_t offset = 0; offset < length; offset += chunk) {
+        assert(fs_file_write(file, data + offset, chunk) == chunk);
+    }
+    assert(file->position == length);
+    assert(fs_stat(&fs, inode_number) == length);
+    size_t reserved = fs.free_count;
+    fs_close(file);
+    assert(fs.free_count > reserved);
+
+    debug("Check streaming through a handle reads no metadata after the first chunk");
+    file = fs_open(&fs, inode_number);
+    assert(file);
+    assert(fs_file_read(file, buffer, chunk) == chunk);
+    assert(memcmp(buffer, data, chunk) == 0);
+    // only the blocks of the read and of the readahead window past it are resolved
+    assert(file->mapped >= chunk / BLOCK_SIZE && file->mapped <= chunk / BLOCK_SIZE + FS_READAHEAD_MAX);
+    disk_stats_reset(disk);
+    size_t lookups = fs.icache->hits + fs.icache->misses;
+    for (size_t offset = chunk; offset < length; offset += chunk) {
+        assert(fs_file_read(file, buffer, chunk) == chunk);
+        assert(memcmp(buffer, data + offset, chunk) == 0);
+    }
+    assert(fs_file_read(file, buffer, chunk) == 0);
+    assert(file->mapped == length / BLOCK_SIZE);
+    DiskStats stats;
+    disk_stats(disk, &stats);
+    assert(stats.tags[DISK_TAG_DATA].reads > 0);
+    assert(stats.tags[DISK_TAG_INDIRECT].reads == 0 && stats.tags[DISK_TAG_INODE].reads == 0);
+    assert(fs.icache->hits + fs.icache->misses == lookups);
+
+    debug("Check handles of files in the same slot keep their own indirect blocks");
+    ssize_t other;
+    do {
+        other = fs_create(&fs);
+        assert(other >= 0);
+    } while (other % FS_READAHEAD_SLOTS != inode_number % FS_READAHEAD_SLOTS);
+    assert(fs_write(&fs, other, data, length, 0) == length);
+    File *second = fs_open(&fs, other);
+    assert(second);
+    assert(fs_file_seek(file, 0));
+    assert(fs_file_read(file, buffer, chunk) == chunk);
+    assert(fs_file_read(second, buffer, chunk) == chunk);
+    disk_stats_reset(disk);
+    for (size_t offset = chunk; offset < length; offset += chunk) {
+        assert(fs_file_read(file, buffer, chunk) == chunk);
+        assert(memcmp(buffer, data + offset, chunk) == 0);
+        assert(fs_file_read(second, buffer, chunk) == chunk);
+        assert(memcmp(buffer, data + offset, chunk) == 0);
+    }
+    disk_stats(disk, &stats);
+    assert(stats.tags[DISK_TAG_INDIRECT].reads == 0);
+    // each handle still holds the indirect block of its own file
+    assert(file->map.valid && file->map.inode_number == (size_t)inode_number && file->map.blocks[0] != 0);
+    assert(second->map.valid && second->map.inode_number == (size_t)other && second->map.blocks[0] != 0);
+
+    debug("Check a handle sees blocks appended by other writers");
+    assert(fs_write(&fs, other, data, 2 * BLOCK_SIZE, length) == 2 * BLOCK_SIZE);
+    assert(fs_file_read(second, buffer, chunk) == 2 * BLOCK_SIZE);
+    assert(memcmp(buffer, data, 2 * BLOCK_SIZE) == 0);
+    fs_close(second);
+    assert(fs_remove(&fs, other));
+
+    debug("Check writes through a handle land at its position");
+    assert(fs_file_seek(file, 5 * BLOCK_SIZE + 10));
+    assert(fs_file_write(file, "handle", 6) == 6);
+    assert(file->position == 5 * BLOCK_SIZE + 16);
+    assert(fs_read(&fs, inode_number, buffer, 6, 5 * BLOCK_SIZE + 10) == 6);
+    assert(memcmp(buffer, "handle", 6) == 0);
+    assert(fs_file_seek(file, 5 * BLOCK_SIZE));
+    assert(fs_file_read(file, buffer, 20) == 20);
+    assert(memcmp(buffer, data + 5 * BLOCK_SIZE, 10) == 0 && memcmp(buffer + 10, "handle", 6) == 0);
+    fs_close(file);
+
+    debug("Check a handle sees holes filled by other writers");
+    ssize_t sparse = fs_create(&fs);
+    assert(sparse >= 0);
+    assert(fs_write(&fs, sparse, data, 1, 10 * BLOCK_SIZE) == 1);
+    file = fs_open(&fs, sparse);
+    assert(file);
+    assert(fs_file_read(file, buffer, BLOCK_SIZE) == BLOCK_SIZE);
+    for (size_t i = 0; i < BLOCK_SIZE; i++) assert(buffer[i] == 0);
+    assert(fs_write(&fs, sparse, data, BLOCK_SIZE, 3 * BLOCK_SIZE) == BLOCK_SIZE);
+    assert(fs_file_seek(file, 3 * BLOCK_SIZE));
+    assert(fs_file_read(file, buffer, BLOCK_SIZE) == BLOCK_SIZE);
+    assert(memcmp(buffer, data, BLOCK_SIZE) == 0);
+
+    debug("Check holes filled in another file of the same slot keep the blocks a handle resolved");
+    size_t mapped = file->mapped;
+    assert(mapped > 0);
+    do {
+        other = fs_create(&fs);
+        assert(other >= 0);
+    } while (other % FS_READAHEAD_SLOTS != sparse % FS_READAHEAD_SLOTS);
+    assert(fs_write(&fs, other, data, 1, 10 * BLOCK_SIZE) == 1);
+    assert(fs_write(&fs, other, data, BLOCK_SIZE, 3 * BLOCK_SIZE) == BLOCK_SIZE);
+    assert(file->mapped == mapped);
+    assert(fs_file_seek(file, 0));
+    assert(fs_file_read(file, buffer, BLOCK_SIZE) == BLOCK_SIZE);
+    assert(file->mapped == mapped);
+    assert(fs_remove(&fs, other));
+    assert(file->mapped == mapped);
+
+    debug("Check a removed inode can no longer be read or opened");
+    assert(fs_remove(&fs, sparse));
+    assert(fs_file_seek(file, 0));
+    assert(fs_file_read(file, buffer, BLOCK_SIZE) == -1);
+    fs_close(file);
+    assert(fs_open(&fs, sparse) == NULL);
+    assert(fs_open(&fs, fs.meta.inodes) == NULL);
+    fs_unmount(&fs);
+    disk_close(disk);
+
+    debug("Check handles on a disk without an inode cache");
+    disk = disk_open_ram(200);
+    assert(disk);
+    assert(fs_mount(&fs, disk));
+    assert(fs.icache == NULL);
+    inode_number = fs_create(&fs);
+    assert(inode_number >= 0);
+    file = fs_open(&fs, inode_number);
+    assert(file && file->inode == NULL);
+    assert(fs_file_write(file, data, 3 * BLOCK_SIZE + 5) == 3 * BLOCK_SIZE + 5);
+    assert(fs_file_seek(file, BLOCK_SIZE));
+    assert(fs_file_read(file, buffer, chunk) == 2 * BLOCK_SIZE + 5);
+    assert(memcmp(buffer, data + BLOCK_SIZE, 2 * BLOCK_SIZE + 5) == 0);
+    fs_close(file);
+    fs_unmount(&fs);
+    disk_close(disk);
+
+    free(data);
+    free(buffer);
+    return EXIT_SUCCESS;
+}
+
+int test_fs_vectors() {
+    unlink("data/image.unit");
+    Disk *disk = disk_open("data/image.unit", 2000);
+    assert(disk);
+
+    FileSystem fs = {0};
+    assert(fs_format(disk));
+    assert(fs_mount(&fs, disk));
+    const size_t records = 16;
+    const size_t header = 16;
+    size_t length = records * BLOCK_SIZE;
+    char *data = malloc(length);
+    char *buffer = malloc(length);
+    assert(data && buffer);
+    for (size_t i = 0; i < length; i++) data[i] = 1 + i % 251;
+
+    debug("Check writing headers and payloads in one call");
+    ssize_t inode_number = fs_create(&fs);
+    assert(inode_number >= 0);
+    // each record is a header piece followed by a payload piece, together a whole block
+    FsVector pieces[2 * records];
+    for (size_t r = 0; r < records; r++) {
+        size_t offset = r * BLOCK_SIZE;
+        pieces[2 * r] = (FsVector){ .data = data + offset, .length = header, .offset = offset };
+        pieces[2 * r + 1] = (FsVector){ .data = data + offset + header, .length = BLOCK_SIZE - header, .offset = offset + header };
+    }
+    assert(fs_writev(&fs, inode_number, pieces, 2 * records) == length);
+    assert(fs_stat(&fs, inode_number) == length);
+    assert(fs_read(&fs, inode_number, buffer, length, 0) == length);
+    assert(memcmp(buffer, data, length) == 0);
+
+    debug("Check rewriting whole blocks from several pieces reads no data");
+    fs_unmount(&fs);
+    assert(fs_mount(&fs, disk));
+    for (size_t i = 0; i < length; i++) data[i] = 1 + i % 239;
+    disk_stats_reset(disk);
+    // given out of order, they are written in file order
+    FsVector reversed[2 * records];
+    for (size_t p = 0; p < 2 * records; p++) reversed[p] = pieces[2 * records - 1 - p];
+    assert(fs_writev(&fs, inode_number, reversed, 2 * records) == length);
+    DiskStats stats;
+    disk_stats(disk, &stats);
+    assert(stats.tags[DISK_TAG_DATA].reads == 0);
+    assert(fs_read(&fs, inode_number, buffer, length, 0) == length);
+    assert(memcmp(buffer, data, length) == 0);
+
+    debug("Check disjoint and overlapping pieces");
+    FsVector scattered[] = {
+        { .data = "tail", .length = 4, .offset = length + 10 },
+        { .data = "first", .length = 5, .offset = 3 },
+        { .data = "middle", .length = 6, .offset = 5 * BLOCK_SIZE - 2 },
+        { .data = "FIRST", .length = 2, .offset = 3 },
+    };
+    assert(fs_writev(&fs, inode_number, scattered, 4) == 17);
+    assert(fs_stat(&fs, inode_number) == length + 14);
+    memcpy(data + 3, "FIrst", 5);
+    memcpy(data + 5 * BLOCK_SIZE - 2, "middle", 6);
+    assert(fs_read(&fs, inode_number, buffer, length, 0) == length);
+    assert(memcmp(buffer, data, length) == 0);
+    assert(fs_read(&fs, inode_number, buffer, 14, length) == 14);
+    for (size_t i = 0; i < 10; i++) assert(buffer[i] == 0);
+    assert(memcmp(buffer + 10, "tail", 4) == 0);
+
+    debug("Check reading scattered and overlapping pieces maps and reads each block once");
+    fs_unmount(&fs);
+    assert(fs_mount(&fs, disk));
+    char head[BLOCK_SIZE], whole[BLOCK_SIZE], across[2 * BLOCK_SIZE], late[BLOCK_SIZE], past[100];
+    FsVector reads[] = {
+        { .data = whole, .length = BLOCK_SIZE, .offset = 9 * BLOCK_SIZE },
+        { .data = head, .length = 100, .offset = 0 },
+        { .data = across, .length = 2 * BLOCK_SIZE, .offset = 8 * BLOCK_SIZE + 50 },
+        { .data = late, .length = 10, .offset = 3 * BLOCK_SIZE + 1 },
+        { .data = past, .length = 100, .offset = length },
+    };
+    disk_stats_reset(disk);
+    assert(fs_readv(&fs, inode_number, reads, 5) == BLOCK_SIZE + 100 + 2 * BLOCK_SIZE + 10 + 14);
+    disk_stats(disk, &stats);
+    // blocks 0, 3, 8, 9, 10 and the first block past the records
+    assert(stats.tags[DISK_TAG_DATA].read_bytes <= 6 * BLOCK_SIZE);
+    assert(memcmp(whole, data + 9 * BLOCK_SIZE, BLOCK_SIZE) == 0);
+    assert(memcmp(head, data, 100) == 0);
+    assert(memcmp(across, data + 8 * BLOCK_SIZE + 50, 2 * BLOCK_SIZE) == 0);
+    assert(memcmp(late, data + 3 * BLOCK_SIZE + 1, 10) == 0);
+    assert(memcmp(past + 10, "tail", 4) == 0);
+
+    debug("Check reading holes and small files");
+    ssize_t sparse = fs_create(&fs);
+    assert(sparse >= 0);
+    FsVector small[] = {
+        { .data = "ab", .length = 2, .offset = 0 },
+        { .data = "yz", .length = 2, .offset = 20 },
+    };
+    assert(fs_writev(&fs, sparse, small, 2) == 4);
+    assert(fs_stat(&fs, sparse) == 22);
+    memset(head, 1, sizeof(head));
+    FsVector small_reads[] = {
+        { .data = head, .length = 10, .offset = 0 },
+        { .data = head + 10, .length = 10, .offset = 18 },
+    };
+    assert(fs_readv(&fs, sparse, small_reads, 2) == 14);
+    assert(memcmp(head, "ab\0\0\0\0\0\0\0\0", 10) == 0);
+    assert(memcmp(head + 10, "\0\0yz", 4) == 0);
+    FsVector far = { .data = "far", .length = 3, .offset = 6 * BLOCK_SIZE };
+    assert(fs_writev(&fs, sparse, &far, 1) == 3);
+    memset(across, 1, sizeof(across));
+    FsVector hole = { .data = across, .length = 2 * BLOCK_SIZE, .offset = 2 * BLOCK_SIZE };
+    assert(fs_readv(&fs, sparse, &hole, 1) == 2 * BLOCK_SIZE);
+    for (size_t i = 0; i < 2 * BLOCK_SIZE; i++) assert(across[i] == 0);
+
+    debug("Check invalid pieces");
+    FsVector missing = { .data = NULL, .length = 1, .offset = 0 };
+    assert(fs_writev(&fs, sparse, &missing, 1) == -1);
+    assert(fs_readv(&fs, sparse, &missing, 1) == -1);
+    assert(fs_readv(&fs, fs.meta.inodes, small_reads, 2) == -1);
+    fs_unmount(&fs);
+    disk_close(disk);
+
+    free(data);
+    free(buffer);
+    return EXIT_SUCCESS;
+}
+
+// describe a file of the given features with fs_extents and check the image holds its bytes there
+void check_fs_file_extents(uint32_t features) {
+    unlink("data/image.unit");
+    Disk *disk = disk_open("data/image.unit", 2000);
+    assert(disk);
+
+    FileSystem fs = {0};
+    assert(fs_format_features(disk, features, 0));
+    assert(fs_mount(&fs, disk));
+    size_t length = 40 * BLOCK_SIZE;
+    char *data = malloc(length);
+    char *buffer = malloc(length);
+    assert(data && buffer);
+    for (size_t i = 0; i < length; i++) data[i] = 1 + i % 251;
+
+    debug("Check a contiguous file is one extent");
+    ssize_t inode_number = fs_create(&fs);
+    assert(inode_number >= 0);
+    // within the direct pointers, past them the indirect block comes between the data blocks
+    assert(fs_write(&fs, inode_number, data, 4 * BLOCK_SIZE + 5, 0) == 4 * BLOCK_SIZE + 5);
+    FsExtent extents[8];
+    assert(fs_extents(&fs, inode_number, 0, extents, 8) == 1);
+    assert(extents[0].offset == 0 && extents[0].length == 4 * BLOCK_SIZE + 5 && extents[0].block != 0);
+    assert(fs_sync(&fs));
+    assert(pread(disk_fd(disk), buffer, extents[0].length, extents[0].block * BLOCK_SIZE) == (ssize_t)extents[0].length);
+    assert(memcmp(buffer, data, extents[0].length) == 0);
+    // extents start at the block holding offset
+    assert(fs_extents(&fs, inode_number, 3 * BLOCK_SIZE + 1, extents, 8) == 1);
+    assert(extents[0].offset == 3 * BLOCK_SIZE && extents[0].length == BLOCK_SIZE + 5);
+    assert(fs_extents(&fs, inode_number, 4 * BLOCK_SIZE + 5, extents, 8) == 0);
+
+    debug("Check holes and blocks elsewhere on disk start new extents");
+    ssize_t sparse = fs_create(&fs);
+    assert(sparse >= 0);
+    assert(fs_write(&fs, sparse, data, 4 * BLOCK_SIZE, 0) == 4 * BLOCK_SIZE);
+    assert(fs_write(&fs, inode_number, data, BLOCK_SIZE, 20 * BLOCK_SIZE) == BLOCK_SIZE);
+    assert(fs_write(&fs, sparse, data, 3 * BLOCK_SIZE, 8 * BLOCK_SIZE) == 3 * BLOCK_SIZE);
+    assert(fs_write(&fs, sparse, data, 100, 12 * BLOCK_SIZE) == 100);
+    assert(fs_extents(&fs, sparse, 0, extents, 8) == 5);
+    assert(extents[0].offset == 0 && extents[0].length == 4 * BLOCK_SIZE && extents[0].block != 0);
+    assert(extents[1].offset == 4 * BLOCK_SIZE && extents[1].length == 4 * BLOCK_SIZE && extents[1].block == 0);
+    assert(extents[2].offset == 8 * BLOCK_SIZE && extents[2].length == 3 * BLOCK_SIZE && extents[2].block != 0);
+    assert(extents[3].offset == 11 * BLOCK_SIZE && extents[3].length == BLOCK_SIZE && extents[3].block == 0);
+    assert(extents[4].offset == 12 * BLOCK_SIZE && extents[4].length == 100 && extents[4].block != 0);
+    assert(fs_extents(&fs, inode_number, 11 * BLOCK_SIZE, extents, 8) == 2);
+    assert(extents[0].offset == 11 * BLOCK_SIZE && extents[0].length == 9 * BLOCK_SIZE && extents[0].block == 0);
+    assert(extents[1].offset == 20 * BLOCK_SIZE && extents[1].length == BLOCK_SIZE && extents[1].block != 0);
+
+    debug("Check extents that do not fit are left for the next call");
+    assert(fs_extents(&fs, sparse, 0, extents, 2) == 2);
+    assert(extents[1].offset == 4 * BLOCK_SIZE);
+    assert(fs_extents(&fs, sparse, extents[1].offset + extents[1].length, extents, 8) == 3);
+    assert(extents[0].offset == 8 * BLOCK_SIZE && extents[1].offset == 11 * BLOCK_SIZE && extents[2].offset == 12 * BLOCK_SIZE);
+    assert(fs_sync(&fs));
+    assert(pread(disk_fd(disk), buffer, 3 * BLOCK_SIZE, extents[0].block * BLOCK_SIZE) == 3 * BLOCK_SIZE);
+    assert(memcmp(buffer, data, 3 * BLOCK_SIZE) == 0);
+
+    debug("Check small files have no blocks of their own");
+    ssize_t small = fs_create(&fs);
+    assert(small >= 0);
+    assert(fs_write(&fs, small, data, 300, 0) == 300);
+    assert(fs_extents(&fs, small, 100, extents, 8) == 1);
+    if (features & FS_FEATURE_INLINE_DATA) {
+        assert(extents[0].offset == 100 && extents[0].length == 200 && extents[0].block == 0);
+    } else {
+        assert(extents[0].offset == 0 && extents[0].length == 300 && extents[0].block != 0);
+    }
+
+    debug("Check invalid inodes");
+    assert(fs_remove(&fs, small));
+    assert(fs_extents(&fs, small, 0, extents, 8) == -1);
+    assert(fs_extents(&fs, fs.meta.inodes, 0, extents, 8) == -1);
+    assert(fs_extents(&fs, sparse, 0, extents, 0) == 0);
+    fs_unmount(&fs);
+    disk_close(disk);
+
+    free(data);
+    free(buffer);
+}
+
+int test_fs_file_extents() {
+    check_fs_file_extents(0);
+    check_fs_file_extents(FS_FEATURE_EXTENTS);
+    check_fs_file_extents(FS_FEATURE_EXTENTS | FS_FEATURE_INLINE_DATA);
+    return EXIT_SUCCESS;
+}
+
+// writes to a failing disk fail while this is set
+bool fail_writes = false;
+
+int failing_write(Disk *disk, size_t block, char **data, size_t count) {
+    if (fail_writes) {
+        errno = EIO;
+        return -1;
+    }
+    return disk_ram_ops.write(disk, block, data, count);
+}
+
+// fail writes on a file system with the specified features and check every block they took is given back
+void check_fs_write_failure(uint32_t features) {
+    DiskOps ops = disk_ram_ops;
+    ops.write = failing_write;
+    Disk *disk = disk_open_ops(&ops, NULL, 2000, 0);
+    assert(disk);
+
+    FileSystem fs = {0};
+    assert(fs_format_features(disk, features, 0));
+    assert(fs_mount(&fs, disk));
+    size_t length = 100 * BLOCK_SIZE;
+    char *data = malloc(length);
+    char *buffer = malloc(length);
+    assert(data && buffer);
+    for (size_t i = 0; i < length; i++) data[i] = 1 + i % 251;
+
+    debug("Check a failed append gives back its data and indirect blocks");
+    ssize_t inode_number = fs_create(&fs);
+    assert(inode_number >= 0);
+    assert(fs_write(&fs, inode_number, data, 3 * BLOCK_SIZE, 0) == 3 * BLOCK_SIZE);
+    fs_release_reservation(&fs, inode_number);
+    size_t free_count = fs.free_count;
+    fail_writes = true;
+    assert(fs_write(&fs, inode_number, data, length, 3 * BLOCK_SIZE) == -1);
+    fail_writes = false;
+    fs_release_reservation(&fs, inode_number);
+    assert(fs.free_count == free_count);
+    assert(fs_stat(&fs, inode_number) == 3 * BLOCK_SIZE);
+    assert(fs_read(&fs, inode_number, buffer, 3 * BLOCK_SIZE, 0) == 3 * BLOCK_SIZE);
+    assert(memcmp(buffer, data, 3 * BLOCK_SIZE) == 0);
+
+    debug("Check a failed write into a hole gives back its blocks");
+    ssize_t sparse = fs_create(&fs);
+    assert(sparse >= 0);
+    // a data extent and a hole, the next data extent needs the extent block (past the hole the indirect block)
+    assert(fs_write(&fs, sparse, data, BLOCK_SIZE, 0) == BLOCK_SIZE);
+    memset(buffer, 0, length);
+    assert(fs_write(&fs, sparse, buffer, 1, 10 * BLOCK_SIZE) == 1);
+    fs_release_reservation(&fs, sparse);
+    free_count = fs.free_count;
+    fail_writes = true;
+    assert(fs_write(&fs, sparse, data, 2 * BLOCK_SIZE, 4 * BLOCK_SIZE) == -1);
+    assert(fs_write(&fs, sparse, data, BLOCK_SIZE, 12 * BLOCK_SIZE) == -1);
+    fail_writes = false;
+    fs_release_reservation(&fs, sparse);
+    assert(fs.free_count == free_count);
+    assert(fs_stat(&fs, sparse) == 10 * BLOCK_SIZE + 1);
+    assert(fs_read(&fs, sparse, buffer, 10 * BLOCK_SIZE + 1, 0) == 10 * BLOCK_SIZE + 1);
+    assert(memcmp(buffer, data, BLOCK_SIZE) == 0);
+    for (size_t i = BLOCK_SIZE; i <= 10 * BLOCK_SIZE; i++) assert(buffer[i] == 0);
+
+    debug("Check the writes succeed once the disk works again");
+    assert(fs_write(&fs, sparse, data, 2 * BLOCK_SIZE, 4 * BLOCK_SIZE) == 2 * BLOCK_SIZE);
+    assert(fs_write(&fs, inode_number, data, length, 3 * BLOCK_SIZE) == length);
+    assert(fs_remove(&fs, sparse));
+    assert(fs_remove(&fs, inode_number));
+    fs_unmount(&fs);
+
+    debug("Check mounting after the failures counts the same free blocks");
+    assert(fs_mount(&fs, disk));
+    size_t mounted = fs.free_count;
+    fs_unmount(&fs);
+    Block block;
+    assert(disk_read(disk, 0, block.data) == BLOCK_SIZE);
+    block.super_block.state = FS_STATE_MOUNTED;
+    assert(disk_write(disk, 0, block.data) == BLOCK_SIZE);
+    assert(fs_mount(&fs, disk));
+    assert(fs.free_count == mounted);
+    fs_unmount(&fs);
+    disk_close(disk);
+
+    free(data);
+    free(buffer);
+}
+
+int test_fs_write_failure() {
+    check_fs_write_failure(0);
+    check_fs_write_failure(FS_FEATURE_EXTENTS);
+    return EXIT_SUCCESS;
+}
+
+// number of blocks reserved for an inode
+size_t reserved_blocks(const FileSystem *fs, size_t inode_number) {
+    for (size_t i = 0; i < FS_READAHEAD_SLOTS; i++) {
+        const Reservation *reservation = &fs->reservations[i];
+        if (reservation->valid && reservation->inode_number == inode_number) return reservation->count;
+    }
+    return 0;
+}
+
+int test_fs_reservations() {
+    Disk *disk = disk_open_ram(2000);
+    assert(disk);
+
+    FileSystem fs = {0};
+    assert(fs_format_features(disk, FS_FEATURE_EXTENTS, 0));
+    assert(fs_mount(&fs, disk));
+    char *data = malloc(8 * BLOCK_SIZE);
+    assert(data);
+    for (size_t i = 0; i < 8 * BLOCK_SIZE; i++) data[i] = 1 + i % 251;
+
+    debug("Check appenders whose numbers collide keep their windows");
+    ssize_t first = fs_create(&fs);
+    assert(first >= 0);
+    ssize_t second;
+    do {
+        second = fs_create(&fs);
+    } while (second >= 0 && second % FS_READAHEAD_SLOTS != first % FS_READAHEAD_SLOTS);
+    assert(second >= 0);
+    for (size_t i = 0; i < 6; i++) {
+        assert(fs_write(&fs, first, data, BLOCK_SIZE, i * BLOCK_SIZE) == BLOCK_SIZE);
+        assert(fs_write(&fs, second, data, BLOCK_SIZE, i * BLOCK_SIZE) == BLOCK_SIZE);
+    }
+    assert(reserved_blocks(&fs, first) > 0 && reserved_blocks(&fs, second) > 0);
+    // past the first appends each file grows inside its own window
+    FsExtent extents[8];
+    assert(fs_extents(&fs, first, 0, extents, 8) <= 3);
+    assert(fs_extents(&fs, second, 0, extents, 8) <= 3);
+
+    debug("Check allocating on a fragmented disk leaves the windows alone");
+    size_t count = fs.free_count;
+    size_t *blocks = malloc(count * sizeof(size_t));
+    assert(blocks);
+    for (size_t i = 0; i < count; i++) assert(fs_allocate_run(&fs, 0, 1, &blocks[i]) == 1);
+    assert(fs.free_count == 0);
+    for (size_t i = 0; i < count; i += 2) fs_release_run(&fs, blocks[i], 1);
+    size_t first_window = reserved_blocks(&fs, first);
+    size_t second_window = reserved_blocks(&fs, second);
+    ssize_t other = fs_create(&fs);
+    assert(other >= 0);
+    assert(fs_write(&fs, other, data, 4 * BLOCK_SIZE, 0) == 4 * BLOCK_SIZE);
+    assert(reserved_blocks(&fs, first) == first_window);
+    assert(reserved_blocks(&fs, second) == second_window);
+
+    debug("Check the windows are given up once the disk runs short");
+    fs_release_reservation(&fs, other);
+    size_t left = fs.free_count;
+    size_t *rest = malloc(left * sizeof(size_t));
+    assert(rest);
+    for (size_t i = 0; i < left; i++) assert(fs_allocate_run(&fs, 0, 1, &rest[i]) == 1);
+    assert(fs.free_count == 0);
+    assert(fs_write(&fs, other, data, BLOCK_SIZE, 4 * BLOCK_SIZE) == BLOCK_SIZE);
+    assert(reserved_blocks(&fs, first) == 0 && reserved_blocks(&fs, second) == 0);
+    assert(fs.free_count == first_window + second_window - 1);
+
+    for (size_t i = 1; i < count; i += 2) fs_release_run(&fs, blocks[i], 1);
+    for (size_t i = 0; i < left; i++) fs_release_run(&fs, rest[i], 1);
+    free(blocks);
+    free(rest);
     fs_unmount(&fs);
     disk_close(disk);
+    free(data);
     return EXIT_SUCCESS;
 }
 
@@ -174,6 +1946,23 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "    1. Test fs_create\n");
         fprintf(stderr, "    2. Test fs_remove\n");
         fprintf(stderr, "    3. Test fs_stat\n");
+        fprintf(stderr, "    4. Test fs_read\n");
+        fprintf(stderr, "    5. Test fs_write\n");
+        fprintf(stderr, "    6. Test fs on a RAM disk\n");
+        fprintf(stderr, "    7. Test fs_mount after a crash\n");
+        fprintf(stderr, "    8. Test parallel mount scan\n");
+        fprintf(stderr, "    9. Test extent mapped inodes\n");
+        fprintf(stderr, "    10. Test block groups\n");
+        fprintf(stderr, "    11. Test double and triple indirect blocks\n");
+        fprintf(stderr, "    12. Test fs_fallocate and reservation windows\n");
+        fprintf(stderr, "    13. Test inline data of small files\n");
+        fprintf(stderr, "    14. Test the inode cache\n");
+        fprintf(stderr, "    15. Test sparse files and holes\n");
+        fprintf(stderr, "    16. Test open file handles\n");
+        fprintf(stderr, "    17. Test fs_readv and fs_writev\n");
+        fprintf(stderr, "    18. Test fs_extents\n");
+        fprintf(stderr, "    19. Test failed writes give their blocks back\n");
+        fprintf(stderr, "    20. Test reservation windows of colliding appenders and on fragmented disks\n");
         return EXIT_FAILURE;
     }
 
@@ -187,6 +1976,23 @@ int main(int argc, char *argv[]) {
         case 1:  status = test_fs_create(); break;
         case 2:  status = test_fs_remove(); break;
         case 3:  status = test_fs_stat(); break;
+        case 4:  status = test_fs_read(); break;
+        case 5:  status = test_fs_write(); break;
+        case 6:  status = test_fs_ram(); break;
+        case 7:  status = test_fs_recovery(); break;
+        case 8:  status = test_fs_scan(); break;
+        case 9:  status = test_fs_extents(); break;
+        case 10: status = test_fs_groups(); break;
+        case 11: status = test_fs_indirect(); break;
+        case 12: status = test_fs_reserve(); break;
+        case 13: status = test_fs_inline(); break;
+        case 14: status = test_fs_icache(); break;
+        case 15: status = test_fs_holes(); break;
+        case 16: status = test_fs_open(); break;
+        case 17: status = test_fs_vectors(); break;
+        case 18: status = test_fs_file_extents(); break;
+        case 19: status = test_fs_write_failure(); break;
+        case 20: status = test_fs_reservations(); break;
         default: fprintf(stderr, "Unknown NUMBER: %d\n", number); break;
     }
 